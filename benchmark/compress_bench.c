@@ -0,0 +1,138 @@
+#include "compress.h"
+#include <ftw.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
+/* Compares every built-in compression backend on a static corpus.
+ * usage: compress_bench [corpus_dir] [min_seconds] */
+
+#define BENCH_MAX_FILES 4096
+#define BENCH_MAX_FILE_SIZE (1024 * 1024)
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+} bench_file_t;
+
+static bench_file_t files[BENCH_MAX_FILES];
+static int file_count = 0;
+static size_t corpus_bytes = 0;
+
+static int load_file(const char *path, const struct stat *st, int typeflag, struct FTW *ftwbuf) {
+    (void)ftwbuf;
+    if (typeflag != FTW_F || st->st_size == 0 || st->st_size > BENCH_MAX_FILE_SIZE ||
+        file_count >= BENCH_MAX_FILES) {
+        return 0;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return 0;
+    }
+
+    unsigned char *data = malloc(st->st_size);
+    ssize_t bytes_read = data ? read(fd, data, st->st_size) : -1;
+    close(fd);
+
+    if (bytes_read != st->st_size) {
+        free(data);
+        return 0;
+    }
+
+    files[file_count].data = data;
+    files[file_count].len = st->st_size;
+    file_count++;
+    corpus_bytes += st->st_size;
+    return 0;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int run_pass(const compress_backend_t *backend, compression_type_t type, int level,
+                    unsigned char *out, size_t out_cap, size_t *total_out) {
+    *total_out = 0;
+    for (int i = 0; i < file_count; i++) {
+        size_t bound = backend->bound(type, level, files[i].len);
+        size_t produced = 0;
+        if (bound == 0 || bound > out_cap ||
+            backend->compress(type, level, files[i].data, files[i].len, out, out_cap, &produced) != 0) {
+            return -1;
+        }
+        *total_out += produced;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *corpus = argc > 1 ? argv[1] : "../static";
+    double min_seconds = argc > 2 ? atof(argv[2]) : 0.5;
+    static const compression_type_t types[] = {
+        COMPRESSION_GZIP, COMPRESSION_DEFLATE, COMPRESSION_BROTLI, COMPRESSION_ZSTD
+    };
+    static const int levels[] = {COMPRESSION_LEVEL_MIN, COMPRESSION_LEVEL_DEFAULT, COMPRESSION_LEVEL_MAX};
+
+    if (nftw(corpus, load_file, 16, FTW_PHYS) != 0 || file_count == 0) {
+        fprintf(stderr, "No files loaded from corpus %s\n", corpus);
+        return 1;
+    }
+
+    size_t largest = 0;
+    for (int i = 0; i < file_count; i++) {
+        if (files[i].len > largest) {
+            largest = files[i].len;
+        }
+    }
+
+    size_t out_cap = largest * 2 + 65536;
+    unsigned char *out = malloc(out_cap);
+    if (!out) {
+        fprintf(stderr, "Failed to allocate output buffer\n");
+        return 1;
+    }
+
+    printf("corpus: %s (%d files, %zu bytes)\n", corpus, file_count, corpus_bytes);
+    printf("%-12s %-8s %5s %10s %8s\n", "backend", "coding", "level", "MB/s", "ratio");
+
+    const compress_backend_t *backend;
+    for (int b = 0; (backend = compress_engine_backend(b)) != NULL; b++) {
+        for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); t++) {
+            if (!backend->supports(types[t])) {
+                continue;
+            }
+
+            for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+                size_t total_out = 0;
+                if (run_pass(backend, types[t], levels[l], out, out_cap, &total_out) != 0) {
+                    printf("%-12s %-8s %5d %10s %8s\n", backend->name, encoding_name(types[t]),
+                           levels[l], "failed", "-");
+                    continue;
+                }
+
+                int passes = 0;
+                double start = now_seconds();
+                double elapsed;
+                do {
+                    run_pass(backend, types[t], levels[l], out, out_cap, &total_out);
+                    passes++;
+                    elapsed = now_seconds() - start;
+                } while (elapsed < min_seconds);
+
+                printf("%-12s %-8s %5d %10.1f %8.3f\n", backend->name, encoding_name(types[t]), levels[l],
+                       (double)corpus_bytes * passes / elapsed / (1024 * 1024),
+                       (double)total_out / corpus_bytes);
+            }
+        }
+    }
+
+    compress_engine_release();
+    free(out);
+    for (int i = 0; i < file_count; i++) {
+        free(files[i].data);
+    }
+    return 0;
+}
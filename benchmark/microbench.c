@@ -0,0 +1,643 @@
+#include "http.h"
+#include "cache.h"
+#include "mempool.h"
+#include "encoding.h"
+#include "worker.h"
+#include "conditional.h"
+#include <sched.h>
+#include <getopt.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Times hot-path server functions in isolation, linked against the same
+ * objects as the server.
+ * usage: microbench [-f filter] [-t seconds] [-w seconds] [-c cpu]
+ *                   [-o results.json] [-b baseline.json] [-r percent]
+ *
+ * Each case is warmed up, then run in BENCH_SAMPLES timed samples on one
+ * pinned CPU; ns/op and cycles/op are sample medians, allocs/op counts every
+ * malloc-family call made while the case ran. With -b the results are
+ * compared against an earlier -o file and the exit status is 1 when any case
+ * got slower by more than -r percent. */
+
+#define BENCH_SAMPLES 11
+#define BENCH_MAX_CASES 64
+#define BENCH_NAME_MAX 64
+
+typedef struct {
+    const char *name;
+    void (*setup)(void);
+    void (*run)(uint64_t iterations);
+} bench_case_t;
+
+typedef struct {
+    char name[BENCH_NAME_MAX];
+    double ns_per_op;
+    double min_ns_per_op;
+    double cycles_per_op;
+    double allocs_per_op;
+    uint64_t ops;
+} bench_result_t;
+
+static volatile uintptr_t sink;
+
+/* allocation counting: these override the libc entry points for the whole
+ * process, so calls from zlib and the other encoders are counted too */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+
+static uint64_t alloc_count = 0;
+
+void *malloc(size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(ptr, size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+    if (alignment < sizeof(void *) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    void *ptr = __libc_memalign(alignment, size);
+    if (!ptr) {
+        return ENOMEM;
+    }
+    *out = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    __atomic_fetch_add(&alloc_count, 1, __ATOMIC_RELAXED);
+    return __libc_memalign(alignment, size);
+}
+
+/* cycle counter: the hardware cycles event when perf allows it, the TSC
+ * (reference cycles) on x86 otherwise */
+static int cycles_fd = -1;
+static const char *cycles_source = "none";
+
+static void cycles_init(void) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    cycles_fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (cycles_fd != -1) {
+        cycles_source = "perf";
+        return;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    cycles_source = "tsc";
+#endif
+}
+
+static uint64_t cycles_now(void) {
+    if (cycles_fd != -1) {
+        uint64_t value = 0;
+        if (read(cycles_fd, &value, sizeof(value)) == sizeof(value)) {
+            return value;
+        }
+        return 0;
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* request parsing; http_parse_request writes into its input, so each
+ * iteration parses a fresh copy */
+
+static const char request_minimal[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+static const char request_browser[] =
+    "GET /assets/app.js?v=3 HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/124.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Linux\"\r\n"
+    "Accept: */*\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: script\r\n"
+    "Referer: https://www.example.com/\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9\r\n"
+    "Cookie: session=8f14e45fceea167a5a36dedd4bea2543; theme=dark\r\n"
+    "\r\n";
+
+static const char request_conditional[] =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "If-None-Match: \"ce8072-3076-6ad57553\"\r\n"
+    "If-Modified-Since: Mon, 19 Oct 2026 01:41:39 GMT\r\n"
+    "\r\n";
+
+static http_request_t parsed_request;
+static char parse_buffer[4096];
+
+static void parse_run(const char *text, size_t len, uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        memcpy(parse_buffer, text, len + 1);
+        sink += http_parse_request(parse_buffer, len, &parsed_request) + parsed_request.header_count;
+    }
+}
+
+static void run_parse_minimal(uint64_t iterations) {
+    parse_run(request_minimal, sizeof(request_minimal) - 1, iterations);
+}
+
+static void run_parse_browser(uint64_t iterations) {
+    parse_run(request_browser, sizeof(request_browser) - 1, iterations);
+}
+
+static void run_parse_conditional(uint64_t iterations) {
+    parse_run(request_conditional, sizeof(request_conditional) - 1, iterations);
+}
+
+/* response cache lookups over a table sized like a busy static site */
+
+#define BENCH_CACHE_PATHS 1024
+
+static char cache_paths[BENCH_CACHE_PATHS][64];
+static char cache_miss_paths[BENCH_CACHE_PATHS][64];
+
+static void setup_cache(void) {
+    static int ready = 0;
+    if (ready) {
+        return;
+    }
+    ready = 1;
+
+    static const char header[] = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: 1024\r\n\r\n";
+    static char body[1024];
+    memset(body, 'x', sizeof(body));
+    for (int i = 0; i < BENCH_CACHE_PATHS; i++) {
+        snprintf(cache_paths[i], sizeof(cache_paths[i]), "./static/pages/page-%04d.html", i);
+        snprintf(cache_miss_paths[i], sizeof(cache_miss_paths[i]), "./static/other/page-%04d.html", i);
+        cache_store(cache_paths[i], 0, COMPRESSION_NONE, header, sizeof(header) - 1, body, sizeof(body));
+    }
+}
+
+static void run_cache_hit(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += (uintptr_t)cache_lookup(cache_paths[i % BENCH_CACHE_PATHS], COMPRESSION_NONE);
+    }
+}
+
+static void run_cache_miss(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += (uintptr_t)cache_lookup(cache_miss_paths[i % BENCH_CACHE_PATHS], COMPRESSION_NONE);
+    }
+}
+
+/* connection buffer pool, sized like a worker's */
+
+#define BENCH_POOL_BURST 256
+
+static mempool_t pool;
+
+static void setup_pool(void) {
+    static int ready = 0;
+    if (ready) {
+        return;
+    }
+    ready = 1;
+    memset(&pool, 0, sizeof(pool));
+    pthread_mutex_init(&pool.mutex, NULL);
+    mempool_init(&pool, BUFFER_SIZE, CAPACITY_GROWTH_STEP);
+}
+
+static void run_pool_pair(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        void *block = mempool_alloc(&pool);
+        sink += (uintptr_t)block;
+        mempool_free(&pool, block);
+    }
+}
+
+static void run_pool_burst(uint64_t iterations) {
+    static void *blocks[BENCH_POOL_BURST];
+    for (uint64_t i = 0; i < iterations; i += BENCH_POOL_BURST) {
+        for (int b = 0; b < BENCH_POOL_BURST; b++) {
+            blocks[b] = mempool_alloc(&pool);
+        }
+        for (int b = 0; b < BENCH_POOL_BURST; b++) {
+            mempool_free(&pool, blocks[b]);
+        }
+    }
+}
+
+/* response head serialization, with the headers http_serve_file sets */
+
+static http_response_t response_200;
+static http_response_t response_304;
+static char header_output[8192];
+
+static void setup_headers(void) {
+    http_create_response(&response_200, 200);
+    http_add_header(&response_200, "Content-Type", "text/html");
+    http_add_header(&response_200, "Content-Length", "12406");
+    http_add_header(&response_200, "Last-Modified", "Mon, 19 Oct 2026 01:41:39 GMT");
+    http_add_header(&response_200, "ETag", "\"ce8072-3076-6ad57553\"");
+    http_add_header(&response_200, "Vary", "Accept-Encoding");
+    http_add_header(&response_200, "Accept-Ranges", "bytes");
+    http_add_header(&response_200, "Cache-Control", "public, max-age=300, must-revalidate");
+    response_200.keep_alive = 1;
+
+    http_create_response(&response_304, 200);
+    response_304.status_code = 304;
+    response_304.status_text = "Not Modified";
+    http_add_header(&response_304, "ETag", "\"ce8072-3076-6ad57553\"");
+    http_add_header(&response_304, "Cache-Control", "public, max-age=300, must-revalidate");
+    response_304.keep_alive = 1;
+}
+
+static void run_headers_200(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += http_format_headers(&response_200, header_output, sizeof(header_output));
+    }
+}
+
+static void run_headers_304(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += http_format_headers(&response_304, header_output, sizeof(header_output));
+    }
+}
+
+/* MIME type and Accept-Encoding lookups */
+
+static const char *mime_paths[] = {
+    "/index.html", "/css/site.css", "/js/app.js", "/img/logo.png",
+    "/favicon.ico", "/data/feed.json", "/README", "/downloads/archive.tar.gz",
+};
+
+#define MIME_PATH_COUNT (sizeof(mime_paths) / sizeof(mime_paths[0]))
+
+static void run_mime(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += (uintptr_t)http_get_mime_type(mime_paths[i % MIME_PATH_COUNT]);
+    }
+}
+
+static void run_negotiate(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += encoding_negotiate("gzip, deflate, br, zstd");
+    }
+}
+
+/* revalidation: a browser-style tag list and a date the client echoes */
+
+static const char conditional_etag[] = "\"ce8072-3076-6ad57553\"";
+
+static void run_conditional_etag(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += conditional_etag_matches("W/\"ce8072-2f00-6ad57553-gzip\", \"ce8072-3076-6ad57553\"",
+                                         conditional_etag, sizeof(conditional_etag) - 1);
+    }
+}
+
+static void run_conditional_date(uint64_t iterations) {
+    for (uint64_t i = 0; i < iterations; i++) {
+        sink += conditional_not_modified_since("Mon, 19 Oct 2026 01:41:39 GMT", NULL, 1792374099);
+    }
+}
+
+/* compression of generated markup; text compresses like real pages */
+
+static char *compress_input = NULL;
+
+static void setup_compress(void) {
+    static const char *words[] = {
+        "<div class=\"item\">", "</div>\n", "<span>", "</span>", "request", "response",
+        "server", "cache", "latency", "worker", "static", "content",
+    };
+    if (compress_input) {
+        return;
+    }
+    compress_input = malloc(64 * 1024);
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    size_t pos = 0;
+    while (pos < 64 * 1024) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        const char *word = words[state % (sizeof(words) / sizeof(words[0]))];
+        size_t len = strlen(word);
+        if (pos + len + 1 > 64 * 1024) {
+            break;
+        }
+        memcpy(compress_input + pos, word, len);
+        pos += len;
+        compress_input[pos++] = ' ';
+    }
+    memset(compress_input + pos, ' ', 64 * 1024 - pos);
+}
+
+static void compress_run(compression_type_t type, size_t size, uint64_t iterations) {
+    static http_response_t response;
+    for (uint64_t i = 0; i < iterations; i++) {
+        memset(&response, 0, sizeof(response));
+        response.body = compress_input;
+        response.body_length = size;
+        http_compress_content(&response, type, COMPRESSION_LEVEL_DEFAULT);
+        sink += response.compressed_length;
+        free(response.compressed_body);
+    }
+}
+
+static void run_gzip_8k(uint64_t iterations) {
+    compress_run(COMPRESSION_GZIP, 8 * 1024, iterations);
+}
+
+static void run_gzip_64k(uint64_t iterations) {
+    compress_run(COMPRESSION_GZIP, 64 * 1024, iterations);
+}
+
+static void run_brotli_8k(uint64_t iterations) {
+    compress_run(COMPRESSION_BROTLI, 8 * 1024, iterations);
+}
+
+static void run_zstd_8k(uint64_t iterations) {
+    compress_run(COMPRESSION_ZSTD, 8 * 1024, iterations);
+}
+
+static const bench_case_t cases[] = {
+    {"parse/minimal", NULL, run_parse_minimal},
+    {"parse/browser", NULL, run_parse_browser},
+    {"parse/conditional", NULL, run_parse_conditional},
+    {"cache/hit", setup_cache, run_cache_hit},
+    {"cache/miss", setup_cache, run_cache_miss},
+    {"mempool/alloc_free", setup_pool, run_pool_pair},
+    {"mempool/burst_256", setup_pool, run_pool_burst},
+    {"headers/200", setup_headers, run_headers_200},
+    {"headers/304", setup_headers, run_headers_304},
+    {"mime/lookup", NULL, run_mime},
+    {"encoding/negotiate", NULL, run_negotiate},
+    {"conditional/etag", NULL, run_conditional_etag},
+    {"conditional/date", NULL, run_conditional_date},
+    {"compress/gzip_8k", setup_compress, run_gzip_8k},
+    {"compress/gzip_64k", setup_compress, run_gzip_64k},
+    {"compress/brotli_8k", setup_compress, run_brotli_8k},
+    {"compress/zstd_8k", setup_compress, run_zstd_8k},
+};
+
+#define CASE_COUNT ((int)(sizeof(cases) / sizeof(cases[0])))
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void measure(const bench_case_t *bench, double warmup, double seconds, bench_result_t *result) {
+    if (bench->setup) {
+        bench->setup();
+    }
+
+    /* warmup doubles the batch until the time is spent, which also gives
+     * the per-op estimate used to size the samples */
+    uint64_t iterations = 1;
+    uint64_t spent = 0;
+    uint64_t done = 0;
+    uint64_t warmup_ns = (uint64_t)(warmup * 1e9);
+    while (spent < warmup_ns || done < 16) {
+        uint64_t start = now_ns();
+        bench->run(iterations);
+        spent += now_ns() - start;
+        done += iterations;
+        if (iterations < (1ULL << 30)) {
+            iterations *= 2;
+        }
+    }
+    double estimate = (double)spent / done;
+    uint64_t per_sample = (uint64_t)(seconds * 1e9 / BENCH_SAMPLES / (estimate > 0 ? estimate : 1));
+    if (per_sample == 0) {
+        per_sample = 1;
+    }
+
+    double ns[BENCH_SAMPLES];
+    double cycles[BENCH_SAMPLES];
+    uint64_t allocs_before = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED);
+    for (int s = 0; s < BENCH_SAMPLES; s++) {
+        uint64_t cycles_start = cycles_now();
+        uint64_t start = now_ns();
+        bench->run(per_sample);
+        uint64_t elapsed = now_ns() - start;
+        uint64_t cycles_elapsed = cycles_now() - cycles_start;
+        ns[s] = (double)elapsed / per_sample;
+        cycles[s] = (double)cycles_elapsed / per_sample;
+    }
+    uint64_t allocs = __atomic_load_n(&alloc_count, __ATOMIC_RELAXED) - allocs_before;
+
+    qsort(ns, BENCH_SAMPLES, sizeof(double), compare_double);
+    qsort(cycles, BENCH_SAMPLES, sizeof(double), compare_double);
+    snprintf(result->name, sizeof(result->name), "%s", bench->name);
+    result->ns_per_op = ns[BENCH_SAMPLES / 2];
+    result->min_ns_per_op = ns[0];
+    result->cycles_per_op = cycles_fd != -1 || strcmp(cycles_source, "tsc") == 0 ? cycles[BENCH_SAMPLES / 2] : 0;
+    result->ops = per_sample * BENCH_SAMPLES;
+    result->allocs_per_op = (double)allocs / result->ops;
+}
+
+static int write_results(const char *path, const bench_result_t *results, int count, int cpu) {
+    FILE *out = fopen(path, "w");
+    if (!out) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    fprintf(out, "{\n  \"cpu\": %d,\n  \"cycles_source\": \"%s\",\n  \"results\": [\n", cpu, cycles_source);
+    for (int i = 0; i < count; i++) {
+        fprintf(out,
+                "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"min_ns_per_op\": %.3f, \"cycles_per_op\": %.1f, "
+                "\"allocs_per_op\": %.3f, \"ops\": %lu}%s\n",
+                results[i].name, results[i].ns_per_op, results[i].min_ns_per_op, results[i].cycles_per_op,
+                results[i].allocs_per_op, (unsigned long)results[i].ops, i + 1 < count ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+    return 0;
+}
+
+/* reads the name and ns_per_op of every result in a file written by
+ * write_results; returns the number of entries or -1 */
+static int read_baseline(const char *path, bench_result_t *baseline, int max) {
+    FILE *in = fopen(path, "r");
+    if (!in) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    int count = 0;
+    char line[1024];
+    while (count < max && fgets(line, sizeof(line), in)) {
+        const char *name = strstr(line, "\"name\": \"");
+        const char *ns = strstr(line, "\"ns_per_op\": ");
+        if (!name || !ns) {
+            continue;
+        }
+        name += 9;
+        size_t len = strcspn(name, "\"");
+        if (len >= BENCH_NAME_MAX) {
+            continue;
+        }
+        memcpy(baseline[count].name, name, len);
+        baseline[count].name[len] = '\0';
+        baseline[count].ns_per_op = strtod(ns + 13, NULL);
+        count++;
+    }
+    fclose(in);
+    return count;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [-f filter] [-t seconds] [-w seconds] [-c cpu] [-o results.json] "
+            "[-b baseline.json] [-r percent]\n",
+            program);
+}
+
+int main(int argc, char *argv[]) {
+    const char *filter = NULL;
+    const char *output = NULL;
+    const char *baseline_path = NULL;
+    double seconds = 1.0;
+    double warmup = 0.2;
+    double threshold = 5.0;
+    int cpu = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "f:t:w:c:o:b:r:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                filter = optarg;
+                break;
+            case 't':
+                seconds = atof(optarg);
+                break;
+            case 'w':
+                warmup = atof(optarg);
+                break;
+            case 'c':
+                cpu = atoi(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'b':
+                baseline_path = optarg;
+                break;
+            case 'r':
+                threshold = atof(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    log_set_level(LOG_WARN);
+
+    /* pin to one CPU so samples do not migrate; the CPU we started on is
+     * the default */
+    if (cpu < 0) {
+        cpu = sched_getcpu();
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        fprintf(stderr, "cannot pin to CPU %d: %s\n", cpu, strerror(errno));
+        return 1;
+    }
+    cycles_init();
+
+    static bench_result_t baseline[BENCH_MAX_CASES];
+    int baseline_count = 0;
+    if (baseline_path) {
+        baseline_count = read_baseline(baseline_path, baseline, BENCH_MAX_CASES);
+        if (baseline_count < 0) {
+            return 1;
+        }
+    }
+
+    printf("cpu %d, cycles from %s\n", cpu, cycles_source);
+    printf("%-22s %12s %12s %10s", "benchmark", "ns/op", "cycles/op", "allocs/op");
+    if (baseline_path) {
+        printf(" %12s %8s", "baseline", "delta");
+    }
+    putchar('\n');
+
+    static bench_result_t results[BENCH_MAX_CASES];
+    int count = 0;
+    int regressions = 0;
+    for (int i = 0; i < CASE_COUNT; i++) {
+        if (filter && !strstr(cases[i].name, filter)) {
+            continue;
+        }
+        if (strncmp(cases[i].name, "compress/", 9) == 0) {
+            compression_type_t type = strstr(cases[i].name, "brotli") ? COMPRESSION_BROTLI
+                                      : strstr(cases[i].name, "zstd") ? COMPRESSION_ZSTD
+                                                                      : COMPRESSION_GZIP;
+            if (!encoding_available(type)) {
+                continue;
+            }
+        }
+
+        bench_result_t *result = &results[count++];
+        measure(&cases[i], warmup, seconds, result);
+        printf("%-22s %12.1f %12.1f %10.2f", result->name, result->ns_per_op, result->cycles_per_op,
+               result->allocs_per_op);
+
+        for (int b = 0; b < baseline_count; b++) {
+            if (strcmp(baseline[b].name, result->name) == 0 && baseline[b].ns_per_op > 0) {
+                double delta = (result->ns_per_op / baseline[b].ns_per_op - 1) * 100;
+                printf(" %12.1f %+7.1f%%", baseline[b].ns_per_op, delta);
+                if (delta > threshold) {
+                    printf("  REGRESSION");
+                    regressions++;
+                }
+                break;
+            }
+        }
+        putchar('\n');
+        fflush(stdout);
+    }
+
+    if (output && write_results(output, results, count, cpu) != 0) {
+        return 1;
+    }
+    if (baseline_path) {
+        printf("%d regression%s over %.1f%%\n", regressions, regressions == 1 ? "" : "s", threshold);
+    }
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,1293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+/* HTTP/1.1 load generator for reproducible numbers on a single box.
+ * usage: nxbench [-H host] [-p port] [-s scenario|all] [-c conns] [-t threads]
+ *                [-d seconds] [-w warmup] [-R rate] [-P depth] [-u path] [-o file]
+ *        nxbench --corpus <dir>
+ *
+ * Without -R the run is closed-loop: every connection keeps -P requests in
+ * flight and sends the next one as soon as a response completes. With -R the
+ * run is open-loop: requests are scheduled at a constant total rate and
+ * latency is measured from the scheduled send time, so a stalled server is
+ * charged for the requests it delayed (coordinated-omission correction); the
+ * time from the actual send is reported alongside as uncorrected latency.
+ * Results are written as JSON, a one-line summary per run goes to stderr. */
+
+#define NXB_PIPELINE_MAX 64
+#define NXB_REQUEST_MAX 512
+#define NXB_HEAD_MAX 8192
+#define NXB_READ_BUFFER (256 * 1024)
+#define NXB_EVENTS 256
+#define NXB_SCAN_NS 10000000ULL
+#define NXB_RETRY_NS 100000000ULL
+
+/* log-linear histogram over nanoseconds, 128 linear sub-buckets per power of
+ * two, so reported percentiles are within 1% of the recorded value */
+#define HIST_SUB_BITS 7
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+#define SCENARIO_CLOSE 0x1
+#define SCENARIO_CONDITIONAL 0x2
+#define SCENARIO_MIXED 0x4
+#define SCENARIO_COMPRESSED 0x8
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+typedef enum {
+    ERR_CONNECT = 0,
+    ERR_READ,
+    ERR_WRITE,
+    ERR_TIMEOUT,
+    ERR_PARSE,
+    ERR_STATUS,
+    ERR_COUNT
+} error_kind_t;
+
+static const char *error_names[ERR_COUNT] = {"connect", "read", "write", "timeout", "parse", "status"};
+
+typedef struct {
+    hist_t latency;
+    hist_t uncorrected;
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t status[5];
+    uint64_t errors[ERR_COUNT];
+} stats_t;
+
+typedef struct {
+    const char *name;
+    const char *path;
+    int flags;
+    int depth;
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+    {"keepalive", "/index.html", 0, 1},
+    {"close", "/index.html", SCENARIO_CLOSE, 1},
+    {"pipeline", "/index.html", 0, 16},
+    {"conditional", "/index.html", SCENARIO_CONDITIONAL, 1},
+    {"mixed", "/index.html", SCENARIO_MIXED, 1},
+    {"compressed", "/app.js", SCENARIO_COMPRESSED, 1},
+    {"large", "/large.bin", 0, 1},
+};
+
+#define SCENARIO_COUNT ((int)(sizeof(scenarios) / sizeof(scenarios[0])))
+
+typedef struct {
+    char text[NXB_REQUEST_MAX];
+    size_t len;
+} request_t;
+
+/* one run of one scenario; templates[1] is the conditional variant */
+typedef struct {
+    const scenario_t *scenario;
+    const char *path;
+    int depth;
+    int has_etag;
+    char etag[256];
+    request_t templates[2];
+} run_t;
+
+typedef enum {
+    CONN_IDLE = 0,
+    CONN_CONNECTING,
+    CONN_READY
+} conn_state_t;
+
+typedef enum {
+    PHASE_HEAD = 0,
+    PHASE_LENGTH,
+    PHASE_CHUNK_SIZE,
+    PHASE_CHUNK_DATA,
+    PHASE_CHUNK_CRLF,
+    PHASE_TRAILER,
+    PHASE_UNTIL_CLOSE
+} phase_t;
+
+typedef struct {
+    uint64_t intended;
+    uint64_t start;
+    int template;
+} pending_t;
+
+typedef struct {
+    int fd;
+    conn_state_t state;
+    uint64_t retry_at;
+    uint64_t next_due;
+    uint64_t sequence;
+    pending_t pending[NXB_PIPELINE_MAX];
+    int head;
+    int count;
+    char *out;
+    size_t out_len;
+    size_t out_off;
+    phase_t phase;
+    char head_buf[NXB_HEAD_MAX];
+    size_t head_len;
+    int status;
+    int close_after;
+    uint64_t left;
+    int chunk_ext;
+    int line_len;
+} conn_t;
+
+typedef struct {
+    pthread_t thread;
+    const run_t *run;
+    conn_t *conns;
+    int conn_count;
+    int first_conn;
+    int epfd;
+    int timerfd;
+    uint64_t start;
+    uint64_t measure_from;
+    uint64_t end;
+    uint64_t interval;
+    uint64_t next_scan;
+    char *buf;
+    stats_t stats;
+} bench_thread_t;
+
+typedef struct {
+    const char *host;
+    const char *port;
+    const char *scenario;
+    const char *path;
+    const char *output;
+    int connections;
+    int threads;
+    int depth;
+    double duration;
+    double warmup;
+    double rate;
+    double timeout;
+} options_t;
+
+static options_t opts = {
+    .host = "127.0.0.1",
+    .port = "7877",
+    .scenario = "keepalive",
+    .connections = 64,
+    .threads = 2,
+    .duration = 10,
+    .warmup = 2,
+    .timeout = 5,
+};
+
+static struct sockaddr_storage server_addr;
+static socklen_t server_addr_len;
+static char host_header[256];
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int hist_index(uint64_t value) {
+    if (value < HIST_SUB_COUNT) {
+        return (int)value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= HIST_MAX_BITS) {
+        return HIST_BUCKETS - 1;
+    }
+    int shift = msb - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB_COUNT + (int)((value >> shift) & (HIST_SUB_COUNT - 1));
+}
+
+static uint64_t hist_upper(int index) {
+    if (index < HIST_SUB_COUNT) {
+        return index;
+    }
+    int shift = index / HIST_SUB_COUNT - 1;
+    uint64_t sub = index % HIST_SUB_COUNT;
+    return ((HIST_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+static void hist_reset(hist_t *hist) {
+    memset(hist, 0, sizeof(*hist));
+    hist->min = UINT64_MAX;
+}
+
+static void hist_record(hist_t *hist, uint64_t value) {
+    hist->count++;
+    hist->sum += value;
+    if (value < hist->min) {
+        hist->min = value;
+    }
+    if (value > hist->max) {
+        hist->max = value;
+    }
+    hist->buckets[hist_index(value)]++;
+}
+
+static void hist_merge(hist_t *into, const hist_t *from) {
+    into->count += from->count;
+    into->sum += from->sum;
+    if (from->min < into->min) {
+        into->min = from->min;
+    }
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        into->buckets[i] += from->buckets[i];
+    }
+}
+
+static uint64_t hist_quantile(const hist_t *hist, double quantile) {
+    if (hist->count == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(quantile * hist->count + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target) {
+            uint64_t upper = hist_upper(i);
+            return upper < hist->max ? upper : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+static void count_error(bench_thread_t *t, error_kind_t kind, uint64_t now) {
+    if (now >= t->measure_from) {
+        t->stats.errors[kind]++;
+    }
+}
+
+static void arm_timer(bench_thread_t *t, uint64_t at) {
+    struct itimerspec spec = {0};
+    spec.it_value.tv_sec = at / 1000000000ULL;
+    spec.it_value.tv_nsec = at % 1000000000ULL;
+    timerfd_settime(t->timerfd, TFD_TIMER_ABSTIME, &spec, NULL);
+}
+
+static void conn_append(conn_t *c, int template, const run_t *run) {
+    const request_t *request = &run->templates[template];
+    if (c->out_off > 0) {
+        memmove(c->out, c->out + c->out_off, c->out_len - c->out_off);
+        c->out_len -= c->out_off;
+        c->out_off = 0;
+    }
+    memcpy(c->out + c->out_len, request->text, request->len);
+    c->out_len += request->len;
+}
+
+static void conn_open(bench_thread_t *t, conn_t *c, uint64_t now) {
+    c->phase = PHASE_HEAD;
+    c->head_len = 0;
+    c->out_len = 0;
+    c->out_off = 0;
+    for (int i = 0; i < c->count; i++) {
+        conn_append(c, c->pending[(c->head + i) % NXB_PIPELINE_MAX].template, t->run);
+    }
+
+    c->fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (c->fd == -1) {
+        goto fail;
+    }
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    if (connect(c->fd, (struct sockaddr *)&server_addr, server_addr_len) != 0 && errno != EINPROGRESS) {
+        close(c->fd);
+        c->fd = -1;
+        goto fail;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = c};
+    epoll_ctl(t->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+    c->state = CONN_CONNECTING;
+    return;
+
+fail:
+    count_error(t, ERR_CONNECT, now);
+    c->state = CONN_IDLE;
+    c->retry_at = now + NXB_RETRY_NS;
+}
+
+/* drops the connection and reconnects; unanswered requests are resent on
+ * the new connection with their original timestamps, except the one that
+ * was being answered when the failure happened, if drop_first is set */
+static void conn_reset(bench_thread_t *t, conn_t *c, uint64_t now, int drop_first) {
+    if (c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->state = CONN_IDLE;
+    if (drop_first && c->count > 0) {
+        c->head = (c->head + 1) % NXB_PIPELINE_MAX;
+        c->count--;
+    }
+    conn_open(t, c, now);
+}
+
+static int conn_flush(conn_t *c) {
+    if (c->state != CONN_READY) {
+        return 0;
+    }
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        c->out_off += n;
+    }
+    c->out_len = 0;
+    c->out_off = 0;
+    return 0;
+}
+
+static void conn_enqueue(bench_thread_t *t, conn_t *c, uint64_t intended, uint64_t now) {
+    const run_t *run = t->run;
+    int template = 0;
+    if (run->has_etag) {
+        if (run->scenario->flags & SCENARIO_CONDITIONAL) {
+            template = 1;
+        } else if ((run->scenario->flags & SCENARIO_MIXED) && c->sequence % 3 == 2) {
+            template = 1;
+        }
+    }
+    c->sequence++;
+
+    pending_t *p = &c->pending[(c->head + c->count) % NXB_PIPELINE_MAX];
+    p->intended = intended;
+    p->start = now;
+    p->template = template;
+    c->count++;
+    conn_append(c, template, run);
+}
+
+/* closed loop keeps the pipeline full; open loop sends whatever is due */
+static void conn_pump(bench_thread_t *t, conn_t *c, uint64_t now) {
+    int depth = t->run->depth;
+    if (t->interval == 0) {
+        while (c->count < depth) {
+            conn_enqueue(t, c, now, now);
+        }
+    } else {
+        while (c->count < depth && c->next_due <= now) {
+            conn_enqueue(t, c, c->next_due, now);
+            c->next_due += t->interval;
+        }
+        if (c->count < depth && c->next_due < t->next_scan) {
+            t->next_scan = c->next_due;
+            arm_timer(t, c->next_due);
+        }
+    }
+    if (conn_flush(c) != 0) {
+        count_error(t, ERR_WRITE, now);
+        conn_reset(t, c, now, 1);
+    }
+}
+
+static int header_is(const char *line, size_t len, const char *name) {
+    size_t name_len = strlen(name);
+    return len > name_len && line[name_len] == ':' && strncasecmp(line, name, name_len) == 0;
+}
+
+/* parses the response head in c->head_buf and picks the body framing */
+static int parse_head(conn_t *c, size_t head_size) {
+    int minor = 0;
+    if (sscanf(c->head_buf, "HTTP/1.%d %d", &minor, &c->status) != 2) {
+        return -1;
+    }
+
+    long long content_length = -1;
+    int chunked = 0;
+    c->close_after = minor == 0;
+
+    const char *line = memchr(c->head_buf, '\n', head_size);
+    const char *end = c->head_buf + head_size - 2;
+    while (line && ++line < end) {
+        const char *eol = memchr(line, '\r', end - line);
+        size_t len = eol ? (size_t)(eol - line) : (size_t)(end - line);
+        if (header_is(line, len, "Content-Length")) {
+            content_length = strtoll(line + 15, NULL, 10);
+        } else if (header_is(line, len, "Transfer-Encoding")) {
+            chunked = memmem(line, len, "chunked", 7) != NULL;
+        } else if (header_is(line, len, "Connection")) {
+            if (memmem(line, len, "close", 5)) {
+                c->close_after = 1;
+            } else if (memmem(line, len, "keep-alive", 10)) {
+                c->close_after = 0;
+            }
+        }
+        line = memchr(line, '\n', end - line);
+    }
+
+    if (c->status < 200 || c->status == 204 || c->status == 304) {
+        c->left = 0;
+        c->phase = PHASE_LENGTH;
+    } else if (chunked) {
+        c->phase = PHASE_CHUNK_SIZE;
+        c->left = 0;
+        c->chunk_ext = 0;
+    } else if (content_length >= 0) {
+        c->phase = PHASE_LENGTH;
+        c->left = content_length;
+    } else {
+        c->phase = PHASE_UNTIL_CLOSE;
+        c->close_after = 1;
+    }
+    return 0;
+}
+
+static void response_done(bench_thread_t *t, conn_t *c, uint64_t now) {
+    pending_t *p = &c->pending[c->head];
+    if (now >= t->measure_from) {
+        stats_t *stats = &t->stats;
+        hist_record(&stats->latency, now - p->intended);
+        hist_record(&stats->uncorrected, now - p->start);
+        stats->requests++;
+        if (c->status >= 100 && c->status < 600) {
+            stats->status[c->status / 100 - 1]++;
+        }
+        if (c->status < 200 || c->status >= 400) {
+            stats->errors[ERR_STATUS]++;
+        }
+    }
+    c->head = (c->head + 1) % NXB_PIPELINE_MAX;
+    c->count--;
+    c->phase = PHASE_HEAD;
+}
+
+/* feeds received bytes through the response parser; returns 1 when a
+ * response completed on a connection the server is closing, -1 on a
+ * malformed response */
+static int conn_feed(bench_thread_t *t, conn_t *c, const char *data, size_t len, uint64_t now) {
+    size_t i = 0;
+    while (i < len) {
+        if (c->count == 0) {
+            return -1;
+        }
+        switch (c->phase) {
+            case PHASE_HEAD: {
+                size_t take = len - i;
+                if (take > NXB_HEAD_MAX - 1 - c->head_len) {
+                    take = NXB_HEAD_MAX - 1 - c->head_len;
+                }
+                if (take == 0) {
+                    return -1;
+                }
+                size_t from = c->head_len >= 3 ? c->head_len - 3 : 0;
+                memcpy(c->head_buf + c->head_len, data + i, take);
+                c->head_len += take;
+                char *end = memmem(c->head_buf + from, c->head_len - from, "\r\n\r\n", 4);
+                if (!end) {
+                    i += take;
+                    break;
+                }
+                size_t head_size = end + 4 - c->head_buf;
+                i += take - (c->head_len - head_size);
+                c->head_buf[head_size] = '\0';
+                c->head_len = 0;
+                if (parse_head(c, head_size) != 0) {
+                    return -1;
+                }
+                if (t->run->scenario->flags & SCENARIO_CLOSE) {
+                    c->close_after = 1;
+                }
+                if (c->status < 200 && c->status >= 100) {
+                    c->phase = PHASE_HEAD;
+                } else if (c->phase == PHASE_LENGTH && c->left == 0) {
+                    response_done(t, c, now);
+                    if (c->close_after) {
+                        return 1;
+                    }
+                }
+                break;
+            }
+            case PHASE_LENGTH:
+            case PHASE_CHUNK_DATA: {
+                uint64_t skip = len - i < c->left ? len - i : c->left;
+                i += skip;
+                c->left -= skip;
+                if (c->left == 0) {
+                    if (c->phase == PHASE_CHUNK_DATA) {
+                        c->phase = PHASE_CHUNK_CRLF;
+                        c->line_len = 2;
+                    } else {
+                        response_done(t, c, now);
+                        if (c->close_after) {
+                            return 1;
+                        }
+                    }
+                }
+                break;
+            }
+            case PHASE_CHUNK_SIZE: {
+                char ch = data[i++];
+                if (ch == '\n') {
+                    c->phase = c->left ? PHASE_CHUNK_DATA : PHASE_TRAILER;
+                    c->line_len = 0;
+                } else if (ch == ';') {
+                    c->chunk_ext = 1;
+                } else if (!c->chunk_ext && ch != '\r') {
+                    int digit = ch >= '0' && ch <= '9'   ? ch - '0'
+                                : ch >= 'a' && ch <= 'f' ? ch - 'a' + 10
+                                : ch >= 'A' && ch <= 'F' ? ch - 'A' + 10
+                                                         : -1;
+                    if (digit < 0 || c->left >> 60) {
+                        return -1;
+                    }
+                    c->left = c->left * 16 + digit;
+                }
+                break;
+            }
+            case PHASE_CHUNK_CRLF:
+                i++;
+                if (--c->line_len == 0) {
+                    c->phase = PHASE_CHUNK_SIZE;
+                    c->left = 0;
+                    c->chunk_ext = 0;
+                }
+                break;
+            case PHASE_TRAILER: {
+                char ch = data[i++];
+                if (ch == '\n') {
+                    if (c->line_len == 0) {
+                        response_done(t, c, now);
+                        if (c->close_after) {
+                            return 1;
+                        }
+                    }
+                    c->line_len = 0;
+                } else if (ch != '\r') {
+                    c->line_len++;
+                }
+                break;
+            }
+            case PHASE_UNTIL_CLOSE:
+                i = len;
+                break;
+        }
+    }
+    return 0;
+}
+
+static void conn_read(bench_thread_t *t, conn_t *c) {
+    for (;;) {
+        ssize_t n = recv(c->fd, t->buf, NXB_READ_BUFFER, 0);
+        uint64_t now = now_ns();
+        if (n > 0) {
+            if (now >= t->measure_from) {
+                t->stats.bytes += n;
+            }
+            int result = conn_feed(t, c, t->buf, n, now);
+            if (result < 0) {
+                count_error(t, ERR_PARSE, now);
+                conn_reset(t, c, now, 1);
+                return;
+            }
+            if (result > 0) {
+                conn_reset(t, c, now, 0);
+                conn_pump(t, c, now);
+                return;
+            }
+            continue;
+        }
+
+        if (n == 0) {
+            if (c->count > 0 && c->phase == PHASE_UNTIL_CLOSE) {
+                response_done(t, c, now);
+                conn_reset(t, c, now, 0);
+            } else if (c->count > 0) {
+                count_error(t, ERR_READ, now);
+                conn_reset(t, c, now, 1);
+            } else {
+                conn_reset(t, c, now, 0);
+            }
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            count_error(t, ERR_READ, now);
+            conn_reset(t, c, now, 1);
+            return;
+        }
+        conn_pump(t, c, now);
+        return;
+    }
+}
+
+static void conn_event(bench_thread_t *t, conn_t *c, uint32_t events) {
+    uint64_t now = now_ns();
+    if (c->state == CONN_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0) {
+            close(c->fd);
+            c->fd = -1;
+            count_error(t, ERR_CONNECT, now);
+            c->state = CONN_IDLE;
+            c->retry_at = now + NXB_RETRY_NS;
+            return;
+        }
+        if (!(events & EPOLLOUT)) {
+            return;
+        }
+        c->state = CONN_READY;
+    }
+
+    if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        conn_read(t, c);
+    }
+    if ((events & EPOLLOUT) && c->state == CONN_READY && conn_flush(c) != 0) {
+        count_error(t, ERR_WRITE, now);
+        conn_reset(t, c, now, 1);
+    }
+}
+
+/* reconnects, expires timed out requests and, in open-loop mode, sends
+ * whatever is due; the timer is rearmed for the next due request */
+static void scan(bench_thread_t *t, uint64_t now) {
+    uint64_t timeout = (uint64_t)(opts.timeout * 1e9);
+    uint64_t next = now + NXB_SCAN_NS;
+
+    for (int i = 0; i < t->conn_count; i++) {
+        conn_t *c = &t->conns[i];
+        if (c->state == CONN_IDLE && now >= c->retry_at) {
+            conn_open(t, c, now);
+        }
+        if (c->count > 0 && now - c->pending[c->head].start > timeout) {
+            count_error(t, ERR_TIMEOUT, now);
+            conn_reset(t, c, now, 1);
+        }
+        conn_pump(t, c, now);
+        if (t->interval && c->count < t->run->depth && c->next_due < next) {
+            next = c->next_due;
+        }
+        if (c->state == CONN_IDLE && c->retry_at < next) {
+            next = c->retry_at;
+        }
+    }
+
+    t->next_scan = next;
+    arm_timer(t, next);
+}
+
+static void *run_thread(void *arg) {
+    bench_thread_t *t = arg;
+    struct epoll_event events[NXB_EVENTS];
+
+    t->buf = malloc(NXB_READ_BUFFER);
+    t->epfd = epoll_create1(EPOLL_CLOEXEC);
+    t->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (!t->buf || t->epfd == -1 || t->timerfd == -1) {
+        fprintf(stderr, "thread setup failed: %s\n", strerror(errno));
+        return NULL;
+    }
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    epoll_ctl(t->epfd, EPOLL_CTL_ADD, t->timerfd, &ev);
+
+    while (now_ns() < t->start) {
+        usleep(1000);
+    }
+
+    uint64_t now = now_ns();
+    uint64_t spacing = t->interval ? t->interval / opts.connections : 0;
+    for (int i = 0; i < t->conn_count; i++) {
+        conn_t *c = &t->conns[i];
+        c->fd = -1;
+        c->next_due = t->start + (uint64_t)(t->first_conn + i) * spacing;
+        conn_open(t, c, now);
+    }
+    scan(t, now);
+
+    while ((now = now_ns()) < t->end) {
+        if (now >= t->next_scan) {
+            scan(t, now);
+        }
+        int n = epoll_wait(t->epfd, events, NXB_EVENTS, 10);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                uint64_t expirations;
+                ssize_t ignored = read(t->timerfd, &expirations, sizeof(expirations));
+                (void)ignored;
+                continue;
+            }
+            conn_event(t, events[i].data.ptr, events[i].events);
+        }
+    }
+
+    for (int i = 0; i < t->conn_count; i++) {
+        if (t->conns[i].fd >= 0) {
+            close(t->conns[i].fd);
+        }
+    }
+    close(t->timerfd);
+    close(t->epfd);
+    free(t->buf);
+    return NULL;
+}
+
+static int fetch_etag(const char *path, char *etag, size_t size) {
+    int fd = socket(server_addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    struct timeval tv = {2, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (struct sockaddr *)&server_addr, server_addr_len) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    char buf[NXB_HEAD_MAX];
+    int len = snprintf(buf, sizeof(buf), "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: nxbench\r\nConnection: close\r\n\r\n",
+                       path, host_header);
+    if (send(fd, buf, len, MSG_NOSIGNAL) != len) {
+        close(fd);
+        return -1;
+    }
+
+    size_t got = 0;
+    char *end = NULL;
+    while (!end && got < sizeof(buf) - 1) {
+        ssize_t n = recv(fd, buf + got, sizeof(buf) - 1 - got, 0);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+        buf[got] = '\0';
+        end = strstr(buf, "\r\n\r\n");
+    }
+    close(fd);
+    if (!end) {
+        return -1;
+    }
+    end[2] = '\0';
+
+    char *value = strcasestr(buf, "\r\nETag:");
+    if (!value) {
+        return -1;
+    }
+    value += 7;
+    while (*value == ' ') {
+        value++;
+    }
+    size_t value_len = strcspn(value, "\r");
+    if (value_len == 0 || value_len >= size) {
+        return -1;
+    }
+    memcpy(etag, value, value_len);
+    etag[value_len] = '\0';
+    return 0;
+}
+
+static int build_request(request_t *request, const run_t *run, int conditional) {
+    int flags = run->scenario->flags;
+    char validator[300] = "";
+    if (conditional) {
+        snprintf(validator, sizeof(validator), "If-None-Match: %s\r\n", run->etag);
+    }
+    int len = snprintf(request->text, sizeof(request->text),
+                       "GET %s HTTP/1.1\r\nHost: %s\r\nUser-Agent: nxbench\r\n%s%s%s\r\n", run->path, host_header,
+                       flags & SCENARIO_COMPRESSED ? "Accept-Encoding: gzip, br, zstd\r\n" : "",
+                       flags & SCENARIO_CLOSE ? "Connection: close\r\n" : "", validator);
+    if (len < 0 || (size_t)len >= sizeof(request->text)) {
+        return -1;
+    }
+    request->len = len;
+    return 0;
+}
+
+static void print_latency(FILE *out, const char *name, const hist_t *hist) {
+    static const struct {
+        const char *label;
+        double quantile;
+    } points[] = {{"p50", 0.5}, {"p75", 0.75}, {"p90", 0.9}, {"p99", 0.99}, {"p99.9", 0.999}, {"p99.99", 0.9999}};
+
+    fprintf(out, "    \"%s\": {\"min\": %.1f, \"mean\": %.1f, \"max\": %.1f", name,
+            hist->count ? hist->min / 1e3 : 0, hist->count ? (double)hist->sum / hist->count / 1e3 : 0,
+            hist->max / 1e3);
+    for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+        fprintf(out, ", \"%s\": %.1f", points[i].label, hist_quantile(hist, points[i].quantile) / 1e3);
+    }
+    fputc('}', out);
+}
+
+static void print_result(FILE *out, const run_t *run, const stats_t *stats, int threads, double seconds) {
+    fprintf(out, "  {\n");
+    fprintf(out, "    \"scenario\": \"%s\",\n", run->scenario->name);
+    fprintf(out, "    \"mode\": \"%s\",\n", opts.rate > 0 ? "open" : "closed");
+    fprintf(out, "    \"target\": \"%s:%s\",\n", opts.host, opts.port);
+    fprintf(out, "    \"path\": \"%s\",\n", run->path);
+    fprintf(out, "    \"connections\": %d,\n", opts.connections);
+    fprintf(out, "    \"threads\": %d,\n", threads);
+    fprintf(out, "    \"pipeline\": %d,\n", run->depth);
+    fprintf(out, "    \"rate\": %.0f,\n", opts.rate);
+    fprintf(out, "    \"warmup_s\": %.3f,\n", opts.warmup);
+    fprintf(out, "    \"duration_s\": %.3f,\n", seconds);
+    fprintf(out, "    \"requests\": %lu,\n", (unsigned long)stats->requests);
+    fprintf(out, "    \"bytes\": %lu,\n", (unsigned long)stats->bytes);
+    fprintf(out, "    \"requests_per_s\": %.1f,\n", stats->requests / seconds);
+    fprintf(out, "    \"bytes_per_s\": %.1f,\n", stats->bytes / seconds);
+    fprintf(out, "    \"status\": {\"1xx\": %lu, \"2xx\": %lu, \"3xx\": %lu, \"4xx\": %lu, \"5xx\": %lu},\n",
+            (unsigned long)stats->status[0], (unsigned long)stats->status[1], (unsigned long)stats->status[2],
+            (unsigned long)stats->status[3], (unsigned long)stats->status[4]);
+    fprintf(out, "    \"errors\": {");
+    for (int i = 0; i < ERR_COUNT; i++) {
+        fprintf(out, "%s\"%s\": %lu", i ? ", " : "", error_names[i], (unsigned long)stats->errors[i]);
+    }
+    fprintf(out, "},\n");
+    print_latency(out, "latency_us", &stats->latency);
+    if (opts.rate > 0) {
+        fprintf(out, ",\n");
+        print_latency(out, "uncorrected_latency_us", &stats->uncorrected);
+    }
+    fprintf(out, "\n  }");
+}
+
+static int run_scenario(const scenario_t *scenario, FILE *out, int *printed) {
+    static run_t run;
+    memset(&run, 0, sizeof(run));
+    run.scenario = scenario;
+    run.path = opts.path ? opts.path : scenario->path;
+    run.depth = scenario->flags & SCENARIO_CLOSE ? 1 : opts.depth > 0 ? opts.depth : scenario->depth;
+    if (run.depth > NXB_PIPELINE_MAX) {
+        run.depth = NXB_PIPELINE_MAX;
+    }
+
+    if (scenario->flags & (SCENARIO_CONDITIONAL | SCENARIO_MIXED)) {
+        run.has_etag = fetch_etag(run.path, run.etag, sizeof(run.etag)) == 0;
+        if (!run.has_etag) {
+            fprintf(stderr, "%s: no ETag for %s, sending unconditional requests\n", scenario->name, run.path);
+        }
+    }
+    if (build_request(&run.templates[0], &run, 0) != 0 ||
+        (run.has_etag && build_request(&run.templates[1], &run, 1) != 0)) {
+        fprintf(stderr, "%s: request does not fit in %d bytes\n", scenario->name, NXB_REQUEST_MAX);
+        return -1;
+    }
+
+    int thread_count = opts.threads < opts.connections ? opts.threads : opts.connections;
+    bench_thread_t *threads = calloc(thread_count, sizeof(bench_thread_t));
+    conn_t *conns = calloc(opts.connections, sizeof(conn_t));
+    char *out_buffers = malloc((size_t)opts.connections * run.depth * NXB_REQUEST_MAX);
+    if (!threads || !conns || !out_buffers) {
+        fprintf(stderr, "out of memory\n");
+        free(threads);
+        free(conns);
+        free(out_buffers);
+        return -1;
+    }
+
+    uint64_t start = now_ns() + 20000000ULL;
+    uint64_t measure_from = start + (uint64_t)(opts.warmup * 1e9);
+    uint64_t end = measure_from + (uint64_t)(opts.duration * 1e9);
+    uint64_t interval = opts.rate > 0 ? (uint64_t)(opts.connections * 1e9 / opts.rate) : 0;
+
+    for (int i = 0; i < opts.connections; i++) {
+        conns[i].out = out_buffers + (size_t)i * run.depth * NXB_REQUEST_MAX;
+    }
+    for (int i = 0; i < thread_count; i++) {
+        bench_thread_t *t = &threads[i];
+        t->run = &run;
+        t->first_conn = (int)((long)opts.connections * i / thread_count);
+        t->conn_count = (int)((long)opts.connections * (i + 1) / thread_count) - t->first_conn;
+        t->conns = conns + t->first_conn;
+        t->start = start;
+        t->measure_from = measure_from;
+        t->end = end;
+        t->interval = interval;
+        hist_reset(&t->stats.latency);
+        hist_reset(&t->stats.uncorrected);
+        if (pthread_create(&t->thread, NULL, run_thread, t) != 0) {
+            fprintf(stderr, "pthread_create: %s\n", strerror(errno));
+            exit(1);
+        }
+    }
+
+    static stats_t total;
+    memset(&total, 0, sizeof(total));
+    hist_reset(&total.latency);
+    hist_reset(&total.uncorrected);
+    for (int i = 0; i < thread_count; i++) {
+        pthread_join(threads[i].thread, NULL);
+        const stats_t *stats = &threads[i].stats;
+        hist_merge(&total.latency, &stats->latency);
+        hist_merge(&total.uncorrected, &stats->uncorrected);
+        total.requests += stats->requests;
+        total.bytes += stats->bytes;
+        for (int s = 0; s < 5; s++) {
+            total.status[s] += stats->status[s];
+        }
+        for (int e = 0; e < ERR_COUNT; e++) {
+            total.errors[e] += stats->errors[e];
+        }
+    }
+
+    double seconds = (end - measure_from) / 1e9;
+    if ((*printed)++ > 0) {
+        fprintf(out, ",\n");
+    }
+    print_result(out, &run, &total, thread_count, seconds);
+    fflush(out);
+
+    uint64_t errors = 0;
+    for (int e = 0; e < ERR_COUNT; e++) {
+        errors += total.errors[e];
+    }
+    fprintf(stderr, "%-12s %10.0f req/s %9.2f MB/s  p50 %8.1fus  p99 %8.1fus  p99.9 %8.1fus  errors %lu\n",
+            scenario->name, total.requests / seconds, total.bytes / seconds / 1e6,
+            hist_quantile(&total.latency, 0.5) / 1e3, hist_quantile(&total.latency, 0.99) / 1e3,
+            hist_quantile(&total.latency, 0.999) / 1e3, (unsigned long)errors);
+
+    free(out_buffers);
+    free(conns);
+    free(threads);
+    return 0;
+}
+
+/* corpus generator: the files every scenario expects, deterministic so two
+ * runs against the same build serve identical bytes */
+
+static uint64_t corpus_rng = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t corpus_next(void) {
+    corpus_rng ^= corpus_rng >> 12;
+    corpus_rng ^= corpus_rng << 25;
+    corpus_rng ^= corpus_rng >> 27;
+    return corpus_rng * 0x2545f4914f6cdd1dULL;
+}
+
+static const char *corpus_words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "server", "request", "response", "cache", "worker",
+    "epoll", "socket", "latency", "buffer", "static", "content", "header", "stream", "compress", "connection",
+    "kernel", "thread", "queue", "event", "signal", "memory", "page", "file", "index", "proxy",
+    "upstream", "metric",
+};
+
+#define CORPUS_WORD_COUNT (sizeof(corpus_words) / sizeof(corpus_words[0]))
+
+static const char *corpus_word(void) {
+    return corpus_words[corpus_next() % CORPUS_WORD_COUNT];
+}
+
+typedef enum {
+    CORPUS_HTML = 0,
+    CORPUS_CSS,
+    CORPUS_JS,
+    CORPUS_JSON
+} corpus_kind_t;
+
+static char *corpus_text(corpus_kind_t kind, size_t size, size_t *out_len) {
+    char *buf = malloc(size + 1024);
+    if (!buf) {
+        return NULL;
+    }
+    size_t pos = 0;
+    int n = 0;
+
+    if (kind == CORPUS_HTML) {
+        pos += sprintf(buf, "<!DOCTYPE html>\n<html><head><title>nxbench</title>"
+                            "<link rel=\"stylesheet\" href=\"/style.css\"><script src=\"/app.js\"></script>"
+                            "</head><body>\n");
+    } else if (kind == CORPUS_JSON) {
+        pos += sprintf(buf, "{\"items\": [\n");
+    }
+
+    while (pos < size) {
+        switch (kind) {
+            case CORPUS_HTML:
+                pos += sprintf(buf + pos, "<p class=\"%s\">", corpus_word());
+                for (int w = 0; w < 40 && pos < size + 512; w++) {
+                    pos += sprintf(buf + pos, "%s ", corpus_word());
+                }
+                pos += sprintf(buf + pos, "</p>\n");
+                break;
+            case CORPUS_CSS:
+                pos += sprintf(buf + pos, ".%s-%d { margin: %dpx; padding: %dpx; color: #%06x; }\n", corpus_word(), n,
+                               (int)(corpus_next() % 32), (int)(corpus_next() % 16),
+                               (unsigned)(corpus_next() & 0xffffff));
+                break;
+            case CORPUS_JS:
+                pos += sprintf(buf + pos, "/* %s %s */\nfunction %s_%d(a, b) { return a * %d + b - %d; }\n",
+                               corpus_word(), corpus_word(), corpus_word(), n, (int)(corpus_next() % 100),
+                               (int)(corpus_next() % 100));
+                break;
+            case CORPUS_JSON:
+                pos += sprintf(buf + pos, "%s{\"id\": %d, \"name\": \"%s %s\", \"score\": %d}", n ? ",\n" : "", n,
+                               corpus_word(), corpus_word(), (int)(corpus_next() % 1000));
+                break;
+        }
+        n++;
+    }
+
+    if (kind == CORPUS_HTML) {
+        pos += sprintf(buf + pos, "</body></html>\n");
+    } else if (kind == CORPUS_JSON) {
+        pos += sprintf(buf + pos, "\n]}\n");
+    }
+    *out_len = pos;
+    return buf;
+}
+
+static int corpus_write(const char *dir, const char *name, const char *data, size_t len) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = write(fd, data + written, len - written);
+        if (n <= 0) {
+            fprintf(stderr, "%s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        written += n;
+    }
+    close(fd);
+    return 0;
+}
+
+static int write_corpus(const char *dir) {
+    static const struct {
+        const char *name;
+        corpus_kind_t kind;
+        size_t size;
+    } texts[] = {
+        {"index.html", CORPUS_HTML, 12 * 1024},
+        {"style.css", CORPUS_CSS, 24 * 1024},
+        {"app.js", CORPUS_JS, 128 * 1024},
+        {"data.json", CORPUS_JSON, 64 * 1024},
+    };
+    char sub[4096];
+    snprintf(sub, sizeof(sub), "%s/small", dir);
+    if ((mkdir(dir, 0755) != 0 && errno != EEXIST) || (mkdir(sub, 0755) != 0 && errno != EEXIST)) {
+        fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+
+    size_t total = 0;
+    int files = 0;
+    for (size_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+        size_t len;
+        char *data = corpus_text(texts[i].kind, texts[i].size, &len);
+        if (!data || corpus_write(dir, texts[i].name, data, len) != 0) {
+            free(data);
+            return -1;
+        }
+        free(data);
+        total += len;
+        files++;
+    }
+
+    for (int i = 0; i < 256; i++) {
+        char name[64];
+        size_t len;
+        snprintf(name, sizeof(name), "small/item-%04d.html", i);
+        char *data = corpus_text(CORPUS_HTML, 512 + corpus_next() % 3584, &len);
+        if (!data || corpus_write(dir, name, data, len) != 0) {
+            free(data);
+            return -1;
+        }
+        free(data);
+        total += len;
+        files++;
+    }
+
+    size_t large = 16 * 1024 * 1024;
+    uint64_t *data = malloc(large);
+    if (!data) {
+        return -1;
+    }
+    for (size_t i = 0; i < large / sizeof(uint64_t); i++) {
+        data[i] = corpus_next();
+    }
+    int result = corpus_write(dir, "large.bin", (const char *)data, large);
+    free(data);
+    if (result != 0) {
+        return -1;
+    }
+    total += large;
+    files++;
+
+    fprintf(stderr, "wrote %d files (%zu bytes) to %s\n", files, total, dir);
+    return 0;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "       %s --corpus <dir>\n"
+            "  -H host       server address (default %s)\n"
+            "  -p port       server port (default %s)\n"
+            "  -s scenario   scenario name or \"all\" (default %s)\n"
+            "  -c conns      connections (default %d)\n"
+            "  -t threads    threads (default %d)\n"
+            "  -d seconds    measured duration (default %.0f)\n"
+            "  -w seconds    warmup before measuring (default %.0f)\n"
+            "  -R rate       open-loop requests per second; closed loop when 0\n"
+            "  -P depth      requests in flight per connection\n"
+            "  -u path       request path, overriding the scenario's\n"
+            "  -T seconds    request timeout (default %.0f)\n"
+            "  -o file       write JSON results to file instead of stdout\n"
+            "scenarios:",
+            program, program, opts.host, opts.port, opts.scenario, opts.connections, opts.threads, opts.duration,
+            opts.warmup, opts.timeout);
+    for (int i = 0; i < SCENARIO_COUNT; i++) {
+        fprintf(stderr, " %s", scenarios[i].name);
+    }
+    fputc('\n', stderr);
+}
+
+int main(int argc, char *argv[]) {
+    static const struct option long_options[] = {
+        {"corpus", required_argument, NULL, 'C'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    const char *corpus = NULL;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "H:p:s:c:t:d:w:R:P:u:T:o:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'H':
+                opts.host = optarg;
+                break;
+            case 'p':
+                opts.port = optarg;
+                break;
+            case 's':
+                opts.scenario = optarg;
+                break;
+            case 'c':
+                opts.connections = atoi(optarg);
+                break;
+            case 't':
+                opts.threads = atoi(optarg);
+                break;
+            case 'd':
+                opts.duration = atof(optarg);
+                break;
+            case 'w':
+                opts.warmup = atof(optarg);
+                break;
+            case 'R':
+                opts.rate = atof(optarg);
+                break;
+            case 'P':
+                opts.depth = atoi(optarg);
+                break;
+            case 'u':
+                opts.path = optarg;
+                break;
+            case 'T':
+                opts.timeout = atof(optarg);
+                break;
+            case 'o':
+                opts.output = optarg;
+                break;
+            case 'C':
+                corpus = optarg;
+                break;
+            case 'h':
+                usage(argv[0]);
+                return 0;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+
+    if (corpus) {
+        return write_corpus(corpus) == 0 ? 0 : 1;
+    }
+    if (opts.connections <= 0 || opts.threads <= 0 || opts.duration <= 0 || opts.warmup < 0 || opts.rate < 0 ||
+        opts.timeout <= 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    struct addrinfo hints = {.ai_family = AF_UNSPEC, .ai_socktype = SOCK_STREAM};
+    struct addrinfo *addrs;
+    int rc = getaddrinfo(opts.host, opts.port, &hints, &addrs);
+    if (rc != 0) {
+        fprintf(stderr, "%s:%s: %s\n", opts.host, opts.port, gai_strerror(rc));
+        return 1;
+    }
+    memcpy(&server_addr, addrs->ai_addr, addrs->ai_addrlen);
+    server_addr_len = addrs->ai_addrlen;
+    freeaddrinfo(addrs);
+    snprintf(host_header, sizeof(host_header), "%s:%s", opts.host, opts.port);
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    const scenario_t *selected[SCENARIO_COUNT];
+    int selected_count = 0;
+    for (int i = 0; i < SCENARIO_COUNT; i++) {
+        if (strcmp(opts.scenario, "all") == 0 || strcmp(opts.scenario, scenarios[i].name) == 0) {
+            selected[selected_count++] = &scenarios[i];
+        }
+    }
+    if (selected_count == 0) {
+        fprintf(stderr, "unknown scenario %s\n", opts.scenario);
+        usage(argv[0]);
+        return 2;
+    }
+
+    FILE *out = opts.output ? fopen(opts.output, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "%s: %s\n", opts.output, strerror(errno));
+        return 1;
+    }
+
+    int status = 0;
+    int printed = 0;
+    fprintf(out, "[\n");
+    for (int i = 0; i < selected_count; i++) {
+        if (run_scenario(selected[i], out, &printed) != 0) {
+            status = 1;
+        }
+    }
+    fprintf(out, "\n]\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return status;
+}
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""Minimal HTTP/1.1 upstream for exercising proxy_pass locally.
+
+Usage: proxy_backend.py PORT [PORT ...]
+
+Each port answers with its own name so balancing is visible:
+  /chunked/...  chunked response
+  /close/...    response delimited by connection close
+  /big/N        N bytes of body
+  anything else Content-Length response echoing method, path and body size
+"""
+import socketserver
+import sys
+import threading
+from http.server import BaseHTTPRequestHandler
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def reply(self):
+        length = int(self.headers.get("Content-Length") or 0)
+        body = self.rfile.read(length) if length else b""
+        name = "backend-%d" % self.server.server_address[1]
+        text = ("%s %s %s body=%d xff=%s\n" % (
+            name, self.command, self.path, len(body),
+            self.headers.get("X-Forwarded-For"))).encode()
+
+        if "/big/" in self.path:
+            text = b"x" * int(self.path.rsplit("/", 1)[1])
+
+        if "/chunked" in self.path:
+            self.send_response(200)
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            for part in (text[:5], text[5:]):
+                self.wfile.write(b"%x;ext=1\r\n%s\r\n" % (len(part), part))
+            self.wfile.write(b"0\r\nX-Trailer: yes\r\n\r\n")
+        elif "/close" in self.path:
+            self.send_response(200)
+            self.send_header("Connection", "close")
+            self.end_headers()
+            self.wfile.write(text)
+            self.close_connection = True
+        else:
+            self.send_response(200)
+            self.send_header("Content-Length", str(len(text)))
+            self.send_header("X-Backend", name)
+            self.end_headers()
+            self.wfile.write(text)
+
+    do_GET = do_POST = do_PUT = do_DELETE = reply
+
+    def do_HEAD(self):
+        self.send_response(200)
+        self.send_header("Content-Length", "123")
+        self.end_headers()
+
+
+class Server(socketserver.ThreadingMixIn, socketserver.TCPServer):
+    allow_reuse_address = True
+    daemon_threads = True
+
+
+if __name__ == "__main__":
+    servers = [Server(("127.0.0.1", int(port)), Handler) for port in sys.argv[1:]]
+    for server in servers[1:]:
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+    servers[0].serve_forever()
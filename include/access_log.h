@@ -0,0 +1,75 @@
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include "log.h"
+#include "http.h"
+#include "config.h"
+#include "access_log_format.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+
+#define ACCESS_LOG_ENTRY_SIZE 2048
+#define ACCESS_LOG_FIELD_MAX 256
+#define ACCESS_LOG_URI_MAX 1024
+#define ACCESS_LOG_MIN_BUFFER (16 * 1024)
+#define ACCESS_LOG_DEFAULT_BUFFER (256 * 1024)
+#define ACCESS_LOG_DEFAULT_FLUSH_MS 1000
+
+typedef enum {
+    ACCESS_LOG_DROP = 0,
+    ACCESS_LOG_BLOCK
+} access_log_overflow_t;
+
+typedef enum {
+    ACCESS_LOG_TEXT = 0,
+    ACCESS_LOG_BINARY
+} access_log_format_t;
+
+/* the request half of a record, captured while the request is still
+ * parsed, because the response may finish after the request buffer has
+ * been reused. In text mode it is `ip - - [time] "request"` followed by
+ * `"referer" "agent"` and the response half is spliced between the two;
+ * in binary mode text holds the raw column values back to back */
+typedef struct {
+    char text[ACCESS_LOG_ENTRY_SIZE];
+    uint16_t request_len;
+    uint16_t len;
+    uint16_t field_len[ACCESS_BIN_COLUMNS];
+    uint32_t addr;
+    uint64_t time_us;
+    uint64_t start;
+} access_log_entry_t;
+
+extern int access_log_enabled;
+
+/* starts this worker's ring and flusher thread; a no-op when config has no
+ * access_log path */
+int access_log_init(const config_t *config, int worker_id);
+/* start is the latency clock reading taken with the request, or 0 when
+ * that clock is off and the record carries no request time. Both calls
+ * accept a NULL entry, which connections get while logging is off */
+void access_log_begin(access_log_entry_t *entry, const char *addr_text, uint32_t addr,
+                      const http_request_t *request, uint64_t start);
+/* queues the finished record and consumes the entry, so a second call for
+ * the same request is a no-op */
+void access_log_finish(access_log_entry_t *entry, int status, size_t bytes);
+/* asks the flusher to reopen its file at the next wakeup, for rotation */
+void access_log_reopen(void);
+void access_log_cleanup(void);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef ACCESS_LOG_FORMAT_H
+#define ACCESS_LOG_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/* binary access log. A file is a sequence of self-contained blocks, each
+ * written with one call, so workers can share a file and a reader can
+ * resynchronise at any block.
+ *
+ * block header, little endian:
+ *   char magic[4], u16 version, u16 header size, u32 records,
+ *   u32 payload bytes, u64 base time (unix microseconds)
+ * record:
+ *   u32 microseconds since base, u32 IPv4 address (network order),
+ *   u16 status, varint bytes sent, varint request time us + 1 (0 = unknown),
+ *   then one varint per column: even values are 2 * an index into that
+ *   column's dictionary, odd values are 2 * length + 1 followed by the
+ *   literal, which becomes the column's next dictionary entry.
+ * Dictionaries start empty in every block */
+
+#define ACCESS_BIN_MAGIC "NXAL"
+#define ACCESS_BIN_VERSION 1
+#define ACCESS_BIN_HEADER_SIZE 24
+#define ACCESS_BIN_DICT_MAX 4096
+#define ACCESS_BIN_BLOCK_TARGET (64 * 1024)
+#define ACCESS_BIN_BLOCK_MAX (256 * 1024)
+
+typedef enum {
+    ACCESS_BIN_METHOD = 0,
+    ACCESS_BIN_URI,
+    ACCESS_BIN_PROTOCOL,
+    ACCESS_BIN_REFERER,
+    ACCESS_BIN_AGENT,
+    ACCESS_BIN_COLUMNS
+} access_bin_column_t;
+
+static inline size_t access_bin_put_varint(unsigned char *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char)value;
+    return n;
+}
+
+static inline int access_bin_get_varint(const unsigned char **p, const unsigned char *end, uint64_t *value) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && *p < end; shift += 7) {
+        unsigned char byte = *(*p)++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            *value = result;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static inline void access_bin_put_le(unsigned char *out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        out[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static inline uint64_t access_bin_get_le(const unsigned char *in, int bytes) {
+    uint64_t value = 0;
+    for (int i = 0; i < bytes; i++) {
+        value |= (uint64_t)in[i] << (8 * i);
+    }
+    return value;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "log.h"
+#include "http.h"
+#include "vhost.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#define CACHE_DEFAULT_ENTRIES 4096
+#define CACHE_DEFAULT_MAX_BYTES ((size_t)64 * 1024 * 1024)
+#define CACHE_BUCKETS 16384
+#define CACHE_TIMEOUT 3600
+#define CACHE_MAX_FILE_SIZE (1024 * 1024)
+#define CACHE_DEFAULT_ZEROCOPY_MIN (64 * 1024)
+#define CACHE_PARTITIONS VHOST_MAX
+
+/* a stored response is refcounted so a send still in progress keeps it
+ * alive after it is replaced or invalidated. Large ones live in a sealed
+ * memfd mapped read-only: the mapping serves in-memory reads and the fd
+ * lets sendfile hand the pages to the socket without copying */
+typedef struct cache_variant {
+    char *response;
+    size_t response_len;
+    size_t header_len;
+    time_t timestamp;
+    int fd;
+    int refs;
+} cache_variant_t;
+
+typedef struct cache_entry {
+    char path[PATH_MAX];
+    uint32_t hash;
+    int partition;
+    cache_variant_t *variants[COMPRESSION_TYPE_COUNT];
+    struct cache_entry *next;
+} cache_entry_t;
+
+/* sizes the entry table and caps the bytes held by stored responses;
+ * the oldest entries are evicted to stay under the cap. The table is
+ * created on first use with the defaults if this was never called */
+int cache_init(int entries, size_t max_bytes);
+void cache_cleanup(void);
+/* each vhost stores into its own partition; a partition with a quota
+ * evicts its own oldest entries first, so one busy host cannot push the
+ * others out of the shared table. 0 removes the quota */
+void cache_set_quota(int partition, size_t max_bytes);
+void cache_set_zerocopy_threshold(size_t min_size);
+cache_variant_t *cache_lookup(const char *path, compression_type_t encoding);
+int cache_store(const char *path, int partition, compression_type_t encoding,
+                const char *header, size_t header_len, const void *body, size_t body_len);
+void cache_invalidate(const char *path);
+void cache_variant_ref(cache_variant_t *variant);
+void cache_variant_release(cache_variant_t *variant);
+
+#endif
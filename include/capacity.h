@@ -0,0 +1,49 @@
+#ifndef CAPACITY_H
+#define CAPACITY_H
+
+#include "log.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+
+#define CAPACITY_DEFAULT_BUDGET ((size_t)256 * 1024 * 1024)
+#define CAPACITY_MIN_CONNECTIONS 64
+#define CAPACITY_GROWTH_STEP 256
+#define CAPACITY_MAX_EVENTS 4096
+#define CAPACITY_MIN_BUFFER 1024
+#define CAPACITY_MAX_BUFFER (64 * 1024)
+#define CAPACITY_CACHE_SHARE 4
+#define CAPACITY_CACHE_ENTRY_ESTIMATE (16 * 1024)
+#define CAPACITY_MIN_CACHE_ENTRIES 64
+#define CAPACITY_MAX_CACHE_ENTRIES 65536
+#define CAPACITY_PENDING_SHARE 4
+
+/* per-worker sizes derived from the worker_memory budget. The response
+ * cache takes a share (1/CAPACITY_CACHE_SHARE unless response_cache_size
+ * is set), fixed tables come off the top, and what is left is divided
+ * into connections. Nothing is reserved up front: the client table and
+ * request buffers grow in growth_step chunks up to max_connections */
+typedef struct {
+    size_t budget;
+    size_t buffer_size;
+    size_t connection_bytes;
+    size_t fixed_bytes;
+    size_t cache_bytes;
+    size_t cache_body_bytes;
+    size_t initial_bytes;
+    size_t peak_bytes;
+    int cache_entries;
+    int max_connections;
+    int derived_connections;
+    int growth_step;
+    int max_events;
+} capacity_plan_t;
+
+/* fails when the budget cannot hold CAPACITY_MIN_CONNECTIONS */
+int capacity_plan(const config_t *config, capacity_plan_t *plan);
+void capacity_report(const capacity_plan_t *plan, int worker_count);
+
+#endif
@@ -2,16 +2,14 @@
 #define COMMON_H
 
 
+/* compile-time fallbacks; per-worker capacities come from the
+ * worker_memory budget at runtime (capacity.h) */
 #define MAX_EVENTS 4096  
-#define MAX_TIMEOUTS 10000  
 
 #define KEEP_ALIVE_TIMEOUT 30  
-#define MAX_CONNECTIONS 100000  
-#define CONNECTION_POOL_SIZE 1000  
 
 #define BUFFER_SIZE 8192  
-#define BUFFER_POOL_SIZE 10000  
 #define SEND_BUFFER_SIZE 65536  
 #define RECV_BUFFER_SIZE 65536  
 
-#endif 
\ No newline at end of file
+#endif
\ No newline at end of file
@@ -0,0 +1,35 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "log.h"
+#include "http.h"
+#include "encoding.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <zlib.h>
+#ifdef HAVE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+#define COMPRESS_ENGINE_AUTO "auto"
+
+typedef struct {
+    const char *name;
+    int (*supports)(compression_type_t type);
+    size_t (*bound)(compression_type_t type, int level, size_t in_len);
+    int (*compress)(compression_type_t type, int level, const void *in, size_t in_len,
+                    void *out, size_t out_cap, size_t *out_len);
+    void (*release)(void);
+} compress_backend_t;
+
+const compress_backend_t *compress_engine_find(const char *name);
+const compress_backend_t *compress_engine_backend(int index);
+int compress_engine_select(const char *name);
+const char *compress_engine_name(void);
+int compress_engine_compress(compression_type_t type, int level, const void *in, size_t in_len,
+                             void **out, size_t *out_len);
+void compress_engine_release(void);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef COMPRESS_CTL_H
+#define COMPRESS_CTL_H
+
+#include "log.h"
+#include "http.h"
+#include "config.h"
+#include "metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define COMPRESS_CTL_INTERVAL_MS 1000
+#define COMPRESS_CTL_OFFSET_MIN (-(COMPRESSION_LEVEL_MAX - 1))
+#define COMPRESS_CTL_OFFSET_MAX 3
+#define COMPRESS_CTL_LARGE_BODY (1024 * 1024)
+
+typedef struct {
+    uint64_t responses[COMPRESSION_LEVEL_MAX + 1];
+    uint64_t skipped;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t cpu_ns;
+    int offset;
+    int cpu_percent;
+    int lag_ms;
+} compress_stats_t;
+
+void compress_ctl_init(const config_t *config);
+int compress_ctl_level(const char *mime_type, compression_type_t type, size_t body_size);
+void compress_ctl_observe_loop(uint64_t busy_usec);
+void compress_ctl_tick(void);
+uint64_t compress_ctl_cpu_now(void);
+void compress_ctl_record(int level, size_t in_len, size_t out_len, uint64_t cpu_ns);
+void compress_ctl_stats(compress_stats_t *stats);
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef COMPRESS_POOL_H
+#define COMPRESS_POOL_H
+
+#include "log.h"
+#include "http.h"
+#include "compress.h"
+#include "compress_ctl.h"
+#include "probes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/eventfd.h>
+
+#define COMPRESS_POOL_MAX_THREADS 64
+#define COMPRESS_POOL_CACHE_LINE 64
+
+typedef struct compress_job {
+    int client_fd;
+    uint64_t id;
+    compression_type_t type;
+    int level;
+    void *in;
+    size_t in_len;
+    void *out;
+    size_t out_len;
+    int status;
+} compress_job_t;
+
+typedef struct {
+    _Atomic size_t sequence;
+    compress_job_t *job;
+} compress_slot_t;
+
+/* bounded MPMC ring: submissions come from the event loop, completions from
+ * the pool threads */
+typedef struct {
+    compress_slot_t *slots;
+    size_t mask;
+    _Alignas(COMPRESS_POOL_CACHE_LINE) _Atomic size_t head;
+    _Alignas(COMPRESS_POOL_CACHE_LINE) _Atomic size_t tail;
+} compress_queue_t;
+
+typedef struct {
+    compress_queue_t submit;
+    compress_queue_t done;
+    sem_t pending;
+    int event_fd;
+    int thread_count;
+    pthread_t threads[COMPRESS_POOL_MAX_THREADS];
+    atomic_int stopping;
+    size_t queue_limit;
+    size_t inflight;
+} compress_pool_t;
+
+compress_pool_t *compress_pool_create(int thread_count, size_t queue_limit);
+int compress_pool_event_fd(const compress_pool_t *pool);
+void compress_pool_ack(compress_pool_t *pool);
+int compress_pool_submit(compress_pool_t *pool, compress_job_t *job);
+compress_job_t *compress_pool_complete(compress_pool_t *pool);
+void compress_pool_destroy(compress_pool_t *pool);
+void compress_job_free(compress_job_t *job);
+
+#endif
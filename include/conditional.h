@@ -0,0 +1,31 @@
+#ifndef CONDITIONAL_H
+#define CONDITIONAL_H
+
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define CONDITIONAL_DATE_CACHE_SIZE 64
+#define CONDITIONAL_DATE_MAX 40
+
+/* revalidation against stored validators. If-None-Match is scanned in
+ * place and each entity tag compared byte for byte with the stored one,
+ * weak tags included since a 304 only needs the weak comparison.
+ * If-Modified-Since is parsed once per distinct value: IMF-fixdate by
+ * hand, the obsolete RFC 850 and asctime forms through strptime, and the
+ * result kept in a small per-process table since clients echo the same
+ * Last-Modified values back */
+int conditional_etag_matches(const char *if_none_match, const char *etag, size_t etag_len);
+int conditional_parse_date(const char *value, time_t *result);
+/* last_modified is the formatted date sent with the representation; a
+ * client echoing it exactly is answered without parsing */
+int conditional_not_modified_since(const char *if_modified_since, const char *last_modified, time_t mtime);
+/* If-None-Match, when present, decides alone and If-Modified-Since is
+ * ignored, as RFC 9110 requires; 1 when a 304 may be sent */
+int conditional_not_modified(const char *if_none_match, const char *if_modified_since,
+                             const char *etag, size_t etag_len, const char *last_modified, time_t mtime);
+
+#endif
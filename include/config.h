@@ -7,6 +7,9 @@
 #include <string.h>
 #include <ctype.h>
 
+#define CONFIG_MAX_PROXY_ROUTES 8
+#define CONFIG_MAX_VHOSTS 64
+
 typedef struct {
     int port;
     int worker_count;
@@ -14,11 +17,68 @@ typedef struct {
     char log_file[256];
     int max_connections;
     int keep_alive_timeout;
+    int precompress;
+    char precompress_dir[256];
+    int precompress_min_size;
+    int precompress_interval;
+    char compression_engine[32];
+    int compress_threads;
+    int compress_queue_size;
+    int compress_offload_min_size;
+    int compress_adaptive;
+    int compress_level_min;
+    int compress_level_max;
+    int compress_cpu_target;
+    int compress_lag_target_ms;
+    int compress_min_size;
+    int compress_skip_size;
+    int open_file_cache_max;
+    int open_file_cache_valid;
+    int io_threads;
+    int io_queue_size;
+    int cache_zerocopy_min_size;
+    char proxy_pass[CONFIG_MAX_PROXY_ROUTES][256];
+    int proxy_pass_count;
+    int proxy_keepalive;
+    int proxy_max_fails;
+    int proxy_fail_timeout;
+    int proxy_timeout;
+    int metrics_port;
+    char metrics_path[128];
+    int latency_histograms;
+    int server_timing_sample;
+    char access_log[256];
+    int access_log_buffer;
+    int access_log_flush_ms;
+    int access_log_overflow;
+    int access_log_per_worker;
+    int access_log_format;
+    int log_level;
+    int drain_timeout;
+    int request_buffer_size;
+    int response_cache_entries;
+    size_t response_cache_size;
+    size_t worker_memory;
+    char vhosts[CONFIG_MAX_VHOSTS][256];
+    int vhost_count;
+    int manifest;
+    int manifest_max_files;
+    int manifest_threads;
 } config_t;
 
 void config_init(config_t *config);
 int config_load(config_t *config, const char *filename);
+int config_validate(const config_t *config);
 int config_reload(config_t *config, const char *filename);
 config_t* config_get_instance(void);
 
+/* a byte count with an optional k, m or g suffix; "auto" is 0 */
+size_t config_parse_size(const char *value);
+
+/* a MAP_SHARED copy the master refreshes on reload so running workers can
+ * adopt the live settings without parsing the file themselves */
+int config_share(void);
+void config_publish(const config_t *config);
+void config_refresh(config_t *config);
+
 #endif 
\ No newline at end of file
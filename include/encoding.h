@@ -0,0 +1,39 @@
+#ifndef ENCODING_H
+#define ENCODING_H
+
+#include "log.h"
+#include "http.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define ENCODING_CHUNK_SIZE 65536
+#define ENCODING_QVALUE_MAX 1000
+
+typedef struct encoding_stream encoding_stream_t;
+
+const char *encoding_name(compression_type_t type);
+const char *encoding_suffix(compression_type_t type);
+int encoding_available(compression_type_t type);
+int encoding_codec_level(compression_type_t type, int level);
+compression_type_t encoding_negotiate(const char *accept_encoding);
+int encoding_compress(compression_type_t type, int level, const void *in, size_t in_len,
+                      void **out, size_t *out_len);
+encoding_stream_t *encoding_stream_create(compression_type_t type, int level);
+int encoding_stream_process(encoding_stream_t *stream, const void *in, size_t in_len, size_t *consumed,
+                            void *out, size_t out_cap, size_t *produced, int finish);
+void encoding_stream_destroy(encoding_stream_t *stream);
+int encoding_compress_fd(compression_type_t type, int level, int in_fd, int out_fd);
+
+#endif
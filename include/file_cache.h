@@ -0,0 +1,72 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include "log.h"
+#include "http.h"
+#include "config.h"
+#include "probes.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#define FILE_CACHE_BUCKETS 4096
+#define FILE_CACHE_DEFAULT_MAX 1024
+#define FILE_CACHE_DEFAULT_VALID 5
+#define FILE_CACHE_SEQUENTIAL_SIZE (1024 * 1024)
+
+typedef struct file_cache_entry {
+    char path[PATH_MAX];
+    uint32_t hash;
+    int fd;
+    struct stat st;
+    const char *mime_type;
+    const char *cache_control;
+    char etags[COMPRESSION_TYPE_COUNT][64];
+    size_t etag_lens[COMPRESSION_TYPE_COUNT];
+    char *not_modified[COMPRESSION_TYPE_COUNT];
+    size_t not_modified_lens[COMPRESSION_TYPE_COUNT];
+    char last_modified[64];
+    char content_length[32];
+    /* precompressed sidecars, opened on first use; a miss is retried
+     * once the source has been revalidated */
+    int sidecar_fds[COMPRESSION_TYPE_COUNT];
+    struct stat sidecar_st[COMPRESSION_TYPE_COUNT];
+    time_t sidecar_checked[COMPRESSION_TYPE_COUNT];
+    time_t validated;
+    int refs;
+    int detached;
+    struct file_cache_entry *next;
+    struct file_cache_entry *lru_prev;
+    struct file_cache_entry *lru_next;
+} file_cache_entry_t;
+
+struct vhost;
+
+void file_cache_init(int max_entries, int valid_seconds);
+/* opens path, which lies under vhost's root, beneath the root handle when
+ * the host has one; entries stay keyed by the absolute path */
+file_cache_entry_t *file_cache_open(const char *path, const struct vhost *vhost);
+void file_cache_release(file_cache_entry_t *entry);
+/* the 304 header block for one encoding of the entry, up to, not
+ * including, the Connection line; built on first use and kept with the
+ * entry, NULL if it cannot be allocated */
+const char *file_cache_not_modified(file_cache_entry_t *entry, compression_type_t type, size_t *len);
+/* the entry's fresh precompressed sidecar for one encoding, -1 if there is
+ * none; the fd belongs to the entry and is closed with it */
+int file_cache_sidecar(file_cache_entry_t *entry, compression_type_t type, const struct stat **st);
+/* 1 when fd is the entry's source or one of its sidecars */
+int file_cache_owns_fd(const file_cache_entry_t *entry, int fd);
+void file_cache_invalidate(const char *path);
+void file_cache_cleanup(void);
+void file_cache_format_etag(const struct stat *st, compression_type_t type, char *etag, size_t size);
+const char *file_cache_control(const char *path);
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef FILE_IO_H
+#define FILE_IO_H
+
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+
+#define FILE_IO_MAX_THREADS 64
+#define FILE_IO_SCRATCH_SIZE 65536
+#define FILE_IO_READAHEAD_WINDOWS 2
+
+typedef enum {
+    FILE_IO_WARM = 0,
+    FILE_IO_READ
+} file_io_kind_t;
+
+/* a cold range handed to the I/O threads: WARM pulls it into the page cache
+ * so the event loop can sendfile/pread it without blocking, READ fills buf
+ * (indexed by file offset) directly */
+typedef struct file_io_job {
+    int client_fd;
+    uint64_t id;
+    file_io_kind_t kind;
+    int fd;
+    off_t offset;
+    size_t length;
+    void *buf;
+    int status;
+    struct file_io_job *next;
+} file_io_job_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t pending;
+    file_io_job_t *submit_head;
+    file_io_job_t *submit_tail;
+    file_io_job_t *done_head;
+    file_io_job_t *done_tail;
+    int event_fd;
+    int thread_count;
+    pthread_t threads[FILE_IO_MAX_THREADS];
+    int stopping;
+    size_t queue_limit;
+    size_t inflight;
+} file_io_pool_t;
+
+void file_io_enable_nowait(int enabled);
+ssize_t file_io_read(int fd, void *buf, size_t len, off_t offset, int nowait);
+int file_io_resident(int fd, off_t offset, size_t len);
+int file_io_warm(int fd, off_t offset, size_t len);
+
+file_io_pool_t *file_io_pool_create(int thread_count, size_t queue_limit);
+int file_io_pool_event_fd(const file_io_pool_t *pool);
+void file_io_pool_ack(file_io_pool_t *pool);
+int file_io_pool_submit(file_io_pool_t *pool, file_io_job_t *job);
+file_io_job_t *file_io_pool_complete(file_io_pool_t *pool);
+void file_io_pool_destroy(file_io_pool_t *pool);
+void file_io_job_free(file_io_job_t *job);
+
+#endif
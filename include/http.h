@@ -25,11 +25,15 @@
 #define MAX_HEADER_SIZE 1024
 #define MAX_URI_SIZE 2048
 #define MAX_METHOD_SIZE 16
+#define HTTP_MAX_RANGES 16
 
 typedef enum {
     COMPRESSION_NONE = 0,
     COMPRESSION_GZIP,
-    COMPRESSION_DEFLATE
+    COMPRESSION_DEFLATE,
+    COMPRESSION_BROTLI,
+    COMPRESSION_ZSTD,
+    COMPRESSION_TYPE_COUNT
 } compression_type_t;
 
 #define COMPRESSION_LEVEL_DEFAULT 6
@@ -37,6 +41,14 @@ typedef enum {
 #define COMPRESSION_LEVEL_MAX 9
 #define COMPRESSION_LEVEL_NONE 0
 
+/* http_send_response: the next body range is not in the page cache; the
+ * caller should warm response->io_* off the event loop and retry */
+#define HTTP_SEND_FILE_IO 2
+
+#define HTTP_DEFER_NONE 0
+#define HTTP_DEFER_COMPRESS 1
+#define HTTP_DEFER_READ 2
+
 typedef struct {
     char method[MAX_METHOD_SIZE];
     char uri[MAX_URI_SIZE];
@@ -46,6 +58,30 @@ typedef struct {
     int keep_alive;  
 } http_request_t;
 
+typedef struct {
+    off_t start;
+    off_t end;
+} http_range_t;
+
+/* per-request phase durations in nanoseconds while latency histograms are
+ * enabled; a zero phase was not on this request's path */
+typedef struct {
+    uint64_t start;
+    uint64_t parse;
+    uint64_t cache;
+    uint64_t open;
+    uint64_t compress;
+    uint64_t ttfb;
+    uint64_t parked;
+    int sampled;
+} http_timing_t;
+
+struct http_stream;
+struct file_cache_entry;
+struct cache_variant;
+struct vhost;
+struct manifest_rep;
+
 typedef struct {
     int status_code;
     const char *status_text;
@@ -56,23 +92,57 @@ typedef struct {
     int is_cached;
     int file_fd;
     const char *cached_response;
+    struct cache_variant *cache;
     void *body;
     size_t body_length;
     off_t file_offset;
+    size_t header_offset;
+    size_t body_offset;
+    int headers_sent;
+    size_t bytes_sent;
+    struct http_stream *stream;
+    struct file_cache_entry *file;
+    int deferred;
+    int io_fd;
+    off_t io_offset;
+    size_t io_length;
+    
+    int range_count;
+    int range_index;
+    http_range_t ranges[HTTP_MAX_RANGES];
+    const char *range_body;
+    char range_boundary[24];
+    char range_part[256];
+    size_t range_part_len;
     
     compression_type_t compression_type;
     void *compressed_body;
     size_t compressed_length;
     int compression_level;
+    
+    http_timing_t timing;
+    const struct vhost *vhost;
+    const struct manifest_rep *prebuilt;
+    const char *head;
+    size_t head_len;
 } http_response_t;
 
 int http_parse_request(const char *buffer, size_t length, http_request_t *request);
 void http_create_response(http_response_t *response, int status_code);
 void http_add_header(http_response_t *response, const char *name, const char *value);
 int http_send_response(int client_fd, http_response_t *response);
-int http_serve_file(const char *path, http_response_t *response, const http_request_t *request);
+size_t http_format_headers(const http_response_t *response, char *buf, size_t size);
+/* builds the response for an opened file. Takes over the caller's
+ * reference to file; cache is the response cache lookup already done for
+ * the request, NULL on a miss */
+int http_serve_file(struct file_cache_entry *file, struct cache_variant *cache, http_response_t *response,
+                    const http_request_t *request);
 const char *http_get_mime_type(const char *path);
 void http_free_response(http_response_t *response);
+void http_discard_body(http_response_t *response);
+void http_complete_deferred(http_response_t *response);
+void http_complete_read(http_response_t *response);
+void http_set_offload_threshold(size_t min_size);
 int http_should_keep_alive(const http_request_t *request);
 void http_handle_request(const http_request_t *request, http_response_t *response);
 
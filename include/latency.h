@@ -0,0 +1,68 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include "log.h"
+#include "http.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+/* log-linear (HDR-style) buckets over nanoseconds: values below 16 get a
+ * bucket each, every power of two above that is split into 16 linear
+ * sub-buckets, so any recorded value is within 1/16 of its bucket's lower
+ * bound. The top bucket covers ~68s; anything slower is clamped into it */
+#define LATENCY_SUB_BITS 4
+#define LATENCY_SUB_COUNT (1 << LATENCY_SUB_BITS)
+#define LATENCY_MAX_BITS 36
+#define LATENCY_BUCKETS ((LATENCY_MAX_BITS - LATENCY_SUB_BITS + 1) * LATENCY_SUB_COUNT)
+#define LATENCY_CLASSES 5
+
+typedef enum {
+    LATENCY_PARSE = 0,
+    LATENCY_CACHE,
+    LATENCY_OPEN,
+    LATENCY_COMPRESS,
+    LATENCY_TTFB,
+    LATENCY_TOTAL,
+    LATENCY_PHASE_COUNT
+} latency_phase_t;
+
+typedef struct {
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[LATENCY_BUCKETS];
+} latency_hist_t;
+
+/* indexed by phase, cache hit (1) or miss (0), and status class 1xx-5xx */
+typedef struct {
+    latency_hist_t hist[LATENCY_PHASE_COUNT][2][LATENCY_CLASSES];
+} latency_set_t;
+
+extern int latency_enabled;
+
+static inline uint64_t latency_now(void) {
+    if (!latency_enabled) {
+        return 0;
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t latency_since(uint64_t start) {
+    return start ? latency_now() - start : 0;
+}
+
+void latency_init(int enabled, int sample_every);
+const char *latency_phase_name(latency_phase_t phase);
+void latency_record(latency_hist_t *hist, uint64_t value);
+uint64_t latency_quantile(const latency_hist_t *hist, double quantile);
+int latency_sample(void);
+int latency_format_server_timing(const http_response_t *response, char *buf, size_t size);
+void latency_first_byte(http_response_t *response);
+void latency_finish(http_response_t *response);
+
+#endif
@@ -7,6 +7,8 @@
 #include <string.h>
 #include <time.h>
 #include <pthread.h>
+#include <signal.h>
+#include <errno.h>
 #include <sys/time.h>
 
 typedef enum {
@@ -17,11 +19,13 @@ typedef enum {
     LOG_FATAL
 } log_level_t;
 
+/* set from SIGUSR1 handlers; the owning loop reopens files once it sees it */
+extern volatile sig_atomic_t log_reopen_requested;
+
 int log_init(const char *filename);
+int log_reopen(void);
 void log_set_level(log_level_t level);
 void log_message(log_level_t level, const char *format, ...);
-void log_access(const char *client_ip, const char *method, const char *uri, 
-                int status, long response_size);
 
 void log_cleanup(void);
 
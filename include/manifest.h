@@ -0,0 +1,55 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include "log.h"
+#include "http.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+
+#define MANIFEST_DEFAULT_MAX_FILES 65536
+#define MANIFEST_MAX_THREADS 8
+#define MANIFEST_FILES_PER_THREAD 256
+#define MANIFEST_INLINE_MAX (16 * 1024)
+
+/* one servable encoding of a file. head and not_modified are complete
+ * 200 and 304 header blocks up to, not including, the Connection line.
+ * Small bodies are copied inline; larger ones are sent from fd */
+typedef struct manifest_rep {
+    int fd;
+    off_t size;
+    const char *body;
+    const char *head;
+    size_t head_len;
+    const char *not_modified;
+    size_t not_modified_len;
+    char etag[64];
+    size_t etag_len;
+} manifest_rep_t;
+
+typedef struct manifest_entry {
+    const char *path;
+    uint32_t hash;
+    ino_t ino;
+    time_t mtime;
+    long mtime_nsec;
+    char last_modified[32];
+    int compressible;
+    manifest_rep_t *reps[COMPRESSION_TYPE_COUNT];
+} manifest_entry_t;
+
+/* with manifest=on the master indexes every regular file under the
+ * document roots before forking; workers inherit the index copy-on-write
+ * and never modify it. A reload rebuilds it for the next workers */
+int manifest_build(const config_t *config);
+const manifest_entry_t *manifest_lookup(const char *path);
+/* walks the roots again and returns 1 when a file was added, removed or
+ * changed since the index was built; run from the background scan */
+int manifest_changed(const config_t *config);
+void manifest_cleanup(void);
+
+#endif
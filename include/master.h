@@ -8,6 +8,10 @@
 #include "config.h"
 #include "worker.h"
 #include "shutdown.h"
+#include "precompress.h"
+#include "metrics.h"
+#include "vhost.h"
+#include "manifest.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,11 +25,23 @@
 #include <errno.h>
 #include <netinet/tcp.h>
 #include <sched.h>
+#include <poll.h>
 
 
 #define MAX_WORKERS 32
 #define DEFAULT_WORKER_COUNT 4
 
+/* how long a reload waits for a successor to initialise, how often the
+ * master checks on it, and the slack past drain_timeout before a draining
+ * worker is killed */
+#define MASTER_ROLL_TIMEOUT 10
+#define MASTER_ROLL_POLL_MS 50
+#define MASTER_DRAIN_GRACE 5
+
+/* the least time between two manifest rebuilds the background scan
+ * triggers, as each one replaces every worker */
+#define MASTER_MANIFEST_REFRESH_INTERVAL 60
+
 typedef struct {
     int server_fd;
     int port;
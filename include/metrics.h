@@ -0,0 +1,84 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "log.h"
+#include "http.h"
+#include "latency.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define METRICS_MAX_WORKERS 32
+#define METRICS_CACHE_LINE 64
+#define METRICS_STATUS_MIN 100
+#define METRICS_STATUS_COUNT 500
+#define METRICS_RESPONSE_SIZE (1024 * 1024)
+#define METRICS_DEFAULT_PATH "/metrics"
+
+/* one slot per worker in a MAP_SHARED segment created by the master before
+ * forking. The event loop is the only writer of the plain counters, so
+ * they are bumped without atomics; the master reads them racily, which is
+ * fine for aligned 64-bit words. Compression totals are also written by
+ * pool threads and sit on their own cache line as atomics */
+typedef struct {
+    uint64_t requests;
+    uint64_t status[METRICS_STATUS_COUNT];
+    uint64_t bytes_out;
+    uint64_t accepts;
+    uint64_t timeouts;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t manifest_hits;
+    uint64_t cache_evictions;
+    uint64_t file_cache_hits;
+    uint64_t file_cache_misses;
+    uint64_t upstream_failures;
+    uint64_t compress_skipped;
+    uint64_t access_log_dropped;
+    int64_t connections;
+    int64_t compress_offset;
+    int64_t compress_cpu_percent;
+    int64_t compress_lag_ms;
+
+    _Alignas(METRICS_CACHE_LINE) _Atomic uint64_t compress_responses[COMPRESSION_LEVEL_MAX + 1];
+    _Atomic uint64_t compress_bytes_in;
+    _Atomic uint64_t compress_bytes_out;
+    _Atomic uint64_t compress_cpu_ns;
+
+    _Alignas(METRICS_CACHE_LINE) latency_set_t latency;
+} __attribute__((aligned(METRICS_CACHE_LINE))) metrics_worker_t;
+
+/* points at this worker's slot once attached, or at a private dummy so
+ * instrumentation never needs a NULL check */
+extern metrics_worker_t *metrics_worker;
+
+#define METRICS_INC(field) (metrics_worker->field++)
+#define METRICS_ADD(field, n) (metrics_worker->field += (n))
+
+static inline void metrics_count_response(int status) {
+    metrics_worker->requests++;
+    if (status >= METRICS_STATUS_MIN && status < METRICS_STATUS_MIN + METRICS_STATUS_COUNT) {
+        metrics_worker->status[status - METRICS_STATUS_MIN]++;
+    }
+}
+
+int metrics_init(int worker_count);
+void metrics_attach(int worker_id);
+void metrics_release(int worker_id);
+int metrics_listen(int port, const char *path);
+void metrics_poll(int timeout_ms);
+size_t metrics_render(char *buf, size_t size);
+void metrics_cleanup(void);
+
+#endif
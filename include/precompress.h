@@ -0,0 +1,27 @@
+#ifndef PRECOMPRESS_H
+#define PRECOMPRESS_H
+
+#include "log.h"
+#include "config.h"
+#include "http.h"
+#include "encoding.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define PRECOMPRESS_MIN_SIZE 256
+#define PRECOMPRESS_SCAN_INTERVAL 30
+
+int precompress_init(const config_t *config);
+int precompress_scan(void);
+int precompress_sidecar_path(const char *path, compression_type_t type, char *out, size_t out_size);
+int precompress_open(const char *path, const struct stat *src_st, compression_type_t type, struct stat *sidecar_st);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+/* USDT tracepoints under the "nxlite" provider. With <sys/sdt.h> each probe
+ * is a single nop plus an ELF note that bpftrace/perf patch into a trap on
+ * attach, so an untraced server pays only for keeping the arguments live.
+ * Without the header the probes compile to nothing; the arguments are only
+ * named inside sizeof so they are never evaluated.
+ *
+ * Probe                 arguments
+ * accept                fd, open connections
+ * request__parsed       fd, uri, method, parse start ns
+ * cache__hit            path, encoding, cached bytes
+ * cache__miss           path, encoding
+ * file__open            path, fd, size
+ * compress__start       encoding, level, input bytes
+ * compress__end         encoding, level, output bytes, cpu ns
+ * send__blocked         fd, bytes left
+ * send__resumed         fd
+ * response__done        fd, status, request start ns
+ * conn__close           fd, open connections
+ *
+ * Timestamps are CLOCK_MONOTONIC ns and are 0 when latency_histograms is
+ * off; scripts can use their own clock (nsecs in bpftrace) instead */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define NX_PROBE1(name, a) DTRACE_PROBE1(nxlite, name, a)
+#define NX_PROBE2(name, a, b) DTRACE_PROBE2(nxlite, name, a, b)
+#define NX_PROBE3(name, a, b, c) DTRACE_PROBE3(nxlite, name, a, b, c)
+#define NX_PROBE4(name, a, b, c, d) DTRACE_PROBE4(nxlite, name, a, b, c, d)
+#else
+#define NX_PROBE_UNUSED(x) ((void)sizeof(x))
+#define NX_PROBE1(name, a) NX_PROBE_UNUSED(a)
+#define NX_PROBE2(name, a, b) (NX_PROBE_UNUSED(a), NX_PROBE_UNUSED(b))
+#define NX_PROBE3(name, a, b, c) (NX_PROBE_UNUSED(a), NX_PROBE_UNUSED(b), NX_PROBE_UNUSED(c))
+#define NX_PROBE4(name, a, b, c, d) \
+    (NX_PROBE_UNUSED(a), NX_PROBE_UNUSED(b), NX_PROBE_UNUSED(c), NX_PROBE_UNUSED(d))
+#endif
+
+#endif
@@ -0,0 +1,147 @@
+#ifndef PROXY_H
+#define PROXY_H
+
+#include "log.h"
+#include "http.h"
+#include "config.h"
+#include "access_log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#define PROXY_MAX_SERVERS 16
+#define PROXY_MAX_IDLE 64
+#define PROXY_RING_POINTS 160
+#define PROXY_HEAD_SIZE 16384
+#define PROXY_BUFFER_SIZE 65536
+#define PROXY_SPLICE_SIZE 65536
+#define PROXY_PIPE_CACHE 16
+#define PROXY_IDLE_TIMEOUT 60
+
+/* results handed back to the worker; the session is already freed for
+ * everything except PROXY_PENDING */
+#define PROXY_PENDING 0
+#define PROXY_DONE 1
+#define PROXY_CLOSE (-1)
+#define PROXY_BAD_GATEWAY 502
+#define PROXY_GATEWAY_TIMEOUT 504
+
+typedef enum {
+    PROXY_BALANCE_ROUND_ROBIN = 0,
+    PROXY_BALANCE_LEAST_CONN,
+    PROXY_BALANCE_HASH
+} proxy_balance_t;
+
+typedef struct {
+    struct sockaddr_in addr;
+    char name[64];
+    int active;
+    int fails;
+    time_t down_until;
+    int idle[PROXY_MAX_IDLE];
+    time_t idle_since[PROXY_MAX_IDLE];
+    int idle_count;
+} proxy_server_t;
+
+typedef struct {
+    uint32_t hash;
+    int server;
+} proxy_ring_point_t;
+
+typedef struct {
+    char prefix[128];
+    size_t prefix_len;
+    proxy_balance_t balance;
+    proxy_server_t servers[PROXY_MAX_SERVERS];
+    int server_count;
+    unsigned int rr_next;
+    proxy_ring_point_t *ring;
+    int ring_size;
+} proxy_route_t;
+
+typedef enum {
+    PROXY_STATE_CONNECTING = 0,
+    PROXY_STATE_SENDING,
+    PROXY_STATE_READING_HEAD,
+    PROXY_STATE_RELAYING
+} proxy_state_t;
+
+typedef enum {
+    PROXY_BODY_NONE = 0,
+    PROXY_BODY_LENGTH,
+    PROXY_BODY_CHUNKED,
+    PROXY_BODY_UNTIL_CLOSE
+} proxy_body_t;
+
+typedef struct proxy_session {
+    int client_fd;
+    int upstream_fd;
+    proxy_route_t *route;
+    int server;
+    unsigned int tried;
+    int reused;
+    int idempotent;
+    int is_head;
+    int client_keep_alive;
+    int streamed;
+    uint32_t key_hash;
+    proxy_state_t state;
+    time_t last_activity;
+
+    char *request;
+    size_t request_cap;
+    size_t request_len;
+    size_t request_sent;
+    size_t body_remaining;
+
+    char head[PROXY_HEAD_SIZE];
+    size_t head_len;
+    int head_sent;
+    int upstream_keep_alive;
+    int upstream_eof;
+
+    proxy_body_t body;
+    uint64_t body_left;
+    int chunk_state;
+    uint64_t chunk_size;
+
+    char *buf;
+    size_t out_pos;
+    size_t out_len;
+    int pipe_fds[2];
+    size_t pipe_len;
+
+    int status;
+    size_t bytes_sent;
+    access_log_entry_t access;
+
+    struct proxy_session *next;
+} proxy_session_t;
+
+int proxy_init(const config_t *config, int epoll_fd);
+int proxy_enabled(void);
+proxy_route_t *proxy_match(const char *uri);
+proxy_session_t *proxy_start(proxy_route_t *route, int client_fd, const http_request_t *request,
+                             const char *body, size_t body_len, int *status);
+int proxy_run(proxy_session_t *session);
+proxy_session_t *proxy_find_upstream(int fd);
+int proxy_handle_upstream(proxy_session_t *session, uint32_t events);
+int proxy_handle_client(proxy_session_t *session);
+int proxy_check_timeout(proxy_session_t *session, time_t now);
+void proxy_abort(proxy_session_t *session);
+void proxy_cleanup(void);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include "log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#define RESOLVE_DIR_CACHE_SIZE 256
+#define RESOLVE_DEFAULT_VALID 5
+
+/* request paths are resolved against an O_PATH handle on the document
+ * root instead of the absolute path. openat2(RESOLVE_BENEATH) rejects any
+ * component that climbs out of the root or crosses a magic link, failing
+ * with EXDEV or ELOOP; kernels without openat2 fall back to openat with
+ * ".." segments refused lexically. Parent directories are kept open in a
+ * small per-process table so deep trees are walked once per validity
+ * window rather than per request */
+int resolve_open_root(const char *root);
+int resolve_open(int root_fd, const char *rel);
+int resolve_stat(int root_fd, const char *rel, struct stat *st);
+int resolve_fstat(int fd, struct stat *st);
+void resolve_set_valid(int seconds);
+void resolve_cleanup(void);
+
+#endif
@@ -5,4 +5,11 @@
 
 extern volatile sig_atomic_t shutdown_requested;
 
-#endif 
\ No newline at end of file
+/* SIGHUP: the master re-reads the configuration, workers pick up the
+ * settings it published */
+extern volatile sig_atomic_t reload_requested;
+
+/* SIGQUIT to a worker: stop accepting, finish open connections, exit */
+extern volatile sig_atomic_t drain_requested;
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "log.h"
+#include "http.h"
+#include "encoding.h"
+#include "compress_ctl.h"
+#include "file_io.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define STREAM_WINDOW_SIZE 65536
+#define STREAM_CHUNK_HEADER_SIZE 10
+#define STREAM_CHUNK_TRAILER_SIZE 7
+#define STREAM_COMPRESS_THRESHOLD (1024 * 1024)
+
+typedef struct http_stream {
+    int file_fd;
+    off_t file_offset;
+    off_t file_size;
+    encoding_stream_t *encoder;
+    int level;
+    uint64_t bytes_out;
+    uint64_t cpu_ns;
+    size_t in_pos;
+    size_t in_len;
+    size_t out_pos;
+    size_t out_len;
+    int eof;
+    int finished;
+    unsigned char in[STREAM_WINDOW_SIZE];
+    unsigned char out[STREAM_CHUNK_HEADER_SIZE + STREAM_WINDOW_SIZE + STREAM_CHUNK_TRAILER_SIZE];
+} http_stream_t;
+
+http_stream_t *stream_create(int file_fd, off_t file_size, compression_type_t type, int level);
+int stream_send(int client_fd, http_stream_t *stream);
+void stream_destroy(http_stream_t *stream);
+
+#endif
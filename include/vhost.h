@@ -0,0 +1,42 @@
+#ifndef VHOST_H
+#define VHOST_H
+
+#include "log.h"
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#define VHOST_MAX (CONFIG_MAX_VHOSTS + 1)
+#define VHOST_MAX_NAMES 8
+#define VHOST_NAME_MAX 128
+#define VHOST_TABLE_SIZE 1024
+
+/* id 0 is the default server built from root; it answers requests whose
+ * Host matches no vhost line. root_fd is the O_PATH handle files are
+ * resolved beneath, -1 to fall back to absolute paths. cache_quota caps
+ * the response cache bytes the host may hold (0 leaves it to the shared
+ * cap) and compress_level_max caps the adaptive level, 0 disabling
+ * compression */
+typedef struct vhost {
+    int id;
+    char name[VHOST_NAME_MAX];
+    char root_dir[256];
+    size_t root_len;
+    int root_fd;
+    size_t cache_quota;
+    int compress_level_max;
+} vhost_t;
+
+/* parses the vhost lines into the host table. Called by the master
+ * before workers fork, so every worker inherits a ready table */
+int vhost_init(const config_t *config);
+int vhost_validate(const config_t *config);
+const vhost_t *vhost_lookup(const char *host);
+const vhost_t *vhost_get(int id);
+int vhost_count(void);
+void vhost_cleanup(void);
+
+#endif
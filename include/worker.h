@@ -23,14 +23,21 @@
 #include "shutdown.h"
 #include "common.h"
 #include "mempool.h"
+#include "compress.h"
+#include "compress_pool.h"
+#include "compress_ctl.h"
+#include "file_cache.h"
+#include "file_io.h"
+#include "cache.h"
+#include "proxy.h"
+#include "metrics.h"
+#include "access_log.h"
+#include "probes.h"
+#include "capacity.h"
+#include "vhost.h"
 #include "http.h"  
 
-#define BUFFER_SIZE 8192
-#define BUFFER_POOL_SIZE 10000
-#define MAX_CONNECTIONS 100000
-#define CONNECTION_POOL_SIZE 1000
-#define SEND_BUFFER_SIZE 65536
-#define RECV_BUFFER_SIZE 65536
+#define WORKER_DRAIN_IDLE 1
 
 typedef struct {
     int fd;
@@ -39,7 +46,13 @@ typedef struct {
     char *buffer;  
     int keep_alive;  
     int has_pending_response;  
-    http_response_t pending_response;  
+    http_response_t *pending_response;  
+    int waiting_for_body;
+    uint64_t job_id;
+    proxy_session_t *proxy;
+    uint32_t ip;
+    char addr[INET_ADDRSTRLEN];
+    access_log_entry_t *access;
 } client_conn_t;
 
 typedef struct {
@@ -50,21 +63,29 @@ typedef struct {
     int keep_alive_timeout;  
     client_conn_t *clients;  
     int client_count;
+    int client_capacity;
+    capacity_plan_t capacity;
     mempool_t buffer_pool;  
+    mempool_t access_pool;
     int cpu_id;  
-    int *connection_pool;  
-    int pool_size;
-    int pool_count;
+    compress_pool_t *compress_pool;
+    file_io_pool_t *io_pool;
+    uint64_t next_job_id;
+    int draining;
+    time_t drain_deadline;
 } worker_t;
 
-int worker_init(worker_t *worker, int server_fd, int cpu_id);
+int worker_init(worker_t *worker, int server_fd, int worker_id, int cpu_id);
 
 void worker_run(worker_t *worker);
 void worker_cleanup(worker_t *worker);
-void worker_handle_connection(worker_t *worker, int client_fd);
+void worker_handle_connection(worker_t *worker, int client_fd, const struct sockaddr_in *client_addr);
 void worker_handle_client_data(worker_t *worker, int client_fd);
 void worker_handle_client_write(worker_t *worker, int client_fd);
 void worker_handle_timeout(worker_t *worker, int timer_fd);
+void worker_handle_compress_done(worker_t *worker);
+void worker_handle_io_done(worker_t *worker);
+void worker_handle_upstream(worker_t *worker, proxy_session_t *session, uint32_t events);
 int worker_add_client(worker_t *worker, int client_fd);
 void worker_remove_client(worker_t *worker, int client_fd);
 
@@ -0,0 +1,604 @@
+#include "access_log.h"
+#include "metrics.h"
+#include "latency.h"
+#include <limits.h>
+
+int access_log_enabled = 0;
+
+/* single-producer single-consumer byte ring of complete newline-terminated
+ * records. Positions only grow and are masked on use; the event loop
+ * publishes head after copying a record in and the flusher publishes tail
+ * after writing, so neither side takes a lock or makes a syscall on the
+ * other's behalf except the eventfd kick past the high watermark */
+typedef struct {
+    char *data;
+    size_t size;
+    size_t mask;
+    _Alignas(64) _Atomic size_t head;
+    _Alignas(64) _Atomic size_t tail;
+    _Alignas(64) _Atomic int kicked;
+    _Atomic int reopen;
+    _Atomic int stopping;
+    int event_fd;
+    int fd;
+    int flush_ms;
+    access_log_overflow_t overflow;
+    access_log_format_t format;
+    char path[PATH_MAX];
+    pthread_t thread;
+} access_ring_t;
+
+/* binary records cross the ring unencoded, as this header followed by the
+ * column values; the flusher does the dictionary and varint work */
+typedef struct {
+    uint32_t len;
+    uint16_t status;
+    uint16_t field_len[ACCESS_BIN_COLUMNS];
+    uint32_t addr;
+    uint64_t time_us;
+    uint64_t bytes;
+    uint64_t duration_ns;
+} access_raw_t;
+
+#define ACCESS_BIN_RECORD_MAX (32 + ACCESS_BIN_COLUMNS * 3 + ACCESS_LOG_ENTRY_SIZE)
+
+typedef struct {
+    uint32_t hash;
+    uint32_t offset;
+    uint32_t len;
+} dict_entry_t;
+
+/* one column's dictionary for the block being built: entries point at the
+ * literal's first appearance in the payload, slots is an open-addressed
+ * index (entry + 1, 0 for empty) */
+typedef struct {
+    dict_entry_t entries[ACCESS_BIN_DICT_MAX];
+    uint16_t slots[ACCESS_BIN_DICT_MAX * 2];
+    int count;
+} dict_t;
+
+typedef struct {
+    dict_t dicts[ACCESS_BIN_COLUMNS];
+    unsigned char payload[ACCESS_BIN_BLOCK_MAX];
+    size_t payload_len;
+    uint32_t records;
+    uint64_t base_us;
+    char scratch[ACCESS_BIN_RECORD_MAX];
+} block_t;
+
+static access_ring_t ring = {.event_fd = -1, .fd = -1};
+static block_t *block = NULL;
+static time_t stamp_time = 0;
+static char stamp[40];
+
+static int open_log(const char *path) {
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        LOG_ERROR("Failed to open access log %s: %s", path, strerror(errno));
+    }
+    return fd;
+}
+
+static void kick(void) {
+    uint64_t one = 1;
+    if (write(ring.event_fd, &one, sizeof(one)) == -1 && errno != EAGAIN) {
+        LOG_ERROR("Failed to wake access log flusher: %s", strerror(errno));
+    }
+}
+
+static void ring_read(size_t pos, void *out, size_t len) {
+    size_t start = pos & ring.mask;
+    size_t first = ring.size - start;
+    if (len <= first) {
+        memcpy(out, ring.data + start, len);
+    } else {
+        memcpy(out, ring.data + start, first);
+        memcpy((char *)out + first, ring.data, len - first);
+    }
+}
+
+static void write_all(struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = ring.fd == -1 ? -1 : writev(ring.fd, iov, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (ring.fd != -1) {
+                LOG_ERROR("Failed to write access log: %s", strerror(errno));
+            }
+            return;
+        }
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+}
+
+static void emit_block(void) {
+    if (block->records == 0) {
+        return;
+    }
+
+    unsigned char header[ACCESS_BIN_HEADER_SIZE];
+    memcpy(header, ACCESS_BIN_MAGIC, 4);
+    access_bin_put_le(header + 4, ACCESS_BIN_VERSION, 2);
+    access_bin_put_le(header + 6, ACCESS_BIN_HEADER_SIZE, 2);
+    access_bin_put_le(header + 8, block->records, 4);
+    access_bin_put_le(header + 12, block->payload_len, 4);
+    access_bin_put_le(header + 16, block->base_us, 8);
+
+    struct iovec iov[2] = {{header, sizeof(header)}, {block->payload, block->payload_len}};
+    write_all(iov, 2);
+
+    for (int c = 0; c < ACCESS_BIN_COLUMNS; c++) {
+        memset(block->dicts[c].slots, 0, sizeof(block->dicts[c].slots));
+        block->dicts[c].count = 0;
+    }
+    block->payload_len = 0;
+    block->records = 0;
+}
+
+static void encode_column(dict_t *dict, const char *value, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)value[i]) * 16777619u;
+    }
+
+    size_t mask = ACCESS_BIN_DICT_MAX * 2 - 1;
+    size_t slot = hash & mask;
+    while (dict->slots[slot]) {
+        const dict_entry_t *entry = &dict->entries[dict->slots[slot] - 1];
+        if (entry->hash == hash && entry->len == len && memcmp(block->payload + entry->offset, value, len) == 0) {
+            block->payload_len += access_bin_put_varint(block->payload + block->payload_len,
+                                                        (uint64_t)(dict->slots[slot] - 1) * 2);
+            return;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    block->payload_len += access_bin_put_varint(block->payload + block->payload_len, (uint64_t)len * 2 + 1);
+    dict->entries[dict->count] = (dict_entry_t){hash, (uint32_t)block->payload_len, (uint32_t)len};
+    dict->slots[slot] = (uint16_t)++dict->count;
+    memcpy(block->payload + block->payload_len, value, len);
+    block->payload_len += len;
+}
+
+static void encode_record(const access_raw_t *raw, const char *fields) {
+    int full = block->payload_len + ACCESS_BIN_RECORD_MAX > sizeof(block->payload) ||
+               raw->time_us < block->base_us || raw->time_us - block->base_us > UINT32_MAX;
+    for (int c = 0; c < ACCESS_BIN_COLUMNS && !full; c++) {
+        full = block->dicts[c].count >= ACCESS_BIN_DICT_MAX;
+    }
+    if (full) {
+        emit_block();
+    }
+    if (block->records == 0) {
+        block->base_us = raw->time_us;
+    }
+
+    unsigned char *out = block->payload + block->payload_len;
+    access_bin_put_le(out, raw->time_us - block->base_us, 4);
+    memcpy(out + 4, &raw->addr, 4);
+    access_bin_put_le(out + 8, raw->status, 2);
+    size_t len = 10;
+    len += access_bin_put_varint(out + len, raw->bytes);
+    len += access_bin_put_varint(out + len, raw->duration_ns ? raw->duration_ns / 1000 + 1 : 0);
+    block->payload_len += len;
+
+    for (int c = 0; c < ACCESS_BIN_COLUMNS; c++) {
+        encode_column(&block->dicts[c], fields, raw->field_len[c]);
+        fields += raw->field_len[c];
+    }
+    block->records++;
+
+    if (block->payload_len >= ACCESS_BIN_BLOCK_TARGET) {
+        emit_block();
+    }
+}
+
+/* encodes everything published so far and closes the block, so a block
+ * never outlives one flush interval */
+static void flush_binary(void) {
+    size_t tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring.head, memory_order_acquire);
+
+    while (tail != head) {
+        access_raw_t raw;
+        ring_read(tail, &raw, sizeof(raw));
+        ring_read(tail + sizeof(raw), block->scratch, raw.len - sizeof(raw));
+        tail += raw.len;
+        atomic_store_explicit(&ring.tail, tail, memory_order_release);
+        encode_record(&raw, block->scratch);
+    }
+
+    emit_block();
+}
+
+/* writes everything published so far; a failing file loses the batch
+ * rather than wedging the producer */
+static void flush_ring(void) {
+    if (ring.format == ACCESS_LOG_BINARY) {
+        flush_binary();
+        return;
+    }
+
+    size_t tail = atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring.head, memory_order_acquire);
+
+    while (tail != head) {
+        size_t start = tail & ring.mask;
+        size_t len = head - tail;
+        size_t first = ring.size - start;
+        struct iovec iov[2] = {{ring.data + start, len < first ? len : first}, {ring.data, 0}};
+        int count = 1;
+        if (len > first) {
+            iov[1].iov_len = len - first;
+            count = 2;
+        }
+
+        ssize_t written = ring.fd == -1 ? -1 : writev(ring.fd, iov, count);
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (ring.fd != -1) {
+                LOG_ERROR("Failed to write access log: %s", strerror(errno));
+            }
+            written = len;
+        }
+
+        tail += written;
+        atomic_store_explicit(&ring.tail, tail, memory_order_release);
+    }
+}
+
+static void *flusher_thread(void *arg) {
+    (void)arg;
+    struct pollfd pfd = {ring.event_fd, POLLIN, 0};
+
+    for (;;) {
+        int stopping = atomic_load(&ring.stopping);
+        if (!stopping && poll(&pfd, 1, ring.flush_ms) == -1 && errno != EINTR) {
+            LOG_ERROR("Access log flusher poll failed: %s", strerror(errno));
+        }
+
+        uint64_t count;
+        if (read(ring.event_fd, &count, sizeof(count)) == -1 && errno != EAGAIN && errno != EINTR) {
+            LOG_ERROR("Failed to read access log eventfd: %s", strerror(errno));
+        }
+        atomic_store(&ring.kicked, 0);
+
+        if (atomic_exchange(&ring.reopen, 0)) {
+            flush_ring();
+            int fd = open_log(ring.path);
+            if (fd != -1) {
+                if (ring.fd != -1) {
+                    close(ring.fd);
+                }
+                ring.fd = fd;
+            }
+        }
+
+        flush_ring();
+        if (stopping) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static void release_ring(void) {
+    if (ring.fd != -1) {
+        close(ring.fd);
+    }
+    if (ring.event_fd != -1) {
+        close(ring.event_fd);
+    }
+    ring.fd = ring.event_fd = -1;
+    free(ring.data);
+    ring.data = NULL;
+    free(block);
+    block = NULL;
+}
+
+int access_log_init(const config_t *config, int worker_id) {
+    if (!config->access_log[0]) {
+        return 0;
+    }
+
+    size_t size = ACCESS_LOG_MIN_BUFFER;
+    while (size < (size_t)config->access_log_buffer && size < ((size_t)1 << 30)) {
+        size <<= 1;
+    }
+
+    if (config->access_log_per_worker) {
+        snprintf(ring.path, sizeof(ring.path), "%s.%d", config->access_log, worker_id);
+    } else {
+        snprintf(ring.path, sizeof(ring.path), "%s", config->access_log);
+    }
+
+    ring.size = size;
+    ring.mask = size - 1;
+    ring.flush_ms = config->access_log_flush_ms > 0 ? config->access_log_flush_ms : ACCESS_LOG_DEFAULT_FLUSH_MS;
+    ring.overflow = config->access_log_overflow;
+    ring.format = config->access_log_format;
+    ring.data = malloc(size);
+    if (ring.format == ACCESS_LOG_BINARY) {
+        block = calloc(1, sizeof(block_t));
+    }
+    if (!ring.data || (ring.format == ACCESS_LOG_BINARY && !block)) {
+        LOG_ERROR("Failed to allocate %zu byte access log buffer", size);
+        release_ring();
+        return -1;
+    }
+    atomic_store(&ring.head, 0);
+    atomic_store(&ring.tail, 0);
+    atomic_store(&ring.kicked, 0);
+    atomic_store(&ring.reopen, 0);
+    atomic_store(&ring.stopping, 0);
+
+    ring.event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ring.event_fd == -1) {
+        LOG_ERROR("Failed to create access log eventfd: %s", strerror(errno));
+        release_ring();
+        return -1;
+    }
+
+    ring.fd = open_log(ring.path);
+    if (ring.fd == -1) {
+        release_ring();
+        return -1;
+    }
+
+    /* signals stay with the event loop, which forwards reopen requests */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    int err = pthread_create(&ring.thread, NULL, flusher_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        LOG_ERROR("Failed to start access log flusher: %s", strerror(err));
+        release_ring();
+        return -1;
+    }
+
+    access_log_enabled = 1;
+    LOG_INFO("Access log %s: %s, %zu byte buffer, flush every %dms, %s when full", ring.path,
+             ring.format == ACCESS_LOG_BINARY ? "binary" : "text", size, ring.flush_ms,
+             ring.overflow == ACCESS_LOG_BLOCK ? "block" : "drop");
+    return 0;
+}
+
+/* copies value until out reaches limit, escaping quotes, backslashes and
+ * non-printable bytes as \xHH so a request cannot forge log lines */
+static size_t append_escaped(char *out, size_t pos, size_t limit, const char *value, size_t max) {
+    static const char hex[] = "0123456789ABCDEF";
+
+    for (size_t i = 0; value[i] && i < max && pos + 4 <= limit; i++) {
+        unsigned char c = (unsigned char)value[i];
+        if (c == '"' || c == '\\' || c < 0x20 || c >= 0x7f) {
+            out[pos++] = '\\';
+            out[pos++] = 'x';
+            out[pos++] = hex[c >> 4];
+            out[pos++] = hex[c & 0xf];
+        } else {
+            out[pos++] = (char)c;
+        }
+    }
+    return pos;
+}
+
+static size_t append_raw(char *out, size_t pos, size_t limit, const char *value) {
+    size_t len = strlen(value);
+    if (len > limit - pos) {
+        len = limit - pos;
+    }
+    memcpy(out + pos, value, len);
+    return pos + len;
+}
+
+/* binary entries keep the raw values; escaping and formatting are left to
+ * the offline decoder */
+static void begin_binary(access_log_entry_t *entry, uint32_t addr, const http_request_t *request,
+                         const char *referer, const char *agent) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    entry->time_us = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    entry->addr = addr;
+
+    const char *values[ACCESS_BIN_COLUMNS] = {
+        [ACCESS_BIN_METHOD] = request->method,
+        [ACCESS_BIN_URI] = request->uri,
+        [ACCESS_BIN_PROTOCOL] = request->version,
+        [ACCESS_BIN_REFERER] = referer,
+        [ACCESS_BIN_AGENT] = agent,
+    };
+    const size_t limits[ACCESS_BIN_COLUMNS] = {
+        [ACCESS_BIN_METHOD] = sizeof(request->method),
+        [ACCESS_BIN_URI] = ACCESS_LOG_URI_MAX,
+        [ACCESS_BIN_PROTOCOL] = sizeof(request->version),
+        [ACCESS_BIN_REFERER] = ACCESS_LOG_FIELD_MAX,
+        [ACCESS_BIN_AGENT] = ACCESS_LOG_FIELD_MAX,
+    };
+
+    size_t pos = 0;
+    for (int c = 0; c < ACCESS_BIN_COLUMNS; c++) {
+        size_t len = strnlen(values[c], limits[c]);
+        memcpy(entry->text + pos, values[c], len);
+        entry->field_len[c] = (uint16_t)len;
+        pos += len;
+    }
+    entry->len = (uint16_t)pos;
+}
+
+void access_log_begin(access_log_entry_t *entry, const char *addr_text, uint32_t addr,
+                      const http_request_t *request, uint64_t start) {
+    if (!access_log_enabled || !entry) {
+        return;
+    }
+
+    const char *referer = NULL;
+    const char *agent = NULL;
+    for (int i = 0; i < request->header_count; i++) {
+        if (strcasecmp(request->headers[i][0], "Referer") == 0) {
+            referer = request->headers[i][1];
+        } else if (strcasecmp(request->headers[i][0], "User-Agent") == 0) {
+            agent = request->headers[i][1];
+        }
+    }
+
+    entry->start = start;
+    if (ring.format == ACCESS_LOG_BINARY) {
+        begin_binary(entry, addr, request, referer ? referer : "", agent ? agent : "");
+        return;
+    }
+
+    time_t now = time(NULL);
+    if (now != stamp_time) {
+        struct tm tm;
+        localtime_r(&now, &tm);
+        strftime(stamp, sizeof(stamp), "%d/%b/%Y:%H:%M:%S %z", &tm);
+        stamp_time = now;
+    }
+
+    /* the request half may use whatever the two quoted fields cannot */
+    char *out = entry->text;
+    size_t limit = sizeof(entry->text) - 2 * (ACCESS_LOG_FIELD_MAX + 3) - 1;
+    size_t pos = 0;
+
+    pos = append_raw(out, pos, limit, addr_text && addr_text[0] ? addr_text : "-");
+    pos = append_raw(out, pos, limit, " - - [");
+    pos = append_raw(out, pos, limit, stamp);
+    pos = append_raw(out, pos, limit, "] \"");
+    pos = append_escaped(out, pos, limit - 1, request->method, sizeof(request->method));
+    pos = append_raw(out, pos, limit - 1, " ");
+    pos = append_escaped(out, pos, limit - 1, request->uri, sizeof(request->uri));
+    pos = append_raw(out, pos, limit - 1, " ");
+    pos = append_escaped(out, pos, limit - 1, request->version, sizeof(request->version));
+    out[pos++] = '"';
+    entry->request_len = (uint16_t)pos;
+
+    pos = append_raw(out, pos, sizeof(entry->text), " \"");
+    pos = append_escaped(out, pos, pos + ACCESS_LOG_FIELD_MAX, referer ? referer : "-", MAX_HEADER_SIZE);
+    pos = append_raw(out, pos, sizeof(entry->text), "\" \"");
+    pos = append_escaped(out, pos, pos + ACCESS_LOG_FIELD_MAX, agent ? agent : "-", MAX_HEADER_SIZE);
+    pos = append_raw(out, pos, sizeof(entry->text), "\"");
+    entry->len = (uint16_t)pos;
+}
+
+static void ring_copy(size_t pos, const void *data, size_t len) {
+    size_t start = pos & ring.mask;
+    size_t first = ring.size - start;
+    if (len <= first) {
+        memcpy(ring.data + start, data, len);
+    } else {
+        memcpy(ring.data + start, data, first);
+        memcpy(ring.data, (const char *)data + first, len - first);
+    }
+}
+
+/* waits for or gives up on ring space according to the overflow policy;
+ * returns the write position, or -1 when the record is dropped */
+static ssize_t ring_reserve(size_t total) {
+    size_t head = atomic_load_explicit(&ring.head, memory_order_relaxed);
+    while (ring.size - (head - atomic_load_explicit(&ring.tail, memory_order_acquire)) < total) {
+        if (!atomic_exchange(&ring.kicked, 1)) {
+            kick();
+        }
+        if (ring.overflow == ACCESS_LOG_DROP) {
+            METRICS_INC(access_log_dropped);
+            return -1;
+        }
+        sched_yield();
+    }
+    return (ssize_t)head;
+}
+
+static void ring_publish(size_t head, size_t total) {
+    atomic_store_explicit(&ring.head, head + total, memory_order_release);
+    size_t used = head + total - atomic_load_explicit(&ring.tail, memory_order_relaxed);
+    if (used >= ring.size / 2 && !atomic_exchange(&ring.kicked, 1)) {
+        kick();
+    }
+}
+
+static void finish_binary(const access_log_entry_t *entry, int status, size_t bytes) {
+    access_raw_t raw = {
+        .len = sizeof(raw) + entry->len,
+        .status = (uint16_t)status,
+        .addr = entry->addr,
+        .time_us = entry->time_us,
+        .bytes = bytes,
+        .duration_ns = latency_since(entry->start),
+    };
+    memcpy(raw.field_len, entry->field_len, sizeof(raw.field_len));
+
+    ssize_t head = ring_reserve(raw.len);
+    if (head < 0) {
+        return;
+    }
+    ring_copy(head, &raw, sizeof(raw));
+    ring_copy(head + sizeof(raw), entry->text, entry->len);
+    ring_publish(head, raw.len);
+}
+
+void access_log_finish(access_log_entry_t *entry, int status, size_t bytes) {
+    if (!access_log_enabled || !entry || entry->len == 0) {
+        return;
+    }
+    if (ring.format == ACCESS_LOG_BINARY) {
+        finish_binary(entry, status, bytes);
+        entry->len = 0;
+        return;
+    }
+
+    char status_part[48];
+    int status_len = snprintf(status_part, sizeof(status_part), " %d %zu", status, bytes);
+    char time_part[32];
+    uint64_t elapsed = latency_since(entry->start);
+    int time_len = elapsed ? snprintf(time_part, sizeof(time_part), " %.6f\n", elapsed / 1e9)
+                           : snprintf(time_part, sizeof(time_part), " -\n");
+
+    size_t tail_len = entry->len - entry->request_len;
+    size_t total = entry->len + status_len + time_len;
+    ssize_t head = ring_reserve(total);
+    if (head >= 0) {
+        ring_copy(head, entry->text, entry->request_len);
+        ring_copy(head + entry->request_len, status_part, status_len);
+        ring_copy(head + entry->request_len + status_len, entry->text + entry->request_len, tail_len);
+        ring_copy(head + entry->len + status_len, time_part, time_len);
+        ring_publish(head, total);
+    }
+    entry->len = 0;
+}
+
+void access_log_reopen(void) {
+    if (!access_log_enabled) {
+        return;
+    }
+    atomic_store(&ring.reopen, 1);
+    if (!atomic_exchange(&ring.kicked, 1)) {
+        kick();
+    }
+}
+
+void access_log_cleanup(void) {
+    if (!access_log_enabled) {
+        return;
+    }
+
+    atomic_store(&ring.stopping, 1);
+    kick();
+    pthread_join(ring.thread, NULL);
+
+    release_ring();
+    access_log_enabled = 0;
+}
@@ -0,0 +1,274 @@
+#include "cache.h"
+#include "metrics.h"
+
+static cache_entry_t *response_cache = NULL;
+static cache_entry_t *cache_buckets[CACHE_BUCKETS];
+static int cache_entries = 0;
+static int cache_index = 0;
+static size_t cache_bytes = 0;
+static size_t cache_max_bytes = 0;
+static size_t partition_bytes[CACHE_PARTITIONS];
+static size_t partition_quota[CACHE_PARTITIONS];
+static size_t zerocopy_min_size = CACHE_DEFAULT_ZEROCOPY_MIN;
+
+static uint32_t hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static cache_entry_t *find_entry(const char *path, uint32_t hash) {
+    for (cache_entry_t *entry = cache_buckets[hash & (CACHE_BUCKETS - 1)]; entry; entry = entry->next) {
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int cache_init(int entries, size_t max_bytes) {
+    cache_cleanup();
+
+    /* calloc leaves the pages untouched until an entry lands on them */
+    response_cache = calloc(entries > 0 ? entries : CACHE_DEFAULT_ENTRIES, sizeof(cache_entry_t));
+    if (!response_cache) {
+        LOG_ERROR("Failed to allocate response cache table");
+        return -1;
+    }
+
+    cache_entries = entries > 0 ? entries : CACHE_DEFAULT_ENTRIES;
+    cache_max_bytes = max_bytes;
+    return 0;
+}
+
+void cache_set_quota(int partition, size_t max_bytes) {
+    if (partition >= 0 && partition < CACHE_PARTITIONS) {
+        partition_quota[partition] = max_bytes;
+    }
+}
+
+void cache_set_zerocopy_threshold(size_t min_size) {
+    zerocopy_min_size = min_size;
+}
+
+void cache_variant_ref(cache_variant_t *variant) {
+    if (variant) {
+        variant->refs++;
+    }
+}
+
+void cache_variant_release(cache_variant_t *variant) {
+    if (!variant || --variant->refs > 0) {
+        return;
+    }
+
+    if (variant->fd != -1) {
+        munmap(variant->response, variant->response_len);
+        close(variant->fd);
+    } else {
+        free(variant->response);
+    }
+    free(variant);
+}
+
+static int write_all(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/* copies the response into a sealed memfd and maps it back read-only;
+ * returns -1 and leaves the variant untouched when any step fails */
+static int store_memfd(cache_variant_t *variant, const char *header, size_t header_len,
+                       const void *body, size_t body_len) {
+    int fd = memfd_create("nxlite-cache", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        return -1;
+    }
+
+    size_t len = header_len + body_len;
+    if (write_all(fd, header, header_len) != 0 || write_all(fd, body, body_len) != 0 ||
+        fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    variant->response = map;
+    variant->fd = fd;
+    return 0;
+}
+
+static void drop_variant(cache_entry_t *entry, int encoding) {
+    cache_variant_t *variant = entry->variants[encoding];
+    if (variant) {
+        cache_bytes -= variant->response_len;
+        partition_bytes[entry->partition] -= variant->response_len;
+        cache_variant_release(variant);
+        entry->variants[encoding] = NULL;
+    }
+}
+
+static void release_entry(cache_entry_t *entry) {
+    if (entry->path[0] == '\0') {
+        return;
+    }
+
+    cache_entry_t **link = &cache_buckets[entry->hash & (CACHE_BUCKETS - 1)];
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = entry->next;
+    }
+
+    for (int i = 0; i < COMPRESSION_TYPE_COUNT; i++) {
+        drop_variant(entry, i);
+    }
+
+    memset(entry, 0, sizeof(*entry));
+}
+
+/* frees the oldest entries, starting at the slot the next new path will
+ * take, until len more bytes fit under the partition quota and the cap */
+static void make_room(int partition, size_t len) {
+    size_t quota = partition_quota[partition];
+    for (int i = 0; quota > 0 && i < cache_entries && partition_bytes[partition] + len > quota; i++) {
+        cache_entry_t *entry = &response_cache[(cache_index + i) % cache_entries];
+        if (entry->path[0] != '\0' && entry->partition == partition) {
+            METRICS_INC(cache_evictions);
+            release_entry(entry);
+        }
+    }
+    for (int i = 0; i < cache_entries && cache_bytes + len > cache_max_bytes; i++) {
+        cache_entry_t *entry = &response_cache[(cache_index + i) % cache_entries];
+        if (entry->path[0] != '\0') {
+            METRICS_INC(cache_evictions);
+            release_entry(entry);
+        }
+    }
+}
+
+void cache_cleanup(void) {
+    if (!response_cache) {
+        return;
+    }
+
+    for (int i = 0; i < cache_entries; i++) {
+        release_entry(&response_cache[i]);
+    }
+    free(response_cache);
+    response_cache = NULL;
+    cache_entries = 0;
+    cache_index = 0;
+    cache_bytes = 0;
+    memset(partition_bytes, 0, sizeof(partition_bytes));
+}
+
+cache_variant_t *cache_lookup(const char *path, compression_type_t encoding) {
+    if ((unsigned)encoding >= COMPRESSION_TYPE_COUNT) {
+        return NULL;
+    }
+
+    cache_entry_t *entry = find_entry(path, hash_path(path));
+    if (entry) {
+        cache_variant_t *variant = entry->variants[encoding];
+        if (variant && time(NULL) - variant->timestamp < CACHE_TIMEOUT) {
+            LOG_DEBUG("Cache hit for %s (encoding %d)", path, encoding);
+            return variant;
+        }
+    }
+
+    LOG_DEBUG("Cache miss for %s (encoding %d)", path, encoding);
+    return NULL;
+}
+
+int cache_store(const char *path, int partition, compression_type_t encoding,
+                const char *header, size_t header_len, const void *body, size_t body_len) {
+    if ((unsigned)encoding >= COMPRESSION_TYPE_COUNT || (unsigned)partition >= CACHE_PARTITIONS ||
+        strlen(path) >= PATH_MAX) {
+        return -1;
+    }
+    if (!response_cache && cache_init(CACHE_DEFAULT_ENTRIES, CACHE_DEFAULT_MAX_BYTES) != 0) {
+        return -1;
+    }
+    if (header_len + body_len > cache_max_bytes ||
+        (partition_quota[partition] > 0 && header_len + body_len > partition_quota[partition])) {
+        return -1;
+    }
+    make_room(partition, header_len + body_len);
+
+    cache_variant_t *variant = malloc(sizeof(cache_variant_t));
+    if (!variant) {
+        LOG_ERROR("Failed to allocate memory for cached response");
+        return -1;
+    }
+    variant->response_len = header_len + body_len;
+    variant->header_len = header_len;
+    variant->timestamp = time(NULL);
+    variant->fd = -1;
+    variant->refs = 1;
+
+    if (zerocopy_min_size == 0 || body_len < zerocopy_min_size ||
+        store_memfd(variant, header, header_len, body, body_len) != 0) {
+        variant->response = malloc(header_len + body_len);
+        if (!variant->response) {
+            LOG_ERROR("Failed to allocate memory for cached response");
+            free(variant);
+            return -1;
+        }
+        memcpy(variant->response, header, header_len);
+        memcpy(variant->response + header_len, body, body_len);
+    }
+
+    uint32_t hash = hash_path(path);
+    cache_entry_t *entry = find_entry(path, hash);
+    if (!entry) {
+        entry = &response_cache[cache_index];
+        if (entry->path[0] != '\0') {
+            METRICS_INC(cache_evictions);
+        }
+        release_entry(entry);
+        cache_index = (cache_index + 1) % cache_entries;
+
+        strcpy(entry->path, path);
+        entry->hash = hash;
+        entry->partition = partition;
+        entry->next = cache_buckets[hash & (CACHE_BUCKETS - 1)];
+        cache_buckets[hash & (CACHE_BUCKETS - 1)] = entry;
+    }
+
+    drop_variant(entry, encoding);
+    entry->variants[encoding] = variant;
+    cache_bytes += variant->response_len;
+    partition_bytes[entry->partition] += variant->response_len;
+
+    LOG_DEBUG("Cached response for %s (encoding %d, %zu bytes%s)", path, encoding, variant->response_len,
+              variant->fd != -1 ? ", memfd" : "");
+    return 0;
+}
+
+void cache_invalidate(const char *path) {
+    cache_entry_t *entry = find_entry(path, hash_path(path));
+    if (entry) {
+        release_entry(entry);
+    }
+}
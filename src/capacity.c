@@ -0,0 +1,82 @@
+#include "capacity.h"
+#include "worker.h"
+#include "cache.h"
+#include "file_cache.h"
+
+static double megabytes(size_t bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+int capacity_plan(const config_t *config, capacity_plan_t *plan) {
+    memset(plan, 0, sizeof(*plan));
+    plan->budget = config->worker_memory > 0 ? config->worker_memory : CAPACITY_DEFAULT_BUDGET;
+    plan->buffer_size = config->request_buffer_size > 0 ? (size_t)config->request_buffer_size : BUFFER_SIZE;
+    plan->growth_step = CAPACITY_GROWTH_STEP;
+
+    /* a client slot, its request buffer and pool header, plus a share of
+     * the heap copy a response takes when its send blocks, and the pooled
+     * access log entry when logging is on */
+    size_t slot_bytes = sizeof(client_conn_t) + plan->buffer_size + sizeof(mem_block_t);
+    if (config->access_log[0]) {
+        slot_bytes += sizeof(access_log_entry_t) + sizeof(mem_block_t);
+    }
+    plan->connection_bytes = slot_bytes + sizeof(http_response_t) / CAPACITY_PENDING_SHARE;
+
+    plan->cache_bytes = config->response_cache_size > 0 ? config->response_cache_size
+                                                        : plan->budget / CAPACITY_CACHE_SHARE;
+    if (config->response_cache_entries > 0) {
+        plan->cache_entries = config->response_cache_entries;
+    } else {
+        size_t entries = plan->cache_bytes / (sizeof(cache_entry_t) + CAPACITY_CACHE_ENTRY_ESTIMATE);
+        plan->cache_entries = entries < CAPACITY_MIN_CACHE_ENTRIES ? CAPACITY_MIN_CACHE_ENTRIES :
+                              entries > CAPACITY_MAX_CACHE_ENTRIES ? CAPACITY_MAX_CACHE_ENTRIES : (int)entries;
+    }
+    size_t table_bytes = (size_t)plan->cache_entries * sizeof(cache_entry_t);
+    plan->cache_body_bytes = plan->cache_bytes > table_bytes ? plan->cache_bytes - table_bytes : 0;
+
+    plan->fixed_bytes = CAPACITY_MAX_EVENTS * sizeof(struct epoll_event);
+    if (config->open_file_cache_max > 0) {
+        plan->fixed_bytes += (size_t)config->open_file_cache_max * sizeof(file_cache_entry_t);
+    }
+    if (config->access_log[0] && config->access_log_buffer > 0) {
+        plan->fixed_bytes += config->access_log_buffer;
+    }
+
+    size_t reserved = plan->cache_bytes + plan->fixed_bytes;
+    size_t derived = plan->budget > reserved ? (plan->budget - reserved) / plan->connection_bytes : 0;
+    plan->derived_connections = derived > INT_MAX ? INT_MAX : (int)derived;
+    plan->max_connections = config->max_connections > 0 ? config->max_connections : plan->derived_connections;
+    if (config->max_connections > 0 && config->max_connections < CAPACITY_MIN_CONNECTIONS) {
+        LOG_ERROR("max_connections %d is below the minimum of %d", config->max_connections,
+                  CAPACITY_MIN_CONNECTIONS);
+        return -1;
+    }
+    if (plan->max_connections < CAPACITY_MIN_CONNECTIONS) {
+        LOG_ERROR("worker_memory of %.0f MB leaves room for %d connections per worker, need at least %d",
+                  megabytes(plan->budget), plan->max_connections, CAPACITY_MIN_CONNECTIONS);
+        return -1;
+    }
+
+    plan->max_events = plan->max_connections < CAPACITY_MAX_EVENTS ? plan->max_connections : CAPACITY_MAX_EVENTS;
+    if (plan->growth_step > plan->max_connections) {
+        plan->growth_step = plan->max_connections;
+    }
+    plan->initial_bytes = (size_t)plan->growth_step * slot_bytes +
+                          plan->max_events * sizeof(struct epoll_event);
+    plan->peak_bytes = reserved + (size_t)plan->max_connections * plan->connection_bytes;
+    return 0;
+}
+
+void capacity_report(const capacity_plan_t *plan, int worker_count) {
+    LOG_INFO("Worker memory budget %.0f MB: %d connections at %.1f KB, response cache %.1f MB "
+             "(%d entries), %.1f MB fixed, %d events per wait",
+             megabytes(plan->budget), plan->max_connections, plan->connection_bytes / 1024.0,
+             megabytes(plan->cache_bytes), plan->cache_entries, megabytes(plan->fixed_bytes), plan->max_events);
+    LOG_INFO("Planned footprint: %.1f MB per worker at startup, growing to %.0f MB; %.0f MB across %d workers",
+             megabytes(plan->initial_bytes), megabytes(plan->peak_bytes),
+             megabytes(plan->peak_bytes) * worker_count, worker_count);
+    if (plan->max_connections > plan->derived_connections) {
+        LOG_WARN("max_connections %d exceeds the %d that fit in worker_memory; a full worker may use %.0f MB",
+                 plan->max_connections, plan->derived_connections, megabytes(plan->peak_bytes));
+    }
+}
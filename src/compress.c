@@ -0,0 +1,332 @@
+#include "compress.h"
+
+static __thread z_stream zlib_contexts[2];
+static __thread int zlib_levels[2];
+static __thread int zlib_dirty[2];
+
+static __thread unsigned char *scratch = NULL;
+static __thread size_t scratch_size = 0;
+
+#ifdef HAVE_LIBDEFLATE
+#define LIBDEFLATE_LEVEL_MAX 12
+static __thread struct libdeflate_compressor *libdeflate_compressors[LIBDEFLATE_LEVEL_MAX + 1];
+#endif
+
+#ifdef HAVE_ZSTD
+static __thread ZSTD_CCtx *zstd_context = NULL;
+#endif
+
+static const compress_backend_t *deflate_backend = NULL;
+
+static int zlib_supports(compression_type_t type) {
+    return type == COMPRESSION_GZIP || type == COMPRESSION_DEFLATE;
+}
+
+static z_stream *zlib_context(compression_type_t type, int level) {
+    int slot = (type == COMPRESSION_GZIP) ? 0 : 1;
+    z_stream *strm = &zlib_contexts[slot];
+
+    if (zlib_levels[slot] != 0 && zlib_levels[slot] != level) {
+        deflateEnd(strm);
+        zlib_levels[slot] = 0;
+    }
+
+    if (zlib_levels[slot] == 0) {
+        memset(strm, 0, sizeof(*strm));
+        int window_bits = (type == COMPRESSION_GZIP) ? (15 + 16) : 15;
+        if (deflateInit2(strm, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            LOG_ERROR("Failed to initialize zlib compression");
+            return NULL;
+        }
+        zlib_levels[slot] = level;
+        zlib_dirty[slot] = 0;
+    } else if (zlib_dirty[slot]) {
+        if (deflateReset(strm) != Z_OK) {
+            deflateEnd(strm);
+            zlib_levels[slot] = 0;
+            return NULL;
+        }
+        zlib_dirty[slot] = 0;
+    }
+
+    return strm;
+}
+
+static size_t zlib_bound(compression_type_t type, int level, size_t in_len) {
+    z_stream *strm = zlib_context(type, encoding_codec_level(type, level));
+    return strm ? deflateBound(strm, in_len) : 0;
+}
+
+static int zlib_compress(compression_type_t type, int level, const void *in, size_t in_len,
+                         void *out, size_t out_cap, size_t *out_len) {
+    z_stream *strm = zlib_context(type, encoding_codec_level(type, level));
+    if (!strm) {
+        return -1;
+    }
+
+    strm->next_in = (Bytef *)in;
+    strm->avail_in = in_len;
+    strm->next_out = out;
+    strm->avail_out = out_cap;
+
+    int ret = deflate(strm, Z_FINISH);
+    zlib_dirty[type == COMPRESSION_GZIP ? 0 : 1] = 1;
+
+    if (ret != Z_STREAM_END) {
+        LOG_ERROR("zlib compression did not complete (%d)", ret);
+        return -1;
+    }
+
+    *out_len = strm->total_out;
+    return 0;
+}
+
+static void zlib_release(void) {
+    for (int i = 0; i < 2; i++) {
+        if (zlib_levels[i] != 0) {
+            deflateEnd(&zlib_contexts[i]);
+            zlib_levels[i] = 0;
+        }
+    }
+}
+
+#ifdef HAVE_LIBDEFLATE
+static struct libdeflate_compressor *libdeflate_compressor(int level) {
+    int mapped = (level >= COMPRESSION_LEVEL_MAX) ? LIBDEFLATE_LEVEL_MAX : level;
+    if (mapped < 1) {
+        mapped = COMPRESSION_LEVEL_DEFAULT;
+    }
+
+    if (!libdeflate_compressors[mapped]) {
+        libdeflate_compressors[mapped] = libdeflate_alloc_compressor(mapped);
+        if (!libdeflate_compressors[mapped]) {
+            LOG_ERROR("Failed to allocate libdeflate compressor for level %d", mapped);
+        }
+    }
+
+    return libdeflate_compressors[mapped];
+}
+
+static size_t libdeflate_bound(compression_type_t type, int level, size_t in_len) {
+    struct libdeflate_compressor *compressor = libdeflate_compressor(level);
+    if (!compressor) {
+        return 0;
+    }
+    return type == COMPRESSION_GZIP ? libdeflate_gzip_compress_bound(compressor, in_len)
+                                    : libdeflate_zlib_compress_bound(compressor, in_len);
+}
+
+static int libdeflate_compress(compression_type_t type, int level, const void *in, size_t in_len,
+                               void *out, size_t out_cap, size_t *out_len) {
+    struct libdeflate_compressor *compressor = libdeflate_compressor(level);
+    if (!compressor) {
+        return -1;
+    }
+
+    size_t size = type == COMPRESSION_GZIP ? libdeflate_gzip_compress(compressor, in, in_len, out, out_cap)
+                                           : libdeflate_zlib_compress(compressor, in, in_len, out, out_cap);
+    if (size == 0) {
+        LOG_ERROR("libdeflate compression did not fit in %zu bytes", out_cap);
+        return -1;
+    }
+
+    *out_len = size;
+    return 0;
+}
+
+static void libdeflate_release(void) {
+    for (int i = 0; i <= LIBDEFLATE_LEVEL_MAX; i++) {
+        if (libdeflate_compressors[i]) {
+            libdeflate_free_compressor(libdeflate_compressors[i]);
+            libdeflate_compressors[i] = NULL;
+        }
+    }
+}
+#endif
+
+#ifdef HAVE_BROTLI
+static int brotli_supports(compression_type_t type) {
+    return type == COMPRESSION_BROTLI;
+}
+
+static size_t brotli_bound(compression_type_t type, int level, size_t in_len) {
+    (void)type;
+    (void)level;
+    return BrotliEncoderMaxCompressedSize(in_len);
+}
+
+static int brotli_compress(compression_type_t type, int level, const void *in, size_t in_len,
+                           void *out, size_t out_cap, size_t *out_len) {
+    size_t size = out_cap;
+    if (!BrotliEncoderCompress(encoding_codec_level(type, level), BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC,
+                               in_len, (const uint8_t *)in, &size, (uint8_t *)out)) {
+        LOG_ERROR("Brotli compression failed");
+        return -1;
+    }
+
+    *out_len = size;
+    return 0;
+}
+
+static void brotli_release(void) {
+}
+#endif
+
+#ifdef HAVE_ZSTD
+static int zstd_supports(compression_type_t type) {
+    return type == COMPRESSION_ZSTD;
+}
+
+static size_t zstd_bound(compression_type_t type, int level, size_t in_len) {
+    (void)type;
+    (void)level;
+    return ZSTD_compressBound(in_len);
+}
+
+static int zstd_compress(compression_type_t type, int level, const void *in, size_t in_len,
+                         void *out, size_t out_cap, size_t *out_len) {
+    if (!zstd_context) {
+        zstd_context = ZSTD_createCCtx();
+        if (!zstd_context) {
+            LOG_ERROR("Failed to create zstd context");
+            return -1;
+        }
+    }
+
+    size_t size = ZSTD_compressCCtx(zstd_context, out, out_cap, in, in_len, encoding_codec_level(type, level));
+    if (ZSTD_isError(size)) {
+        LOG_ERROR("Zstd compression failed: %s", ZSTD_getErrorName(size));
+        return -1;
+    }
+
+    *out_len = size;
+    return 0;
+}
+
+static void zstd_release(void) {
+    if (zstd_context) {
+        ZSTD_freeCCtx(zstd_context);
+        zstd_context = NULL;
+    }
+}
+#endif
+
+static const compress_backend_t backends[] = {
+#ifdef HAVE_LIBDEFLATE
+    {"libdeflate", zlib_supports, libdeflate_bound, libdeflate_compress, libdeflate_release},
+#endif
+    {"zlib", zlib_supports, zlib_bound, zlib_compress, zlib_release},
+#ifdef HAVE_BROTLI
+    {"brotli", brotli_supports, brotli_bound, brotli_compress, brotli_release},
+#endif
+#ifdef HAVE_ZSTD
+    {"zstd", zstd_supports, zstd_bound, zstd_compress, zstd_release},
+#endif
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+const compress_backend_t *compress_engine_find(const char *name) {
+    for (int i = 0; backends[i].name != NULL; i++) {
+        if (strcasecmp(backends[i].name, name) == 0) {
+            return &backends[i];
+        }
+    }
+    return NULL;
+}
+
+const compress_backend_t *compress_engine_backend(int index) {
+    for (int i = 0; backends[i].name != NULL; i++) {
+        if (i == index) {
+            return &backends[i];
+        }
+    }
+    return NULL;
+}
+
+int compress_engine_select(const char *name) {
+    if (!name || name[0] == '\0' || strcasecmp(name, COMPRESS_ENGINE_AUTO) == 0) {
+        deflate_backend = &backends[0];
+    } else {
+        const compress_backend_t *backend = compress_engine_find(name);
+        if (!backend || !backend->supports(COMPRESSION_GZIP)) {
+            LOG_WARN("Compression engine '%s' not available, using %s", name, backends[0].name);
+            deflate_backend = &backends[0];
+            return -1;
+        }
+        deflate_backend = backend;
+    }
+
+    LOG_INFO("Using %s compression engine for gzip/deflate", deflate_backend->name);
+    return 0;
+}
+
+const char *compress_engine_name(void) {
+    return deflate_backend ? deflate_backend->name : backends[0].name;
+}
+
+static const compress_backend_t *backend_for(compression_type_t type) {
+    const compress_backend_t *preferred = deflate_backend ? deflate_backend : &backends[0];
+    if (preferred->supports(type)) {
+        return preferred;
+    }
+
+    for (int i = 0; backends[i].name != NULL; i++) {
+        if (backends[i].supports(type)) {
+            return &backends[i];
+        }
+    }
+    return NULL;
+}
+
+int compress_engine_compress(compression_type_t type, int level, const void *in, size_t in_len,
+                             void **out, size_t *out_len) {
+    if (!in || in_len == 0) {
+        return -1;
+    }
+
+    const compress_backend_t *backend = backend_for(type);
+    if (!backend) {
+        return -1;
+    }
+
+    size_t bound = backend->bound(type, level, in_len);
+    if (bound == 0) {
+        return -1;
+    }
+
+    if (bound > scratch_size) {
+        unsigned char *grown = realloc(scratch, bound);
+        if (!grown) {
+            LOG_ERROR("Failed to grow compression buffer to %zu bytes", bound);
+            return -1;
+        }
+        scratch = grown;
+        scratch_size = bound;
+    }
+
+    size_t produced = 0;
+    if (backend->compress(type, level, in, in_len, scratch, scratch_size, &produced) != 0) {
+        return -1;
+    }
+
+    void *result = malloc(produced);
+    if (!result) {
+        LOG_ERROR("Failed to allocate memory for compressed body");
+        return -1;
+    }
+    memcpy(result, scratch, produced);
+
+    *out = result;
+    *out_len = produced;
+    return 0;
+}
+
+void compress_engine_release(void) {
+    for (int i = 0; backends[i].name != NULL; i++) {
+        backends[i].release();
+    }
+
+    free(scratch);
+    scratch = NULL;
+    scratch_size = 0;
+}
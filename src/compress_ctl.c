@@ -0,0 +1,178 @@
+#include "compress_ctl.h"
+
+static const struct {
+    const char *prefix;
+    int level;
+} base_levels[] = {
+    {"image/svg+xml", COMPRESSION_LEVEL_MAX},
+    {"application/font", COMPRESSION_LEVEL_MAX},
+    {"application/x-font", COMPRESSION_LEVEL_MAX},
+    {"application/vnd.ms-fontobject", COMPRESSION_LEVEL_MAX},
+    {"image/", COMPRESSION_LEVEL_MIN},
+    {"application/octet-stream", COMPRESSION_LEVEL_MIN},
+    {NULL, COMPRESSION_LEVEL_DEFAULT}
+};
+
+/* highest level worth spending on a live response: brotli 9 and zstd 9 map
+ * to quality 11 / level 19, which are only affordable for sidecars */
+static const int online_max[COMPRESSION_TYPE_COUNT] = {
+    [COMPRESSION_NONE] = COMPRESSION_LEVEL_NONE,
+    [COMPRESSION_GZIP] = COMPRESSION_LEVEL_MAX,
+    [COMPRESSION_DEFLATE] = COMPRESSION_LEVEL_MAX,
+    [COMPRESSION_BROTLI] = COMPRESSION_LEVEL_MAX - 1,
+    [COMPRESSION_ZSTD] = COMPRESSION_LEVEL_MAX - 1,
+};
+
+static struct {
+    int adaptive;
+    int level_min;
+    int level_max;
+    int cpu_target;
+    int lag_target_ms;
+    size_t min_size;
+    size_t skip_size;
+
+    int offset;
+    int cpu_percent;
+    uint64_t lag_max_usec;
+    int lag_ms;
+    uint64_t last_tick_ms;
+    uint64_t last_cpu_usec;
+} ctl = {
+    .adaptive = 0,
+    .level_min = COMPRESSION_LEVEL_MIN,
+    .level_max = COMPRESSION_LEVEL_MAX,
+};
+
+static uint64_t monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t process_cpu_usec(void) {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == -1) {
+        return 0;
+    }
+    return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+           usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static int clamp(int value, int low, int high) {
+    return value < low ? low : (value > high ? high : value);
+}
+
+void compress_ctl_init(const config_t *config) {
+    ctl.adaptive = config->compress_adaptive;
+    ctl.level_min = clamp(config->compress_level_min, COMPRESSION_LEVEL_MIN, COMPRESSION_LEVEL_MAX);
+    ctl.level_max = clamp(config->compress_level_max, ctl.level_min, COMPRESSION_LEVEL_MAX);
+    ctl.cpu_target = config->compress_cpu_target > 0 ? config->compress_cpu_target : 70;
+    ctl.lag_target_ms = config->compress_lag_target_ms > 0 ? config->compress_lag_target_ms : 10;
+    ctl.min_size = config->compress_min_size > 0 ? (size_t)config->compress_min_size : 0;
+    ctl.skip_size = config->compress_skip_size > 0 ? (size_t)config->compress_skip_size : 0;
+
+    ctl.offset = 0;
+    ctl.lag_max_usec = 0;
+    ctl.last_tick_ms = monotonic_ms();
+    ctl.last_cpu_usec = process_cpu_usec();
+}
+
+int compress_ctl_level(const char *mime_type, compression_type_t type, size_t body_size) {
+    if ((unsigned)type >= COMPRESSION_TYPE_COUNT || type == COMPRESSION_NONE) {
+        return COMPRESSION_LEVEL_NONE;
+    }
+
+    if (body_size < ctl.min_size) {
+        METRICS_INC(compress_skipped);
+        return COMPRESSION_LEVEL_NONE;
+    }
+
+    int base = COMPRESSION_LEVEL_DEFAULT;
+    for (int i = 0; base_levels[i].prefix != NULL; i++) {
+        if (mime_type && strncasecmp(mime_type, base_levels[i].prefix, strlen(base_levels[i].prefix)) == 0) {
+            base = base_levels[i].level;
+            break;
+        }
+    }
+
+    int level = base + ctl.offset;
+    if (level < ctl.level_min && body_size < ctl.skip_size) {
+        METRICS_INC(compress_skipped);
+        return COMPRESSION_LEVEL_NONE;
+    }
+
+    int ceiling = ctl.level_max < online_max[type] ? ctl.level_max : online_max[type];
+    if (body_size >= COMPRESS_CTL_LARGE_BODY && ceiling > COMPRESSION_LEVEL_DEFAULT) {
+        ceiling = COMPRESSION_LEVEL_DEFAULT;
+    }
+
+    return clamp(level, ctl.level_min < ceiling ? ctl.level_min : ceiling, ceiling);
+}
+
+void compress_ctl_observe_loop(uint64_t busy_usec) {
+    if (busy_usec > ctl.lag_max_usec) {
+        ctl.lag_max_usec = busy_usec;
+    }
+}
+
+void compress_ctl_tick(void) {
+    uint64_t now = monotonic_ms();
+    uint64_t elapsed = now - ctl.last_tick_ms;
+    if (elapsed < COMPRESS_CTL_INTERVAL_MS) {
+        return;
+    }
+
+    uint64_t cpu = process_cpu_usec();
+    ctl.cpu_percent = (int)((cpu - ctl.last_cpu_usec) / (elapsed * 10));
+    ctl.lag_ms = (int)(ctl.lag_max_usec / 1000);
+    ctl.last_cpu_usec = cpu;
+    ctl.last_tick_ms = now;
+    ctl.lag_max_usec = 0;
+    metrics_worker->compress_cpu_percent = ctl.cpu_percent;
+    metrics_worker->compress_lag_ms = ctl.lag_ms;
+
+    if (!ctl.adaptive) {
+        return;
+    }
+
+    int previous = ctl.offset;
+    if (ctl.cpu_percent > ctl.cpu_target || ctl.lag_ms > ctl.lag_target_ms) {
+        ctl.offset = clamp(ctl.offset - 2, COMPRESS_CTL_OFFSET_MIN, COMPRESS_CTL_OFFSET_MAX);
+    } else if (ctl.cpu_percent < ctl.cpu_target / 2 && ctl.lag_ms < ctl.lag_target_ms / 2) {
+        ctl.offset = clamp(ctl.offset + 1, COMPRESS_CTL_OFFSET_MIN, COMPRESS_CTL_OFFSET_MAX);
+    }
+
+    if (ctl.offset != previous) {
+        metrics_worker->compress_offset = ctl.offset;
+        LOG_DEBUG("Compression level offset %d -> %d (cpu %d%%, loop lag %dms)",
+                  previous, ctl.offset, ctl.cpu_percent, ctl.lag_ms);
+    }
+}
+
+uint64_t compress_ctl_cpu_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void compress_ctl_record(int level, size_t in_len, size_t out_len, uint64_t cpu_ns) {
+    level = clamp(level, COMPRESSION_LEVEL_NONE, COMPRESSION_LEVEL_MAX);
+    atomic_fetch_add_explicit(&metrics_worker->compress_responses[level], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics_worker->compress_bytes_in, in_len, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics_worker->compress_bytes_out, out_len, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics_worker->compress_cpu_ns, cpu_ns, memory_order_relaxed);
+}
+
+void compress_ctl_stats(compress_stats_t *stats) {
+    for (int i = 0; i <= COMPRESSION_LEVEL_MAX; i++) {
+        stats->responses[i] = atomic_load_explicit(&metrics_worker->compress_responses[i], memory_order_relaxed);
+    }
+    stats->skipped = metrics_worker->compress_skipped;
+    stats->bytes_in = atomic_load_explicit(&metrics_worker->compress_bytes_in, memory_order_relaxed);
+    stats->bytes_out = atomic_load_explicit(&metrics_worker->compress_bytes_out, memory_order_relaxed);
+    stats->cpu_ns = atomic_load_explicit(&metrics_worker->compress_cpu_ns, memory_order_relaxed);
+    stats->offset = ctl.offset;
+    stats->cpu_percent = ctl.cpu_percent;
+    stats->lag_ms = ctl.lag_ms;
+}
@@ -0,0 +1,260 @@
+#include "compress_pool.h"
+
+static int queue_init(compress_queue_t *queue, size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    queue->slots = malloc(sizeof(compress_slot_t) * size);
+    if (!queue->slots) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&queue->slots[i].sequence, i);
+        queue->slots[i].job = NULL;
+    }
+    queue->mask = size - 1;
+    atomic_init(&queue->head, 0);
+    atomic_init(&queue->tail, 0);
+    return 0;
+}
+
+static int queue_push(compress_queue_t *queue, compress_job_t *job) {
+    size_t pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+    compress_slot_t *slot;
+
+    for (;;) {
+        slot = &queue->slots[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+
+    slot->job = job;
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+    return 0;
+}
+
+static compress_job_t *queue_pop(compress_queue_t *queue) {
+    size_t pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+    compress_slot_t *slot;
+
+    for (;;) {
+        slot = &queue->slots[pos & queue->mask];
+        size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return NULL;
+        } else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+
+    compress_job_t *job = slot->job;
+    atomic_store_explicit(&slot->sequence, pos + queue->mask + 1, memory_order_release);
+    return job;
+}
+
+static void *compress_thread(void *arg) {
+    compress_pool_t *pool = arg;
+
+    for (;;) {
+        if (sem_wait(&pool->pending) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (atomic_load(&pool->stopping)) {
+            break;
+        }
+
+        compress_job_t *job = queue_pop(&pool->submit);
+        if (!job) {
+            continue;
+        }
+
+        NX_PROBE3(compress__start, job->type, job->level, job->in_len);
+        uint64_t cpu_start = compress_ctl_cpu_now();
+        job->status = compress_engine_compress(job->type, job->level, job->in, job->in_len,
+                                               &job->out, &job->out_len);
+        if (job->status == 0) {
+            uint64_t cpu_ns = compress_ctl_cpu_now() - cpu_start;
+            compress_ctl_record(job->level, job->in_len, job->out_len, cpu_ns);
+            NX_PROBE4(compress__end, job->type, job->level, job->out_len, cpu_ns);
+        }
+
+        if (queue_push(&pool->done, job) != 0) {
+            LOG_ERROR("Compression completion queue full, dropping job for fd=%d", job->client_fd);
+            compress_job_free(job);
+            continue;
+        }
+
+        uint64_t one = 1;
+        if (write(pool->event_fd, &one, sizeof(one)) != sizeof(one)) {
+            LOG_ERROR("Failed to signal compression completion: %s", strerror(errno));
+        }
+    }
+
+    compress_engine_release();
+    return NULL;
+}
+
+compress_pool_t *compress_pool_create(int thread_count, size_t queue_limit) {
+    if (thread_count <= 0 || queue_limit == 0) {
+        return NULL;
+    }
+    if (thread_count > COMPRESS_POOL_MAX_THREADS) {
+        thread_count = COMPRESS_POOL_MAX_THREADS;
+    }
+
+    compress_pool_t *pool = calloc(1, sizeof(compress_pool_t));
+    if (!pool) {
+        LOG_ERROR("Failed to allocate compression pool");
+        return NULL;
+    }
+
+    if (queue_init(&pool->submit, queue_limit) != 0 || queue_init(&pool->done, queue_limit) != 0) {
+        LOG_ERROR("Failed to allocate compression queues");
+        free(pool->submit.slots);
+        free(pool);
+        return NULL;
+    }
+
+    pool->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pool->event_fd == -1) {
+        LOG_ERROR("Failed to create compression eventfd: %s", strerror(errno));
+        free(pool->submit.slots);
+        free(pool->done.slots);
+        free(pool);
+        return NULL;
+    }
+
+    sem_init(&pool->pending, 0, 0);
+    atomic_init(&pool->stopping, 0);
+    pool->queue_limit = queue_limit;
+    pool->inflight = 0;
+
+    /* signals stay with the event loop thread, and the threads float across
+     * all CPUs instead of sharing the worker's pinned core */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+    for (long i = 0; i < cpu_count && i < CPU_SETSIZE; i++) {
+        CPU_SET(i, &cpus);
+    }
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], &attr, compress_thread, pool) != 0) {
+            LOG_ERROR("Failed to start compression thread %d", i);
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (pool->thread_count == 0) {
+        compress_pool_destroy(pool);
+        return NULL;
+    }
+
+    LOG_INFO("Compression pool started: %d threads, queue limit %zu", pool->thread_count, queue_limit);
+    return pool;
+}
+
+int compress_pool_event_fd(const compress_pool_t *pool) {
+    return pool ? pool->event_fd : -1;
+}
+
+void compress_pool_ack(compress_pool_t *pool) {
+    uint64_t count;
+    while (read(pool->event_fd, &count, sizeof(count)) == -1 && errno == EINTR) {
+    }
+}
+
+int compress_pool_submit(compress_pool_t *pool, compress_job_t *job) {
+    if (!pool || pool->inflight >= pool->queue_limit) {
+        return -1;
+    }
+
+    if (queue_push(&pool->submit, job) != 0) {
+        return -1;
+    }
+
+    pool->inflight++;
+    sem_post(&pool->pending);
+    return 0;
+}
+
+compress_job_t *compress_pool_complete(compress_pool_t *pool) {
+    compress_job_t *job = queue_pop(&pool->done);
+    if (job) {
+        pool->inflight--;
+    }
+    return job;
+}
+
+void compress_pool_destroy(compress_pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+
+    atomic_store(&pool->stopping, 1);
+    for (int i = 0; i < pool->thread_count; i++) {
+        sem_post(&pool->pending);
+    }
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    compress_job_t *job;
+    while ((job = queue_pop(&pool->submit)) != NULL) {
+        compress_job_free(job);
+    }
+    while ((job = queue_pop(&pool->done)) != NULL) {
+        compress_job_free(job);
+    }
+
+    sem_destroy(&pool->pending);
+    close(pool->event_fd);
+    free(pool->submit.slots);
+    free(pool->done.slots);
+    free(pool);
+}
+
+void compress_job_free(compress_job_t *job) {
+    if (!job) {
+        return;
+    }
+    free(job->in);
+    free(job->out);
+    free(job);
+}
@@ -0,0 +1,182 @@
+#include "conditional.h"
+#include <ctype.h>
+
+typedef struct {
+    char value[CONDITIONAL_DATE_MAX];
+    time_t time;
+    int parsed;
+} conditional_date_t;
+
+static conditional_date_t date_cache[CONDITIONAL_DATE_CACHE_SIZE];
+
+static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+static int skip_space(const char **p) {
+    while (**p == ' ' || **p == '\t') {
+        (*p)++;
+    }
+    return **p;
+}
+
+int conditional_etag_matches(const char *if_none_match, const char *etag, size_t etag_len) {
+    const char *p = if_none_match;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        if (*p == '\0') {
+            return 0;
+        }
+
+        if (*p == '*') {
+            p++;
+            int next = skip_space(&p);
+            if (next == '\0' || next == ',') {
+                return 1;
+            }
+        }
+        if (p[0] == 'W' && p[1] == '/') {
+            p += 2;
+        }
+
+        if (*p == '"') {
+            const char *end = strchr(p + 1, '"');
+            if (!end) {
+                return 0;
+            }
+            size_t len = end - p + 1;
+            if (len == etag_len && memcmp(p, etag, len) == 0) {
+                return 1;
+            }
+            p = end + 1;
+        } else {
+            /* some clients drop the quotes; compare against the opaque part */
+            const char *start = p;
+            while (*p && *p != ',') {
+                p++;
+            }
+            const char *end = p;
+            while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+                end--;
+            }
+            size_t len = end - start;
+            if (etag_len >= 2 && etag[0] == '"' && len == etag_len - 2 && memcmp(start, etag + 1, len) == 0) {
+                return 1;
+            }
+        }
+
+        while (*p && *p != ',') {
+            p++;
+        }
+    }
+}
+
+static int digits(const char *p, int count) {
+    int value = 0;
+    for (int i = 0; i < count; i++) {
+        if (!isdigit((unsigned char)p[i])) {
+            return -1;
+        }
+        value = value * 10 + (p[i] - '0');
+    }
+    return value;
+}
+
+/* days since 1970-01-01 of a proleptic Gregorian date */
+static int64_t days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t yoe = year - era * 400;
+    int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+/* "Sun, 06 Nov 1994 08:49:37 GMT" */
+static int parse_imf_fixdate(const char *value, time_t *result) {
+    if (strlen(value) != 29 || value[3] != ',' || value[4] != ' ' || value[7] != ' ' || value[11] != ' ' ||
+        value[16] != ' ' || value[19] != ':' || value[22] != ':' || memcmp(value + 25, " GMT", 4) != 0) {
+        return -1;
+    }
+
+    int month = 0;
+    while (month < 12 && memcmp(months + month * 3, value + 8, 3) != 0) {
+        month++;
+    }
+    int day = digits(value + 5, 2);
+    int year = digits(value + 12, 4);
+    int hour = digits(value + 17, 2);
+    int minute = digits(value + 20, 2);
+    int second = digits(value + 23, 2);
+    if (month == 12 || day < 1 || day > 31 || year < 0 || hour < 0 || hour > 23 ||
+        minute < 0 || minute > 59 || second < 0 || second > 60) {
+        return -1;
+    }
+
+    *result = (time_t)(days_from_civil(year, month + 1, day) * 86400 + hour * 3600 + minute * 60 + second);
+    return 0;
+}
+
+static int parse_date(const char *value, time_t *result) {
+    if (parse_imf_fixdate(value, result) == 0) {
+        return 0;
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (strptime(value, "%A, %d-%b-%y %H:%M:%S GMT", &tm) == NULL &&
+        strptime(value, "%a %b %d %H:%M:%S %Y", &tm) == NULL) {
+        return -1;
+    }
+    *result = timegm(&tm);
+    return *result == -1 ? -1 : 0;
+}
+
+int conditional_parse_date(const char *value, time_t *result) {
+    size_t len = strlen(value);
+    if (len >= CONDITIONAL_DATE_MAX) {
+        return parse_date(value, result);
+    }
+
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)value[i];
+        hash *= 16777619u;
+    }
+    conditional_date_t *slot = &date_cache[hash & (CONDITIONAL_DATE_CACHE_SIZE - 1)];
+    if (slot->value[0] != '\0' && memcmp(slot->value, value, len + 1) == 0) {
+        *result = slot->time;
+        return slot->parsed ? 0 : -1;
+    }
+
+    time_t parsed;
+    int status = parse_date(value, &parsed);
+    if (status != 0) {
+        LOG_DEBUG("Failed to parse HTTP date: %s", value);
+    }
+    memcpy(slot->value, value, len + 1);
+    slot->time = status == 0 ? parsed : 0;
+    slot->parsed = status == 0;
+    *result = slot->time;
+    return status;
+}
+
+int conditional_not_modified_since(const char *if_modified_since, const char *last_modified, time_t mtime) {
+    if (last_modified && strcmp(if_modified_since, last_modified) == 0) {
+        return 1;
+    }
+
+    time_t since;
+    if (conditional_parse_date(if_modified_since, &since) != 0) {
+        return 0;
+    }
+    return mtime <= since;
+}
+
+int conditional_not_modified(const char *if_none_match, const char *if_modified_since,
+                             const char *etag, size_t etag_len, const char *last_modified, time_t mtime) {
+    if (if_none_match) {
+        return conditional_etag_matches(if_none_match, etag, etag_len);
+    }
+    return if_modified_since && conditional_not_modified_since(if_modified_since, last_modified, mtime);
+}
@@ -1,6 +1,16 @@
 #include "config.h"
+#include "log.h"
+#include "http.h"
+#include "capacity.h"
+#include "vhost.h"
+#include <limits.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 static config_t config_instance;
+static config_t *config_shared = NULL;
+static char config_path[PATH_MAX];
 
 config_t* config_get_instance(void) {
     return &config_instance;
@@ -11,24 +21,95 @@ void config_init(config_t *config) {
     config->port = 8080;
     config->worker_count = 4;
     strncpy(config->root_dir, "./static", sizeof(config->root_dir) - 1);
-    strncpy(config->log_file, "./logs/access.log", sizeof(config->log_file) - 1);
-    config->max_connections = 10000;
+    strncpy(config->log_file, "./logs/error.log", sizeof(config->log_file) - 1);
+    config->max_connections = 0;
     config->keep_alive_timeout = 60;
+    config->precompress = 1;
+    strncpy(config->precompress_dir, "./cache", sizeof(config->precompress_dir) - 1);
+    config->precompress_min_size = 256;
+    config->precompress_interval = 30;
+    strncpy(config->compression_engine, "auto", sizeof(config->compression_engine) - 1);
+    config->compress_threads = 2;
+    config->compress_queue_size = 256;
+    config->compress_offload_min_size = 32768;
+    config->compress_adaptive = 1;
+    config->compress_level_min = 1;
+    config->compress_level_max = 9;
+    config->compress_cpu_target = 70;
+    config->compress_lag_target_ms = 10;
+    config->compress_min_size = 256;
+    config->compress_skip_size = 4096;
+    config->open_file_cache_max = 1024;
+    config->open_file_cache_valid = 5;
+    config->io_threads = 2;
+    config->io_queue_size = 256;
+    config->cache_zerocopy_min_size = 65536;
+    config->proxy_keepalive = 16;
+    config->proxy_max_fails = 3;
+    config->proxy_fail_timeout = 10;
+    config->proxy_timeout = 30;
+    strncpy(config->metrics_path, "/metrics", sizeof(config->metrics_path) - 1);
+    config->latency_histograms = 1;
+    config->server_timing_sample = 0;
+    config->access_log_buffer = 262144;
+    config->access_log_flush_ms = 1000;
+    config->access_log_overflow = 0;
+    config->access_log_per_worker = 0;
+    config->access_log_format = 0;
+    config->log_level = LOG_INFO;
+    config->drain_timeout = 30;
+    config->request_buffer_size = 8192;
+    config->response_cache_entries = 0;
+    config->response_cache_size = 0;
+    config->worker_memory = CAPACITY_DEFAULT_BUDGET;
 }
 
 static void trim_whitespace(char *str) {
+    char *start = str;
     char *end;
-    while (isspace((unsigned char)*str)) str++;
+    while (isspace((unsigned char)*start)) start++;
+    if (start != str) memmove(str, start, strlen(start) + 1);
     if (*str == 0) return;
     end = str + strlen(str) - 1;
     while (end > str && isspace((unsigned char)*end)) end--;
     end[1] = '\0';
 }
 
+static int parse_flag(const char *value) {
+    return strcasecmp(value, "on") == 0 || strcasecmp(value, "yes") == 0 ||
+           strcasecmp(value, "true") == 0 || atoi(value) > 0;
+}
+
+/* a byte count with an optional k, m or g suffix; "auto" is 0, which
+ * leaves the value to be derived from worker_memory */
+size_t config_parse_size(const char *value) {
+    if (strcasecmp(value, "auto") == 0) {
+        return 0;
+    }
+
+    char *end;
+    unsigned long long size = strtoull(value, &end, 10);
+    switch (tolower((unsigned char)*end)) {
+        case 'g': size <<= 30; break;
+        case 'm': size <<= 20; break;
+        case 'k': size <<= 10; break;
+    }
+    return (size_t)size;
+}
+
+static int parse_log_level(const char *value) {
+    if (strcasecmp(value, "debug") == 0) return LOG_DEBUG;
+    if (strcasecmp(value, "info") == 0) return LOG_INFO;
+    if (strcasecmp(value, "warn") == 0 || strcasecmp(value, "warning") == 0) return LOG_WARN;
+    if (strcasecmp(value, "error") == 0) return LOG_ERROR;
+    return -1;
+}
+
 static int parse_config_line(config_t *config, const char *line) {
     char key[64], value[256];
     
-    if (line[0] == '#' || line[0] == '\0' || line[0] == '\n') {
+    while (isspace((unsigned char)*line)) line++;
+    if (line[0] == '#' || line[0] == '\0') {
         return 0;
     }
 
@@ -48,44 +129,306 @@ static int parse_config_line(config_t *config, const char *line) {
     } else if (strcmp(key, "log") == 0) {
         strncpy(config->log_file, value, sizeof(config->log_file) - 1);
     } else if (strcmp(key, "max_connections") == 0) {
-        config->max_connections = atoi(value);
+        config->max_connections = (int)config_parse_size(value);
     } else if (strcmp(key, "keep_alive_timeout") == 0) {
         config->keep_alive_timeout = atoi(value);
+    } else if (strcmp(key, "precompress") == 0) {
+        config->precompress = parse_flag(value);
+    } else if (strcmp(key, "precompress_dir") == 0) {
+        strncpy(config->precompress_dir, value, sizeof(config->precompress_dir) - 1);
+    } else if (strcmp(key, "precompress_min_size") == 0) {
+        config->precompress_min_size = atoi(value);
+    } else if (strcmp(key, "precompress_interval") == 0) {
+        config->precompress_interval = atoi(value);
+    } else if (strcmp(key, "compression_engine") == 0) {
+        strncpy(config->compression_engine, value, sizeof(config->compression_engine) - 1);
+    } else if (strcmp(key, "compress_threads") == 0) {
+        config->compress_threads = atoi(value);
+    } else if (strcmp(key, "compress_queue_size") == 0) {
+        config->compress_queue_size = atoi(value);
+    } else if (strcmp(key, "compress_offload_min_size") == 0) {
+        config->compress_offload_min_size = atoi(value);
+    } else if (strcmp(key, "compress_adaptive") == 0) {
+        config->compress_adaptive = parse_flag(value);
+    } else if (strcmp(key, "compress_level_min") == 0) {
+        config->compress_level_min = atoi(value);
+    } else if (strcmp(key, "compress_level_max") == 0) {
+        config->compress_level_max = atoi(value);
+    } else if (strcmp(key, "compress_cpu_target") == 0) {
+        config->compress_cpu_target = atoi(value);
+    } else if (strcmp(key, "compress_lag_target_ms") == 0) {
+        config->compress_lag_target_ms = atoi(value);
+    } else if (strcmp(key, "compress_min_size") == 0) {
+        config->compress_min_size = atoi(value);
+    } else if (strcmp(key, "compress_skip_size") == 0) {
+        config->compress_skip_size = atoi(value);
+    } else if (strcmp(key, "open_file_cache_max") == 0) {
+        config->open_file_cache_max = atoi(value);
+    } else if (strcmp(key, "open_file_cache_valid") == 0) {
+        config->open_file_cache_valid = atoi(value);
+    } else if (strcmp(key, "io_threads") == 0) {
+        config->io_threads = atoi(value);
+    } else if (strcmp(key, "io_queue_size") == 0) {
+        config->io_queue_size = atoi(value);
+    } else if (strcmp(key, "cache_zerocopy_min_size") == 0) {
+        config->cache_zerocopy_min_size = atoi(value);
+    } else if (strcmp(key, "proxy_pass") == 0) {
+        if (config->proxy_pass_count >= CONFIG_MAX_PROXY_ROUTES) {
+            return -1;
+        }
+        strncpy(config->proxy_pass[config->proxy_pass_count++], value, sizeof(config->proxy_pass[0]) - 1);
+    } else if (strcmp(key, "manifest") == 0) {
+        config->manifest = parse_flag(value);
+    } else if (strcmp(key, "manifest_max_files") == 0) {
+        config->manifest_max_files = atoi(value);
+    } else if (strcmp(key, "manifest_threads") == 0) {
+        config->manifest_threads = atoi(value);
+    } else if (strcmp(key, "vhost") == 0) {
+        if (config->vhost_count >= CONFIG_MAX_VHOSTS) {
+            return -1;
+        }
+        strncpy(config->vhosts[config->vhost_count++], value, sizeof(config->vhosts[0]) - 1);
+    } else if (strcmp(key, "proxy_keepalive") == 0) {
+        config->proxy_keepalive = atoi(value);
+    } else if (strcmp(key, "proxy_max_fails") == 0) {
+        config->proxy_max_fails = atoi(value);
+    } else if (strcmp(key, "proxy_fail_timeout") == 0) {
+        config->proxy_fail_timeout = atoi(value);
+    } else if (strcmp(key, "proxy_timeout") == 0) {
+        config->proxy_timeout = atoi(value);
+    } else if (strcmp(key, "metrics_port") == 0) {
+        config->metrics_port = atoi(value);
+    } else if (strcmp(key, "metrics_path") == 0) {
+        strncpy(config->metrics_path, value, sizeof(config->metrics_path) - 1);
+    } else if (strcmp(key, "latency_histograms") == 0) {
+        config->latency_histograms = parse_flag(value);
+    } else if (strcmp(key, "server_timing_sample") == 0) {
+        config->server_timing_sample = atoi(value);
+    } else if (strcmp(key, "access_log") == 0) {
+        if (strcasecmp(value, "off") == 0) {
+            config->access_log[0] = '\0';
+        } else {
+            strncpy(config->access_log, value, sizeof(config->access_log) - 1);
+        }
+    } else if (strcmp(key, "access_log_buffer") == 0) {
+        config->access_log_buffer = atoi(value);
+    } else if (strcmp(key, "access_log_flush_ms") == 0) {
+        config->access_log_flush_ms = atoi(value);
+    } else if (strcmp(key, "access_log_overflow") == 0) {
+        config->access_log_overflow = strcasecmp(value, "block") == 0;
+    } else if (strcmp(key, "access_log_per_worker") == 0) {
+        config->access_log_per_worker = parse_flag(value);
+    } else if (strcmp(key, "access_log_format") == 0) {
+        config->access_log_format = strcasecmp(value, "binary") == 0;
+    } else if (strcmp(key, "log_level") == 0) {
+        config->log_level = parse_log_level(value);
+        if (config->log_level < 0) {
+            return -1;
+        }
+    } else if (strcmp(key, "drain_timeout") == 0) {
+        config->drain_timeout = atoi(value);
+    } else if (strcmp(key, "worker_memory") == 0) {
+        config->worker_memory = config_parse_size(value);
+    } else if (strcmp(key, "request_buffer_size") == 0) {
+        config->request_buffer_size = (int)config_parse_size(value);
+    } else if (strcmp(key, "response_cache_entries") == 0) {
+        config->response_cache_entries = (int)config_parse_size(value);
+    } else if (strcmp(key, "response_cache_size") == 0) {
+        config->response_cache_size = config_parse_size(value);
+    } else {
+        LOG_WARN("Ignoring unknown config key '%s'", key);
     }
 
     return 0;
 }
 
+/* a file with a malformed line is rejected as a whole; on success the
+ * path is remembered so a reload can read it again */
 int config_load(config_t *config, const char *filename) {
     FILE *file = fopen(filename, "r");
     if (!file) {
-        perror("Failed to open config file");
+        LOG_ERROR("Failed to open config file %s: %s", filename, strerror(errno));
         return -1;
     }
 
     char line[512];
+    int errors = 0;
+    int line_no = 0;
     while (fgets(line, sizeof(line), file)) {
+        line_no++;
         if (parse_config_line(config, line) != 0) {
-            fprintf(stderr, "Error parsing config line: %s", line);
+            line[strcspn(line, "\r\n")] = '\0';
+            LOG_ERROR("Error parsing %s line %d: %s", filename, line_no, line);
+            errors++;
         }
     }
 
     fclose(file);
+    if (errors > 0) {
+        return -1;
+    }
+
+    if (filename != config_path) {
+        snprintf(config_path, sizeof(config_path), "%s", filename);
+    }
     return 0;
 }
 
+int config_validate(const config_t *config) {
+    int errors = 0;
+    struct stat st;
+
+    if (config->port <= 0 || config->port > 65535) {
+        LOG_ERROR("port %d is out of range", config->port);
+        errors++;
+    }
+    if (config->worker_count <= 0) {
+        LOG_ERROR("worker_processes must be at least 1");
+        errors++;
+    }
+    if (stat(config->root_dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        LOG_ERROR("root %s is not a directory", config->root_dir);
+        errors++;
+    }
+    if (config->keep_alive_timeout <= 0) {
+        LOG_ERROR("keep_alive_timeout must be positive");
+        errors++;
+    }
+    if (config->drain_timeout <= 0) {
+        LOG_ERROR("drain_timeout must be positive");
+        errors++;
+    }
+    if (config->compress_level_min < COMPRESSION_LEVEL_MIN || config->compress_level_max > COMPRESSION_LEVEL_MAX ||
+        config->compress_level_min > config->compress_level_max) {
+        LOG_ERROR("compress_level_min/max must satisfy %d <= min <= max <= %d",
+                  COMPRESSION_LEVEL_MIN, COMPRESSION_LEVEL_MAX);
+        errors++;
+    }
+    if (config->compress_threads < 0 || config->io_threads < 0 ||
+        (config->compress_threads > 0 && config->compress_queue_size <= 0) ||
+        (config->io_threads > 0 && config->io_queue_size <= 0)) {
+        LOG_ERROR("thread pools need a non-negative thread count and a positive queue size");
+        errors++;
+    }
+    if (config->metrics_port < 0 || config->metrics_port > 65535 || config->metrics_port == config->port) {
+        LOG_ERROR("metrics_port %d is out of range or clashes with port", config->metrics_port);
+        errors++;
+    }
+    if (config->access_log[0] && config->access_log_buffer <= 0) {
+        LOG_ERROR("access_log_buffer must be positive");
+        errors++;
+    }
+    if (config->request_buffer_size < CAPACITY_MIN_BUFFER || config->request_buffer_size > CAPACITY_MAX_BUFFER) {
+        LOG_ERROR("request_buffer_size must be between %d and %d", CAPACITY_MIN_BUFFER, CAPACITY_MAX_BUFFER);
+        errors++;
+    }
+    capacity_plan_t plan;
+    if (capacity_plan(config, &plan) != 0) {
+        errors++;
+    }
+    if (vhost_validate(config) != 0) {
+        errors++;
+    }
+
+    return errors > 0 ? -1 : 0;
+}
+
+/* the listening sockets, metrics slots and error log were set up by the
+ * master at startup, so these keep their running values until a restart */
+static void keep_restart_settings(config_t *next, const config_t *current) {
+    if (next->port != current->port) {
+        LOG_WARN("port change to %d needs a restart, keeping %d", next->port, current->port);
+        next->port = current->port;
+    }
+    if (next->worker_count != current->worker_count) {
+        LOG_WARN("worker_processes change to %d needs a restart, keeping %d",
+                 next->worker_count, current->worker_count);
+        next->worker_count = current->worker_count;
+    }
+    if (strcmp(next->log_file, current->log_file) != 0) {
+        LOG_WARN("log change to %s needs a restart, keeping %s", next->log_file, current->log_file);
+        memcpy(next->log_file, current->log_file, sizeof(next->log_file));
+    }
+    if (next->metrics_port != current->metrics_port || strcmp(next->metrics_path, current->metrics_path) != 0) {
+        LOG_WARN("metrics_port/metrics_path changes need a restart, keeping %d%s",
+                 current->metrics_port, current->metrics_path);
+        next->metrics_port = current->metrics_port;
+        memcpy(next->metrics_path, current->metrics_path, sizeof(next->metrics_path));
+    }
+}
+
+/* settings a running worker can swap in place; everything else reaches
+ * the workers forked to replace it */
+static void copy_live_settings(config_t *dst, const config_t *src) {
+    dst->keep_alive_timeout = src->keep_alive_timeout;
+    dst->log_level = src->log_level;
+    dst->drain_timeout = src->drain_timeout;
+    dst->precompress_interval = src->precompress_interval;
+    dst->compress_offload_min_size = src->compress_offload_min_size;
+    dst->compress_adaptive = src->compress_adaptive;
+    dst->compress_level_min = src->compress_level_min;
+    dst->compress_level_max = src->compress_level_max;
+    dst->compress_cpu_target = src->compress_cpu_target;
+    dst->compress_lag_target_ms = src->compress_lag_target_ms;
+    dst->compress_min_size = src->compress_min_size;
+    dst->compress_skip_size = src->compress_skip_size;
+    dst->open_file_cache_max = src->open_file_cache_max;
+    dst->open_file_cache_valid = src->open_file_cache_valid;
+    dst->cache_zerocopy_min_size = src->cache_zerocopy_min_size;
+    dst->latency_histograms = src->latency_histograms;
+    dst->server_timing_sample = src->server_timing_sample;
+}
+
+/* parses and validates into a scratch copy so a bad file never touches
+ * the running settings. Returns 1 when the workers have to be replaced
+ * to apply the result, 0 when only live settings changed, -1 when the
+ * file was rejected */
 int config_reload(config_t *config, const char *filename) {
-    config_t new_config;
-    config_init(&new_config);
-    
-    if (config_load(&new_config, filename) != 0) {
+    if (!filename) {
+        filename = config_path;
+    }
+    if (filename[0] == '\0') {
         return -1;
     }
 
-    config->worker_count = new_config.worker_count;
-    strncpy(config->root_dir, new_config.root_dir, sizeof(config->root_dir) - 1);
-    strncpy(config->log_file, new_config.log_file, sizeof(config->log_file) - 1);
-    config->keep_alive_timeout = new_config.keep_alive_timeout;
+    config_t next;
+    config_init(&next);
+    if (config_load(&next, filename) != 0 || config_validate(&next) != 0) {
+        return -1;
+    }
+    keep_restart_settings(&next, config);
+
+    /* every field is a number or a zero-padded string and config_init zeroes
+     * the padding, so the structs compare bytewise */
+    config_t live;
+    memcpy(&live, config, sizeof(live));
+    copy_live_settings(&live, &next);
+    int replace = memcmp(&live, &next, sizeof(next)) != 0;
+
+    memcpy(config, &next, sizeof(next));
+    return replace;
+}
+
+int config_share(void) {
+    config_shared = mmap(NULL, sizeof(config_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (config_shared == MAP_FAILED) {
+        LOG_ERROR("Failed to map shared configuration: %s", strerror(errno));
+        config_shared = NULL;
+        return -1;
+    }
 
+    memcpy(config_shared, &config_instance, sizeof(config_t));
     return 0;
-} 
\ No newline at end of file
+}
+
+void config_publish(const config_t *config) {
+    if (config_shared) {
+        memcpy(config_shared, config, sizeof(config_t));
+    }
+}
+
+void config_refresh(config_t *config) {
+    if (config_shared) {
+        copy_live_settings(config, config_shared);
+    }
+}
@@ -0,0 +1,397 @@
+#include "encoding.h"
+#include "compress.h"
+
+static const struct {
+    compression_type_t type;
+    const char *name;
+    const char *suffix;
+    int available;
+} encoders[] = {
+#ifdef HAVE_BROTLI
+    {COMPRESSION_BROTLI, "br", ".br", 1},
+#else
+    {COMPRESSION_BROTLI, "br", ".br", 0},
+#endif
+#ifdef HAVE_ZSTD
+    {COMPRESSION_ZSTD, "zstd", ".zst", 1},
+#else
+    {COMPRESSION_ZSTD, "zstd", ".zst", 0},
+#endif
+    {COMPRESSION_GZIP, "gzip", ".gz", 1},
+    {COMPRESSION_DEFLATE, "deflate", NULL, 1},
+    {COMPRESSION_NONE, NULL, NULL, 0}
+};
+
+static const struct {
+    const char *token;
+    compression_type_t type;
+} coding_aliases[] = {
+    {"x-gzip", COMPRESSION_GZIP},
+    {NULL, COMPRESSION_NONE}
+};
+
+const char *encoding_name(compression_type_t type) {
+    for (int i = 0; encoders[i].name != NULL; i++) {
+        if (encoders[i].type == type) {
+            return encoders[i].name;
+        }
+    }
+    return NULL;
+}
+
+const char *encoding_suffix(compression_type_t type) {
+    for (int i = 0; encoders[i].name != NULL; i++) {
+        if (encoders[i].type == type) {
+            return encoders[i].available ? encoders[i].suffix : NULL;
+        }
+    }
+    return NULL;
+}
+
+int encoding_available(compression_type_t type) {
+    for (int i = 0; encoders[i].name != NULL; i++) {
+        if (encoders[i].type == type) {
+            return encoders[i].available;
+        }
+    }
+    return 0;
+}
+
+int encoding_codec_level(compression_type_t type, int level) {
+    if (level < COMPRESSION_LEVEL_MIN || level > COMPRESSION_LEVEL_MAX) {
+        level = COMPRESSION_LEVEL_DEFAULT;
+    }
+
+    switch (type) {
+        case COMPRESSION_BROTLI:
+            return level == COMPRESSION_LEVEL_MAX ? 11 : (level > 1 ? level - 1 : 1);
+        case COMPRESSION_ZSTD:
+            return level == COMPRESSION_LEVEL_MAX ? 19 : level;
+        default:
+            return level;
+    }
+}
+
+static int parse_qvalue(const char *p, const char *end) {
+    if (p >= end) {
+        return -1;
+    }
+
+    if (*p == '1') {
+        return ENCODING_QVALUE_MAX;
+    }
+
+    if (*p != '0') {
+        return -1;
+    }
+
+    int q = 0;
+    p++;
+    if (p < end && *p == '.') {
+        p++;
+        for (int scale = 100; scale > 0 && p < end && isdigit((unsigned char)*p); scale /= 10, p++) {
+            q += (*p - '0') * scale;
+        }
+    }
+
+    return q;
+}
+
+compression_type_t encoding_negotiate(const char *accept_encoding) {
+    if (!accept_encoding) {
+        return COMPRESSION_NONE;
+    }
+
+    int qvalues[COMPRESSION_TYPE_COUNT];
+    for (int i = 0; i < COMPRESSION_TYPE_COUNT; i++) {
+        qvalues[i] = -1;
+    }
+    int star_q = -1;
+    int identity_q = -1;
+
+    const char *p = accept_encoding;
+    while (*p) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (!*p) break;
+
+        const char *token = p;
+        while (*p && *p != ',' && *p != ';' && *p != ' ' && *p != '\t') p++;
+        size_t token_len = p - token;
+
+        int qvalue = ENCODING_QVALUE_MAX;
+        while (*p && *p != ',') {
+            while (*p == ' ' || *p == '\t' || *p == ';') p++;
+            if ((p[0] == 'q' || p[0] == 'Q') && p[1] == '=') {
+                const char *value = p + 2;
+                const char *value_end = value;
+                while (*value_end && *value_end != ',' && *value_end != ';' &&
+                       *value_end != ' ' && *value_end != '\t') value_end++;
+                int parsed = parse_qvalue(value, value_end);
+                if (parsed >= 0) {
+                    qvalue = parsed;
+                }
+                p = value_end;
+            } else {
+                while (*p && *p != ',' && *p != ';') p++;
+            }
+        }
+
+        if (token_len == 1 && token[0] == '*') {
+            star_q = qvalue;
+        } else if (token_len == 8 && strncasecmp(token, "identity", 8) == 0) {
+            identity_q = qvalue;
+        } else {
+            compression_type_t type = COMPRESSION_NONE;
+            for (int i = 0; encoders[i].name != NULL; i++) {
+                if (strlen(encoders[i].name) == token_len &&
+                    strncasecmp(token, encoders[i].name, token_len) == 0) {
+                    type = encoders[i].type;
+                    break;
+                }
+            }
+            for (int i = 0; type == COMPRESSION_NONE && coding_aliases[i].token != NULL; i++) {
+                if (strlen(coding_aliases[i].token) == token_len &&
+                    strncasecmp(token, coding_aliases[i].token, token_len) == 0) {
+                    type = coding_aliases[i].type;
+                }
+            }
+            if (type != COMPRESSION_NONE) {
+                qvalues[type] = qvalue;
+            }
+        }
+    }
+
+    compression_type_t best = COMPRESSION_NONE;
+    int best_q = 0;
+    for (int i = 0; encoders[i].name != NULL; i++) {
+        if (!encoders[i].available) {
+            continue;
+        }
+        int q = qvalues[encoders[i].type] >= 0 ? qvalues[encoders[i].type] : (star_q >= 0 ? star_q : 0);
+        if (q > best_q) {
+            best = encoders[i].type;
+            best_q = q;
+        }
+    }
+
+    if (best != COMPRESSION_NONE && identity_q > best_q) {
+        LOG_DEBUG("Client prefers identity (q=%d) over %s (q=%d)", identity_q, encoding_name(best), best_q);
+        return COMPRESSION_NONE;
+    }
+
+    if (best != COMPRESSION_NONE) {
+        LOG_DEBUG("Negotiated %s compression (q=%d)", encoding_name(best), best_q);
+    }
+
+    return best;
+}
+
+int encoding_compress(compression_type_t type, int level, const void *in, size_t in_len,
+                      void **out, size_t *out_len) {
+    if (!in || in_len == 0 || !encoding_available(type)) {
+        return -1;
+    }
+
+    return compress_engine_compress(type, level, in, in_len, out, out_len);
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += written;
+        len -= written;
+    }
+    return 0;
+}
+
+static ssize_t read_chunk(int fd, unsigned char *buf, size_t len) {
+    ssize_t bytes_read;
+    do {
+        bytes_read = read(fd, buf, len);
+    } while (bytes_read == -1 && errno == EINTR);
+    return bytes_read;
+}
+
+struct encoding_stream {
+    compression_type_t type;
+    z_stream zlib;
+#ifdef HAVE_BROTLI
+    BrotliEncoderState *brotli;
+#endif
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+};
+
+encoding_stream_t *encoding_stream_create(compression_type_t type, int level) {
+    if (!encoding_available(type)) {
+        return NULL;
+    }
+
+    encoding_stream_t *stream = calloc(1, sizeof(encoding_stream_t));
+    if (!stream) {
+        return NULL;
+    }
+    stream->type = type;
+
+    int mapped = encoding_codec_level(type, level);
+
+    switch (type) {
+        case COMPRESSION_GZIP:
+        case COMPRESSION_DEFLATE: {
+            int window_bits = (type == COMPRESSION_GZIP) ? (15 + 16) : 15;
+            if (deflateInit2(&stream->zlib, mapped, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                free(stream);
+                return NULL;
+            }
+            return stream;
+        }
+#ifdef HAVE_BROTLI
+        case COMPRESSION_BROTLI:
+            stream->brotli = BrotliEncoderCreateInstance(NULL, NULL, NULL);
+            if (!stream->brotli) {
+                free(stream);
+                return NULL;
+            }
+            BrotliEncoderSetParameter(stream->brotli, BROTLI_PARAM_QUALITY, mapped);
+            BrotliEncoderSetParameter(stream->brotli, BROTLI_PARAM_LGWIN, BROTLI_DEFAULT_WINDOW);
+            return stream;
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESSION_ZSTD:
+            stream->zstd = ZSTD_createCCtx();
+            if (!stream->zstd) {
+                free(stream);
+                return NULL;
+            }
+            ZSTD_CCtx_setParameter(stream->zstd, ZSTD_c_compressionLevel, mapped);
+            return stream;
+#endif
+        default:
+            free(stream);
+            return NULL;
+    }
+}
+
+int encoding_stream_process(encoding_stream_t *stream, const void *in, size_t in_len, size_t *consumed,
+                            void *out, size_t out_cap, size_t *produced, int finish) {
+    *consumed = 0;
+    *produced = 0;
+
+    switch (stream->type) {
+        case COMPRESSION_GZIP:
+        case COMPRESSION_DEFLATE: {
+            stream->zlib.next_in = (Bytef *)in;
+            stream->zlib.avail_in = in_len;
+            stream->zlib.next_out = out;
+            stream->zlib.avail_out = out_cap;
+            int ret = deflate(&stream->zlib, finish ? Z_FINISH : Z_NO_FLUSH);
+            if (ret == Z_STREAM_ERROR) {
+                return -1;
+            }
+            *consumed = in_len - stream->zlib.avail_in;
+            *produced = out_cap - stream->zlib.avail_out;
+            return ret == Z_STREAM_END ? 1 : 0;
+        }
+#ifdef HAVE_BROTLI
+        case COMPRESSION_BROTLI: {
+            size_t avail_in = in_len;
+            const uint8_t *next_in = in;
+            size_t avail_out = out_cap;
+            uint8_t *next_out = out;
+            if (!BrotliEncoderCompressStream(stream->brotli,
+                                             finish ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS,
+                                             &avail_in, &next_in, &avail_out, &next_out, NULL)) {
+                return -1;
+            }
+            *consumed = in_len - avail_in;
+            *produced = out_cap - avail_out;
+            return finish && BrotliEncoderIsFinished(stream->brotli) ? 1 : 0;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESSION_ZSTD: {
+            ZSTD_inBuffer input = { in, in_len, 0 };
+            ZSTD_outBuffer output = { out, out_cap, 0 };
+            size_t remaining = ZSTD_compressStream2(stream->zstd, &output, &input,
+                                                    finish ? ZSTD_e_end : ZSTD_e_continue);
+            if (ZSTD_isError(remaining)) {
+                return -1;
+            }
+            *consumed = input.pos;
+            *produced = output.pos;
+            return finish && remaining == 0 && input.pos == in_len ? 1 : 0;
+        }
+#endif
+        default:
+            return -1;
+    }
+}
+
+void encoding_stream_destroy(encoding_stream_t *stream) {
+    if (!stream) {
+        return;
+    }
+
+    switch (stream->type) {
+        case COMPRESSION_GZIP:
+        case COMPRESSION_DEFLATE:
+            deflateEnd(&stream->zlib);
+            break;
+#ifdef HAVE_BROTLI
+        case COMPRESSION_BROTLI:
+            BrotliEncoderDestroyInstance(stream->brotli);
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case COMPRESSION_ZSTD:
+            ZSTD_freeCCtx(stream->zstd);
+            break;
+#endif
+        default:
+            break;
+    }
+
+    free(stream);
+}
+
+int encoding_compress_fd(compression_type_t type, int level, int in_fd, int out_fd) {
+    unsigned char in[ENCODING_CHUNK_SIZE];
+    unsigned char out[ENCODING_CHUNK_SIZE];
+
+    encoding_stream_t *stream = encoding_stream_create(type, level);
+    if (!stream) {
+        return -1;
+    }
+
+    int result = 0;
+    int done = 0;
+    while (!done && result == 0) {
+        ssize_t bytes_read = read_chunk(in_fd, in, sizeof(in));
+        if (bytes_read == -1) {
+            result = -1;
+            break;
+        }
+
+        int eof = (bytes_read == 0);
+        size_t pos = 0;
+        size_t consumed, produced;
+        do {
+            int ret = encoding_stream_process(stream, in + pos, bytes_read - pos, &consumed,
+                                              out, sizeof(out), &produced, eof);
+            if (ret < 0 || write_all(out_fd, out, produced) != 0) {
+                result = -1;
+                break;
+            }
+            pos += consumed;
+            done = (ret == 1);
+        } while (!done && (eof || pos < (size_t)bytes_read || produced == sizeof(out)));
+    }
+
+    encoding_stream_destroy(stream);
+    return result;
+}
@@ -0,0 +1,332 @@
+#include "file_cache.h"
+#include "encoding.h"
+#include "cache.h"
+#include "metrics.h"
+#include "vhost.h"
+#include "resolve.h"
+#include "precompress.h"
+
+static file_cache_entry_t *buckets[FILE_CACHE_BUCKETS];
+static file_cache_entry_t *lru_head = NULL;
+static file_cache_entry_t *lru_tail = NULL;
+static int entry_count = 0;
+static int max_entries = FILE_CACHE_DEFAULT_MAX;
+static int valid_seconds = FILE_CACHE_DEFAULT_VALID;
+
+static uint32_t hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void lru_unlink(file_cache_entry_t *entry) {
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void lru_push_front(file_cache_entry_t *entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = lru_head;
+    if (lru_head) {
+        lru_head->lru_prev = entry;
+    }
+    lru_head = entry;
+    if (!lru_tail) {
+        lru_tail = entry;
+    }
+}
+
+static void destroy_entry(file_cache_entry_t *entry) {
+    if (entry->fd != -1) {
+        close(entry->fd);
+    }
+    for (int i = 0; i < COMPRESSION_TYPE_COUNT; i++) {
+        free(entry->not_modified[i]);
+        if (entry->sidecar_fds[i] != -1) {
+            close(entry->sidecar_fds[i]);
+        }
+    }
+    free(entry);
+}
+
+/* drop the entry from the table; its fd stays open until the last
+ * response using it releases it */
+static void detach_entry(file_cache_entry_t *entry) {
+    file_cache_entry_t **link = &buckets[entry->hash & (FILE_CACHE_BUCKETS - 1)];
+    while (*link && *link != entry) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = entry->next;
+    }
+
+    lru_unlink(entry);
+    entry_count--;
+    entry->detached = 1;
+
+    if (entry->refs == 0) {
+        destroy_entry(entry);
+    }
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec && a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static void fill_metadata(file_cache_entry_t *entry) {
+    entry->mime_type = http_get_mime_type(entry->path);
+    entry->cache_control = file_cache_control(entry->path);
+
+    for (int i = 0; i < COMPRESSION_TYPE_COUNT; i++) {
+        file_cache_format_etag(&entry->st, (compression_type_t)i, entry->etags[i], sizeof(entry->etags[i]));
+        entry->etag_lens[i] = strlen(entry->etags[i]);
+        entry->not_modified[i] = NULL;
+        entry->not_modified_lens[i] = 0;
+        entry->sidecar_fds[i] = -1;
+        entry->sidecar_checked[i] = 0;
+    }
+
+    struct tm tm_info;
+    gmtime_r(&entry->st.st_mtime, &tm_info);
+    strftime(entry->last_modified, sizeof(entry->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm_info);
+    snprintf(entry->content_length, sizeof(entry->content_length), "%ld", (long)entry->st.st_size);
+}
+
+void file_cache_init(int max, int valid) {
+    max_entries = max > 0 ? max : 0;
+    valid_seconds = valid >= 0 ? valid : FILE_CACHE_DEFAULT_VALID;
+    resolve_set_valid(valid_seconds);
+}
+
+/* the part of path below the host's root, NULL when it has no root
+ * handle; such a host serves nothing rather than opening the absolute
+ * path unconfined */
+static const char *relative_path(const char *path, const vhost_t *vhost) {
+    if (!vhost || vhost->root_fd == -1 || strncmp(path, vhost->root_dir, vhost->root_len) != 0) {
+        return NULL;
+    }
+    return path + vhost->root_len;
+}
+
+file_cache_entry_t *file_cache_open(const char *path, const vhost_t *vhost) {
+    size_t path_len = strlen(path);
+    if (path_len >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return NULL;
+    }
+    const char *rel = relative_path(path, vhost);
+    if (!rel) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    uint32_t hash = hash_path(path);
+    time_t now = time(NULL);
+
+    file_cache_entry_t *entry = buckets[hash & (FILE_CACHE_BUCKETS - 1)];
+    while (entry && !(entry->hash == hash && strcmp(entry->path, path) == 0)) {
+        entry = entry->next;
+    }
+
+    if (entry) {
+        if (now - entry->validated < valid_seconds) {
+            METRICS_INC(file_cache_hits);
+            lru_unlink(entry);
+            lru_push_front(entry);
+            entry->refs++;
+            return entry;
+        }
+
+        struct stat current;
+        int found = resolve_stat(vhost->root_fd, rel, &current);
+        if (found == 0 && same_file(&current, &entry->st)) {
+            entry->validated = now;
+            METRICS_INC(file_cache_hits);
+            lru_unlink(entry);
+            lru_push_front(entry);
+            entry->refs++;
+            return entry;
+        }
+
+        LOG_DEBUG("File changed on disk, reopening %s", path);
+        detach_entry(entry);
+        cache_invalidate(path);
+    }
+
+    METRICS_INC(file_cache_misses);
+    errno = 0;
+    int fd = resolve_open(vhost->root_fd, rel);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    entry = malloc(sizeof(file_cache_entry_t));
+    if (!entry) {
+        LOG_ERROR("Failed to allocate open file cache entry");
+        close(fd);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    int stated = resolve_fstat(fd, &entry->st);
+    if (stated == -1 || !S_ISREG(entry->st.st_mode)) {
+        int saved = errno;
+        if (saved == 0 || S_ISDIR(entry->st.st_mode)) {
+            saved = EISDIR;
+        }
+        close(fd);
+        free(entry);
+        errno = saved;
+        return NULL;
+    }
+
+    /* large files are read front to back by sendfile or the stream encoder,
+     * so let the kernel use a wider readahead window */
+    if (entry->st.st_size >= FILE_CACHE_SEQUENTIAL_SIZE) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    NX_PROBE3(file__open, path, fd, entry->st.st_size);
+
+    memcpy(entry->path, path, path_len + 1);
+    entry->hash = hash;
+    entry->fd = fd;
+    entry->validated = now;
+    entry->refs = 1;
+    entry->detached = 0;
+    entry->next = NULL;
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+    fill_metadata(entry);
+
+    if (max_entries == 0) {
+        entry->detached = 1;
+        return entry;
+    }
+
+    while (entry_count >= max_entries && lru_tail) {
+        detach_entry(lru_tail);
+    }
+
+    entry->next = buckets[hash & (FILE_CACHE_BUCKETS - 1)];
+    buckets[hash & (FILE_CACHE_BUCKETS - 1)] = entry;
+    lru_push_front(entry);
+    entry_count++;
+
+    return entry;
+}
+
+void file_cache_release(file_cache_entry_t *entry) {
+    if (!entry) {
+        return;
+    }
+
+    entry->refs--;
+    if (entry->refs == 0 && entry->detached) {
+        destroy_entry(entry);
+    }
+}
+
+const char *file_cache_not_modified(file_cache_entry_t *entry, compression_type_t type, size_t *len) {
+    if (!entry->not_modified[type]) {
+        char head[1024];
+        int head_len = snprintf(head, sizeof(head),
+                                "HTTP/1.1 304 Not Modified\r\nServer: NxLite\r\nETag: %s\r\nLast-Modified: %s\r\n"
+                                "Cache-Control: %s\r\nVary: Accept-Encoding\r\n",
+                                entry->etags[type], entry->last_modified, entry->cache_control);
+        if (head_len < 0 || (size_t)head_len >= sizeof(head) || !(entry->not_modified[type] = strdup(head))) {
+            return NULL;
+        }
+        entry->not_modified_lens[type] = head_len;
+    }
+    *len = entry->not_modified_lens[type];
+    return entry->not_modified[type];
+}
+
+int file_cache_sidecar(file_cache_entry_t *entry, compression_type_t type, const struct stat **st) {
+    if (entry->sidecar_fds[type] == -1 && entry->sidecar_checked[type] != entry->validated) {
+        entry->sidecar_checked[type] = entry->validated;
+        entry->sidecar_fds[type] = precompress_open(entry->path, &entry->st, type, &entry->sidecar_st[type]);
+    }
+    *st = &entry->sidecar_st[type];
+    return entry->sidecar_fds[type];
+}
+
+int file_cache_owns_fd(const file_cache_entry_t *entry, int fd) {
+    if (fd == entry->fd) {
+        return 1;
+    }
+    for (int i = 0; i < COMPRESSION_TYPE_COUNT; i++) {
+        if (fd == entry->sidecar_fds[i]) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void file_cache_invalidate(const char *path) {
+    uint32_t hash = hash_path(path);
+    file_cache_entry_t *entry = buckets[hash & (FILE_CACHE_BUCKETS - 1)];
+    while (entry && !(entry->hash == hash && strcmp(entry->path, path) == 0)) {
+        entry = entry->next;
+    }
+    if (entry) {
+        detach_entry(entry);
+    }
+}
+
+void file_cache_cleanup(void) {
+    while (lru_tail) {
+        detach_entry(lru_tail);
+    }
+    resolve_cleanup();
+}
+
+void file_cache_format_etag(const struct stat *st, compression_type_t type, char *etag, size_t size) {
+    const char *encoding = encoding_name(type);
+    snprintf(etag, size, "\"%lx-%lx-%lx%s%s\"",
+             (unsigned long)st->st_ino,
+             (unsigned long)st->st_size,
+             (unsigned long)st->st_mtime,
+             encoding ? "-" : "",
+             encoding ? encoding : "");
+}
+
+const char *file_cache_control(const char *path) {
+    const char *ext = strrchr(path, '.');
+    if (!ext) {
+        return "no-cache, no-store, must-revalidate";
+    }
+
+    if (strcasecmp(ext, ".css") == 0 || strcasecmp(ext, ".js") == 0) {
+        return "public, max-age=86400, must-revalidate";
+    } else if (strcasecmp(ext, ".png") == 0 ||
+               strcasecmp(ext, ".jpg") == 0 ||
+               strcasecmp(ext, ".jpeg") == 0 ||
+               strcasecmp(ext, ".gif") == 0 ||
+               strcasecmp(ext, ".ico") == 0) {
+        return "public, max-age=604800, immutable";
+    } else if (strcasecmp(ext, ".html") == 0 || strcasecmp(ext, ".htm") == 0) {
+        return "public, max-age=300, must-revalidate";
+    } else if (strcasecmp(ext, ".pdf") == 0 ||
+               strcasecmp(ext, ".doc") == 0 ||
+               strcasecmp(ext, ".docx") == 0) {
+        return "public, max-age=86400";
+    }
+
+    return "public, max-age=3600";
+}
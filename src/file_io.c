@@ -0,0 +1,280 @@
+#include "file_io.h"
+
+static int nowait_enabled = 0;
+static __thread unsigned char scratch[FILE_IO_SCRATCH_SIZE];
+
+static void disable_nowait(int err) {
+    if (nowait_enabled) {
+        LOG_WARN("RWF_NOWAIT reads unavailable (%s), file reads will block", strerror(err));
+        nowait_enabled = 0;
+    }
+}
+
+void file_io_enable_nowait(int enabled) {
+    nowait_enabled = enabled;
+}
+
+ssize_t file_io_read(int fd, void *buf, size_t len, off_t offset, int nowait) {
+    size_t done = 0;
+
+    while (done < len) {
+        ssize_t n;
+        if (nowait && nowait_enabled) {
+            struct iovec iov = {(char *)buf + done, len - done};
+            n = preadv2(fd, &iov, 1, offset + done, RWF_NOWAIT);
+            if (n == -1 && errno == EAGAIN) {
+                return done;
+            }
+            if (n == -1 && (errno == EOPNOTSUPP || errno == ENOSYS || errno == EINVAL)) {
+                disable_nowait(errno);
+                continue;
+            }
+        } else {
+            n = pread(fd, (char *)buf + done, len - done, offset + done);
+        }
+
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+
+    return done;
+}
+
+/* probes both ends of the range with one-byte RWF_NOWAIT reads; readahead
+ * fills pages in order, so a resident tail almost always means the middle
+ * is resident too */
+int file_io_resident(int fd, off_t offset, size_t len) {
+    if (!nowait_enabled || len == 0) {
+        return 1;
+    }
+
+    off_t probes[2] = {offset, offset + (off_t)len - 1};
+    for (int i = 0; i < 2; i++) {
+        char byte;
+        struct iovec iov = {&byte, 1};
+        if (preadv2(fd, &iov, 1, probes[i], RWF_NOWAIT) == -1) {
+            if (errno == EAGAIN) {
+                return 0;
+            }
+            if (errno == EOPNOTSUPP || errno == ENOSYS || errno == EINVAL) {
+                disable_nowait(errno);
+            }
+            return 1;
+        }
+    }
+
+    return 1;
+}
+
+int file_io_warm(int fd, off_t offset, size_t len) {
+    posix_fadvise(fd, offset, (off_t)len * FILE_IO_READAHEAD_WINDOWS, POSIX_FADV_WILLNEED);
+
+    size_t done = 0;
+    while (done < len) {
+        size_t want = len - done > sizeof(scratch) ? sizeof(scratch) : len - done;
+        ssize_t n = pread(fd, scratch, want, offset + done);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+
+    return 0;
+}
+
+static void *file_io_thread(void *arg) {
+    file_io_pool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->submit_head && !pool->stopping) {
+            pthread_cond_wait(&pool->pending, &pool->lock);
+        }
+        if (pool->stopping) {
+            break;
+        }
+
+        file_io_job_t *job = pool->submit_head;
+        pool->submit_head = job->next;
+        if (!pool->submit_head) {
+            pool->submit_tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        if (job->kind == FILE_IO_READ) {
+            ssize_t n = file_io_read(job->fd, (char *)job->buf + job->offset, job->length, job->offset, 0);
+            job->status = n == (ssize_t)job->length ? 0 : -1;
+        } else {
+            job->status = file_io_warm(job->fd, job->offset, job->length);
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        job->next = NULL;
+        if (pool->done_tail) {
+            pool->done_tail->next = job;
+        } else {
+            pool->done_head = job;
+        }
+        pool->done_tail = job;
+
+        uint64_t one = 1;
+        if (write(pool->event_fd, &one, sizeof(one)) != sizeof(one)) {
+            LOG_ERROR("Failed to signal file I/O completion: %s", strerror(errno));
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+file_io_pool_t *file_io_pool_create(int thread_count, size_t queue_limit) {
+    if (thread_count <= 0 || queue_limit == 0) {
+        return NULL;
+    }
+    if (thread_count > FILE_IO_MAX_THREADS) {
+        thread_count = FILE_IO_MAX_THREADS;
+    }
+
+    file_io_pool_t *pool = calloc(1, sizeof(file_io_pool_t));
+    if (!pool) {
+        LOG_ERROR("Failed to allocate file I/O pool");
+        return NULL;
+    }
+
+    pool->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pool->event_fd == -1) {
+        LOG_ERROR("Failed to create file I/O eventfd: %s", strerror(errno));
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->pending, NULL);
+    pool->queue_limit = queue_limit;
+
+    /* threads spend their time blocked in the page cache, so they keep the
+     * worker's CPU affinity and only need signals masked */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    for (int i = 0; i < thread_count; i++) {
+        if (pthread_create(&pool->threads[i], NULL, file_io_thread, pool) != 0) {
+            LOG_ERROR("Failed to start file I/O thread %d", i);
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (pool->thread_count == 0) {
+        file_io_pool_destroy(pool);
+        return NULL;
+    }
+
+    LOG_INFO("File I/O pool started: %d threads, queue limit %zu", pool->thread_count, queue_limit);
+    return pool;
+}
+
+int file_io_pool_event_fd(const file_io_pool_t *pool) {
+    return pool ? pool->event_fd : -1;
+}
+
+void file_io_pool_ack(file_io_pool_t *pool) {
+    uint64_t count;
+    while (read(pool->event_fd, &count, sizeof(count)) == -1 && errno == EINTR) {
+    }
+}
+
+int file_io_pool_submit(file_io_pool_t *pool, file_io_job_t *job) {
+    if (!pool || pool->inflight >= pool->queue_limit) {
+        return -1;
+    }
+
+    job->next = NULL;
+    pthread_mutex_lock(&pool->lock);
+    if (pool->submit_tail) {
+        pool->submit_tail->next = job;
+    } else {
+        pool->submit_head = job;
+    }
+    pool->submit_tail = job;
+    pthread_cond_signal(&pool->pending);
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->inflight++;
+    return 0;
+}
+
+file_io_job_t *file_io_pool_complete(file_io_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    file_io_job_t *job = pool->done_head;
+    if (job) {
+        pool->done_head = job->next;
+        if (!pool->done_head) {
+            pool->done_tail = NULL;
+        }
+        pool->inflight--;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return job;
+}
+
+void file_io_pool_destroy(file_io_pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->pending);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    file_io_job_t *job = pool->submit_head;
+    while (job) {
+        file_io_job_t *next = job->next;
+        file_io_job_free(job);
+        job = next;
+    }
+    job = pool->done_head;
+    while (job) {
+        file_io_job_t *next = job->next;
+        file_io_job_free(job);
+        job = next;
+    }
+
+    pthread_cond_destroy(&pool->pending);
+    pthread_mutex_destroy(&pool->lock);
+    close(pool->event_fd);
+    free(pool);
+}
+
+void file_io_job_free(file_io_job_t *job) {
+    if (!job) {
+        return;
+    }
+    if (job->fd != -1) {
+        close(job->fd);
+    }
+    free(job->buf);
+    free(job);
+}
@@ -1,4 +1,17 @@
 #include "http.h"
+#include "encoding.h"
+#include "cache.h"
+#include "stream.h"
+#include "metrics.h"
+#include "latency.h"
+#include "compress_ctl.h"
+#include "file_cache.h"
+#include "file_io.h"
+#include "vhost.h"
+#include "manifest.h"
+#include "conditional.h"
+#include "probes.h"
+#include <sys/uio.h>
 
 
 static const struct {
@@ -6,11 +19,16 @@ static const struct {
     const char *text;
 } status_messages[] = {
     {200, "OK"},
+    {206, "Partial Content"},
     {400, "Bad Request"},
     {403, "Forbidden"},
     {404, "Not Found"},
+    {411, "Length Required"},
+    {416, "Range Not Satisfiable"},
     {500, "Internal Server Error"},
     {501, "Not Implemented"},
+    {502, "Bad Gateway"},
+    {504, "Gateway Timeout"},
     {505, "HTTP Version Not Supported"},
     {0, NULL}
 };
@@ -34,90 +52,10 @@ static const struct {
     {NULL, "application/octet-stream"}
 };
 
-#define CACHE_SIZE 10000    
-#define CACHE_TIMEOUT 3600      
-
 static char header_buffer[8192];
 
-typedef struct {
-    char path[PATH_MAX];
-    char *response;
-    size_t response_len;
-    time_t timestamp;
-    char vary_key[256];  
-} cache_entry_t;
-
-static cache_entry_t response_cache[CACHE_SIZE];
-static int cache_index = 0;
-
-static void generate_vary_key(const char *path, const http_request_t *request, char *key, size_t key_size) {
-    if (!request) {
-        strncpy(key, path, key_size - 1);
-        key[key_size - 1] = '\0';
-        return;
-    }
-    
-    snprintf(key, key_size, "%s:", path);
-    
-    for (int i = 0; i < request->header_count; i++) {
-        if (strcasecmp(request->headers[i][0], "User-Agent") == 0) {
-            size_t current_len = strlen(key);
-            snprintf(key + current_len, key_size - current_len, "UA:%s:", request->headers[i][1]);
-            break;
-        }
-    }
-    
-    for (int i = 0; i < request->header_count; i++) {
-        if (strcasecmp(request->headers[i][0], "Accept-Encoding") == 0) {
-            size_t current_len = strlen(key);
-            snprintf(key + current_len, key_size - current_len, "AE:%s", request->headers[i][1]);
-            break;
-        }
-    }
-}
-
-static cache_entry_t *find_cached_response(const char *path, const http_request_t *request) {
-    char vary_key[256];
-    generate_vary_key(path, request, vary_key, sizeof(vary_key));
-    
-    for (int i = 0; i < CACHE_SIZE; i++) {
-        if (response_cache[i].path[0] != '\0' && 
-            strcmp(response_cache[i].path, path) == 0 &&
-            strcmp(response_cache[i].vary_key, vary_key) == 0 &&
-            time(NULL) - response_cache[i].timestamp < CACHE_TIMEOUT) {
-            LOG_DEBUG("Cache hit for %s with vary key %s", path, vary_key);
-            return &response_cache[i];
-        }
-    }
-    LOG_DEBUG("Cache miss for %s with vary key %s", path, vary_key);
-    return NULL;
-}
-
-static void cache_response(const char *path, const char *response, size_t response_len, const http_request_t *request) {
-    cache_entry_t *entry = &response_cache[cache_index];
-    
-    if (entry->response) {
-        free(entry->response);
-        entry->response = NULL;
-    }
-    
-    strncpy(entry->path, path, PATH_MAX - 1);
-    entry->path[PATH_MAX - 1] = '\0';
-    
-    generate_vary_key(path, request, entry->vary_key, sizeof(entry->vary_key));
-    
-    entry->response = malloc(response_len);
-    if (entry->response) {
-        memcpy(entry->response, response, response_len);
-        entry->response_len = response_len;
-        entry->timestamp = time(NULL);
-        LOG_DEBUG("Cached response for %s with vary key %s", path, entry->vary_key);
-    } else {
-        LOG_ERROR("Failed to allocate memory for cached response");
-    }
-    
-    cache_index = (cache_index + 1) % CACHE_SIZE;
-}
+#define CACHED_KEEP_ALIVE "Connection: keep-alive\r\n\r\n"
+#define CACHED_CLOSE "Connection: close\r\n\r\n"
 
 int http_parse_request(const char *buffer, size_t length, http_request_t *request) {
     char *line_start = (char *)buffer;
@@ -146,14 +84,23 @@ int http_parse_request(const char *buffer, size_t length, http_request_t *reques
         
         if (line_end == line_start) break;
         
-        char *colon = strchr(line_start, ':');
+        char *colon = memchr(line_start, ':', line_end - line_start);
         if (colon) {
             *colon = '\0';
             char *value = colon + 1;
-            while (*value == ' ') value++;
+            while (*value == ' ' || *value == '\t') value++;
+            
+            size_t value_len = line_end - value;
+            while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t')) {
+                value_len--;
+            }
+            if (value_len > MAX_HEADER_SIZE - 1) {
+                value_len = MAX_HEADER_SIZE - 1;
+            }
             
             strncpy(request->headers[request->header_count][0], line_start, MAX_HEADER_SIZE - 1);
-            strncpy(request->headers[request->header_count][1], value, MAX_HEADER_SIZE - 1);
+            memcpy(request->headers[request->header_count][1], value, value_len);
+            request->headers[request->header_count][1][value_len] = '\0';
             
             if (strcasecmp(line_start, "Connection") == 0) {
                 LOG_DEBUG("Found Connection header: %s", value);
@@ -227,204 +174,352 @@ const char *http_get_mime_type(const char *path) {
     return mime_types[0].type;
 }
 
-int http_serve_file(const char *path, http_response_t *response, const http_request_t *request) {
-    char full_path[PATH_MAX];
+static void cache_full_response(const char *path, compression_type_t encoding, 
+                                const http_response_t *response, const void *body, size_t body_len) {
+    char header[4096];
+    int header_len = 0;
     
-    strncpy(full_path, path, PATH_MAX - 1);
-    full_path[PATH_MAX - 1] = '\0';
+    header_len += snprintf(header + header_len, sizeof(header) - header_len,
+                          "HTTP/1.1 200 OK\r\n");
     
-    size_t path_len = strlen(full_path);
-    if (full_path[path_len - 1] == '/') {
-        strncat(full_path, "index.html", PATH_MAX - path_len - 1);
+    for (int i = 0; i < response->header_count && (size_t)header_len < sizeof(header); i++) {
+        header_len += snprintf(header + header_len, sizeof(header) - header_len,
+                             "%s: %s\r\n", 
+                             response->headers[i][0], 
+                             response->headers[i][1]);
     }
     
-    LOG_DEBUG("Serving file: %s", full_path);
+    if ((size_t)header_len < sizeof(header)) {
+        header_len += snprintf(header + header_len, sizeof(header) - header_len,
+                              "%s", CACHED_KEEP_ALIVE);
+    }
     
-    cache_entry_t *cache = find_cached_response(full_path, request);
-    if (cache) {
-        LOG_DEBUG("Using cached response for %s", full_path);
-        response->is_cached = 1;
-        response->cached_response = cache->response;
-        response->body_length = cache->response_len;
+    if ((size_t)header_len >= sizeof(header)) {
+        LOG_WARN("Response headers too large to cache for %s", path);
+        return;
+    }
+    
+    cache_store(path, response->vhost ? response->vhost->id : 0, encoding, header, header_len, body, body_len);
+}
+
+static void use_cached_response(http_response_t *response, cache_variant_t *cache) {
+    response->is_cached = 1;
+    response->cached_response = cache->response;
+    response->body_length = cache->response_len;
+    response->cache = cache;
+    cache_variant_ref(cache);
+}
+
+static size_t offload_min_size = 0;
+
+void http_set_offload_threshold(size_t min_size) {
+    offload_min_size = min_size;
+}
+
+static void finish_file_response(http_response_t *response, int has_sidecar);
+
+/* parses a bytes Range header against a representation of `size` bytes.
+ * Returns the number of satisfiable ranges, 0 when the header has to be
+ * ignored (other units, bad syntax, too many ranges) and -1 when none of
+ * the ranges is satisfiable */
+static int parse_ranges(const char *value, off_t size, http_range_t *ranges) {
+    while (*value == ' ' || *value == '\t') value++;
+    if (strncasecmp(value, "bytes", 5) != 0) {
+        return 0;
+    }
+    value += 5;
+    while (*value == ' ' || *value == '\t') value++;
+    if (*value++ != '=') {
         return 0;
     }
     
-    int file_fd = open(full_path, O_RDONLY | O_NONBLOCK);
-    if (file_fd == -1) {
-        LOG_WARN("Failed to open file %s: %s", full_path, strerror(errno));
-        return -1;
+    int count = 0;
+    int seen = 0;
+    const char *p = value;
+    for (;;) {
+        while (*p == ' ' || *p == '\t' || *p == ',') p++;
+        if (*p == '\0') {
+            break;
+        }
+        if (++seen > HTTP_MAX_RANGES) {
+            return 0;
+        }
+        
+        char *next;
+        long long start = -1;
+        long long end = -1;
+        if (*p == '-') {
+            if (!isdigit((unsigned char)p[1])) {
+                return 0;
+            }
+            long long suffix = strtoll(p + 1, &next, 10);
+            if (suffix > 0 && size > 0) {
+                start = suffix >= size ? 0 : size - suffix;
+                end = size - 1;
+            }
+        } else {
+            if (!isdigit((unsigned char)*p)) {
+                return 0;
+            }
+            long long first = strtoll(p, &next, 10);
+            if (*next++ != '-') {
+                return 0;
+            }
+            long long last = -1;
+            if (isdigit((unsigned char)*next)) {
+                last = strtoll(next, &next, 10);
+                if (last < first) {
+                    return 0;
+                }
+            }
+            if (first < size) {
+                start = first;
+                end = (last == -1 || last >= size) ? size - 1 : last;
+            }
+        }
+        
+        if (start != -1) {
+            ranges[count].start = start;
+            ranges[count].end = end;
+            count++;
+        }
+        
+        p = next;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p != ',' && *p != '\0') {
+            return 0;
+        }
     }
     
-    struct stat st;
-    if (fstat(file_fd, &st) == -1) {
-        LOG_ERROR("Failed to stat file %s: %s", full_path, strerror(errno));
-        close(file_fd);
-        return -1;
+    if (seen == 0) {
+        return 0;
+    }
+    return count > 0 ? count : -1;
+}
+
+/* If-Range only allows strong comparison: an exact ETag or the exact
+ * Last-Modified date */
+static int if_range_matches(const char *if_range, const char *etag, const char *last_modified) {
+    if (if_range[0] == 'W' && if_range[1] == '/') {
+        return 0;
+    }
+    if (if_range[0] == '"') {
+        return strcmp(if_range, etag) == 0;
+    }
+    return strcmp(if_range, last_modified) == 0;
+}
+
+static int format_range_part(const http_response_t *response, int index, char *buf, size_t size) {
+    if (index == response->range_count) {
+        return snprintf(buf, size, "\r\n--%s--\r\n", response->range_boundary);
     }
     
-    if (!S_ISREG(st.st_mode)) {
-        LOG_WARN("Not a regular file: %s", full_path);
-        close(file_fd);
-        return -1;
+    return snprintf(buf, size, "\r\n--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n",
+                    response->range_boundary, response->file->mime_type,
+                    (long long)response->ranges[index].start, (long long)response->ranges[index].end,
+                    (long long)response->file->st.st_size);
+}
+
+/* 206 for the identity representation. A cached copy of the file is
+ * sliced in place, otherwise the ranges are sendfile'd from the open
+ * file cache descriptor */
+static void serve_ranges(http_response_t *response, cache_variant_t *cache) {
+    const file_cache_entry_t *file = response->file;
+    char value[128];
+    
+    response->status_code = 206;
+    response->status_text = "Partial Content";
+    
+    if (cache && cache->response_len - cache->header_len == (size_t)file->st.st_size) {
+        response->range_body = cache->response + cache->header_len;
+        response->cache = cache;
+        cache_variant_ref(cache);
+    } else {
+        response->file_fd = file->fd;
+        response->is_file = 1;
     }
     
-    const char *mime_type = http_get_mime_type(full_path);
-    http_add_header(response, "Content-Type", mime_type);
-    
-    int is_compressible = http_should_compress_mime_type(mime_type);
-    
-    if (is_compressible && response->compression_type != COMPRESSION_NONE && st.st_size <= 10 * 1024 * 1024) {
-        void *file_content = malloc(st.st_size);
-        if (file_content) {
-            ssize_t bytes_read = pread(file_fd, file_content, st.st_size, 0);
-            if (bytes_read == st.st_size) {
-                response->body = file_content;
-                response->body_length = st.st_size;
-                response->is_file = 0;
-                close(file_fd);
-                
-                int compression_level = COMPRESSION_LEVEL_DEFAULT;
-                
-                if (strncasecmp(mime_type, "text/html", 9) == 0 || 
-                    strncasecmp(mime_type, "text/css", 8) == 0 ||
-                    strncasecmp(mime_type, "application/javascript", 22) == 0) {
-                    compression_level = COMPRESSION_LEVEL_DEFAULT;
-                }
-                else if (strncasecmp(mime_type, "image/", 6) == 0 ||
-                        strncasecmp(mime_type, "application/octet-stream", 24) == 0) {
-                    compression_level = COMPRESSION_LEVEL_MIN;
-                }
-                else if (strncasecmp(mime_type, "application/font", 16) == 0 ||
-                        strncasecmp(mime_type, "image/svg+xml", 13) == 0) {
-                    compression_level = COMPRESSION_LEVEL_MAX;
-                }
-                
-                if (http_compress_content(response, response->compression_type, compression_level) == 0) {
-                    if (response->compression_type == COMPRESSION_GZIP) {
-                        http_add_header(response, "Content-Encoding", "gzip");
-                        LOG_DEBUG("Applied gzip compression: %zu bytes -> %zu bytes", 
-                                  response->body_length, response->compressed_length);
-                    } else if (response->compression_type == COMPRESSION_DEFLATE) {
-                        http_add_header(response, "Content-Encoding", "deflate");
-                        LOG_DEBUG("Applied deflate compression: %zu bytes -> %zu bytes", 
-                                  response->body_length, response->compressed_length);
-                    }
-                    
-                    char content_length[32];
-                    snprintf(content_length, sizeof(content_length), "%zu", response->compressed_length);
-                    http_add_header(response, "Content-Length", content_length);
-                } else {
-                    char content_length[32];
-                    snprintf(content_length, sizeof(content_length), "%zu", response->body_length);
-                    http_add_header(response, "Content-Length", content_length);
-                }
-            } else {
-                free(file_content);
-                response->body_length = st.st_size;
-                response->file_fd = file_fd;
-                response->is_file = 1;
-                
-                char content_length[32];
-                snprintf(content_length, sizeof(content_length), "%ld", (long)st.st_size);
-                http_add_header(response, "Content-Length", content_length);
+    long long content_length;
+    if (response->range_count == 1) {
+        http_add_header(response, "Content-Type", file->mime_type);
+        snprintf(value, sizeof(value), "bytes %lld-%lld/%lld",
+                 (long long)response->ranges[0].start, (long long)response->ranges[0].end,
+                 (long long)file->st.st_size);
+        http_add_header(response, "Content-Range", value);
+        content_length = response->ranges[0].end - response->ranges[0].start + 1;
+    } else {
+        static unsigned long boundary_seq = 0;
+        snprintf(response->range_boundary, sizeof(response->range_boundary), "%08lx%08lx",
+                 (unsigned long)(file->st.st_ino ^ file->st.st_mtime) & 0xffffffffUL, ++boundary_seq);
+        snprintf(value, sizeof(value), "multipart/byteranges; boundary=%s", response->range_boundary);
+        http_add_header(response, "Content-Type", value);
+        
+        content_length = 0;
+        for (int i = 0; i <= response->range_count; i++) {
+            content_length += format_range_part(response, i, response->range_part, sizeof(response->range_part));
+            if (i < response->range_count) {
+                content_length += response->ranges[i].end - response->ranges[i].start + 1;
             }
-        } else {
-            response->body_length = st.st_size;
-            response->file_fd = file_fd;
-            response->is_file = 1;
-            
-            char content_length[32];
-            snprintf(content_length, sizeof(content_length), "%ld", (long)st.st_size);
-            http_add_header(response, "Content-Length", content_length);
         }
+    }
+    
+    snprintf(value, sizeof(value), "%lld", content_length);
+    http_add_header(response, "Content-Length", value);
+    http_add_header(response, "Accept-Ranges", "bytes");
+    http_add_header(response, "Last-Modified", file->last_modified);
+    http_add_header(response, "ETag", file->etags[COMPRESSION_NONE]);
+    http_add_header(response, "Cache-Control", file->cache_control);
+    
+    response->range_index = 0;
+    response->range_part_len = 0;
+    response->file_offset = response->ranges[0].start;
+    
+    LOG_DEBUG("Serving %d range(s) of %s from %s", response->range_count, file->path,
+              response->range_body ? "the response cache" : "disk");
+}
+
+/* compresses a fully loaded body inline, or returns 1 to leave it to the
+ * worker's compression pool */
+static int compress_loaded_body(http_response_t *response, int can_offload) {
+    if (can_offload && offload_min_size > 0 && response->body_length >= offload_min_size) {
+        response->deferred = HTTP_DEFER_COMPRESS;
+        LOG_DEBUG("Deferring %s compression of %s (%zu bytes)",
+                  encoding_name(response->compression_type), response->file->path, response->body_length);
+        return 1;
+    }
+    
+    char content_length[32];
+    if (http_compress_content(response, response->compression_type, response->compression_level) == 0) {
+        http_add_header(response, "Content-Encoding", encoding_name(response->compression_type));
+        LOG_DEBUG("Applied %s compression: %zu bytes -> %zu bytes", 
+                  encoding_name(response->compression_type),
+                  response->body_length, response->compressed_length);
+        snprintf(content_length, sizeof(content_length), "%zu", response->compressed_length);
     } else {
-        response->body_length = st.st_size;
-        response->file_fd = file_fd;
+        snprintf(content_length, sizeof(content_length), "%zu", response->body_length);
+    }
+    http_add_header(response, "Content-Length", content_length);
+    return 0;
+}
+
+int http_serve_file(file_cache_entry_t *file, cache_variant_t *cache, http_response_t *response,
+                    const http_request_t *request) {
+    const char *full_path = file->path;
+    LOG_DEBUG("Serving file: %s", full_path);
+    response->file = file;
+    
+    if (response->range_count > 0) {
+        serve_ranges(response, cache);
+        return 0;
+    }
+    if (cache) {
+        LOG_DEBUG("Using cached response for %s", full_path);
+        use_cached_response(response, cache);
+        return 0;
+    }
+    
+    const struct stat *st = &file->st;
+    http_add_header(response, "Content-Type", file->mime_type);
+    
+    int is_compressible = http_should_compress_mime_type(file->mime_type);
+    
+    int sidecar_fd = -1;
+    const struct stat *sidecar_st = NULL;
+    if (is_compressible && response->compression_type != COMPRESSION_NONE) {
+        sidecar_fd = file_cache_sidecar(file, response->compression_type, &sidecar_st);
+    }
+    
+    int can_defer = request && strcmp(request->method, "GET") == 0;
+    ssize_t loaded;
+    int compression_level = COMPRESSION_LEVEL_NONE;
+    if (sidecar_fd == -1 && is_compressible && response->compression_type != COMPRESSION_NONE) {
+        compression_level = compress_ctl_level(file->mime_type, response->compression_type, st->st_size);
+        if (response->vhost && compression_level > response->vhost->compress_level_max) {
+            compression_level = response->vhost->compress_level_max;
+        }
+    }
+    
+    if (sidecar_fd != -1) {
+        response->file_fd = sidecar_fd;
         response->is_file = 1;
+        response->body_length = sidecar_st->st_size;
+        http_add_header(response, "Content-Encoding", encoding_name(response->compression_type));
         
         char content_length[32];
-        snprintf(content_length, sizeof(content_length), "%ld", (long)st.st_size);
+        snprintf(content_length, sizeof(content_length), "%ld", (long)sidecar_st->st_size);
         http_add_header(response, "Content-Length", content_length);
-    }
-    
-    char last_modified[64];
-    struct tm *tm_info = gmtime(&st.st_mtime);
-    strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", tm_info);
-    http_add_header(response, "Last-Modified", last_modified);
-    
-    char etag[64];
-    snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx\"", 
-             (unsigned long)st.st_ino, 
-             (unsigned long)st.st_size, 
-             (unsigned long)st.st_mtime);
-    http_add_header(response, "ETag", etag);
-    
-    http_add_header(response, "Vary", "Accept-Encoding, User-Agent");
-    
-    const char *ext = strrchr(full_path, '.');
-    if (ext) {
-        if (strcasecmp(ext, ".css") == 0 || strcasecmp(ext, ".js") == 0) {
-            http_add_header(response, "Cache-Control", "public, max-age=86400, must-revalidate");
-        } 
-        else if (strcasecmp(ext, ".png") == 0 || 
-                 strcasecmp(ext, ".jpg") == 0 || 
-                 strcasecmp(ext, ".jpeg") == 0 || 
-                 strcasecmp(ext, ".gif") == 0 || 
-                 strcasecmp(ext, ".ico") == 0) {
-            http_add_header(response, "Cache-Control", "public, max-age=604800, immutable");
-        }
-        else if (strcasecmp(ext, ".html") == 0 || strcasecmp(ext, ".htm") == 0) {
-            http_add_header(response, "Cache-Control", "public, max-age=300, must-revalidate");
-        }
-        else if (strcasecmp(ext, ".pdf") == 0 || 
-                 strcasecmp(ext, ".doc") == 0 || 
-                 strcasecmp(ext, ".docx") == 0) {
-            http_add_header(response, "Cache-Control", "public, max-age=86400");
-        }
-        else {
-            http_add_header(response, "Cache-Control", "public, max-age=3600");
+    } else if (compression_level != COMPRESSION_LEVEL_NONE &&
+               st->st_size >= STREAM_COMPRESS_THRESHOLD && request && 
+               strcmp(request->version, "HTTP/1.1") == 0 &&
+               (response->stream = stream_create(file->fd, st->st_size, response->compression_type,
+                                                 compression_level)) != NULL) {
+        http_add_header(response, "Content-Encoding", encoding_name(response->compression_type));
+        http_add_header(response, "Transfer-Encoding", "chunked");
+        LOG_DEBUG("Streaming %s compression for %s (%ld bytes)", 
+                  encoding_name(response->compression_type), full_path, (long)st->st_size);
+    } else if (compression_level != COMPRESSION_LEVEL_NONE && st->st_size < STREAM_COMPRESS_THRESHOLD &&
+               (response->body = malloc(st->st_size)) != NULL &&
+               (loaded = file_io_read(file->fd, response->body, st->st_size, 0, can_defer)) >= 0 &&
+               (loaded == st->st_size || can_defer)) {
+        response->body_length = st->st_size;
+        response->compression_level = compression_level;
+        
+        if (loaded < st->st_size) {
+            response->deferred = HTTP_DEFER_READ;
+            response->io_fd = file->fd;
+            response->io_offset = loaded;
+            response->io_length = st->st_size - loaded;
+            LOG_DEBUG("Deferring cold read of %s (%ld of %ld bytes resident)",
+                      full_path, (long)loaded, (long)st->st_size);
+            return 0;
         }
         
-        if (st.st_size < 1024 * 1024 && response->compressed_body == NULL) {
-            char *file_content = malloc(st.st_size);
-            if (file_content) {
-                ssize_t bytes_read = pread(file_fd, file_content, st.st_size, 0);
-                if (bytes_read == st.st_size) {
-                    char header[4096];
-                    int header_len = 0;
-                    
-                    header_len += snprintf(header + header_len, sizeof(header) - header_len,
-                                          "HTTP/1.1 200 OK\r\n");
-                    
-                    for (int i = 0; i < response->header_count; i++) {
-                        header_len += snprintf(header + header_len, sizeof(header) - header_len,
-                                             "%s: %s\r\n", 
-                                             response->headers[i][0], 
-                                             response->headers[i][1]);
-                    }
-                    
-                    header_len += snprintf(header + header_len, sizeof(header) - header_len,
-                                          "Connection: keep-alive\r\n");
-                    
-                    header_len += snprintf(header + header_len, sizeof(header) - header_len, "\r\n");
-                    
-                    char *complete_response = malloc(header_len + st.st_size);
-                    if (complete_response) {
-                        memcpy(complete_response, header, header_len);
-                        memcpy(complete_response + header_len, file_content, st.st_size);
-                        cache_response(full_path, complete_response, header_len + st.st_size, request);
-                        free(complete_response);
-                    }
-                }
-                free(file_content);
-            }
+        if (compress_loaded_body(response, can_defer)) {
+            return 0;
         }
     } else {
-        http_add_header(response, "Cache-Control", "no-cache, no-store, must-revalidate");
+        free(response->body);
+        response->body = NULL;
+        response->body_length = st->st_size;
+        response->file_fd = file->fd;
+        response->is_file = 1;
+        http_add_header(response, "Content-Length", file->content_length);
     }
     
+    finish_file_response(response, sidecar_fd != -1);
     return 0;
 }
+static void finish_file_response(http_response_t *response, int has_sidecar) {
+    const file_cache_entry_t *file = response->file;
+    
+    http_add_header(response, "Last-Modified", file->last_modified);
+    
+    compression_type_t applied = (has_sidecar || response->compressed_body || response->stream) ? 
+                                 response->compression_type : COMPRESSION_NONE;
+    http_add_header(response, "ETag", file->etags[applied]);
+    http_add_header(response, "Vary", "Accept-Encoding");
+    http_add_header(response, "Accept-Ranges", "bytes");
+    http_add_header(response, "Cache-Control", file->cache_control);
+    
+    if (strrchr(file->path, '.') && file->st.st_size < CACHE_MAX_FILE_SIZE && !has_sidecar && !response->stream) {
+        const void *body = response->compressed_body ? response->compressed_body : response->body;
+        size_t body_len = response->compressed_body ? response->compressed_length : response->body_length;
+        char *file_content = NULL;
+        
+        if (!body) {
+            file_content = malloc(file->st.st_size);
+            if (file_content && file_io_read(file->fd, file_content, file->st.st_size, 0, 1) == file->st.st_size) {
+                body = file_content;
+                body_len = file->st.st_size;
+            }
+        }
+        
+        if (body) {
+            cache_full_response(file->path, applied, response, body, body_len);
+        }
+        free(file_content);
+    }
+}
 
 int http_should_keep_alive(const http_request_t *request) {
     if (strcmp(request->version, "HTTP/1.1") == 0) {
@@ -459,177 +554,389 @@ int http_should_keep_alive(const http_request_t *request) {
     return 0;
 }
 
-int http_send_response(int client_fd, http_response_t *response) {
-    if (response->is_cached && response->cached_response) {
-        ssize_t total_sent = 0;
-        size_t remaining = response->body_length;
-        const char *ptr = response->cached_response;
+static int send_buffer(int client_fd, const char *buf, size_t len, size_t *offset, int flags, const char *what) {
+    while (*offset < len) {
+        ssize_t sent = send(client_fd, buf + *offset, len - *offset, flags | MSG_NOSIGNAL);
+        if (sent == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            } else if (errno == EINTR) {
+                continue;
+            } else if (errno == EPIPE || errno == ECONNRESET) {
+                LOG_DEBUG("Client disconnected during %s send: %s", what, strerror(errno));
+                return -1;
+            }
+            LOG_ERROR("Failed to send %s: %s", what, strerror(errno));
+            return -1;
+        }
+        *offset += sent;
+        METRICS_ADD(bytes_out, sent);
+    }
+    
+    return 1;
+}
+
+/* sendfile from fd between response->file_offset and end; memfd-backed
+ * cache bodies skip the page cache residency probe */
+static int send_file_range(int client_fd, http_response_t *response, int fd, off_t end, int probe) {
+    off_t offset = response->file_offset;
+    const size_t CHUNK_SIZE = 1024 * 1024;
+    
+    while (offset < end) {
+        size_t remaining = end - offset;
+        size_t to_send = (remaining > CHUNK_SIZE) ? CHUNK_SIZE : remaining;
+        if (probe && !file_io_resident(fd, offset, to_send)) {
+            response->file_offset = offset;
+            response->io_fd = fd;
+            response->io_offset = offset;
+            response->io_length = to_send;
+            return HTTP_SEND_FILE_IO;
+        }
         
-        while (remaining > 0) {
-            ssize_t sent = send(client_fd, ptr + total_sent, remaining, MSG_NOSIGNAL);
-            if (sent <= 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    return 0;  
-                } else if (errno == EPIPE || errno == ECONNRESET) {
-                    LOG_DEBUG("Client disconnected during send: %s", strerror(errno));
-                    return -1;
-                }
-                LOG_ERROR("Failed to send cached response: %s", strerror(errno));
+        ssize_t sent = sendfile(client_fd, fd, &offset, to_send);
+        if (sent <= 0) {
+            if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                response->file_offset = offset;
+                return 0;  
+            } else if (sent == -1 && (errno == EPIPE || errno == ECONNRESET)) {
+                LOG_DEBUG("Client disconnected during file send: %s", strerror(errno));
                 return -1;
             }
+            LOG_ERROR("Failed to send file: %s", sent == 0 ? "unexpected end of file" : strerror(errno));
+            return -1;
+        }
+        METRICS_ADD(bytes_out, sent);
+    }
+    response->file_offset = offset;
+    
+    return 1;
+}
+
+static int send_range_data(int client_fd, http_response_t *response, int flags) {
+    off_t end = response->ranges[response->range_index].end + 1;
+    if (!response->range_body) {
+        return send_file_range(client_fd, response, response->file_fd, end, 1);
+    }
+    
+    size_t offset = response->file_offset;
+    int result = send_buffer(client_fd, response->range_body, end, &offset, flags, "cached range");
+    response->file_offset = offset;
+    return result;
+}
+
+/* a single range is sent bare; several are framed as multipart/byteranges
+ * with each part header built just before its data */
+static int send_ranges(int client_fd, http_response_t *response) {
+    int multipart = response->range_count > 1;
+    
+    while (response->range_index < response->range_count + multipart) {
+        int index = response->range_index;
+        int last = index == response->range_count;
+        
+        if (multipart) {
+            if (response->range_part_len == 0) {
+                response->range_part_len = format_range_part(response, index, response->range_part,
+                                                              sizeof(response->range_part));
+                response->body_offset = 0;
+                if (!last) {
+                    response->file_offset = response->ranges[index].start;
+                }
+            }
             
-            total_sent += sent;
-            remaining -= sent;
+            int result = send_buffer(client_fd, response->range_part, response->range_part_len,
+                                     &response->body_offset, last ? 0 : MSG_MORE, "range part header");
+            if (result != 1) {
+                return result;
+            }
+            if (last) {
+                response->range_index++;
+                break;
+            }
         }
         
-        return 1;  
+        int result = send_range_data(client_fd, response, multipart ? MSG_MORE : 0);
+        if (result != 1) {
+            return result;
+        }
+        response->range_index++;
+        response->range_part_len = 0;
     }
     
-    int header_len = 0;
+    return 1;
+}
+
+/* serializes the status line, headers and connection header; output is
+ * truncated, never overrun, when size is too small */
+size_t http_format_headers(const http_response_t *response, char *buf, size_t size) {
+    size_t len = 0;
+    
+    len += snprintf(buf + len, size - len, "HTTP/1.1 %d %s\r\n", 
+                    response->status_code, 
+                    response->status_text ? response->status_text : "Unknown");
+    
+    for (int i = 0; i < response->header_count && len < size; i++) {
+        len += snprintf(buf + len, size - len, "%s: %s\r\n", 
+                        response->headers[i][0], 
+                        response->headers[i][1]);
+    }
     
-    header_len += snprintf(header_buffer + header_len, sizeof(header_buffer) - header_len,
-                          "HTTP/1.1 %d %s\r\n", 
-                          response->status_code, 
-                          response->status_text ? response->status_text : "Unknown");
+    if (response->timing.sampled && len < size) {
+        len += latency_format_server_timing(response, buf + len, size - len);
+    }
     
-    for (int i = 0; i < response->header_count; i++) {
-        header_len += snprintf(header_buffer + header_len, sizeof(header_buffer) - header_len,
-                              "%s: %s\r\n", 
-                              response->headers[i][0], 
-                              response->headers[i][1]);
+    if (len < size) {
+        len += snprintf(buf + len, size - len, "Connection: %s\r\n\r\n",
+                        response->keep_alive ? "keep-alive" : "close");
     }
     
-    if (response->keep_alive) {
-        header_len += snprintf(header_buffer + header_len, sizeof(header_buffer) - header_len,
-                              "Connection: keep-alive\r\n");
-    } else {
-        header_len += snprintf(header_buffer + header_len, sizeof(header_buffer) - header_len,
-                              "Connection: close\r\n");
+    return len < size ? len : size - 1;
+}
+
+/* stored headers always end in keep-alive; a connection that closes after
+ * this response gets them with the last line swapped, rebuilt on every
+ * attempt like the uncached headers so a partial send can resume */
+static int send_cached_close_headers(int client_fd, http_response_t *response) {
+    const cache_variant_t *cache = response->cache;
+    size_t keep_len = sizeof(CACHED_KEEP_ALIVE) - 1;
+    size_t close_len = sizeof(CACHED_CLOSE) - 1;
+    if (cache->header_len < keep_len || cache->header_len - keep_len + close_len > sizeof(header_buffer) ||
+        memcmp(cache->response + cache->header_len - keep_len, CACHED_KEEP_ALIVE, keep_len) != 0) {
+        return 1;
     }
     
-    header_len += snprintf(header_buffer + header_len, sizeof(header_buffer) - header_len, "\r\n");
+    size_t prefix_len = cache->header_len - keep_len;
+    memcpy(header_buffer, cache->response, prefix_len);
+    memcpy(header_buffer + prefix_len, CACHED_CLOSE, close_len);
     
-    if (response->is_file && response->file_fd >= 0) {
-        ssize_t sent = send(client_fd, header_buffer, header_len, MSG_MORE | MSG_NOSIGNAL);
-        if (sent != header_len) {
+    int result = send_buffer(client_fd, header_buffer, prefix_len + close_len, &response->header_offset,
+                             response->body_length > cache->header_len ? MSG_MORE : 0, "cached headers");
+    if (result == 1) {
+        response->headers_sent = 1;
+        response->body_offset = cache->header_len;
+        response->file_offset = cache->header_len;
+    }
+    return result;
+}
+
+/* the prebuilt head, the connection line and an inline body leave in one
+ * sendmsg; a manifest body kept on disk follows with sendfile */
+static int send_prebuilt(int client_fd, http_response_t *response) {
+    const manifest_rep_t *rep = response->prebuilt;
+    const char *connection = response->keep_alive ? CACHED_KEEP_ALIVE : CACHED_CLOSE;
+    const char *body = rep && response->body_length > 0 ? rep->body : NULL;
+    int file_body = rep && !rep->body && response->body_length > 0;
+    
+    struct iovec parts[3] = {
+        { (void *)response->head, response->head_len },
+        { (void *)connection, strlen(connection) },
+        { (void *)body, body ? response->body_length : 0 },
+    };
+    size_t total = parts[0].iov_len + parts[1].iov_len + parts[2].iov_len;
+    
+    while (response->header_offset < total) {
+        struct iovec iov[3];
+        int count = 0;
+        size_t skip = response->header_offset;
+        for (int i = 0; i < 3; i++) {
+            if (skip >= parts[i].iov_len) {
+                skip -= parts[i].iov_len;
+                continue;
+            }
+            iov[count].iov_base = (char *)parts[i].iov_base + skip;
+            iov[count].iov_len = parts[i].iov_len - skip;
+            skip = 0;
+            count++;
+        }
+        
+        struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+        ssize_t sent = sendmsg(client_fd, &msg, MSG_NOSIGNAL | (file_body ? MSG_MORE : 0));
+        if (sent == -1) {
             if (errno == EAGAIN || errno == EWOULDBLOCK) {
                 return 0;
+            } else if (errno == EINTR) {
+                continue;
             } else if (errno == EPIPE || errno == ECONNRESET) {
-                LOG_DEBUG("Client disconnected during header send: %s", strerror(errno));
+                LOG_DEBUG("Client disconnected during prebuilt send: %s", strerror(errno));
                 return -1;
             }
-            LOG_ERROR("Failed to send headers: %s", strerror(errno));
+            LOG_ERROR("Failed to send prebuilt response: %s", strerror(errno));
             return -1;
         }
-        
-        off_t offset = response->file_offset; 
-        size_t total_sent = 0;
-        size_t remaining = response->body_length - offset;
-        
-        const size_t CHUNK_SIZE = 1024 * 1024;
-        
-        while (remaining > 0) {
-            size_t to_send = (remaining > CHUNK_SIZE) ? CHUNK_SIZE : remaining;
-            ssize_t sent = sendfile(client_fd, response->file_fd, &offset, to_send);
-            
-            if (sent <= 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    response->file_offset = offset;
-                    return 0;  
-                } else if (errno == EPIPE || errno == ECONNRESET) {
-                    LOG_DEBUG("Client disconnected during file send: %s", strerror(errno));
-                    return -1;
-                }
-                LOG_ERROR("Failed to send file: %s", strerror(errno));
-                return -1;
-            }
-            
-            total_sent += sent;
-            remaining -= sent;
-        }
-        
+        response->header_offset += sent;
+        METRICS_ADD(bytes_out, sent);
+    }
+    
+    if (!file_body) {
+        return 1;
+    }
+    
+    int result = send_file_range(client_fd, response, rep->fd, response->body_length, 1);
+    if (result == 1) {
         int off = 0;
         setsockopt(client_fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
-        
-        return 1;  
+    }
+    return result;
+}
+
+static int send_response(int client_fd, http_response_t *response) {
+    if (response->head) {
+        return send_prebuilt(client_fd, response);
     }
     
-    if (response->compressed_body && response->compressed_length > 0) {
-        ssize_t sent = send(client_fd, header_buffer, header_len, MSG_MORE | MSG_NOSIGNAL);
-        if (sent != header_len) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return 0;  
-            } else if (errno == EPIPE || errno == ECONNRESET) {
-                LOG_DEBUG("Client disconnected during header send: %s", strerror(errno));
-                return -1;
+    if (response->is_cached && response->cached_response) {
+        const cache_variant_t *cache = response->cache;
+        if (!response->keep_alive && !response->headers_sent && cache) {
+            int result = send_cached_close_headers(client_fd, response);
+            if (result != 1) {
+                return result;
             }
-            LOG_ERROR("Failed to send headers: %s", strerror(errno));
-            return -1;
         }
-        
-        sent = send(client_fd, response->compressed_body, response->compressed_length, MSG_NOSIGNAL);
-        if (sent != (ssize_t)response->compressed_length) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return 0;  
-            } else if (errno == EPIPE || errno == ECONNRESET) {
-                LOG_DEBUG("Client disconnected during compressed body send: %s", strerror(errno));
-                return -1;
+        if (cache && cache->fd != -1 && response->body_length > cache->header_len) {
+            if (response->body_offset < cache->header_len) {
+                int result = send_buffer(client_fd, cache->response, cache->header_len,
+                                         &response->body_offset, MSG_MORE, "cached headers");
+                if (result != 1) {
+                    return result;
+                }
+                response->file_offset = cache->header_len;
             }
-            LOG_ERROR("Failed to send compressed body: %s", strerror(errno));
-            return -1;
+            return send_file_range(client_fd, response, cache->fd, response->body_length, 0);
         }
         
-        return 1;  
+        return send_buffer(client_fd, response->cached_response, response->body_length, 
+                           &response->body_offset, 0, "cached response");
     }
     
-    if (response->body && response->body_length > 0) {
-        ssize_t sent = send(client_fd, header_buffer, header_len, MSG_MORE | MSG_NOSIGNAL);
-        if (sent != header_len) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return 0;  
-            } else if (errno == EPIPE || errno == ECONNRESET) {
-                LOG_DEBUG("Client disconnected during header send: %s", strerror(errno));
-                return -1;
-            }
-            LOG_ERROR("Failed to send headers: %s", strerror(errno));
-            return -1;
-        }
+    int has_body = (response->is_file && response->file_fd >= 0) || response->stream || response->range_count > 0 ||
+                   (response->compressed_body && response->compressed_length > 0) ||
+                   (response->body && response->body_length > 0);
+    
+    if (!response->headers_sent) {
+        size_t header_len = http_format_headers(response, header_buffer, sizeof(header_buffer));
         
-        sent = send(client_fd, response->body, response->body_length, MSG_NOSIGNAL);
-        if (sent != (ssize_t)response->body_length) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                return 0;  
-            } else if (errno == EPIPE || errno == ECONNRESET) {
-                LOG_DEBUG("Client disconnected during body send: %s", strerror(errno));
-                return -1;
-            }
-            LOG_ERROR("Failed to send body: %s", strerror(errno));
-            return -1;
+        int result = send_buffer(client_fd, header_buffer, header_len, &response->header_offset,
+                                 has_body ? MSG_MORE : 0, "headers");
+        if (result != 1) {
+            return result;
         }
-        
-        return 1;  
+        response->headers_sent = 1;
     }
     
-    ssize_t sent = send(client_fd, header_buffer, header_len, MSG_NOSIGNAL);
-    if (sent != header_len) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
-            return 0;  
-        } else if (errno == EPIPE || errno == ECONNRESET) {
-            LOG_DEBUG("Client disconnected during header send: %s", strerror(errno));
-            return -1;
+    if (response->stream) {
+        int result = stream_send(client_fd, response->stream);
+        if (result == HTTP_SEND_FILE_IO) {
+            off_t remaining = response->stream->file_size - response->stream->file_offset;
+            response->io_fd = response->stream->file_fd;
+            response->io_offset = response->stream->file_offset;
+            response->io_length = remaining > STREAM_WINDOW_SIZE ? STREAM_WINDOW_SIZE : (size_t)remaining;
         }
-        LOG_ERROR("Failed to send headers: %s", strerror(errno));
-        return -1;
+        return result;
+    }
+    
+    if (response->range_count > 0) {
+        return send_ranges(client_fd, response);
+    }
+    
+    if (response->is_file && response->file_fd >= 0) {
+        int result = send_file_range(client_fd, response, response->file_fd, response->body_length, 1);
+        if (result == 1) {
+            int off = 0;
+            setsockopt(client_fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+        }
+        return result;
+    }
+    
+    if (response->compressed_body && response->compressed_length > 0) {
+        return send_buffer(client_fd, response->compressed_body, response->compressed_length,
+                           &response->body_offset, 0, "compressed body");
+    }
+    
+    if (response->body && response->body_length > 0) {
+        return send_buffer(client_fd, response->body, response->body_length,
+                           &response->body_offset, 0, "body");
     }
     
     return 1;  
 }
 
+/* the worker's byte counter only moves for this connection between entry
+ * and return, so its delta is what this attempt wrote */
+int http_send_response(int client_fd, http_response_t *response) {
+    uint64_t before = metrics_worker->bytes_out;
+    int result = send_response(client_fd, response);
+    response->bytes_sent += metrics_worker->bytes_out - before;
+    return result;
+}
+
+void http_complete_read(http_response_t *response) {
+    if (response->deferred != HTTP_DEFER_READ) {
+        return;
+    }
+    response->deferred = HTTP_DEFER_NONE;
+    
+    if (!compress_loaded_body(response, 1)) {
+        finish_file_response(response, 0);
+    }
+}
+
+void http_complete_deferred(http_response_t *response) {
+    if (response->deferred != HTTP_DEFER_COMPRESS) {
+        return;
+    }
+    response->deferred = HTTP_DEFER_NONE;
+    
+    char content_length[32];
+    if (response->compressed_body) {
+        http_add_header(response, "Content-Encoding", encoding_name(response->compression_type));
+        snprintf(content_length, sizeof(content_length), "%zu", response->compressed_length);
+        LOG_DEBUG("Applied deferred %s compression: %zu bytes -> %zu bytes",
+                  encoding_name(response->compression_type),
+                  response->body_length, response->compressed_length);
+    } else {
+        snprintf(content_length, sizeof(content_length), "%zu", response->body_length);
+    }
+    http_add_header(response, "Content-Length", content_length);
+    
+    finish_file_response(response, 0);
+}
+
+void http_discard_body(http_response_t *response) {
+    if (response->is_file && response->file_fd != -1 &&
+        !(response->file && file_cache_owns_fd(response->file, response->file_fd))) {
+        close(response->file_fd);
+    }
+    response->is_file = 0;
+    response->file_fd = -1;
+    
+    if (response->stream) {
+        stream_destroy(response->stream);
+        response->stream = NULL;
+    }
+    
+    free(response->body);
+    response->body = NULL;
+    free(response->compressed_body);
+    response->compressed_body = NULL;
+    response->compressed_length = 0;
+    response->body_length = 0;
+    
+    response->deferred = HTTP_DEFER_NONE;
+    
+    file_cache_release(response->file);
+    response->file = NULL;
+}
+
 void http_free_response(http_response_t *response) {
-    if (response->is_file && response->file_fd != -1) {
+    if (response->is_file && response->file_fd != -1 &&
+        !(response->file && file_cache_owns_fd(response->file, response->file_fd))) {
         close(response->file_fd);
     }
     
+    if (response->stream) {
+        stream_destroy(response->stream);
+        response->stream = NULL;
+    }
+    
     if (response->body) {
         free(response->body);
         response->body = NULL;
@@ -639,6 +946,103 @@ void http_free_response(http_response_t *response) {
         free(response->compressed_body);
         response->compressed_body = NULL;
     }
+    
+    if (response->file) {
+        file_cache_release(response->file);
+        response->file = NULL;
+    }
+    
+    cache_variant_release(response->cache);
+    response->cache = NULL;
+}
+
+static const char *find_header(const http_request_t *request, const char *name) {
+    for (int i = 0; i < request->header_count; i++) {
+        if (strcasecmp(request->headers[i][0], name) == 0) {
+            return request->headers[i][1];
+        }
+    }
+    return NULL;
+}
+
+/* a manifest hit is answered from prebuilt header blocks without touching
+ * the filesystem; returns 0 to fall through to the regular path, which
+ * also covers encodings that have no precompressed sidecar */
+static int serve_manifest(const http_request_t *request, http_response_t *response, const char *path,
+                          compression_type_t compression_type, int is_head) {
+    const manifest_entry_t *entry = manifest_lookup(path);
+    if (!entry || !entry->reps[compression_type]) {
+        return 0;
+    }
+    
+    const manifest_rep_t *rep = entry->reps[compression_type];
+    METRICS_INC(manifest_hits);
+    response->prebuilt = rep;
+    response->keep_alive = http_should_keep_alive(request);
+    
+    /* as in serve_not_modified, a client may hold the identity tag */
+    const char *if_none_match = find_header(request, "If-None-Match");
+    const manifest_rep_t *matched = rep;
+    int not_modified = conditional_not_modified(if_none_match, find_header(request, "If-Modified-Since"),
+                                                rep->etag, rep->etag_len, entry->last_modified, entry->mtime);
+    if (!not_modified && if_none_match && compression_type != COMPRESSION_NONE && entry->reps[COMPRESSION_NONE]) {
+        matched = entry->reps[COMPRESSION_NONE];
+        not_modified = conditional_etag_matches(if_none_match, matched->etag, matched->etag_len);
+    }
+    if (not_modified) {
+        response->prebuilt = matched;
+        response->status_code = 304;
+        response->status_text = "Not Modified";
+        response->head = matched->not_modified;
+        response->head_len = matched->not_modified_len;
+        return 1;
+    }
+    
+    response->head = rep->head;
+    response->head_len = rep->head_len;
+    response->body_length = is_head ? 0 : (size_t)rep->size;
+    return 1;
+}
+
+/* a request carrying validators is checked against the open-file cache's
+ * metadata before the response cache, which would otherwise answer with
+ * the full body. Within open_file_cache_valid this touches no file and
+ * the 304 goes out as the entry's preassembled header block; returns 0
+ * to fall through to the regular path, which takes over the entry left in
+ * *opened (NULL when the file could not be opened) */
+static int serve_not_modified(const http_request_t *request, http_response_t *response, const char *path,
+                              compression_type_t compression_type, const char *if_none_match,
+                              const char *if_modified_since, file_cache_entry_t **opened) {
+    file_cache_entry_t *file = file_cache_open(path, response->vhost);
+    *opened = file;
+    if (!file) {
+        return 0;
+    }
+    
+    /* a response that ended up uncompressed carried the identity tag */
+    compression_type_t matched = compression_type;
+    int not_modified = conditional_not_modified(if_none_match, if_modified_since, file->etags[matched],
+                                                file->etag_lens[matched], file->last_modified, file->st.st_mtime);
+    if (!not_modified && if_none_match && compression_type != COMPRESSION_NONE) {
+        matched = COMPRESSION_NONE;
+        not_modified = conditional_etag_matches(if_none_match, file->etags[matched], file->etag_lens[matched]);
+    }
+    
+    size_t head_len;
+    const char *head;
+    if (!not_modified || !(head = file_cache_not_modified(file, matched, &head_len))) {
+        return 0;
+    }
+    
+    *opened = NULL;
+    LOG_DEBUG("Validators match for %s, returning 304 Not Modified", path);
+    response->file = file;
+    response->head = head;
+    response->head_len = head_len;
+    response->status_code = 304;
+    response->status_text = "Not Modified";
+    response->keep_alive = http_should_keep_alive(request);
+    return 1;
 }
 
 void http_handle_request(const http_request_t *request, http_response_t *response) {
@@ -658,299 +1062,164 @@ void http_handle_request(const http_request_t *request, http_response_t *respons
 
     config_t *config = config_get_instance();
 
+    const char *host = NULL;
+    for (int i = 0; i < request->header_count; i++) {
+        if (strcasecmp(request->headers[i][0], "Host") == 0) {
+            host = request->headers[i][1];
+            break;
+        }
+    }
+    const vhost_t *vhost = vhost_lookup(host);
+    if (!vhost) {
+        response->status_code = 500;
+        response->status_text = "Internal Server Error";
+        response->keep_alive = 0;
+        return;
+    }
+    response->vhost = vhost;
+
     char file_path[PATH_MAX];
     const char *request_path = strcmp(request->uri, "/") == 0 ? "/index.html" : request->uri;
 
-    size_t root_len = strlen(config->root_dir);
+    size_t root_len = vhost->root_len;
     size_t path_len = strlen(request_path);
 
     if (root_len + path_len >= sizeof(file_path)) {
-        LOG_ERROR("Path too long: %s%s", config->root_dir, request_path);
+        LOG_ERROR("Path too long: %s%s", vhost->root_dir, request_path);
         response->status_code = 414;  
         response->status_text = "Request-URI Too Long";
         response->keep_alive = 0;  
         return;
     }
 
-    int written = snprintf(file_path, sizeof(file_path), "%s%s", config->root_dir, request_path);
+    int written = snprintf(file_path, sizeof(file_path), "%s%s", vhost->root_dir, request_path);
     if (written < 0 || (size_t)written >= sizeof(file_path)) {
-        LOG_ERROR("Path truncation occurred: %s%s", config->root_dir, request_path);
+        LOG_ERROR("Path truncation occurred: %s%s", vhost->root_dir, request_path);
         response->status_code = 414;  
         response->status_text = "Request-URI Too Long";
         response->keep_alive = 0;  
         return;
     }
     
-    cache_entry_t *cache = find_cached_response(file_path, request);
+    const char *content_type = http_get_mime_type(file_path);
+    
+    int is_compressible = http_should_compress_mime_type(content_type);
+    
+    compression_type_t compression_type = COMPRESSION_NONE;
+    if (is_compressible && vhost->compress_level_max != COMPRESSION_LEVEL_NONE) {
+        compression_type = http_negotiate_compression(request);
+    }
+    
+    const char *range = NULL;
+    const char *if_range = NULL;
+    for (int i = 0; i < request->header_count && !is_head; i++) {
+        if (strcasecmp(request->headers[i][0], "Range") == 0) {
+            range = request->headers[i][1];
+        } else if (strcasecmp(request->headers[i][0], "If-Range") == 0) {
+            if_range = request->headers[i][1];
+        }
+    }
+    
+    uint64_t started = latency_now();
+    if (!range && serve_manifest(request, response, file_path, compression_type, is_head)) {
+        response->timing.cache = latency_since(started);
+        return;
+    }
+    /* byte ranges always address the identity representation */
+    const char *if_none_match = find_header(request, "If-None-Match");
+    const char *if_modified_since = find_header(request, "If-Modified-Since");
+    int validated = if_none_match || if_modified_since;
+    file_cache_entry_t *file = NULL;
+    if (validated && serve_not_modified(request, response, file_path, range ? COMPRESSION_NONE : compression_type,
+                                        if_none_match, if_modified_since, &file)) {
+        response->timing.cache = latency_since(started);
+        return;
+    }
+    int ranged = range != NULL;
+    cache_variant_t *cache = ranged ? NULL : cache_lookup(file_path, compression_type);
+    response->timing.cache = ranged ? 0 : latency_since(started);
     if (cache) {
+        file_cache_release(file);
+        METRICS_INC(cache_hits);
+        NX_PROBE3(cache__hit, (const char *)file_path, compression_type, cache->response_len);
         LOG_DEBUG("Using cached response for %s", file_path);
-        response->is_cached = 1;
-        response->cached_response = cache->response;
-        response->body_length = cache->response_len;
+        use_cached_response(response, cache);
         response->keep_alive = http_should_keep_alive(request);
         
         if (is_head) {
-            response->body_length = 0;
+            response->body_length = cache->header_len;
         }
         
         return;
     }
+    if (!ranged) {
+        METRICS_INC(cache_misses);
+        NX_PROBE2(cache__miss, (const char *)file_path, compression_type);
+    }
 
-    struct stat st;
-    if (stat(file_path, &st) == -1) {
+    if (!validated) {
+        started = latency_now();
+        file = file_cache_open(file_path, response->vhost);
+        response->timing.open = latency_since(started);
+    }
+    if (!file) {
         LOG_WARN("File not found: %s", file_path);
         response->status_code = 404;
         response->status_text = "Not Found";
         response->keep_alive = 0;
         return;
     }
-
-    const char* if_none_match = NULL;
-    for (int i = 0; i < request->header_count; i++) {
-        if (strcasecmp(request->headers[i][0], "If-None-Match") == 0) {
-            if_none_match = request->headers[i][1];
-            break;
-        }
+    
+    if (range && if_range && !if_range_matches(if_range, file->etags[COMPRESSION_NONE], file->last_modified)) {
+        LOG_DEBUG("If-Range validator changed, sending full response");
+        range = NULL;
     }
-
-    const char* if_modified_since = NULL;
-    for (int i = 0; i < request->header_count; i++) {
-        if (strcasecmp(request->headers[i][0], "If-Modified-Since") == 0) {
-            if_modified_since = request->headers[i][1];
-            break;
-        }
+    if (range) {
+        compression_type = COMPRESSION_NONE;
     }
-
-    char etag[64];
-    snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx\"", 
-             (unsigned long)st.st_ino, 
-             (unsigned long)st.st_size, 
-             (unsigned long)st.st_mtime);
-
-    if (if_none_match) {
-        LOG_DEBUG("Checking ETag: client sent '%s', server has '%s'", if_none_match, etag);
-        
-        char if_none_match_copy[1024];
-        strncpy(if_none_match_copy, if_none_match, sizeof(if_none_match_copy) - 1);
-        if_none_match_copy[sizeof(if_none_match_copy) - 1] = '\0';
-        
-        char *token = strtok(if_none_match_copy, ",");
-        int matched = 0;
-        
-        while (token && !matched) {
-            while (isspace(*token)) token++;
-            
-            if (strcmp(token, "*") == 0) {
-                matched = 1;
-                break;
-            }
-            
-            char clean_token[256] = {0};
-            const char *start = token;
-            if (*start == 'W' && *(start+1) == '/') {
-                start += 2;
-            }
-            
-            if (*start == '"') {
-                start++;
-                const char *end = strrchr(start, '"');
-                if (end) {
-                    size_t len = end - start;
-                    strncpy(clean_token, start, len);
-                    clean_token[len] = '\0';
-                } else {
-                    strncpy(clean_token, start, sizeof(clean_token) - 1);
-                }
-            } else {
-                strncpy(clean_token, start, sizeof(clean_token) - 1);
-            }
-            
-            char *p = clean_token + strlen(clean_token) - 1;
-            while (p >= clean_token && isspace(*p)) {
-                *p = '\0';
-                p--;
-            }
-            
-            char our_etag[64] = {0};
-            const char *etag_start = etag;
-            if (*etag_start == '"') {
-                etag_start++;
-                const char *etag_end = strrchr(etag_start, '"');
-                if (etag_end) {
-                    size_t len = etag_end - etag_start;
-                    strncpy(our_etag, etag_start, len);
-                    our_etag[len] = '\0';
-                }
-            } else {
-                strncpy(our_etag, etag_start, sizeof(our_etag) - 1);
-            }
-            
-            LOG_DEBUG("Comparing cleaned ETags: client '%s' vs server '%s'", clean_token, our_etag);
-            
-            if (strcmp(clean_token, our_etag) == 0) {
-                matched = 1;
-                break;
-            }
-            
-            token = strtok(NULL, ",");
-        }
-        
-        if (matched) {
-            LOG_DEBUG("ETag match found, returning 304 Not Modified");
-            response->status_code = 304;
-            response->status_text = "Not Modified";
-            
-            http_add_header(response, "ETag", etag);
-            
-            const char *ext = strrchr(file_path, '.');
-            if (ext) {
-                if (strcasecmp(ext, ".css") == 0 || strcasecmp(ext, ".js") == 0) {
-                    http_add_header(response, "Cache-Control", "public, max-age=86400, must-revalidate");
-                } 
-                else if (strcasecmp(ext, ".png") == 0 || 
-                         strcasecmp(ext, ".jpg") == 0 || 
-                         strcasecmp(ext, ".jpeg") == 0 || 
-                         strcasecmp(ext, ".gif") == 0 || 
-                         strcasecmp(ext, ".ico") == 0) {
-                    http_add_header(response, "Cache-Control", "public, max-age=604800, immutable");
-                }
-                else if (strcasecmp(ext, ".html") == 0 || strcasecmp(ext, ".htm") == 0) {
-                    http_add_header(response, "Cache-Control", "public, max-age=300, must-revalidate");
-                }
-                else {
-                    http_add_header(response, "Cache-Control", "public, max-age=3600");
-                }
-            }
+    
+    struct stat st = file->st;
+    response->compression_type = compression_type;
+    
+    if (range) {
+        int range_count = parse_ranges(range, st.st_size, response->ranges);
+        if (range_count == -1) {
+            LOG_DEBUG("Unsatisfiable range '%s' for %s", range, file_path);
+            response->status_code = 416;
+            response->status_text = "Range Not Satisfiable";
             
-            http_add_header(response, "Vary", "Accept-Encoding, User-Agent");
+            char content_range[64];
+            snprintf(content_range, sizeof(content_range), "bytes */%lld", (long long)st.st_size);
+            http_add_header(response, "Content-Range", content_range);
+            http_add_header(response, "Content-Length", "0");
             
+            file_cache_release(file);
             response->keep_alive = http_should_keep_alive(request);
             return;
         }
+        response->range_count = range_count;
     }
-
-    if (if_modified_since) {
-        LOG_DEBUG("Checking If-Modified-Since: %s", if_modified_since);
-        
-        struct tm tm_since;
-        memset(&tm_since, 0, sizeof(struct tm));
-        int parsed = 0;
-        
-        if (!parsed && strptime(if_modified_since, "%a, %d %b %Y %H:%M:%S GMT", &tm_since) != NULL) {
-            parsed = 1;
-        }
-        
-        if (!parsed && strptime(if_modified_since, "%A, %d-%b-%y %H:%M:%S GMT", &tm_since) != NULL) {
-            parsed = 1;
-        }
-        
-        if (!parsed && strptime(if_modified_since, "%a %b %d %H:%M:%S %Y", &tm_since) != NULL) {
-            parsed = 1;
-        }
-        
-        if (parsed) {   
-            tm_since.tm_isdst = -1;
-            time_t since_time = mktime(&tm_since);
-            
-            if (since_time != -1) {
-                since_time += timezone;
-                
-                struct tm *tm_file = gmtime(&st.st_mtime);
-                char file_time_str[64];
-                strftime(file_time_str, sizeof(file_time_str), "%a, %d %b %Y %H:%M:%S GMT", tm_file);
-                
-                LOG_DEBUG("Comparing times: file time %s (%ld) vs if-modified-since %s (%ld)", 
-                          file_time_str, (long)st.st_mtime, if_modified_since, (long)since_time);
-                
-                if (difftime(st.st_mtime, since_time) <= 0) {
-                    LOG_DEBUG("File not modified since %s, returning 304", if_modified_since);
-                    response->status_code = 304;
-                    response->status_text = "Not Modified";
-                    
-                    http_add_header(response, "ETag", etag);
-                    
-                    char last_modified[64];
-                    strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", tm_file);
-                    http_add_header(response, "Last-Modified", last_modified);
-                    
-                    http_add_header(response, "Vary", "Accept-Encoding, User-Agent");
-                    
-                    response->keep_alive = http_should_keep_alive(request);
-                    return;
-                } else {
-                    LOG_DEBUG("File was modified since %s, returning full response", if_modified_since);
-                }
-            } else {
-                LOG_WARN("Failed to convert parsed time to time_t");
-            }
+    
+    /* a Range request skipped the lookup above; ranges are sliced from a
+     * cached identity copy, and a dropped range is served whole from the
+     * cache like any other request */
+    if (ranged) {
+        started = latency_now();
+        cache = cache_lookup(file_path, compression_type);
+        response->timing.cache += latency_since(started);
+        if (cache) {
+            METRICS_INC(cache_hits);
+            NX_PROBE3(cache__hit, (const char *)file_path, compression_type, cache->response_len);
         } else {
-            LOG_WARN("Failed to parse If-Modified-Since date: %s", if_modified_since);
+            METRICS_INC(cache_misses);
+            NX_PROBE2(cache__miss, (const char *)file_path, compression_type);
         }
     }
 
-    const char *content_type = http_get_mime_type(file_path);
-    
-    int is_compressible = http_should_compress_mime_type(content_type);
-    
-    compression_type_t compression_type = COMPRESSION_NONE;
-    if (is_compressible) {
-        compression_type = http_negotiate_compression(request);
-    }
-    
-    response->compression_type = compression_type;
-
-    if (http_serve_file(file_path, response, request) != 0) {
-        response->status_code = 404;
-        response->status_text = "Not Found";
-        response->keep_alive = 0;  
-        return;
-    }
+    http_serve_file(file, cache, response, request);
 
     response->keep_alive = http_should_keep_alive(request);
     
-    if (compression_type != COMPRESSION_NONE && !response->is_file && response->body && 
-        response->body_length > 0 && response->compressed_body == NULL) {
-        int compression_level = COMPRESSION_LEVEL_DEFAULT;
-        
-        if (strncasecmp(content_type, "text/html", 9) == 0 || 
-            strncasecmp(content_type, "text/css", 8) == 0 ||
-            strncasecmp(content_type, "application/javascript", 22) == 0) {
-            compression_level = COMPRESSION_LEVEL_DEFAULT;
-        }
-        else if (strncasecmp(content_type, "image/", 6) == 0 ||
-                 strncasecmp(content_type, "application/octet-stream", 24) == 0) {
-            compression_level = COMPRESSION_LEVEL_MIN;
-        }   
-        else if (strncasecmp(content_type, "application/font", 16) == 0 ||
-                 strncasecmp(content_type, "image/svg+xml", 13) == 0) {
-            compression_level = COMPRESSION_LEVEL_MAX;
-        }
-        
-        if (http_compress_content(response, compression_type, compression_level) == 0) {
-            if (compression_type == COMPRESSION_GZIP) {
-                http_add_header(response, "Content-Encoding", "gzip");
-            } else if (compression_type == COMPRESSION_DEFLATE) {
-                http_add_header(response, "Content-Encoding", "deflate");
-            }
-            
-            char content_length[32];
-            snprintf(content_length, sizeof(content_length), "%zu", response->compressed_length);
-            
-            int found = 0;
-            for (int i = 0; i < response->header_count; i++) {
-                if (strcasecmp(response->headers[i][0], "Content-Length") == 0) {
-                    strncpy(response->headers[i][1], content_length, MAX_HEADER_SIZE - 1);
-                    found = 1;
-                    break;
-                }
-            }
-            
-            if (!found) {
-                http_add_header(response, "Content-Length", content_length);
-            }
-        }
-    }
-    
     if (response->keep_alive) {
         char timeout_str[32];
         snprintf(timeout_str, sizeof(timeout_str), "timeout=%d", config->keep_alive_timeout);
@@ -961,9 +1230,8 @@ void http_handle_request(const http_request_t *request, http_response_t *respons
     }
 
     if (is_head) {
-        response->is_file = 0;
+        http_discard_body(response);
         response->is_cached = 0;
-        response->body_length = 0;
     }
 }
 
@@ -1003,17 +1271,7 @@ compression_type_t http_negotiate_compression(const http_request_t *request) {
     
     for (int i = 0; i < request->header_count; i++) {
         if (strcasecmp(request->headers[i][0], "Accept-Encoding") == 0) {
-            const char *encodings = request->headers[i][1];
-            
-            if (strstr(encodings, "gzip") != NULL) {
-                LOG_DEBUG("Client accepts gzip compression");
-                return COMPRESSION_GZIP;
-            }
-            
-            if (strstr(encodings, "deflate") != NULL) {
-                LOG_DEBUG("Client accepts deflate compression");
-                return COMPRESSION_DEFLATE;
-            }
+            return encoding_negotiate(request->headers[i][1]);
         }
     }
     
@@ -1029,7 +1287,7 @@ int http_compress_content(http_response_t *response, compression_type_t type, in
         return 0;
     }
     
-    if (type != COMPRESSION_GZIP && type != COMPRESSION_DEFLATE) {
+    if (!encoding_available(type)) {
         return -1;
     }
     
@@ -1037,69 +1295,22 @@ int http_compress_content(http_response_t *response, compression_type_t type, in
         level = COMPRESSION_LEVEL_DEFAULT;
     }
     
-    size_t buffer_size = response->body_length + 128;
-    unsigned char *compressed = malloc(buffer_size);
-    
-    if (!compressed) {
-        LOG_ERROR("Failed to allocate memory for compression");
-        return -1;
-    }
-    
-    z_stream strm;
-    memset(&strm, 0, sizeof(strm));
-    
-    int window_bits = (type == COMPRESSION_GZIP) ? (15 + 16) : 15;
-    
-    if (deflateInit2(&strm, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
-        LOG_ERROR("Failed to initialize zlib compression");
-        free(compressed);
+    void *compressed = NULL;
+    size_t compressed_length = 0;
+    NX_PROBE3(compress__start, type, level, response->body_length);
+    uint64_t cpu_start = compress_ctl_cpu_now();
+    uint64_t started = latency_now();
+    if (encoding_compress(type, level, response->body, response->body_length, 
+                          &compressed, &compressed_length) != 0) {
         return -1;
     }
-    
-    strm.avail_in = response->body_length;
-    strm.next_in = (Bytef*)response->body;
-    strm.avail_out = buffer_size;
-    strm.next_out = compressed;
-    
-    int ret = deflate(&strm, Z_FINISH);
-    
-    if (ret != Z_STREAM_END) {
-        free(compressed);
-        deflateEnd(&strm);
-        
-        buffer_size = response->body_length * 2;
-        compressed = malloc(buffer_size);
-        
-        if (!compressed) {
-            LOG_ERROR("Failed to allocate memory for compression retry");
-            return -1;
-        }
-        
-        memset(&strm, 0, sizeof(strm));
-        
-        if (deflateInit2(&strm, level, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
-            LOG_ERROR("Failed to initialize zlib compression for retry");
-            free(compressed);
-            return -1;
-        }
-        
-        strm.avail_in = response->body_length;
-        strm.next_in = (Bytef*)response->body;
-        strm.avail_out = buffer_size;
-        strm.next_out = compressed;
-        
-        ret = deflate(&strm, Z_FINISH);
-        
-        if (ret != Z_STREAM_END) {
-            LOG_ERROR("Failed to compress data even with larger buffer");
-            free(compressed);
-            deflateEnd(&strm);
-            return -1;
-        }
-    }
+    response->timing.compress += latency_since(started);
+    uint64_t cpu_ns = compress_ctl_cpu_now() - cpu_start;
+    compress_ctl_record(level, response->body_length, compressed_length, cpu_ns);
+    NX_PROBE4(compress__end, type, level, compressed_length, cpu_ns);
     
     response->compressed_body = compressed;
-    response->compressed_length = strm.total_out;
+    response->compressed_length = compressed_length;
     response->compression_type = type;
     response->compression_level = level;
     
@@ -1107,6 +1318,5 @@ int http_compress_content(http_response_t *response, compression_type_t type, in
               response->body_length, response->compressed_length,
               (int)(100 - (response->compressed_length * 100.0 / response->body_length)));
     
-    deflateEnd(&strm);
     return 0;
 } 
\ No newline at end of file
@@ -0,0 +1,159 @@
+#include "latency.h"
+#include "metrics.h"
+#include "stream.h"
+
+int latency_enabled = 0;
+static int sample_every = 0;
+static unsigned int sample_counter = 0;
+
+static const char *phase_names[LATENCY_PHASE_COUNT] = {
+    [LATENCY_PARSE] = "parse",
+    [LATENCY_CACHE] = "cache",
+    [LATENCY_OPEN] = "open",
+    [LATENCY_COMPRESS] = "compress",
+    [LATENCY_TTFB] = "ttfb",
+    [LATENCY_TOTAL] = "total",
+};
+
+void latency_init(int enabled, int sample) {
+    latency_enabled = enabled;
+    sample_every = enabled && sample > 0 ? sample : 0;
+}
+
+const char *latency_phase_name(latency_phase_t phase) {
+    return phase_names[phase];
+}
+
+static int bucket_index(uint64_t value) {
+    if (value < LATENCY_SUB_COUNT) {
+        return (int)value;
+    }
+
+    int msb = 63 - __builtin_clzll(value);
+    if (msb >= LATENCY_MAX_BITS) {
+        return LATENCY_BUCKETS - 1;
+    }
+
+    int shift = msb - LATENCY_SUB_BITS;
+    return (shift + 1) * LATENCY_SUB_COUNT + (int)((value >> shift) - LATENCY_SUB_COUNT);
+}
+
+static uint64_t bucket_upper(int index) {
+    if (index < LATENCY_SUB_COUNT) {
+        return index;
+    }
+
+    int shift = index / LATENCY_SUB_COUNT - 1;
+    uint64_t sub = index % LATENCY_SUB_COUNT + LATENCY_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+void latency_record(latency_hist_t *hist, uint64_t value) {
+    hist->buckets[bucket_index(value)]++;
+    hist->count++;
+    hist->sum += value;
+    if (value > hist->max) {
+        hist->max = value;
+    }
+}
+
+/* the highest value equivalent to the bucket holding the quantile, capped
+ * at the largest value actually recorded */
+uint64_t latency_quantile(const latency_hist_t *hist, double quantile) {
+    uint64_t count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)(quantile * count + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+
+    uint64_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    uint64_t seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+        if (seen >= target) {
+            uint64_t upper = bucket_upper(i);
+            return upper < max ? upper : max;
+        }
+    }
+
+    return max;
+}
+
+int latency_sample(void) {
+    return sample_every && ++sample_counter % sample_every == 0;
+}
+
+int latency_format_server_timing(const http_response_t *response, char *buf, size_t size) {
+    const http_timing_t *timing = &response->timing;
+    const struct {
+        const char *name;
+        uint64_t ns;
+    } phases[] = {
+        {"parse", timing->parse},
+        {"cache", timing->cache},
+        {"open", timing->open},
+        {"compress", timing->compress},
+        {"total", latency_since(timing->start)},
+    };
+
+    int len = snprintf(buf, size, "Server-Timing: ");
+    const char *sep = "";
+    for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); i++) {
+        if (phases[i].ns && (size_t)len < size) {
+            len += snprintf(buf + len, size - len, "%s%s;dur=%.3f", sep, phases[i].name, phases[i].ns / 1e6);
+            sep = ", ";
+        }
+    }
+    if ((size_t)len < size) {
+        len += snprintf(buf + len, size - len, "\r\n");
+    }
+    return (size_t)len < size ? len : 0;
+}
+
+void latency_first_byte(http_response_t *response) {
+    if (response->timing.start && !response->timing.ttfb &&
+        (response->headers_sent || response->header_offset > 0 || response->body_offset > 0)) {
+        response->timing.ttfb = latency_since(response->timing.start);
+    }
+}
+
+void latency_finish(http_response_t *response) {
+    http_timing_t *timing = &response->timing;
+    if (!timing->start) {
+        return;
+    }
+
+    uint64_t total = latency_since(timing->start);
+    if (!timing->ttfb) {
+        timing->ttfb = total;
+    }
+    if (response->stream) {
+        timing->compress += response->stream->cpu_ns;
+    }
+
+    int hit = response->is_cached || response->head ? 1 : 0;
+    int class = response->status_code / 100 - 1;
+    if (class < 0 || class >= LATENCY_CLASSES) {
+        class = LATENCY_CLASSES - 1;
+    }
+
+    uint64_t values[LATENCY_PHASE_COUNT] = {
+        [LATENCY_PARSE] = timing->parse,
+        [LATENCY_CACHE] = timing->cache,
+        [LATENCY_OPEN] = timing->open,
+        [LATENCY_COMPRESS] = timing->compress,
+        [LATENCY_TTFB] = timing->ttfb,
+        [LATENCY_TOTAL] = total,
+    };
+    for (int phase = 0; phase < LATENCY_PHASE_COUNT; phase++) {
+        if (values[phase]) {
+            latency_record(&metrics_worker->latency.hist[phase][hit][class], values[phase]);
+        }
+    }
+
+    timing->start = 0;
+}
@@ -1,7 +1,10 @@
 #include "log.h"
 
 
+volatile sig_atomic_t log_reopen_requested = 0;
+
 static FILE *log_file = NULL;
+static char log_path[256];
 static log_level_t current_level = LOG_INFO;
 static pthread_mutex_t log_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -23,7 +26,32 @@ int log_init(const char *filename) {
         perror("Failed to open log file");
         return -1;
     }
+    snprintf(log_path, sizeof(log_path), "%s", filename);
+
+    return 0;
+}
 
+/* opens the configured path again after logrotate moved it; the old file
+ * stays in use if the new one cannot be created */
+int log_reopen(void) {
+    if (!log_path[0]) {
+        return 0;
+    }
+
+    FILE *file = fopen(log_path, "a");
+    if (file == NULL) {
+        log_message(LOG_ERROR, "Failed to reopen log file %s: %s", log_path, strerror(errno));
+        return -1;
+    }
+
+    pthread_mutex_lock(&log_mutex);
+    FILE *old = log_file;
+    log_file = file;
+    pthread_mutex_unlock(&log_mutex);
+
+    if (old != NULL) {
+        fclose(old);
+    }
     return 0;
 }
 
@@ -78,22 +106,6 @@ void log_message(log_level_t level, const char *format, ...) {
     pthread_mutex_unlock(&log_mutex);
 }
 
-void log_access(const char *client_ip, const char *method, const char *uri, 
-                int status, long response_size) {
-    pthread_mutex_lock(&log_mutex);
-
-    char timestamp[32];
-    get_timestamp(timestamp, sizeof(timestamp));
-
-    if (log_file != NULL) {
-        fprintf(log_file, "%s - - [%s] \"%s %s\" %d %ld\n",
-                client_ip, timestamp, method, uri, status, response_size);
-        fflush(log_file);
-    }
-
-    pthread_mutex_unlock(&log_mutex);
-}
-
 void log_cleanup(void) {
     pthread_mutex_lock(&log_mutex);
     
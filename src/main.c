@@ -2,6 +2,10 @@
 #include "config.h"
 #include "log.h"
 #include "shutdown.h"
+#include "precompress.h"
+#include "compress.h"
+#include "vhost.h"
+#include "manifest.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -20,6 +24,10 @@ void handle_shutdown_signal(int signo) {
     shutdown_requested = 1;
 }
 
+void handle_reopen_signal(int signo __attribute__((unused))) {
+    log_reopen_requested = 1;
+}
+
 void setup_signal_handlers(void) {
     struct sigaction sa;
     
@@ -36,6 +44,13 @@ void setup_signal_handlers(void) {
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
     
+    /* workers inherit this handler and reopen their own files */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_reopen_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+    
     signal(SIGPIPE, SIG_IGN);
 }
 
@@ -130,24 +145,45 @@ int main(int argc, char *argv[]) {
     }
     
     config_t *config = config_get_instance();
-    if (config_load(config, abs_config_path) != 0) {
+    config_init(config);
+    if (config_load(config, abs_config_path) != 0 || config_validate(config) != 0) {
         fprintf(stderr, "Failed to load configuration from %s\n", abs_config_path);
         return 1;
     }
     
     ensure_directories_exist(config->log_file);
+    if (config->access_log[0]) {
+        ensure_directories_exist(config->access_log);
+    }
     ensure_directories_exist(config->root_dir);
     
     if (log_init(config->log_file) != 0) {
         fprintf(stderr, "Failed to initialize logging\n");
         return 1;
     }
+    log_set_level((log_level_t)config->log_level);
+    
+    if (vhost_init(config) < 0) {
+        return 1;
+    }
+    
+    /* after the vhost table, whose roots get their own sidecars */
+    if (precompress_init(config) != 0) {
+        LOG_WARN("Failed to initialize precompression (continuing without sidecars)");
+    }
+    
+    compress_engine_select(config->compression_engine);
     
     if (set_resource_limits() != 0) {
         LOG_ERROR("Failed to set resource limits");
         return 1;
     }
     
+    /* after the descriptor limit is raised; the manifest keeps large files open */
+    if (manifest_build(config) < 0) {
+        LOG_WARN("Failed to build the manifest (continuing without it)");
+    }
+    
     setup_signal_handlers();
     
     master_t master;
@@ -162,6 +198,7 @@ int main(int argc, char *argv[]) {
     master_run(&master);
     
     master_cleanup(&master);
+    manifest_cleanup();
     log_cleanup();
     
     LOG_INFO("Server shutdown complete");
@@ -0,0 +1,462 @@
+#include "manifest.h"
+#include "vhost.h"
+#include "file_cache.h"
+#include "precompress.h"
+#include "encoding.h"
+#include <fcntl.h>
+#include <ftw.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+static manifest_entry_t *entries = NULL;
+static int entry_count = 0;
+static int indexed_count = 0;
+static int tree_files = 0;
+static manifest_entry_t **index_slots = NULL;
+static size_t index_mask = 0;
+
+/* nftw passes no user pointer, so the walk state lives here. Keys are the
+ * vhost root as configured followed by the path below it, matching the
+ * file paths http_handle_request builds */
+static char **walk_paths = NULL;
+static int walk_count = 0;
+static int walk_capacity = 0;
+static int walk_limit = 0;
+static int walk_skipped = 0;
+static const char *walk_root = NULL;
+static size_t walk_strip = 0;
+static int check_files = 0;
+static int check_matched = 0;
+
+typedef struct {
+    int start;
+    int end;
+    int built;
+    int fds;
+    size_t inline_bytes;
+} build_job_t;
+
+static uint32_t hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    while (*path) {
+        hash ^= (unsigned char)*path++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int collect_file(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)ftw;
+    if (type != FTW_F || !S_ISREG(st->st_mode)) {
+        return 0;
+    }
+    if (walk_count >= walk_limit) {
+        walk_skipped++;
+        return 0;
+    }
+
+    if (walk_count == walk_capacity) {
+        int capacity = walk_capacity ? walk_capacity * 2 : 1024;
+        char **paths = realloc(walk_paths, sizeof(char *) * capacity);
+        if (!paths) {
+            return -1;
+        }
+        walk_paths = paths;
+        walk_capacity = capacity;
+    }
+
+    size_t len = strlen(walk_root) + strlen(path + walk_strip) + 1;
+    char *key = malloc(len);
+    if (!key) {
+        return -1;
+    }
+    snprintf(key, len, "%s%s", walk_root, path + walk_strip);
+    walk_paths[walk_count++] = key;
+    return 0;
+}
+
+/* stops the walk with 1 at the first indexed file that differs */
+static int check_file(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    (void)ftw;
+    if (type != FTW_F || !S_ISREG(st->st_mode)) {
+        return 0;
+    }
+    check_files++;
+
+    char key[PATH_MAX];
+    snprintf(key, sizeof(key), "%s%s", walk_root, path + walk_strip);
+    const manifest_entry_t *entry = manifest_lookup(key);
+    if (!entry) {
+        return 0;
+    }
+    check_matched++;
+    if (entry->ino != st->st_ino || entry->mtime != st->st_mtim.tv_sec ||
+        entry->mtime_nsec != st->st_mtim.tv_nsec || entry->reps[COMPRESSION_NONE]->size != st->st_size) {
+        LOG_DEBUG("%s changed since the manifest was built", key);
+        return 1;
+    }
+    return 0;
+}
+
+static int walk_tree(const char *root, int (*visit)(const char *, const struct stat *, int, struct FTW *)) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", root);
+    size_t len = strlen(dir);
+    while (len > 1 && dir[len - 1] == '/') {
+        dir[--len] = '\0';
+    }
+
+    walk_root = root;
+    walk_strip = len;
+    int result = nftw(dir, visit, 32, FTW_PHYS);
+    if (result == -1) {
+        LOG_ERROR("Failed to scan %s for the manifest: %s", dir, strerror(errno));
+    }
+    return result;
+}
+
+/* every distinct vhost root once, or the global root without a vhost
+ * table; stops at the first walk that does not return 0 */
+static int walk_roots(const config_t *config, int (*visit)(const char *, const struct stat *, int, struct FTW *)) {
+    int roots = vhost_count();
+    int result = roots > 0 ? 0 : walk_tree(config->root_dir, visit);
+    for (int i = 0; i < roots && result == 0; i++) {
+        const char *root = vhost_get(i)->root_dir;
+        int seen = 0;
+        for (int j = 0; j < i && !seen; j++) {
+            seen = strcmp(vhost_get(j)->root_dir, root) == 0;
+        }
+        result = seen ? 0 : walk_tree(root, visit);
+    }
+    return result;
+}
+
+static int read_body(int fd, char *body, off_t size) {
+    off_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, body + done, size - done, done);
+        if (n <= 0) {
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+static void free_rep(manifest_rep_t *rep) {
+    if (!rep) {
+        return;
+    }
+    if (rep->fd != -1) {
+        close(rep->fd);
+    }
+    free((char *)rep->body);
+    free((char *)rep->head);
+    free((char *)rep->not_modified);
+    free(rep);
+}
+
+/* takes ownership of fd, which holds the body for this encoding; the
+ * validators always describe the source file */
+static manifest_rep_t *build_rep(int fd, off_t size, compression_type_t type, const struct stat *src_st) {
+    manifest_rep_t *rep = calloc(1, sizeof(manifest_rep_t));
+    if (!rep) {
+        close(fd);
+        return NULL;
+    }
+    rep->fd = fd;
+    rep->size = size;
+    file_cache_format_etag(src_st, type, rep->etag, sizeof(rep->etag));
+    rep->etag_len = strlen(rep->etag);
+
+    if (size <= MANIFEST_INLINE_MAX) {
+        char *body = malloc(size > 0 ? size : 1);
+        if (body && read_body(fd, body, size) == 0) {
+            rep->body = body;
+            close(fd);
+            rep->fd = -1;
+        } else {
+            free(body);
+        }
+    }
+
+    return rep;
+}
+
+static int format_heads(manifest_rep_t *rep, compression_type_t type, const char *mime_type,
+                        const char *cache_control, const char *last_modified) {
+    char encoding[64] = "";
+    if (type != COMPRESSION_NONE) {
+        snprintf(encoding, sizeof(encoding), "Content-Encoding: %s\r\n", encoding_name(type));
+    }
+
+    char head[1024];
+    int len = snprintf(head, sizeof(head),
+                       "HTTP/1.1 200 OK\r\nServer: NxLite\r\nContent-Type: %s\r\n%sContent-Length: %lld\r\n"
+                       "Last-Modified: %s\r\nETag: %s\r\nVary: Accept-Encoding\r\nAccept-Ranges: bytes\r\n"
+                       "Cache-Control: %s\r\n",
+                       mime_type, encoding, (long long)rep->size, last_modified, rep->etag, cache_control);
+    if (len < 0 || (size_t)len >= sizeof(head) || !(rep->head = strdup(head))) {
+        return -1;
+    }
+    rep->head_len = len;
+
+    len = snprintf(head, sizeof(head),
+                   "HTTP/1.1 304 Not Modified\r\nServer: NxLite\r\nETag: %s\r\nLast-Modified: %s\r\n"
+                   "Cache-Control: %s\r\nVary: Accept-Encoding\r\n",
+                   rep->etag, last_modified, cache_control);
+    if (len < 0 || (size_t)len >= sizeof(head) || !(rep->not_modified = strdup(head))) {
+        return -1;
+    }
+    rep->not_modified_len = len;
+    return 0;
+}
+
+static int build_entry(manifest_entry_t *entry) {
+    int fd = open(entry->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    const char *mime_type = http_get_mime_type(entry->path);
+    const char *cache_control = file_cache_control(entry->path);
+    char *last_modified = entry->last_modified;
+    struct tm tm_info;
+    gmtime_r(&st.st_mtime, &tm_info);
+    strftime(last_modified, sizeof(entry->last_modified), "%a, %d %b %Y %H:%M:%S GMT", &tm_info);
+
+    entry->hash = hash_path(entry->path);
+    entry->ino = st.st_ino;
+    entry->mtime = st.st_mtim.tv_sec;
+    entry->mtime_nsec = st.st_mtim.tv_nsec;
+    entry->compressible = http_should_compress_mime_type(mime_type);
+
+    entry->reps[COMPRESSION_NONE] = build_rep(fd, st.st_size, COMPRESSION_NONE, &st);
+    if (!entry->reps[COMPRESSION_NONE] ||
+        format_heads(entry->reps[COMPRESSION_NONE], COMPRESSION_NONE, mime_type, cache_control, last_modified) != 0) {
+        return -1;
+    }
+
+    for (int type = COMPRESSION_NONE + 1; entry->compressible && type < COMPRESSION_TYPE_COUNT; type++) {
+        struct stat sidecar_st;
+        int sidecar_fd = precompress_open(entry->path, &st, (compression_type_t)type, &sidecar_st);
+        if (sidecar_fd == -1) {
+            continue;
+        }
+        manifest_rep_t *rep = build_rep(sidecar_fd, sidecar_st.st_size, (compression_type_t)type, &st);
+        if (rep && format_heads(rep, (compression_type_t)type, mime_type, cache_control, last_modified) != 0) {
+            free_rep(rep);
+            rep = NULL;
+        }
+        entry->reps[type] = rep;
+    }
+    return 0;
+}
+
+static void free_entry(manifest_entry_t *entry) {
+    for (int i = 0; i < COMPRESSION_TYPE_COUNT; i++) {
+        free_rep(entry->reps[i]);
+        entry->reps[i] = NULL;
+    }
+    free((char *)entry->path);
+    entry->path = NULL;
+}
+
+static void *build_range(void *arg) {
+    build_job_t *job = arg;
+    for (int i = job->start; i < job->end; i++) {
+        manifest_entry_t *entry = &entries[i];
+        if (build_entry(entry) != 0) {
+            LOG_WARN("Leaving %s out of the manifest", entry->path);
+            free_entry(entry);
+            continue;
+        }
+        job->built++;
+        for (int type = 0; type < COMPRESSION_TYPE_COUNT; type++) {
+            const manifest_rep_t *rep = entry->reps[type];
+            if (rep) {
+                job->fds += rep->fd != -1;
+                job->inline_bytes += rep->body ? (size_t)rep->size : 0;
+            }
+        }
+    }
+    return NULL;
+}
+
+static int build_index(void) {
+    size_t slots = 1024;
+    while (slots < (size_t)entry_count * 2) {
+        slots <<= 1;
+    }
+
+    index_slots = calloc(slots, sizeof(manifest_entry_t *));
+    if (!index_slots) {
+        LOG_ERROR("Failed to allocate the manifest index");
+        return -1;
+    }
+    index_mask = slots - 1;
+
+    for (int i = 0; i < entry_count; i++) {
+        manifest_entry_t *entry = &entries[i];
+        if (!entry->path) {
+            continue;
+        }
+        size_t slot = entry->hash & index_mask;
+        while (index_slots[slot]) {
+            slot = (slot + 1) & index_mask;
+        }
+        index_slots[slot] = entry;
+    }
+    return 0;
+}
+
+static int thread_count(const config_t *config, int files) {
+    long threads = config->manifest_threads > 0 ? config->manifest_threads : sysconf(_SC_NPROCESSORS_ONLN);
+    long useful = (files + MANIFEST_FILES_PER_THREAD - 1) / MANIFEST_FILES_PER_THREAD;
+    if (threads > MANIFEST_MAX_THREADS) {
+        threads = MANIFEST_MAX_THREADS;
+    }
+    if (threads > useful) {
+        threads = useful;
+    }
+    return threads > 0 ? (int)threads : 1;
+}
+
+int manifest_build(const config_t *config) {
+    manifest_cleanup();
+    if (!config->manifest) {
+        return 0;
+    }
+
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    walk_limit = config->manifest_max_files > 0 ? config->manifest_max_files : MANIFEST_DEFAULT_MAX_FILES;
+    walk_count = 0;
+    walk_skipped = 0;
+
+    int failed = walk_roots(config, collect_file) != 0;
+
+    if (!failed && walk_count > 0 && !(entries = calloc(walk_count, sizeof(manifest_entry_t)))) {
+        LOG_ERROR("Failed to allocate the manifest");
+        failed = 1;
+    }
+    if (failed) {
+        for (int i = 0; i < walk_count; i++) {
+            free(walk_paths[i]);
+        }
+        free(walk_paths);
+        walk_paths = NULL;
+        walk_capacity = 0;
+        return -1;
+    }
+
+    entry_count = walk_count;
+    for (int i = 0; i < entry_count; i++) {
+        entries[i].path = walk_paths[i];
+    }
+    free(walk_paths);
+    walk_paths = NULL;
+    walk_capacity = 0;
+
+    /* every file is opened, read and formatted independently, so the
+     * walk's output is split into contiguous slices, one per thread */
+    int threads = thread_count(config, entry_count);
+    build_job_t jobs[MANIFEST_MAX_THREADS];
+    pthread_t tids[MANIFEST_MAX_THREADS];
+    for (int t = 0; t < threads; t++) {
+        memset(&jobs[t], 0, sizeof(jobs[t]));
+        jobs[t].start = (int)((long)entry_count * t / threads);
+        jobs[t].end = (int)((long)entry_count * (t + 1) / threads);
+    }
+    int spawned = 1;
+    while (spawned < threads && pthread_create(&tids[spawned], NULL, build_range, &jobs[spawned]) == 0) {
+        spawned++;
+    }
+    build_range(&jobs[0]);
+    for (int t = spawned; t < threads; t++) {
+        build_range(&jobs[t]);
+    }
+    for (int t = 1; t < spawned; t++) {
+        pthread_join(tids[t], NULL);
+    }
+
+    int built = 0;
+    int fds = 0;
+    size_t inline_bytes = 0;
+    for (int t = 0; t < threads; t++) {
+        built += jobs[t].built;
+        fds += jobs[t].fds;
+        inline_bytes += jobs[t].inline_bytes;
+    }
+
+    if (build_index() != 0) {
+        manifest_cleanup();
+        return -1;
+    }
+    indexed_count = built;
+    tree_files = walk_count + walk_skipped;
+
+    if (walk_skipped > 0) {
+        LOG_WARN("manifest_max_files %d reached, %d files are served without the manifest",
+                 walk_limit, walk_skipped);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    LOG_INFO("Manifest indexed %d files in %.1f ms with %d threads: %.1f MB inline, %d open descriptors",
+             built, (finished.tv_sec - started.tv_sec) * 1e3 + (finished.tv_nsec - started.tv_nsec) / 1e6,
+             threads, inline_bytes / (1024.0 * 1024.0), fds);
+    return built;
+}
+
+const manifest_entry_t *manifest_lookup(const char *path) {
+    if (!index_slots) {
+        return NULL;
+    }
+
+    uint32_t hash = hash_path(path);
+    for (size_t slot = hash & index_mask;; slot = (slot + 1) & index_mask) {
+        const manifest_entry_t *entry = index_slots[slot];
+        if (!entry) {
+            return NULL;
+        }
+        if (entry->hash == hash && strcmp(entry->path, path) == 0) {
+            return entry;
+        }
+    }
+}
+
+int manifest_changed(const config_t *config) {
+    if (!index_slots) {
+        return 0;
+    }
+
+    check_files = 0;
+    check_matched = 0;
+    int result = walk_roots(config, check_file);
+    if (result == -1) {
+        return 0;
+    }
+    return result == 1 || check_files != tree_files || check_matched != indexed_count;
+}
+
+void manifest_cleanup(void) {
+    for (int i = 0; i < entry_count; i++) {
+        free_entry(&entries[i]);
+    }
+    free(entries);
+    entries = NULL;
+    entry_count = 0;
+    free(index_slots);
+    index_slots = NULL;
+    index_mask = 0;
+    indexed_count = 0;
+    tree_files = 0;
+}
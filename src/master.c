@@ -4,38 +4,94 @@
 static master_t *master_instance = NULL;
 static pid_t *worker_pids = NULL;
 
+/* a reload forks each worker's successor before the predecessor drains,
+ * so an index briefly has two processes. Generations alternate between
+ * two metrics slots per index to keep their counters apart */
+static int worker_generations[MAX_WORKERS];
+static pid_t draining_pids[MAX_WORKERS];
+static time_t drain_deadlines[MAX_WORKERS];
+
+/* rolling replacement in progress: the next index to replace and the
+ * successor still initialising, which reports readiness over a pipe */
+static int roll_next = -1;
+static pid_t roll_pid = 0;
+static int roll_ready_fd = -1;
+static time_t roll_started = 0;
+
+/* the sidecar scan compresses at the highest level and can run for
+ * minutes on a large tree, so it runs in a helper process; the handler
+ * records whether the manifest went stale, through new sidecars or files
+ * changed under the roots */
+static pid_t scan_pid = 0;
+static volatile sig_atomic_t scan_finished = 0;
+static volatile sig_atomic_t scan_stale = 0;
+static int manifest_refresh = 0;
+static time_t manifest_built = 0;
+
+static int metrics_slot(int worker_id, int generation) {
+    int count = master_instance->worker_count;
+    if (count * 2 > METRICS_MAX_WORKERS) {
+        return worker_id;
+    }
+    return worker_id + (generation & 1) * count;
+}
+
+/* the successor of worker_id counts into the slot of the next generation */
+static void release_successor_slot(int worker_id) {
+    int slot = metrics_slot(worker_id, worker_generations[worker_id] + 1);
+    if (slot != metrics_slot(worker_id, worker_generations[worker_id])) {
+        metrics_release(slot);
+    }
+}
+
 static void handle_child_signal(int signo __attribute__((unused))) {
     pid_t pid;
     int status;
     
     while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (pid == scan_pid) {
+            scan_pid = 0;
+            scan_stale = WIFEXITED(status) && WEXITSTATUS(status) == 1;
+            scan_finished = 1;
+            continue;
+        }
         LOG_INFO("Worker process %d exited with status %d", pid, WEXITSTATUS(status));
         
-        if (master_instance && master_instance->is_running) {
-            for (int i = 0; i < master_instance->worker_count; i++) {
-                if (worker_pids[i] == pid) {
-                    LOG_INFO("Restarting worker %d", i);
-                    pid_t new_pid = fork();
-                    if (new_pid == 0) {
-                        worker_t worker;
-                        if (worker_init(&worker, master_instance->server_fd, i) == 0) {
-                            worker_run(&worker);
-                            worker_cleanup(&worker);
-                        }
-                        exit(0);
-                    } else if (new_pid > 0) {
-                        worker_pids[i] = new_pid;
-                        LOG_INFO("Worker %d restarted with PID %d", i, new_pid);
-                    } else {
-                        LOG_ERROR("Failed to fork worker process: %s", strerror(errno));
-                    }
-                    break;
+        if (!master_instance) {
+            continue;
+        }
+        
+        /* a successor that exits before it is installed; the roll sees
+         * roll_pid cleared and gives up without signalling the PID */
+        if (pid == roll_pid) {
+            roll_pid = 0;
+            release_successor_slot(roll_next);
+            continue;
+        }
+        
+        /* the master loop forks replacements; forking here would race
+         * with the loop updating the same PID tables */
+        for (int i = 0; i < master_instance->worker_count; i++) {
+            if (worker_pids[i] == pid) {
+                worker_pids[i] = 0;
+                break;
+            }
+            if (draining_pids[i] == pid) {
+                draining_pids[i] = 0;
+                int slot = metrics_slot(i, worker_generations[i] + 1);
+                if (slot != metrics_slot(i, worker_generations[i])) {
+                    metrics_release(slot);
                 }
+                break;
             }
         }
     }
 }
 
+static void handle_drain_signal(int signo __attribute__((unused))) {
+    drain_requested = 1;
+}
+
 static int configure_tcp_socket(int sockfd) {
     int opt = 1;
     
@@ -116,14 +172,34 @@ static int set_worker_cpu_affinity(int worker_id) {
     return cpu_id;
 }
 
-static pid_t fork_worker(master_t *master, int worker_id) {
+static pid_t fork_worker(master_t *master, int worker_id, int generation, int ready_fd) {
     pid_t pid = fork();
     
     if (pid == -1) {
         LOG_ERROR("Failed to fork worker process: %s", strerror(errno));
         return -1;
     } else if (pid == 0) {
+        sigset_t chld;
+        sigemptyset(&chld);
+        sigaddset(&chld, SIGCHLD);
+        signal(SIGCHLD, SIG_DFL);
+        sigprocmask(SIG_UNBLOCK, &chld, NULL);
+        
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = handle_drain_signal;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        sigaction(SIGQUIT, &sa, NULL);
+        reload_requested = 0;
+        drain_requested = 0;
+        
+        if (roll_ready_fd != -1) {
+            close(roll_ready_fd);
+        }
+        
         LOG_INFO("Worker %d started with PID %d", worker_id, getpid());
+        metrics_attach(metrics_slot(worker_id, generation));
         
         int cpu_id = set_worker_cpu_affinity(worker_id);
         if (cpu_id < 0) {
@@ -131,7 +207,14 @@ static pid_t fork_worker(master_t *master, int worker_id) {
         }
         
         worker_t worker;
-        if (worker_init(&worker, master->server_fd, cpu_id) == 0) {
+        if (worker_init(&worker, master->server_fd, worker_id, cpu_id) == 0) {
+            if (ready_fd != -1) {
+                char ready = 1;
+                if (write(ready_fd, &ready, 1) != 1) {
+                    LOG_WARN("Worker %d failed to report readiness: %s", worker_id, strerror(errno));
+                }
+                close(ready_fd);
+            }
             worker_run(&worker);
             worker_cleanup(&worker);
         }
@@ -143,10 +226,264 @@ static pid_t fork_worker(master_t *master, int worker_id) {
     return pid;
 }
 
+/* SIGCHLD stays blocked until the PID is recorded, otherwise a child that
+ * dies at once would be reaped before the master knows about it */
+static pid_t spawn_worker(master_t *master, int worker_id, int generation, int ready_fd, pid_t *pid_out) {
+    sigset_t chld, prev;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &prev);
+    
+    pid_t pid = fork_worker(master, worker_id, generation, ready_fd);
+    if (pid > 0) {
+        *pid_out = pid;
+    }
+    
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return pid;
+}
+
+/* forks the background scan unless one is still running. It writes
+ * missing sidecars and, with the manifest on, compares the roots against
+ * it; the helper exits with 1 when the manifest needs a rebuild */
+static void start_scan(master_t *master) {
+    config_t *config = config_get_instance();
+    if (scan_pid > 0 || (!config->precompress && !config->manifest)) {
+        return;
+    }
+    
+    sigset_t chld, prev;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &prev);
+    
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGCHLD, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGHUP, SIG_IGN);
+        signal(SIGUSR1, SIG_IGN);
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        close(master->server_fd);
+        if (roll_ready_fd != -1) {
+            close(roll_ready_fd);
+        }
+        int stale = precompress_scan() > 0 && config->manifest;
+        _exit(stale || (config->manifest && manifest_changed(config)) ? 1 : 0);
+    }
+    if (pid == -1) {
+        LOG_ERROR("Failed to fork the background scan: %s", strerror(errno));
+    } else {
+        scan_pid = pid;
+    }
+    
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+}
+
+static int draining_count(const master_t *master) {
+    int count = 0;
+    for (int i = 0; i < master->worker_count; i++) {
+        if (draining_pids[i] > 0) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static void roll_abort(int worker_id, const char *reason) {
+    LOG_ERROR("Replacement for worker %d %s; reload stopped with %d workers replaced",
+              worker_id, reason, worker_id);
+    
+    /* with SIGCHLD blocked the successor cannot be reaped, and its PID
+     * reused, between the check and the kill */
+    sigset_t chld, prev;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &prev);
+    if (roll_pid > 0) {
+        kill(roll_pid, SIGKILL);
+        release_successor_slot(worker_id);
+    }
+    roll_pid = 0;
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    
+    if (roll_ready_fd != -1) {
+        close(roll_ready_fd);
+        roll_ready_fd = -1;
+    }
+    roll_next = -1;
+}
+
+/* replaces one worker at a time: the successor starts accepting on the
+ * shared socket before its predecessor is told to stop and drain, so
+ * capacity never drops below worker_count */
+static void master_roll(master_t *master) {
+    int i = roll_next;
+    
+    if (roll_pid == 0 && roll_ready_fd != -1) {
+        roll_abort(i, "exited during startup");
+        return;
+    }
+    
+    if (roll_pid == 0) {
+        if (i >= master->worker_count) {
+            LOG_INFO("Reload complete, %d workers replaced", master->worker_count);
+            roll_next = -1;
+            return;
+        }
+        
+        int fds[2];
+        if (pipe2(fds, O_CLOEXEC) == -1) {
+            LOG_ERROR("Failed to create readiness pipe: %s", strerror(errno));
+            roll_abort(i, "could not be started");
+            return;
+        }
+        
+        roll_ready_fd = fds[0];
+        roll_started = time(NULL);
+        pid_t pid = spawn_worker(master, i, worker_generations[i] + 1, fds[1], &roll_pid);
+        close(fds[1]);
+        if (pid <= 0) {
+            roll_abort(i, "could not be forked");
+        }
+        return;
+    }
+    
+    struct pollfd pfd = {roll_ready_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) <= 0) {
+        if (time(NULL) - roll_started > MASTER_ROLL_TIMEOUT) {
+            roll_abort(i, "did not become ready");
+        }
+        return;
+    }
+    
+    char ready = 0;
+    ssize_t n = read(roll_ready_fd, &ready, 1);
+    close(roll_ready_fd);
+    roll_ready_fd = -1;
+    if (n != 1) {
+        roll_abort(i, "failed to initialise");
+        return;
+    }
+    
+    sigset_t chld, prev;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &chld, &prev);
+    
+    if (roll_pid == 0) {
+        sigprocmask(SIG_SETMASK, &prev, NULL);
+        roll_abort(i, "exited during startup");
+        return;
+    }
+    
+    pid_t old = worker_pids[i];
+    worker_pids[i] = roll_pid;
+    worker_generations[i]++;
+    if (old > 0) {
+        draining_pids[i] = old;
+        drain_deadlines[i] = time(NULL) + config_get_instance()->drain_timeout + MASTER_DRAIN_GRACE;
+        kill(old, SIGQUIT);
+    }
+    
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    
+    LOG_INFO("Worker %d replaced by PID %d, PID %d draining", i, roll_pid, old);
+    roll_pid = 0;
+    roll_next++;
+}
+
+static void master_report_capacity(master_t *master) {
+    capacity_plan_t plan;
+    if (capacity_plan(config_get_instance(), &plan) != 0) {
+        return;
+    }
+    capacity_report(&plan, master->worker_count);
+    
+    size_t quotas = 0;
+    for (int i = 0; i < vhost_count(); i++) {
+        quotas += vhost_get(i)->cache_quota;
+    }
+    if (quotas > plan.cache_body_bytes) {
+        LOG_WARN("vhost cache quotas total %zu bytes, more than the %zu byte response cache",
+                 quotas, plan.cache_body_bytes);
+    }
+}
+
+static void master_reload(master_t *master) {
+    config_t *config = config_get_instance();
+    
+    LOG_INFO("Reloading configuration");
+    int replace = config_reload(config, NULL);
+    if (replace < 0) {
+        LOG_ERROR("Configuration rejected, keeping the running settings");
+        return;
+    }
+    
+    log_set_level((log_level_t)config->log_level);
+    config_publish(config);
+    
+    /* the manifest is a snapshot of the roots, so a reload is also how a
+     * deploy reaches it and always replaces the workers */
+    if (config->manifest && !replace) {
+        LOG_INFO("Rebuilding the manifest");
+        replace = 1;
+    }
+    
+    if (!replace) {
+        LOG_INFO("Only live settings changed, applying them to running workers");
+        for (int i = 0; i < master->worker_count; i++) {
+            if (worker_pids[i] > 0) {
+                kill(worker_pids[i], SIGHUP);
+            }
+        }
+        return;
+    }
+    
+    /* state built in the master before fork is inherited by the successors */
+    compress_engine_select(config->compression_engine);
+    vhost_init(config);
+    if (precompress_init(config) != 0) {
+        LOG_WARN("Failed to initialize precompression (continuing without sidecars)");
+    }
+    if (manifest_build(config) < 0) {
+        LOG_WARN("Failed to build the manifest (continuing without it)");
+    }
+    manifest_built = time(NULL);
+    manifest_refresh = 0;
+    
+    master_report_capacity(master);
+    LOG_INFO("Replacing %d workers", master->worker_count);
+    roll_next = 0;
+    
+    /* files deployed with this reload get sidecars from a fresh scan,
+     * which rebuilds the manifest again once it wrote any */
+    start_scan(master);
+}
+
+/* the manifest is a snapshot of the files and sidecars that existed when
+ * it was built; on a fresh deploy that is no sidecars, so it is rebuilt
+ * after the first scan, and again whenever a scan finds it stale */
+static void master_refresh_manifest(master_t *master) {
+    LOG_INFO("Files or sidecars changed since the manifest was built, rebuilding it");
+    manifest_built = time(NULL);
+    if (manifest_build(config_get_instance()) < 0) {
+        LOG_WARN("Failed to rebuild the manifest, workers keep the previous one");
+        return;
+    }
+    LOG_INFO("Replacing %d workers", master->worker_count);
+    roll_next = 0;
+}
+
 int master_init(master_t *master, int port, int worker_count) {
     if (!master || worker_count <= 0) {
         return -1;
     }
+    if (worker_count > MAX_WORKERS) {
+        LOG_ERROR("worker_processes %d exceeds the limit of %d", worker_count, MAX_WORKERS);
+        return -1;
+    }
 
     memset(master, 0, sizeof(master_t));
     master->port = port;
@@ -191,6 +528,14 @@ int master_init(master_t *master, int port, int worker_count) {
         return -1;
     }
 
+    if (metrics_init(worker_count * 2) != 0) {
+        LOG_WARN("Metrics unavailable, counters will not be exported");
+    }
+    
+    if (config_share() != 0) {
+        LOG_WARN("Live settings will only reach workers through replacement");
+    }
+
     worker_pids = calloc(worker_count, sizeof(pid_t));
     if (!worker_pids) {
         LOG_ERROR("Failed to allocate worker PID array");
@@ -219,11 +564,11 @@ void master_run(master_t *master) {
     }
 
     LOG_INFO("Starting master process with %d workers", master->worker_count);
+    master_report_capacity(master);
 
     for (int i = 0; i < master->worker_count; i++) {
-        pid_t pid = fork_worker(master, i);
+        pid_t pid = spawn_worker(master, i, worker_generations[i], -1, &worker_pids[i]);
         if (pid > 0) {
-            worker_pids[i] = pid;
             LOG_INFO("Started worker %d with PID %d", i, pid);
         }
     }
@@ -233,21 +578,87 @@ void master_run(master_t *master) {
     time_t last_stats_time = time(NULL);
     int stats_interval = 60; 
     
+    config_t *config = config_get_instance();
+    metrics_listen(config->metrics_port, config->metrics_path);
+    start_scan(master);
+    time_t last_precompress_time = time(NULL);
+    manifest_built = last_precompress_time;
+    int reload_deferred = 0;
+    
     while (master->is_running && !shutdown_requested) {
-        sleep(1);
+        metrics_poll(roll_next >= 0 ? MASTER_ROLL_POLL_MS : 1000);
         
         for (int i = 0; i < master->worker_count; i++) {
             if (worker_pids[i] <= 0) {
                 LOG_INFO("Restarting missing worker %d", i);
-                pid_t pid = fork_worker(master, i);
+                pid_t pid = spawn_worker(master, i, worker_generations[i], -1, &worker_pids[i]);
                 if (pid > 0) {
-                    worker_pids[i] = pid;
                     LOG_INFO("Restarted worker %d with PID %d", i, pid);
                 }
             }
         }
         
+        if (scan_finished) {
+            scan_finished = 0;
+            if (scan_stale && config->manifest) {
+                manifest_refresh = 1;
+            }
+        }
+        
+        /* a reload while the last one is still draining waits for it, so
+         * an index never has more than two processes. Scan-triggered
+         * rebuilds are further held to one per refresh interval */
+        int refresh_due = manifest_refresh && time(NULL) - manifest_built >= MASTER_MANIFEST_REFRESH_INTERVAL;
+        if ((reload_requested || refresh_due) && roll_next < 0) {
+            if (draining_count(master) > 0) {
+                if (!reload_deferred) {
+                    LOG_INFO("Reload deferred until %d draining workers exit", draining_count(master));
+                    reload_deferred = 1;
+                }
+            } else if (reload_requested) {
+                reload_requested = 0;
+                reload_deferred = 0;
+                master_reload(master);
+            } else {
+                manifest_refresh = 0;
+                reload_deferred = 0;
+                master_refresh_manifest(master);
+            }
+        }
+        
+        if (roll_next >= 0) {
+            master_roll(master);
+        }
+        
+        if (log_reopen_requested) {
+            log_reopen_requested = 0;
+            LOG_INFO("Reopening log files");
+            log_reopen();
+            for (int i = 0; i < master->worker_count; i++) {
+                if (worker_pids[i] > 0) {
+                    kill(worker_pids[i], SIGUSR1);
+                }
+                if (draining_pids[i] > 0) {
+                    kill(draining_pids[i], SIGUSR1);
+                }
+            }
+        }
+        
         time_t now = time(NULL);
+        for (int i = 0; i < master->worker_count; i++) {
+            if (draining_pids[i] > 0 && now > drain_deadlines[i]) {
+                LOG_WARN("Worker %d (PID %d) overran its drain deadline, sending SIGKILL", i, draining_pids[i]);
+                kill(draining_pids[i], SIGKILL);
+            }
+        }
+        
+        int precompress_interval = config->precompress_interval > 0 ?
+                                   config->precompress_interval : PRECOMPRESS_SCAN_INTERVAL;
+        if (now - last_precompress_time >= precompress_interval && scan_pid == 0) {
+            start_scan(master);
+            last_precompress_time = now;
+        }
+        
         if (now - last_stats_time >= stats_interval) {
             LOG_INFO("Master process running with %d workers", master->worker_count);
             last_stats_time = now;
@@ -255,10 +666,32 @@ void master_run(master_t *master) {
     }
 
     LOG_INFO("Master shutting down, sending SIGTERM to workers");
+    
+    /* reaped below instead of by the handler, which would race the loop */
+    signal(SIGCHLD, SIG_DFL);
+    
+    pid_t remaining[MAX_WORKERS * 2 + 2];
+    int remaining_count = 0;
     for (int i = 0; i < master->worker_count; i++) {
         if (worker_pids[i] > 0) {
-            kill(worker_pids[i], SIGTERM);
+            remaining[remaining_count++] = worker_pids[i];
         }
+        if (draining_pids[i] > 0) {
+            remaining[remaining_count++] = draining_pids[i];
+        }
+        worker_pids[i] = 0;
+        draining_pids[i] = 0;
+    }
+    if (roll_pid > 0) {
+        remaining[remaining_count++] = roll_pid;
+        roll_pid = 0;
+    }
+    if (scan_pid > 0) {
+        remaining[remaining_count++] = scan_pid;
+        scan_pid = 0;
+    }
+    for (int i = 0; i < remaining_count; i++) {
+        kill(remaining[i], SIGTERM);
     }
 
     int timeout = 5; 
@@ -267,15 +700,17 @@ void master_run(master_t *master) {
     
     while (!all_exited && time(NULL) - start_time < timeout) {
         all_exited = 1;
-        for (int i = 0; i < master->worker_count; i++) {
-            if (worker_pids[i] > 0) {
+        for (int i = 0; i < remaining_count; i++) {
+            if (remaining[i] > 0) {
                 int status;
-                pid_t result = waitpid(worker_pids[i], &status, WNOHANG);
+                pid_t result = waitpid(remaining[i], &status, WNOHANG);
                 if (result == 0) {
                     all_exited = 0;
-                } else if (result > 0) {
-                    worker_pids[i] = 0;
-                    LOG_INFO("Worker %d exited with status %d", i, WEXITSTATUS(status));
+                } else {
+                    if (result > 0) {
+                        LOG_INFO("Worker process %d exited with status %d", remaining[i], WEXITSTATUS(status));
+                    }
+                    remaining[i] = 0;
                 }
             }
         }
@@ -285,12 +720,11 @@ void master_run(master_t *master) {
         }
     }
 
-    for (int i = 0; i < master->worker_count; i++) {
-        if (worker_pids[i] > 0) {
-            LOG_WARN("Worker %d (PID %d) did not exit gracefully, sending SIGKILL", 
-                    i, worker_pids[i]);
-            kill(worker_pids[i], SIGKILL);
-            waitpid(worker_pids[i], NULL, 0);
+    for (int i = 0; i < remaining_count; i++) {
+        if (remaining[i] > 0) {
+            LOG_WARN("Worker process %d did not exit gracefully, sending SIGKILL", remaining[i]);
+            kill(remaining[i], SIGKILL);
+            waitpid(remaining[i], NULL, 0);
         }
     }
 
@@ -311,6 +745,13 @@ void master_cleanup(master_t *master) {
         free(worker_pids);
         worker_pids = NULL;
     }
+    
+    if (roll_ready_fd != -1) {
+        close(roll_ready_fd);
+        roll_ready_fd = -1;
+    }
+
+    metrics_cleanup();
 
     master_instance = NULL;
 }
@@ -327,19 +768,8 @@ void master_handle_signal(int signum) {
             master_instance->is_running = 0;
             break;
         case SIGHUP:
-            LOG_INFO("Received reload signal");
-            config_t *config = config_get_instance();
-            if (config_load(config, NULL) == 0) {
-                LOG_INFO("Configuration reloaded successfully");
-                
-                for (int i = 0; i < master_instance->worker_count; i++) {
-                    if (worker_pids[i] > 0) {
-                        kill(worker_pids[i], SIGHUP);
-                    }
-                }
-            } else {
-                LOG_ERROR("Failed to reload configuration");
-            }
+            /* parsed and applied from the master loop, not from here */
+            reload_requested = 1;
             break;
     }
 }
@@ -1,8 +1,17 @@
 #include "mempool.h"
 
-static __thread mem_block_t *local_free_list = NULL;
-static __thread int local_free_count = 0;
 #define LOCAL_BATCH_SIZE 64  
+#define LOCAL_CACHES 4
+
+/* blocks freed by this thread, kept apart per pool so a block never goes
+ * back out of a pool other than the one that owns it */
+typedef struct {
+    mempool_t *pool;
+    mem_block_t *free_list;
+    int free_count;
+} local_cache_t;
+
+static __thread local_cache_t local_caches[LOCAL_CACHES];
 
 #define CACHE_LINE_SIZE 64
 
@@ -21,12 +30,12 @@ static void* allocate_memory(size_t size) {
     void* ptr = mmap(NULL, aligned_size, PROT_READ | PROT_WRITE, 
                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     
+    /* pages are faulted in as blocks are first handed out, so a pool only
+     * costs memory for the connections it has actually served */
     if (ptr == MAP_FAILED) {
         return NULL;
     }
     
-    madvise(ptr, aligned_size, MADV_WILLNEED);
-    
     return ptr;
 }
 
@@ -115,29 +124,53 @@ int mempool_init(mempool_t *pool, size_t block_size, size_t blocks_per_pool) {
     return 0;
 }
 
-static void flush_local_cache(mempool_t *pool) {
-    if (!local_free_list) return;
+static void flush_local_cache(local_cache_t *cache) {
+    mempool_t *pool = cache->pool;
+    if (!cache->free_list) return;
     
     pthread_mutex_lock(&pool->mutex);
     
-    mem_block_t *last = local_free_list;
+    mem_block_t *last = cache->free_list;
     int count = 1;
-    while (last->next && count < local_free_count) {
+    while (last->next && count < cache->free_count) {
         prefetch_next_block(last);
         last = last->next;
         count++;
     }
     
     last->next = pool->free_list;
-    pool->free_list = local_free_list;
+    pool->free_list = cache->free_list;
     
     pthread_mutex_unlock(&pool->mutex);
     
-    local_free_list = NULL;
-    local_free_count = 0;
+    cache->free_list = NULL;
+    cache->free_count = 0;
 }
 
-static int refill_local_cache(mempool_t *pool) {
+/* this thread's cache for pool; with every slot taken the last one is
+ * flushed back to its own pool and reused */
+static local_cache_t *local_cache(mempool_t *pool) {
+    local_cache_t *unused = NULL;
+    for (int i = 0; i < LOCAL_CACHES; i++) {
+        if (local_caches[i].pool == pool) {
+            return &local_caches[i];
+        }
+        if (!local_caches[i].pool && !unused) {
+            unused = &local_caches[i];
+        }
+    }
+    if (!unused) {
+        unused = &local_caches[LOCAL_CACHES - 1];
+        flush_local_cache(unused);
+    }
+    unused->pool = pool;
+    unused->free_list = NULL;
+    unused->free_count = 0;
+    return unused;
+}
+
+static int refill_local_cache(local_cache_t *cache) {
+    mempool_t *pool = cache->pool;
     pthread_mutex_lock(&pool->mutex);
     
     if (!pool->free_list) {
@@ -188,8 +221,8 @@ static int refill_local_cache(mempool_t *pool) {
         LOG_DEBUG("Memory pool expanded to %zu blocks", pool->total_blocks);
     }
     
-    local_free_list = pool->free_list;
-    mem_block_t *last = local_free_list;
+    cache->free_list = pool->free_list;
+    mem_block_t *last = cache->free_list;
     int count = 1;
     
     while (count < LOCAL_BATCH_SIZE && last->next) {
@@ -200,7 +233,7 @@ static int refill_local_cache(mempool_t *pool) {
     
     pool->free_list = last->next;
     last->next = NULL;
-    local_free_count = count;
+    cache->free_count = count;
     
     pthread_mutex_unlock(&pool->mutex);
     
@@ -208,21 +241,22 @@ static int refill_local_cache(mempool_t *pool) {
 }
 
 void* mempool_alloc(mempool_t *pool) {
-    if (!local_free_list) {
-        if (refill_local_cache(pool) != 0) {
+    local_cache_t *cache = local_cache(pool);
+    if (!cache->free_list) {
+        if (refill_local_cache(cache) != 0) {
             return NULL;
         }
         
-        if (!local_free_list) {
+        if (!cache->free_list) {
             return NULL;
         }
     }
     
-    mem_block_t *block = local_free_list;
-    local_free_list = block->next;
-    local_free_count--;
+    mem_block_t *block = cache->free_list;
+    cache->free_list = block->next;
+    cache->free_count--;
     
-    prefetch_next_block(local_free_list);
+    prefetch_next_block(cache->free_list);
     
     __atomic_add_fetch(&pool->used_blocks, 1, __ATOMIC_SEQ_CST);
     
@@ -234,6 +268,7 @@ void mempool_free(mempool_t *pool, void *ptr) {
         return;
     }
     
+    local_cache_t *cache = local_cache(pool);
     int found = 0;
     for (size_t i = 0; i < pool->num_memory_blocks; i += 2) {
         char *block_memory = (char *)pool->memory_blocks[i];
@@ -249,9 +284,9 @@ void mempool_free(mempool_t *pool, void *ptr) {
             mem_block_t *block_headers = (mem_block_t *)pool->memory_blocks[i + 1];
             mem_block_t *block = &block_headers[block_index];
             
-            block->next = local_free_list;
-            local_free_list = block;
-            local_free_count++;
+            block->next = cache->free_list;
+            cache->free_list = block;
+            cache->free_count++;
             
             __atomic_sub_fetch(&pool->used_blocks, 1, __ATOMIC_SEQ_CST);
             
@@ -265,8 +300,8 @@ void mempool_free(mempool_t *pool, void *ptr) {
         return;
     }
     
-    if (local_free_count >= LOCAL_BATCH_SIZE * 2) {
-        flush_local_cache(pool);
+    if (cache->free_count >= LOCAL_BATCH_SIZE * 2) {
+        flush_local_cache(cache);
     }
 }
 
@@ -275,7 +310,12 @@ void mempool_cleanup(mempool_t *pool) {
         return;
     }
 
-    flush_local_cache(pool);
+    for (int i = 0; i < LOCAL_CACHES; i++) {
+        if (local_caches[i].pool == pool) {
+            flush_local_cache(&local_caches[i]);
+            local_caches[i].pool = NULL;
+        }
+    }
     
     pthread_mutex_lock(&pool->mutex);
 
@@ -284,7 +324,7 @@ void mempool_cleanup(mempool_t *pool) {
         free_memory(pool->memory_blocks[i], total_size);
         
         if (i + 1 < pool->num_memory_blocks) {
-            free(pool->memory_blocks[i + 1]);
+            free_memory(pool->memory_blocks[i + 1], sizeof(mem_block_t) * pool->blocks_per_pool);
         }
     }
     
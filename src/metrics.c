@@ -0,0 +1,348 @@
+#include "metrics.h"
+
+static metrics_worker_t private_slot;
+metrics_worker_t *metrics_worker = &private_slot;
+
+static metrics_worker_t *slots = NULL;
+static int slot_count = 0;
+static int listen_fd = -1;
+static char metrics_path[128] = METRICS_DEFAULT_PATH;
+static char response_buf[METRICS_RESPONSE_SIZE];
+
+#define LOAD(field) __atomic_load_n(&(field), __ATOMIC_RELAXED)
+
+int metrics_init(int worker_count) {
+    if (worker_count > METRICS_MAX_WORKERS) {
+        worker_count = METRICS_MAX_WORKERS;
+    }
+
+    slots = mmap(NULL, sizeof(metrics_worker_t) * worker_count, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (slots == MAP_FAILED) {
+        LOG_ERROR("Failed to map metrics segment: %s", strerror(errno));
+        slots = NULL;
+        return -1;
+    }
+
+    slot_count = worker_count;
+    return 0;
+}
+
+/* a restarted worker inherits its predecessor's counters so totals stay
+ * monotonic, but gauges describe the process and start over */
+void metrics_attach(int worker_id) {
+    if (!slots || worker_id < 0 || worker_id >= slot_count) {
+        return;
+    }
+
+    if (listen_fd != -1) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+
+    metrics_worker = &slots[worker_id];
+    metrics_release(worker_id);
+}
+
+/* the counters stay in the totals after the owning process is gone, the
+ * gauges are cleared so an unused slot does not report stale values */
+void metrics_release(int worker_id) {
+    if (!slots || worker_id < 0 || worker_id >= slot_count) {
+        return;
+    }
+
+    slots[worker_id].connections = 0;
+    slots[worker_id].compress_offset = 0;
+    slots[worker_id].compress_cpu_percent = 0;
+    slots[worker_id].compress_lag_ms = 0;
+}
+
+int metrics_listen(int port, const char *path) {
+    if (port <= 0) {
+        return 0;
+    }
+    if (path && path[0] == '/') {
+        strncpy(metrics_path, path, sizeof(metrics_path) - 1);
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        LOG_ERROR("Failed to create metrics socket: %s", strerror(errno));
+        return -1;
+    }
+
+    int opt = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 16) == -1) {
+        LOG_ERROR("Failed to listen for metrics on 127.0.0.1:%d: %s", port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    listen_fd = fd;
+    LOG_INFO("Serving metrics on http://127.0.0.1:%d%s", port, metrics_path);
+    return 0;
+}
+
+static void append(char *buf, size_t size, size_t *len, const char *format, ...) {
+    if (*len >= size) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buf + *len, size - *len, format, args);
+    va_end(args);
+
+    if (n > 0) {
+        *len = *len + n < size ? *len + n : size;
+    }
+}
+
+static void append_counter(char *buf, size_t size, size_t *len, const char *name, const char *help,
+                           uint64_t value) {
+    append(buf, size, len, "# HELP %s %s\n# TYPE %s counter\n%s %lu\n",
+           name, help, name, name, (unsigned long)value);
+}
+
+size_t metrics_render(char *buf, size_t size) {
+    metrics_worker_t sum;
+    memset(&sum, 0, sizeof(sum));
+    size_t len = 0;
+
+    for (int w = 0; w < slot_count; w++) {
+        metrics_worker_t *slot = &slots[w];
+        sum.requests += LOAD(slot->requests);
+        for (int i = 0; i < METRICS_STATUS_COUNT; i++) {
+            sum.status[i] += LOAD(slot->status[i]);
+        }
+        sum.bytes_out += LOAD(slot->bytes_out);
+        sum.accepts += LOAD(slot->accepts);
+        sum.timeouts += LOAD(slot->timeouts);
+        sum.cache_hits += LOAD(slot->cache_hits);
+        sum.cache_misses += LOAD(slot->cache_misses);
+        sum.manifest_hits += LOAD(slot->manifest_hits);
+        sum.cache_evictions += LOAD(slot->cache_evictions);
+        sum.file_cache_hits += LOAD(slot->file_cache_hits);
+        sum.file_cache_misses += LOAD(slot->file_cache_misses);
+        sum.upstream_failures += LOAD(slot->upstream_failures);
+        sum.compress_skipped += LOAD(slot->compress_skipped);
+        sum.access_log_dropped += LOAD(slot->access_log_dropped);
+        for (int i = 0; i <= COMPRESSION_LEVEL_MAX; i++) {
+            sum.compress_responses[i] += atomic_load_explicit(&slot->compress_responses[i], memory_order_relaxed);
+        }
+        sum.compress_bytes_in += atomic_load_explicit(&slot->compress_bytes_in, memory_order_relaxed);
+        sum.compress_bytes_out += atomic_load_explicit(&slot->compress_bytes_out, memory_order_relaxed);
+        sum.compress_cpu_ns += atomic_load_explicit(&slot->compress_cpu_ns, memory_order_relaxed);
+    }
+
+    append(buf, size, &len, "# HELP nxlite_requests_total HTTP responses by status code.\n"
+                            "# TYPE nxlite_requests_total counter\n");
+    for (int i = 0; i < METRICS_STATUS_COUNT; i++) {
+        if (sum.status[i]) {
+            append(buf, size, &len, "nxlite_requests_total{code=\"%d\"} %lu\n",
+                   i + METRICS_STATUS_MIN, (unsigned long)sum.status[i]);
+        }
+    }
+    append_counter(buf, size, &len, "nxlite_sent_bytes_total", "Bytes written to client sockets.",
+                   sum.bytes_out);
+    append_counter(buf, size, &len, "nxlite_accepted_connections_total", "Client connections accepted.",
+                   sum.accepts);
+    append_counter(buf, size, &len, "nxlite_timeouts_total", "Idle client and upstream timeouts.",
+                   sum.timeouts);
+    append_counter(buf, size, &len, "nxlite_upstream_failures_total", "Failed proxy upstream attempts.",
+                   sum.upstream_failures);
+    append_counter(buf, size, &len, "nxlite_access_log_dropped_total",
+                   "Access log records discarded because the buffer was full.", sum.access_log_dropped);
+
+    append(buf, size, &len, "# HELP nxlite_cache_hits_total Cache lookups that found an entry.\n"
+                            "# TYPE nxlite_cache_hits_total counter\n"
+                            "nxlite_cache_hits_total{cache=\"response\"} %lu\n"
+                            "nxlite_cache_hits_total{cache=\"open_file\"} %lu\n"
+                            "nxlite_cache_hits_total{cache=\"manifest\"} %lu\n",
+           (unsigned long)sum.cache_hits, (unsigned long)sum.file_cache_hits, (unsigned long)sum.manifest_hits);
+    append(buf, size, &len, "# HELP nxlite_cache_misses_total Cache lookups that found nothing usable.\n"
+                            "# TYPE nxlite_cache_misses_total counter\n"
+                            "nxlite_cache_misses_total{cache=\"response\"} %lu\n"
+                            "nxlite_cache_misses_total{cache=\"open_file\"} %lu\n",
+           (unsigned long)sum.cache_misses, (unsigned long)sum.file_cache_misses);
+    append_counter(buf, size, &len, "nxlite_cache_evictions_total",
+                   "Response cache entries displaced by new ones.", sum.cache_evictions);
+
+    append(buf, size, &len, "# HELP nxlite_compressed_responses_total Responses compressed on the fly by level.\n"
+                            "# TYPE nxlite_compressed_responses_total counter\n");
+    for (int i = COMPRESSION_LEVEL_MIN; i <= COMPRESSION_LEVEL_MAX; i++) {
+        append(buf, size, &len, "nxlite_compressed_responses_total{level=\"%d\"} %lu\n",
+               i, (unsigned long)sum.compress_responses[i]);
+    }
+    append_counter(buf, size, &len, "nxlite_compression_skipped_total",
+                   "Compressible responses sent identity because they were too small.", sum.compress_skipped);
+    append_counter(buf, size, &len, "nxlite_compression_input_bytes_total", "Bytes fed to compressors.",
+                   sum.compress_bytes_in);
+    append_counter(buf, size, &len, "nxlite_compression_output_bytes_total", "Bytes produced by compressors.",
+                   sum.compress_bytes_out);
+    append(buf, size, &len, "# HELP nxlite_compression_ratio Input over output bytes for on-the-fly compression.\n"
+                            "# TYPE nxlite_compression_ratio gauge\nnxlite_compression_ratio %.3f\n",
+           sum.compress_bytes_out ? (double)sum.compress_bytes_in / sum.compress_bytes_out : 0.0);
+    append(buf, size, &len, "# HELP nxlite_compression_cpu_seconds_total CPU time spent compressing.\n"
+                            "# TYPE nxlite_compression_cpu_seconds_total counter\n"
+                            "nxlite_compression_cpu_seconds_total %.6f\n",
+           sum.compress_cpu_ns / 1e9);
+
+    static const struct {
+        const char *name;
+        const char *help;
+        size_t offset;
+    } gauges[] = {
+        {"nxlite_open_connections", "Client connections currently open.",
+         offsetof(metrics_worker_t, connections)},
+        {"nxlite_compression_level_offset", "Adaptive compression level offset.",
+         offsetof(metrics_worker_t, compress_offset)},
+        {"nxlite_worker_cpu_percent", "Worker CPU use over the last controller interval.",
+         offsetof(metrics_worker_t, compress_cpu_percent)},
+        {"nxlite_event_loop_lag_milliseconds", "Longest event loop batch in the last controller interval.",
+         offsetof(metrics_worker_t, compress_lag_ms)},
+    };
+    for (size_t g = 0; g < sizeof(gauges) / sizeof(gauges[0]); g++) {
+        append(buf, size, &len, "# HELP %s %s\n# TYPE %s gauge\n",
+               gauges[g].name, gauges[g].help, gauges[g].name);
+        for (int w = 0; w < slot_count; w++) {
+            int64_t *value = (int64_t *)((char *)&slots[w] + gauges[g].offset);
+            append(buf, size, &len, "%s{worker=\"%d\"} %ld\n", gauges[g].name, w, (long)LOAD(*value));
+        }
+    }
+
+    static const char *classes[LATENCY_CLASSES] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    append(buf, size, &len, "# HELP nxlite_phase_latency_seconds Request phase latency by cache result and status class.\n"
+                            "# TYPE nxlite_phase_latency_seconds summary\n");
+    for (int w = 0; w < slot_count; w++) {
+        for (int phase = 0; phase < LATENCY_PHASE_COUNT; phase++) {
+            for (int hit = 0; hit < 2; hit++) {
+                for (int class = 0; class < LATENCY_CLASSES; class++) {
+                    const latency_hist_t *hist = &slots[w].latency.hist[phase][hit][class];
+                    uint64_t count = LOAD(hist->count);
+                    if (count == 0) {
+                        continue;
+                    }
+
+                    char labels[128];
+                    snprintf(labels, sizeof(labels), "worker=\"%d\",phase=\"%s\",cache=\"%s\",class=\"%s\"",
+                             w, latency_phase_name(phase), hit ? "hit" : "miss", classes[class]);
+                    for (size_t q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+                        append(buf, size, &len, "nxlite_phase_latency_seconds{%s,quantile=\"%g\"} %.9f\n",
+                               labels, quantiles[q], latency_quantile(hist, quantiles[q]) / 1e9);
+                    }
+                    append(buf, size, &len, "nxlite_phase_latency_seconds{%s,quantile=\"1\"} %.9f\n"
+                                            "nxlite_phase_latency_seconds_sum{%s} %.9f\n"
+                                            "nxlite_phase_latency_seconds_count{%s} %lu\n",
+                           labels, LOAD(hist->max) / 1e9, labels, LOAD(hist->sum) / 1e9,
+                           labels, (unsigned long)count);
+                }
+            }
+        }
+    }
+
+    append(buf, size, &len, "# EOF\n");
+    return len;
+}
+
+static void send_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/* scrapes are rare and tiny, so each one is answered synchronously with
+ * short socket timeouts bounding how long a slow client can stall the
+ * master */
+static void serve_scrape(int fd) {
+    struct timeval tv = {1, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    char request[2048];
+    size_t got = 0;
+    while (got < sizeof(request) - 1) {
+        ssize_t n = recv(fd, request + got, sizeof(request) - 1 - got, 0);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+        request[got] = '\0';
+        if (strstr(request, "\r\n\r\n")) {
+            break;
+        }
+    }
+    request[got] = '\0';
+
+    char method[8], path[256];
+    int found = sscanf(request, "%7s %255s", method, path) == 2 && strcmp(method, "GET") == 0;
+    if (found) {
+        path[strcspn(path, "?")] = '\0';
+        found = strcmp(path, metrics_path) == 0;
+    }
+
+    char header[256];
+    if (!found) {
+        int header_len = snprintf(header, sizeof(header),
+                                  "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+        send_all(fd, header, header_len);
+        return;
+    }
+
+    size_t body_len = metrics_render(response_buf, sizeof(response_buf));
+    int header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                              "Content-Length: %zu\r\nConnection: close\r\n\r\n", body_len);
+    send_all(fd, header, header_len);
+    send_all(fd, response_buf, body_len);
+}
+
+void metrics_poll(int timeout_ms) {
+    if (listen_fd == -1) {
+        usleep(timeout_ms * 1000);
+        return;
+    }
+
+    struct pollfd pfd = {listen_fd, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return;
+    }
+
+    for (;;) {
+        int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1) {
+            return;
+        }
+        serve_scrape(fd);
+        close(fd);
+    }
+}
+
+void metrics_cleanup(void) {
+    if (listen_fd != -1) {
+        close(listen_fd);
+        listen_fd = -1;
+    }
+    if (slots) {
+        munmap(slots, sizeof(metrics_worker_t) * slot_count);
+        slots = NULL;
+        slot_count = 0;
+    }
+    metrics_worker = &private_slot;
+}
@@ -0,0 +1,319 @@
+#include "precompress.h"
+#include "vhost.h"
+#include <sys/xattr.h>
+
+#define SIDECAR_SOURCE_XATTR "user.nxlite.source"
+
+/* each distinct document root gets its own directory under cache_dir,
+ * named after the root's last component and a hash of its full path, so
+ * two roots with the same relative paths never share a sidecar */
+typedef struct {
+    char dir[PATH_MAX];
+    size_t len;
+    char key[64];
+} sidecar_root_t;
+
+static int precompress_enabled = 0;
+static sidecar_root_t roots[VHOST_MAX];
+static int root_count = 0;
+static char cache_dir[PATH_MAX];
+static size_t cache_len = 0;
+static size_t min_size = PRECOMPRESS_MIN_SIZE;
+
+static int scan_checked = 0;
+static int scan_written = 0;
+
+static const compression_type_t sidecar_types[] = {
+    COMPRESSION_BROTLI,
+    COMPRESSION_ZSTD,
+    COMPRESSION_GZIP,
+    COMPRESSION_NONE
+};
+
+static void add_root(const char *dir) {
+    sidecar_root_t *root = &roots[root_count];
+    snprintf(root->dir, sizeof(root->dir), "%s", dir);
+    root->len = strlen(root->dir);
+    while (root->len > 1 && root->dir[root->len - 1] == '/') {
+        root->dir[--root->len] = '\0';
+    }
+
+    for (int i = 0; i < root_count; i++) {
+        if (strcmp(roots[i].dir, root->dir) == 0) {
+            return;
+        }
+    }
+
+    uint32_t hash = 2166136261u;
+    for (const char *p = root->dir; *p; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 16777619u;
+    }
+    const char *base = strrchr(root->dir, '/');
+    base = base && base[1] ? base + 1 : "root";
+    snprintf(root->key, sizeof(root->key), "%.40s-%08x", base, hash);
+    root_count++;
+}
+
+/* called after vhost_init so every host's root is known */
+int precompress_init(const config_t *config) {
+    precompress_enabled = 0;
+
+    if (!config->precompress || config->precompress_dir[0] == '\0') {
+        LOG_INFO("Precompressed sidecars disabled");
+        return 0;
+    }
+
+    root_count = 0;
+    int hosts = vhost_count();
+    if (hosts <= 0) {
+        add_root(config->root_dir);
+    }
+    for (int i = 0; i < hosts && root_count < VHOST_MAX; i++) {
+        add_root(vhost_get(i)->root_dir);
+    }
+
+    strncpy(cache_dir, config->precompress_dir, sizeof(cache_dir) - 1);
+    cache_dir[sizeof(cache_dir) - 1] = '\0';
+    cache_len = strlen(cache_dir);
+    while (cache_len > 1 && cache_dir[cache_len - 1] == '/') {
+        cache_dir[--cache_len] = '\0';
+    }
+
+    if (config->precompress_min_size > 0) {
+        min_size = config->precompress_min_size;
+    }
+
+    if (mkdir(cache_dir, 0755) == -1 && errno != EEXIST) {
+        LOG_ERROR("Failed to create precompress directory %s: %s", cache_dir, strerror(errno));
+        return -1;
+    }
+
+    precompress_enabled = 1;
+    for (int i = 0; i < root_count; i++) {
+        LOG_INFO("Precompressed sidecars enabled: %s -> %s/%s", roots[i].dir, cache_dir, roots[i].key);
+    }
+    return 0;
+}
+
+/* the longest root path lies under, matched on a path component boundary,
+ * so nested roots agree on one sidecar per file */
+static const sidecar_root_t *find_root(const char *path) {
+    const sidecar_root_t *found = NULL;
+    for (int i = 0; i < root_count; i++) {
+        const sidecar_root_t *root = &roots[i];
+        if (strncmp(path, root->dir, root->len) != 0) {
+            continue;
+        }
+        char next = path[root->len];
+        if ((next == '/' || next == '\0' || root->dir[root->len - 1] == '/') &&
+            (!found || root->len > found->len)) {
+            found = root;
+        }
+    }
+    return found;
+}
+
+int precompress_sidecar_path(const char *path, compression_type_t type, char *out, size_t out_size) {
+    const char *suffix = encoding_suffix(type);
+    if (!precompress_enabled || !suffix) {
+        return -1;
+    }
+
+    const sidecar_root_t *root = find_root(path);
+    if (!root) {
+        return -1;
+    }
+
+    const char *rel = path + root->len;
+    int written = snprintf(out, out_size, "%s/%s%s%s%s",
+                           cache_dir, root->key, rel[0] == '/' ? "" : "/", rel, suffix);
+    if (written < 0 || (size_t)written >= out_size) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/* the source a sidecar was compressed from, stored on the sidecar since
+ * an mtime alone also matches a different file deployed with the same
+ * timestamp */
+static int format_source(const struct stat *src_st, char *out, size_t out_size) {
+    return snprintf(out, out_size, "%llx:%llx:%llx", (unsigned long long)src_st->st_dev,
+                    (unsigned long long)src_st->st_ino, (unsigned long long)src_st->st_size);
+}
+
+/* fd is the open sidecar, or -1 to look it up by path */
+static int sidecar_is_fresh(const struct stat *src_st, const struct stat *sc_st, int fd, const char *sidecar) {
+    if (!S_ISREG(sc_st->st_mode) ||
+        sc_st->st_mtim.tv_sec != src_st->st_mtim.tv_sec ||
+        sc_st->st_mtim.tv_nsec != src_st->st_mtim.tv_nsec) {
+        return 0;
+    }
+
+    char expected[64], recorded[64];
+    int expected_len = format_source(src_st, expected, sizeof(expected));
+    ssize_t recorded_len = fd != -1 ? fgetxattr(fd, SIDECAR_SOURCE_XATTR, recorded, sizeof(recorded))
+                                    : getxattr(sidecar, SIDECAR_SOURCE_XATTR, recorded, sizeof(recorded));
+    return recorded_len == expected_len && memcmp(recorded, expected, expected_len) == 0;
+}
+
+int precompress_open(const char *path, const struct stat *src_st, compression_type_t type, struct stat *sidecar_st) {
+    char sidecar[PATH_MAX];
+    if (precompress_sidecar_path(path, type, sidecar, sizeof(sidecar)) != 0) {
+        return -1;
+    }
+
+    int fd = open(sidecar, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    if (fstat(fd, sidecar_st) == -1 || !sidecar_is_fresh(src_st, sidecar_st, fd, sidecar) ||
+        sidecar_st->st_size >= src_st->st_size) {
+        close(fd);
+        return -1;
+    }
+
+    LOG_DEBUG("Using precompressed sidecar %s (%ld bytes)", sidecar, (long)sidecar_st->st_size);
+    return fd;
+}
+
+static int make_parent_dirs(const char *path) {
+    char tmp[PATH_MAX];
+    strncpy(tmp, path, sizeof(tmp) - 1);
+    tmp[sizeof(tmp) - 1] = '\0';
+
+    for (char *p = tmp + cache_len + 1; *p; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(tmp, 0755) == -1 && errno != EEXIST) {
+                LOG_WARN("Failed to create directory %s: %s", tmp, strerror(errno));
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+
+    return 0;
+}
+
+static int write_sidecar(const char *src_path, const struct stat *src_st,
+                         compression_type_t type, const char *sidecar) {
+    if (make_parent_dirs(sidecar) != 0) {
+        return -1;
+    }
+
+    char tmp_path[PATH_MAX];
+    int written = snprintf(tmp_path, sizeof(tmp_path), "%s.tmp.%d", sidecar, (int)getpid());
+    if (written < 0 || (size_t)written >= sizeof(tmp_path)) {
+        return -1;
+    }
+
+    int in_fd = open(src_path, O_RDONLY);
+    if (in_fd == -1) {
+        LOG_WARN("Failed to open %s for precompression: %s", src_path, strerror(errno));
+        return -1;
+    }
+
+    int out_fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out_fd == -1) {
+        LOG_WARN("Failed to create sidecar %s: %s", tmp_path, strerror(errno));
+        close(in_fd);
+        return -1;
+    }
+
+    int result = encoding_compress_fd(type, COMPRESSION_LEVEL_MAX, in_fd, out_fd);
+    close(in_fd);
+
+    if (result == 0) {
+        char source[64];
+        int source_len = format_source(src_st, source, sizeof(source));
+        struct timespec times[2] = { src_st->st_atim, src_st->st_mtim };
+        if (fsetxattr(out_fd, SIDECAR_SOURCE_XATTR, source, source_len, 0) == -1 ||
+            futimens(out_fd, times) == -1) {
+            result = -1;
+        }
+    }
+
+    if (close(out_fd) == -1) {
+        result = -1;
+    }
+
+    if (result == 0 && rename(tmp_path, sidecar) == -1) {
+        result = -1;
+    }
+
+    if (result != 0) {
+        LOG_WARN("Failed to write sidecar %s: %s", sidecar, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    LOG_DEBUG("Wrote sidecar %s", sidecar);
+    return 0;
+}
+
+static int scan_entry(const char *path, const struct stat *st, int typeflag, struct FTW *ftwbuf) {
+    (void)ftwbuf;
+
+    if (typeflag != FTW_F || !S_ISREG(st->st_mode) || (size_t)st->st_size < min_size) {
+        return 0;
+    }
+
+    if (strncmp(path, cache_dir, cache_len) == 0 && path[cache_len] == '/') {
+        return 0;
+    }
+
+    if (!http_should_compress_mime_type(http_get_mime_type(path))) {
+        return 0;
+    }
+
+    scan_checked++;
+
+    for (int i = 0; sidecar_types[i] != COMPRESSION_NONE; i++) {
+        char sidecar[PATH_MAX];
+        if (precompress_sidecar_path(path, sidecar_types[i], sidecar, sizeof(sidecar)) != 0) {
+            continue;
+        }
+
+        struct stat sc_st;
+        if (stat(sidecar, &sc_st) == 0 && sidecar_is_fresh(st, &sc_st, -1, sidecar)) {
+            continue;
+        }
+
+        if (write_sidecar(path, st, sidecar_types[i], sidecar) == 0) {
+            scan_written++;
+        }
+    }
+
+    return 0;
+}
+
+int precompress_scan(void) {
+    if (!precompress_enabled) {
+        return 0;
+    }
+
+    scan_checked = 0;
+    scan_written = 0;
+
+    int failed = 0;
+    for (int i = 0; i < root_count; i++) {
+        if (nftw(roots[i].dir, scan_entry, 32, FTW_PHYS) == -1) {
+            LOG_ERROR("Failed to scan %s for precompression: %s", roots[i].dir, strerror(errno));
+            failed++;
+        }
+    }
+    if (failed == root_count) {
+        return -1;
+    }
+
+    if (scan_written > 0) {
+        LOG_INFO("Precompression scan: %d files checked, %d sidecars written", scan_checked, scan_written);
+    } else {
+        LOG_DEBUG("Precompression scan: %d files checked, all sidecars fresh", scan_checked);
+    }
+
+    return scan_written;
+}
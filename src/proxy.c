@@ -0,0 +1,1061 @@
+#include "proxy.h"
+#include "metrics.h"
+
+enum {
+    CHUNK_SIZE = 0,
+    CHUNK_EXT,
+    CHUNK_SIZE_LF,
+    CHUNK_DATA,
+    CHUNK_DATA_CR,
+    CHUNK_DATA_LF,
+    CHUNK_TRAILER,
+    CHUNK_TRAILER_LINE,
+    CHUNK_FINAL_LF,
+    CHUNK_DONE,
+    CHUNK_ERROR
+};
+
+static proxy_route_t routes[CONFIG_MAX_PROXY_ROUTES];
+static int route_count = 0;
+static int proxy_epoll_fd = -1;
+static int keepalive_max = 16;
+static int max_fails = 3;
+static int fail_timeout = 10;
+static int upstream_timeout = 30;
+
+static proxy_session_t *sessions = NULL;
+/* indexed by upstream fd, so the worker dispatches an event with one
+ * lookup instead of walking the sessions */
+static proxy_session_t **upstreams = NULL;
+static int upstream_slots = 0;
+static int pipe_cache[PROXY_PIPE_CACHE][2];
+static int pipe_cache_count = 0;
+
+static uint32_t hash_bytes(const char *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 16777619u;
+    }
+    /* FNV-1a alone clusters similar keys on the ring, so finish with a mix */
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+static int compare_points(const void *a, const void *b) {
+    uint32_t ha = ((const proxy_ring_point_t *)a)->hash;
+    uint32_t hb = ((const proxy_ring_point_t *)b)->hash;
+    return ha < hb ? -1 : (ha > hb ? 1 : 0);
+}
+
+static int build_ring(proxy_route_t *route) {
+    route->ring_size = route->server_count * PROXY_RING_POINTS;
+    route->ring = malloc(sizeof(proxy_ring_point_t) * route->ring_size);
+    if (!route->ring) {
+        return -1;
+    }
+
+    int n = 0;
+    for (int i = 0; i < route->server_count; i++) {
+        for (int j = 0; j < PROXY_RING_POINTS; j++) {
+            char point[96];
+            int len = snprintf(point, sizeof(point), "%s-%d", route->servers[i].name, j);
+            route->ring[n].hash = hash_bytes(point, len);
+            route->ring[n].server = i;
+            n++;
+        }
+    }
+    qsort(route->ring, route->ring_size, sizeof(proxy_ring_point_t), compare_points);
+    return 0;
+}
+
+static int parse_server(proxy_server_t *server, const char *spec) {
+    char host[64];
+    const char *colon = strrchr(spec, ':');
+    if (!colon || colon == spec || (size_t)(colon - spec) >= sizeof(host)) {
+        return -1;
+    }
+    memcpy(host, spec, colon - spec);
+    host[colon - spec] = '\0';
+
+    struct addrinfo hints, *result;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, colon + 1, &hints, &result) != 0) {
+        return -1;
+    }
+    memcpy(&server->addr, result->ai_addr, sizeof(server->addr));
+    freeaddrinfo(result);
+
+    strncpy(server->name, spec, sizeof(server->name) - 1);
+    return 0;
+}
+
+/* "<prefix> <host:port>[,<host:port>...] [round_robin|least_conn|hash]" */
+static int parse_route(proxy_route_t *route, const char *spec) {
+    char copy[256];
+    strncpy(copy, spec, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    char *save;
+    char *prefix = strtok_r(copy, " \t", &save);
+    char *servers = strtok_r(NULL, " \t", &save);
+    char *balance = strtok_r(NULL, " \t", &save);
+    if (!prefix || !servers || prefix[0] != '/' || strlen(prefix) >= sizeof(route->prefix)) {
+        return -1;
+    }
+
+    memset(route, 0, sizeof(*route));
+    strcpy(route->prefix, prefix);
+    route->prefix_len = strlen(prefix);
+
+    if (!balance || strcmp(balance, "round_robin") == 0) {
+        route->balance = PROXY_BALANCE_ROUND_ROBIN;
+    } else if (strcmp(balance, "least_conn") == 0) {
+        route->balance = PROXY_BALANCE_LEAST_CONN;
+    } else if (strcmp(balance, "hash") == 0) {
+        route->balance = PROXY_BALANCE_HASH;
+    } else {
+        return -1;
+    }
+
+    char *server_save;
+    for (char *server = strtok_r(servers, ",", &server_save); server;
+         server = strtok_r(NULL, ",", &server_save)) {
+        if (route->server_count == PROXY_MAX_SERVERS ||
+            parse_server(&route->servers[route->server_count], server) != 0) {
+            LOG_ERROR("Invalid upstream server '%s' for %s", server, prefix);
+            return -1;
+        }
+        route->server_count++;
+    }
+
+    if (route->server_count == 0) {
+        return -1;
+    }
+    if (route->balance == PROXY_BALANCE_HASH && build_ring(route) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+int proxy_init(const config_t *config, int epoll_fd) {
+    proxy_epoll_fd = epoll_fd;
+    keepalive_max = config->proxy_keepalive < PROXY_MAX_IDLE ? config->proxy_keepalive : PROXY_MAX_IDLE;
+    max_fails = config->proxy_max_fails;
+    fail_timeout = config->proxy_fail_timeout > 0 ? config->proxy_fail_timeout : 10;
+    upstream_timeout = config->proxy_timeout > 0 ? config->proxy_timeout : 30;
+
+    route_count = 0;
+    for (int i = 0; i < config->proxy_pass_count; i++) {
+        if (parse_route(&routes[route_count], config->proxy_pass[i]) != 0) {
+            LOG_ERROR("Invalid proxy_pass '%s'", config->proxy_pass[i]);
+            free(routes[route_count].ring);
+            continue;
+        }
+        LOG_INFO("Proxying %s to %d upstream server(s)", routes[route_count].prefix,
+                 routes[route_count].server_count);
+        route_count++;
+    }
+
+    return route_count;
+}
+
+int proxy_enabled(void) {
+    return route_count > 0;
+}
+
+proxy_route_t *proxy_match(const char *uri) {
+    proxy_route_t *best = NULL;
+    for (int i = 0; i < route_count; i++) {
+        proxy_route_t *route = &routes[i];
+        if (strncmp(uri, route->prefix, route->prefix_len) != 0) {
+            continue;
+        }
+        char next = uri[route->prefix_len];
+        if (route->prefix[route->prefix_len - 1] != '/' && next != '\0' && next != '/' && next != '?') {
+            continue;
+        }
+        if (!best || route->prefix_len > best->prefix_len) {
+            best = route;
+        }
+    }
+    return best;
+}
+
+static int server_usable(const proxy_route_t *route, int index, unsigned int tried, time_t now, int check_health) {
+    return !(tried & (1u << index)) && (!check_health || route->servers[index].down_until <= now);
+}
+
+/* the second pass ignores health so a route whose servers are all marked
+ * down still gets a connection attempt */
+static int pick_server(proxy_route_t *route, uint32_t key_hash, unsigned int tried) {
+    time_t now = time(NULL);
+    int n = route->server_count;
+
+    for (int pass = 0; pass < 2; pass++) {
+        int check_health = pass == 0;
+        int best = -1;
+
+        if (route->balance == PROXY_BALANCE_HASH) {
+            int lo = 0, hi = route->ring_size;
+            while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (route->ring[mid].hash < key_hash) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid;
+                }
+            }
+            for (int i = 0; i < route->ring_size; i++) {
+                int index = route->ring[(lo + i) % route->ring_size].server;
+                if (server_usable(route, index, tried, now, check_health)) {
+                    best = index;
+                    break;
+                }
+            }
+        } else {
+            for (int i = 0; i < n; i++) {
+                int index = (route->rr_next + i) % n;
+                if (!server_usable(route, index, tried, now, check_health)) {
+                    continue;
+                }
+                if (route->balance == PROXY_BALANCE_ROUND_ROBIN) {
+                    best = index;
+                    break;
+                }
+                if (best == -1 || route->servers[index].active < route->servers[best].active) {
+                    best = index;
+                }
+            }
+            if (best != -1) {
+                route->rr_next = best + 1;
+            }
+        }
+
+        if (best != -1) {
+            return best;
+        }
+    }
+
+    return -1;
+}
+
+static void mark_failure(proxy_server_t *server) {
+    METRICS_INC(upstream_failures);
+    server->fails++;
+    if (max_fails > 0 && server->fails >= max_fails) {
+        server->down_until = time(NULL) + fail_timeout;
+        server->fails = 0;
+        LOG_WARN("Upstream %s marked down for %ds", server->name, fail_timeout);
+    }
+}
+
+/* pooled connections are not watched by epoll, so a peek is the only way
+ * to notice the upstream closed them while idle */
+static int take_idle(proxy_server_t *server, time_t now) {
+    while (server->idle_count > 0) {
+        int i = --server->idle_count;
+        int fd = server->idle[i];
+        if (now - server->idle_since[i] < PROXY_IDLE_TIMEOUT) {
+            char byte;
+            if (recv(fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return fd;
+            }
+        }
+        close(fd);
+    }
+    return -1;
+}
+
+static int index_upstream(int fd, proxy_session_t *session) {
+    if (fd >= upstream_slots) {
+        int slots = upstream_slots > 0 ? upstream_slots : 64;
+        while (slots <= fd) {
+            slots *= 2;
+        }
+        proxy_session_t **grown = realloc(upstreams, slots * sizeof(*grown));
+        if (!grown) {
+            LOG_ERROR("Failed to grow the upstream table to %d slots", slots);
+            return -1;
+        }
+        memset(grown + upstream_slots, 0, (slots - upstream_slots) * sizeof(*grown));
+        upstreams = grown;
+        upstream_slots = slots;
+    }
+    upstreams[fd] = session;
+    return 0;
+}
+
+static int connect_upstream(proxy_session_t *session) {
+    proxy_server_t *server = &session->route->servers[session->server];
+    time_t now = time(NULL);
+
+    int fd = take_idle(server, now);
+    if (fd != -1) {
+        session->reused = 1;
+        session->state = PROXY_STATE_SENDING;
+    } else {
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            LOG_ERROR("Failed to create upstream socket: %s", strerror(errno));
+            return -1;
+        }
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        if (connect(fd, (struct sockaddr *)&server->addr, sizeof(server->addr)) == -1 && errno != EINPROGRESS) {
+            LOG_WARN("Failed to connect to upstream %s: %s", server->name, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        session->reused = 0;
+        session->state = PROXY_STATE_CONNECTING;
+    }
+
+    if (index_upstream(fd, session) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = fd;
+    if (epoll_ctl(proxy_epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        LOG_ERROR("Failed to add upstream to epoll: %s", strerror(errno));
+        upstreams[fd] = NULL;
+        close(fd);
+        return -1;
+    }
+
+    session->upstream_fd = fd;
+    session->request_sent = 0;
+    session->last_activity = now;
+    server->active++;
+    LOG_DEBUG("Upstream %s %s for fd=%d", server->name, session->reused ? "reused" : "connecting",
+              session->client_fd);
+    return 0;
+}
+
+static void close_upstream(proxy_session_t *session, int keep) {
+    if (session->upstream_fd == -1) {
+        return;
+    }
+
+    proxy_server_t *server = &session->route->servers[session->server];
+    epoll_ctl(proxy_epoll_fd, EPOLL_CTL_DEL, session->upstream_fd, NULL);
+    upstreams[session->upstream_fd] = NULL;
+    server->active--;
+
+    if (keep && server->idle_count < keepalive_max) {
+        server->idle[server->idle_count] = session->upstream_fd;
+        server->idle_since[server->idle_count] = time(NULL);
+        server->idle_count++;
+    } else {
+        close(session->upstream_fd);
+    }
+    session->upstream_fd = -1;
+}
+
+static void free_session(proxy_session_t *session) {
+    if (session->head_sent) {
+        access_log_finish(&session->access, session->status, session->bytes_sent);
+    }
+
+    proxy_session_t **link = &sessions;
+    while (*link && *link != session) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = session->next;
+    }
+
+    if (session->pipe_fds[0] != -1) {
+        if (session->pipe_len == 0 && pipe_cache_count < PROXY_PIPE_CACHE) {
+            pipe_cache[pipe_cache_count][0] = session->pipe_fds[0];
+            pipe_cache[pipe_cache_count][1] = session->pipe_fds[1];
+            pipe_cache_count++;
+        } else {
+            close(session->pipe_fds[0]);
+            close(session->pipe_fds[1]);
+        }
+    }
+
+    free(session->request);
+    free(session->buf);
+    free(session);
+}
+
+static int finish(proxy_session_t *session, int ok) {
+    int result = PROXY_CLOSE;
+    if (ok) {
+        session->route->servers[session->server].fails = 0;
+        close_upstream(session, session->upstream_keep_alive);
+        result = session->client_keep_alive ? PROXY_DONE : PROXY_CLOSE;
+    } else {
+        close_upstream(session, 0);
+    }
+
+    free_session(session);
+    return result;
+}
+
+/* the upstream broke before a complete response head arrived: replay the
+ * request elsewhere when that cannot duplicate a side effect. A failure on
+ * a reused pooled connection is usually a keep-alive race, so it retries
+ * the same server without counting against it */
+static int upstream_failed(proxy_session_t *session) {
+    proxy_route_t *route = session->route;
+    int stale = session->reused && session->head_len == 0;
+    int replayable = !session->streamed && session->head_len == 0 &&
+                     (session->idempotent || session->request_sent == 0);
+
+    if (!stale) {
+        mark_failure(&route->servers[session->server]);
+        session->tried |= 1u << session->server;
+    }
+    close_upstream(session, 0);
+
+    if (session->head_sent) {
+        return finish(session, 0);
+    }
+
+    if (replayable) {
+        for (;;) {
+            int next = stale ? session->server : pick_server(route, session->key_hash, session->tried);
+            if (next == -1) {
+                break;
+            }
+            session->server = next;
+            if (connect_upstream(session) == 0) {
+                return PROXY_PENDING;
+            }
+            mark_failure(&route->servers[next]);
+            session->tried |= 1u << next;
+            stale = 0;
+        }
+    }
+
+    LOG_WARN("No upstream could serve %s request for fd=%d", route->prefix, session->client_fd);
+    free_session(session);
+    return PROXY_BAD_GATEWAY;
+}
+
+static int send_request(proxy_session_t *session) {
+    for (;;) {
+        if (session->request_sent < session->request_len) {
+            ssize_t n = send(session->upstream_fd, session->request + session->request_sent,
+                             session->request_len - session->request_sent, MSG_NOSIGNAL);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return PROXY_PENDING;
+                } else if (errno == EINTR) {
+                    continue;
+                }
+                LOG_DEBUG("Upstream send failed: %s", strerror(errno));
+                return upstream_failed(session);
+            }
+            session->request_sent += n;
+            continue;
+        }
+
+        if (session->body_remaining == 0) {
+            return PROXY_DONE;
+        }
+
+        size_t want = session->body_remaining < session->request_cap ? session->body_remaining : session->request_cap;
+        ssize_t n = recv(session->client_fd, session->request, want, 0);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return PROXY_PENDING;
+        } else if (n <= 0) {
+            LOG_DEBUG("Client closed during request body for fd=%d", session->client_fd);
+            return finish(session, 0);
+        }
+        session->streamed = 1;
+        session->request_len = n;
+        session->request_sent = 0;
+        session->body_remaining -= n;
+    }
+}
+
+static size_t chunk_feed(proxy_session_t *session, const char *data, size_t len) {
+    size_t i = 0;
+    while (i < len && session->chunk_state != CHUNK_DONE && session->chunk_state != CHUNK_ERROR) {
+        char c = data[i];
+        switch (session->chunk_state) {
+        case CHUNK_SIZE:
+            if (isxdigit((unsigned char)c)) {
+                session->chunk_size = session->chunk_size * 16 +
+                                      (isdigit((unsigned char)c) ? c - '0' : (tolower((unsigned char)c) - 'a' + 10));
+            } else if (c == ';' || c == ' ' || c == '\t') {
+                session->chunk_state = CHUNK_EXT;
+            } else if (c == '\r') {
+                session->chunk_state = CHUNK_SIZE_LF;
+            } else {
+                session->chunk_state = CHUNK_ERROR;
+                continue;
+            }
+            i++;
+            break;
+        case CHUNK_EXT:
+            if (c == '\r') {
+                session->chunk_state = CHUNK_SIZE_LF;
+            }
+            i++;
+            break;
+        case CHUNK_SIZE_LF:
+            if (c != '\n') {
+                session->chunk_state = CHUNK_ERROR;
+                continue;
+            }
+            session->body_left = session->chunk_size;
+            session->chunk_size = 0;
+            session->chunk_state = session->body_left ? CHUNK_DATA : CHUNK_TRAILER;
+            i++;
+            break;
+        case CHUNK_DATA: {
+            size_t take = len - i < session->body_left ? len - i : session->body_left;
+            i += take;
+            session->body_left -= take;
+            if (session->body_left == 0) {
+                session->chunk_state = CHUNK_DATA_CR;
+            }
+            break;
+        }
+        case CHUNK_DATA_CR:
+            session->chunk_state = c == '\r' ? CHUNK_DATA_LF : CHUNK_ERROR;
+            i++;
+            break;
+        case CHUNK_DATA_LF:
+            session->chunk_state = c == '\n' ? CHUNK_SIZE : CHUNK_ERROR;
+            i++;
+            break;
+        case CHUNK_TRAILER:
+            session->chunk_state = c == '\r' ? CHUNK_FINAL_LF : CHUNK_TRAILER_LINE;
+            i++;
+            break;
+        case CHUNK_TRAILER_LINE:
+            if (c == '\n') {
+                session->chunk_state = CHUNK_TRAILER;
+            }
+            i++;
+            break;
+        case CHUNK_FINAL_LF:
+            session->chunk_state = c == '\n' ? CHUNK_DONE : CHUNK_ERROR;
+            i++;
+            break;
+        }
+    }
+    return i;
+}
+
+static int header_is(const char *line, size_t len, const char *name) {
+    size_t name_len = strlen(name);
+    return len > name_len && line[name_len] == ':' && strncasecmp(line, name, name_len) == 0;
+}
+
+/* rewrites the upstream head for the client: hop-by-hop headers are
+ * dropped, Connection reflects the client's keep-alive, and any body bytes
+ * that arrived with the head are queued behind it */
+static int parse_head(proxy_session_t *session, size_t head_end) {
+    int minor, status;
+    if (sscanf(session->head, "HTTP/1.%d %d", &minor, &status) != 2) {
+        LOG_WARN("Malformed upstream response from %s", session->route->servers[session->server].name);
+        return -1;
+    }
+
+    if (status >= 100 && status < 200) {
+        memmove(session->head, session->head + head_end, session->head_len - head_end);
+        session->head_len -= head_end;
+        return 0;
+    }
+
+    session->upstream_keep_alive = minor >= 1;
+    long long content_length = -1;
+    int chunked = 0;
+    size_t out = 0;
+    size_t cap = PROXY_BUFFER_SIZE;
+
+    const char *line = session->head;
+    const char *end = session->head + head_end - 2;
+    int first = 1;
+    while (line < end) {
+        const char *eol = memchr(line, '\r', end - line);
+        if (!eol) {
+            eol = end;
+        }
+        size_t len = eol - line;
+        int keep = 1;
+
+        if (!first) {
+            if (header_is(line, len, "Connection")) {
+                if (memmem(line, len, "close", 5)) {
+                    session->upstream_keep_alive = 0;
+                } else if (memmem(line, len, "keep-alive", 10)) {
+                    session->upstream_keep_alive = 1;
+                }
+                keep = 0;
+            } else if (header_is(line, len, "Keep-Alive") || header_is(line, len, "Proxy-Connection")) {
+                keep = 0;
+            } else if (header_is(line, len, "Content-Length")) {
+                content_length = strtoll(line + 15, NULL, 10);
+            } else if (header_is(line, len, "Transfer-Encoding")) {
+                chunked = memmem(line, len, "chunked", 7) != NULL;
+            }
+        }
+        first = 0;
+
+        if (keep) {
+            if (out + len + 2 > cap - 64) {
+                return -1;
+            }
+            memcpy(session->buf + out, line, len);
+            memcpy(session->buf + out + len, "\r\n", 2);
+            out += len + 2;
+        }
+        line = eol + 2;
+    }
+
+    if (session->is_head || status == 204 || status == 304) {
+        session->body = PROXY_BODY_NONE;
+    } else if (chunked) {
+        session->body = PROXY_BODY_CHUNKED;
+        session->chunk_state = CHUNK_SIZE;
+        session->chunk_size = 0;
+    } else if (content_length >= 0) {
+        session->body = content_length > 0 ? PROXY_BODY_LENGTH : PROXY_BODY_NONE;
+        session->body_left = content_length;
+    } else {
+        session->body = PROXY_BODY_UNTIL_CLOSE;
+        session->upstream_keep_alive = 0;
+        session->client_keep_alive = 0;
+    }
+
+    out += snprintf(session->buf + out, cap - out, "Connection: %s\r\n\r\n",
+                    session->client_keep_alive ? "keep-alive" : "close");
+
+    size_t extra = session->head_len - head_end;
+    const char *body = session->head + head_end;
+    size_t take = extra;
+    if (session->body == PROXY_BODY_NONE) {
+        take = 0;
+    } else if (session->body == PROXY_BODY_LENGTH) {
+        take = extra < session->body_left ? extra : session->body_left;
+        session->body_left -= take;
+    } else if (session->body == PROXY_BODY_CHUNKED) {
+        take = chunk_feed(session, body, extra);
+    }
+    if (take < extra) {
+        session->upstream_keep_alive = 0;
+    }
+
+    memcpy(session->buf + out, body, take);
+    session->out_pos = 0;
+    session->out_len = out + take;
+
+    session->status = status;
+    metrics_count_response(status);
+    LOG_DEBUG("Upstream %s answered %d for fd=%d", session->route->servers[session->server].name,
+              status, session->client_fd);
+    return 1;
+}
+
+static int read_head(proxy_session_t *session) {
+    for (;;) {
+        char *end = session->head_len >= 4 ? memmem(session->head, session->head_len, "\r\n\r\n", 4) : NULL;
+        if (end) {
+            int result = parse_head(session, end + 4 - session->head);
+            if (result == 1) {
+                return PROXY_DONE;
+            } else if (result == 0) {
+                continue;
+            }
+            mark_failure(&session->route->servers[session->server]);
+            close_upstream(session, 0);
+            free_session(session);
+            return PROXY_BAD_GATEWAY;
+        }
+
+        if (session->head_len == sizeof(session->head)) {
+            LOG_WARN("Upstream response head too large for fd=%d", session->client_fd);
+            close_upstream(session, 0);
+            free_session(session);
+            return PROXY_BAD_GATEWAY;
+        }
+
+        ssize_t n = recv(session->upstream_fd, session->head + session->head_len,
+                         sizeof(session->head) - session->head_len, 0);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return PROXY_PENDING;
+        } else if (n == -1 && errno == EINTR) {
+            continue;
+        } else if (n <= 0) {
+            LOG_DEBUG("Upstream closed before response head: %s", n == 0 ? "EOF" : strerror(errno));
+            return upstream_failed(session);
+        }
+        session->head_len += n;
+    }
+}
+
+static int open_pipe(proxy_session_t *session) {
+    if (pipe_cache_count > 0) {
+        pipe_cache_count--;
+        session->pipe_fds[0] = pipe_cache[pipe_cache_count][0];
+        session->pipe_fds[1] = pipe_cache[pipe_cache_count][1];
+        return 0;
+    }
+    return pipe2(session->pipe_fds, O_NONBLOCK | O_CLOEXEC);
+}
+
+static int body_complete(const proxy_session_t *session) {
+    switch (session->body) {
+    case PROXY_BODY_NONE:
+        return 1;
+    case PROXY_BODY_LENGTH:
+        return session->body_left == 0;
+    case PROXY_BODY_CHUNKED:
+        return session->chunk_state == CHUNK_DONE;
+    case PROXY_BODY_UNTIL_CLOSE:
+        return session->upstream_eof;
+    }
+    return 1;
+}
+
+/* moves the response to the client: buffered bytes first, then the pipe,
+ * then more from the upstream. Length-delimited and close-delimited bodies
+ * are spliced socket to socket; chunked bodies are read into userspace so
+ * the end of the message can be found */
+static int relay(proxy_session_t *session) {
+    for (;;) {
+        while (session->out_pos < session->out_len) {
+            ssize_t n = send(session->client_fd, session->buf + session->out_pos,
+                             session->out_len - session->out_pos, MSG_NOSIGNAL);
+            if (n == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return PROXY_PENDING;
+                } else if (errno == EINTR) {
+                    continue;
+                }
+                LOG_DEBUG("Client disconnected during proxied response: %s", strerror(errno));
+                return finish(session, 0);
+            }
+            session->head_sent = 1;
+            session->out_pos += n;
+            session->bytes_sent += n;
+            METRICS_ADD(bytes_out, n);
+        }
+        session->out_pos = session->out_len = 0;
+
+        if (session->pipe_len > 0) {
+            ssize_t n = splice(session->pipe_fds[0], NULL, session->client_fd, NULL, session->pipe_len,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return PROXY_PENDING;
+            } else if (n <= 0) {
+                LOG_DEBUG("Client disconnected during proxied response: %s", n == 0 ? "EOF" : strerror(errno));
+                return finish(session, 0);
+            }
+            session->pipe_len -= n;
+            session->bytes_sent += n;
+            METRICS_ADD(bytes_out, n);
+            continue;
+        }
+
+        if (body_complete(session)) {
+            return finish(session, 1);
+        }
+
+        if (session->body == PROXY_BODY_CHUNKED || (session->pipe_fds[0] == -1 && open_pipe(session) != 0)) {
+            ssize_t n = recv(session->upstream_fd, session->buf, PROXY_BUFFER_SIZE, 0);
+            if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                return PROXY_PENDING;
+            } else if (n == 0 && session->body == PROXY_BODY_UNTIL_CLOSE) {
+                session->upstream_eof = 1;
+                continue;
+            } else if (n <= 0) {
+                LOG_WARN("Upstream %s closed mid-response", session->route->servers[session->server].name);
+                return finish(session, 0);
+            }
+
+            size_t take = n;
+            if (session->body == PROXY_BODY_CHUNKED) {
+                take = chunk_feed(session, session->buf, n);
+                if (session->chunk_state == CHUNK_ERROR) {
+                    LOG_WARN("Malformed chunked response from %s", session->route->servers[session->server].name);
+                    return finish(session, 0);
+                }
+            } else if (session->body == PROXY_BODY_LENGTH) {
+                take = (uint64_t)n < session->body_left ? (size_t)n : session->body_left;
+                session->body_left -= take;
+            }
+            if (take < (size_t)n) {
+                session->upstream_keep_alive = 0;
+            }
+            session->out_len = take;
+            continue;
+        }
+
+        size_t want = PROXY_SPLICE_SIZE;
+        if (session->body == PROXY_BODY_LENGTH && session->body_left < want) {
+            want = session->body_left;
+        }
+        ssize_t n = splice(session->upstream_fd, NULL, session->pipe_fds[1], NULL, want,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+            return PROXY_PENDING;
+        } else if (n == 0 && session->body == PROXY_BODY_UNTIL_CLOSE) {
+            session->upstream_eof = 1;
+            continue;
+        } else if (n <= 0) {
+            LOG_WARN("Upstream %s closed mid-response", session->route->servers[session->server].name);
+            return finish(session, 0);
+        }
+        session->pipe_len += n;
+        if (session->body == PROXY_BODY_LENGTH) {
+            session->body_left -= n;
+        }
+    }
+}
+
+int proxy_run(proxy_session_t *session) {
+    session->last_activity = time(NULL);
+
+    for (;;) {
+        int result;
+        switch (session->state) {
+        case PROXY_STATE_CONNECTING:
+            return PROXY_PENDING;
+        case PROXY_STATE_SENDING:
+            result = send_request(session);
+            if (result != PROXY_DONE) {
+                return result;
+            }
+            session->state = PROXY_STATE_READING_HEAD;
+            break;
+        case PROXY_STATE_READING_HEAD:
+            result = read_head(session);
+            if (result != PROXY_DONE) {
+                return result;
+            }
+            session->state = PROXY_STATE_RELAYING;
+            break;
+        case PROXY_STATE_RELAYING:
+            return relay(session);
+        }
+    }
+}
+
+static const char *hop_by_hop[] = {
+    "Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", "Upgrade", "Expect",
+    "X-Forwarded-For", "Content-Length", NULL
+};
+
+proxy_session_t *proxy_start(proxy_route_t *route, int client_fd, const http_request_t *request,
+                             const char *body, size_t body_len, int *status) {
+    *status = PROXY_BAD_GATEWAY;
+
+    long long content_length = 0;
+    const char *host = NULL;
+    const char *forwarded_for = NULL;
+    int expect_continue = 0;
+    for (int i = 0; i < request->header_count; i++) {
+        const char *name = request->headers[i][0];
+        const char *value = request->headers[i][1];
+        if (strcasecmp(name, "Transfer-Encoding") == 0) {
+            *status = 411;
+            return NULL;
+        } else if (strcasecmp(name, "Content-Length") == 0) {
+            content_length = strtoll(value, NULL, 10);
+        } else if (strcasecmp(name, "Host") == 0) {
+            host = value;
+        } else if (strcasecmp(name, "X-Forwarded-For") == 0) {
+            forwarded_for = value;
+        } else if (strcasecmp(name, "Expect") == 0) {
+            expect_continue = strcasecmp(value, "100-continue") == 0;
+        }
+    }
+    if (content_length < 0) {
+        *status = 400;
+        return NULL;
+    }
+
+    char client_ip[INET_ADDRSTRLEN] = "unknown";
+    struct sockaddr_in peer;
+    socklen_t peer_len = sizeof(peer);
+    if (getpeername(client_fd, (struct sockaddr *)&peer, &peer_len) == 0) {
+        inet_ntop(AF_INET, &peer.sin_addr, client_ip, sizeof(client_ip));
+    }
+
+    proxy_session_t *session = calloc(1, sizeof(proxy_session_t));
+    if (!session) {
+        LOG_ERROR("Failed to allocate proxy session");
+        return NULL;
+    }
+    session->client_fd = client_fd;
+    session->upstream_fd = -1;
+    session->pipe_fds[0] = session->pipe_fds[1] = -1;
+    session->route = route;
+    session->is_head = strcmp(request->method, "HEAD") == 0;
+    session->idempotent = session->is_head || strcmp(request->method, "GET") == 0 ||
+                          strcmp(request->method, "PUT") == 0 || strcmp(request->method, "DELETE") == 0 ||
+                          strcmp(request->method, "OPTIONS") == 0;
+    session->client_keep_alive = request->keep_alive;
+    session->key_hash = hash_bytes(request->uri, strlen(request->uri));
+
+    size_t buffered = body_len < (size_t)content_length ? body_len : (size_t)content_length;
+    session->body_remaining = content_length - buffered;
+
+    size_t needed = strlen(request->method) + strlen(request->uri) + 256 + buffered;
+    for (int i = 0; i < request->header_count; i++) {
+        needed += strlen(request->headers[i][0]) + strlen(request->headers[i][1]) + 4;
+    }
+    session->request_cap = needed > 16384 ? needed : 16384;
+    session->request = malloc(session->request_cap);
+    session->buf = malloc(PROXY_BUFFER_SIZE);
+    if (!session->request || !session->buf) {
+        LOG_ERROR("Failed to allocate proxy buffers");
+        free(session->request);
+        free(session->buf);
+        free(session);
+        return NULL;
+    }
+
+    char *out = session->request;
+    size_t cap = session->request_cap;
+    size_t len = snprintf(out, cap, "%s %s HTTP/1.1\r\n", request->method, request->uri);
+    for (int i = 0; i < request->header_count; i++) {
+        int skip = 0;
+        for (int j = 0; hop_by_hop[j]; j++) {
+            if (strcasecmp(request->headers[i][0], hop_by_hop[j]) == 0) {
+                skip = 1;
+                break;
+            }
+        }
+        if (!skip) {
+            len += snprintf(out + len, cap - len, "%s: %s\r\n", request->headers[i][0], request->headers[i][1]);
+        }
+    }
+    if (!host) {
+        len += snprintf(out + len, cap - len, "Host: %s\r\n", route->servers[0].name);
+    }
+    if (content_length > 0) {
+        len += snprintf(out + len, cap - len, "Content-Length: %lld\r\n", content_length);
+    }
+    len += snprintf(out + len, cap - len, "X-Forwarded-For: %s%s%s\r\nX-Forwarded-Proto: http\r\n"
+                    "Connection: keep-alive\r\n\r\n",
+                    forwarded_for ? forwarded_for : "", forwarded_for ? ", " : "", client_ip);
+    memcpy(out + len, body, buffered);
+    session->request_len = len + buffered;
+
+    for (;;) {
+        session->server = pick_server(route, session->key_hash, session->tried);
+        if (session->server == -1) {
+            free_session(session);
+            return NULL;
+        }
+        if (connect_upstream(session) == 0) {
+            break;
+        }
+        mark_failure(&route->servers[session->server]);
+        session->tried |= 1u << session->server;
+    }
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.fd = client_fd;
+    epoll_ctl(proxy_epoll_fd, EPOLL_CTL_MOD, client_fd, &ev);
+
+    if (expect_continue && session->body_remaining > 0) {
+        static const char interim[] = "HTTP/1.1 100 Continue\r\n\r\n";
+        if (send(client_fd, interim, sizeof(interim) - 1, MSG_NOSIGNAL) != sizeof(interim) - 1) {
+            LOG_DEBUG("Failed to send 100 Continue to fd=%d", client_fd);
+        }
+    }
+
+    session->next = sessions;
+    sessions = session;
+    return session;
+}
+
+proxy_session_t *proxy_find_upstream(int fd) {
+    return fd >= 0 && fd < upstream_slots ? upstreams[fd] : NULL;
+}
+
+int proxy_handle_upstream(proxy_session_t *session, uint32_t events) {
+    if (session->state == PROXY_STATE_CONNECTING) {
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        if (getsockopt(session->upstream_fd, SOL_SOCKET, SO_ERROR, &err, &err_len) == -1) {
+            err = errno;
+        }
+        if (err) {
+            LOG_WARN("Failed to connect to upstream %s: %s",
+                     session->route->servers[session->server].name, strerror(err));
+            return upstream_failed(session);
+        }
+        if (!(events & EPOLLOUT)) {
+            return PROXY_PENDING;
+        }
+        session->state = PROXY_STATE_SENDING;
+    }
+
+    return proxy_run(session);
+}
+
+int proxy_handle_client(proxy_session_t *session) {
+    return proxy_run(session);
+}
+
+int proxy_check_timeout(proxy_session_t *session, time_t now) {
+    if (now - session->last_activity < upstream_timeout) {
+        return PROXY_PENDING;
+    }
+
+    LOG_WARN("Upstream %s timed out for fd=%d", session->route->servers[session->server].name,
+             session->client_fd);
+    METRICS_INC(timeouts);
+    mark_failure(&session->route->servers[session->server]);
+    if (session->head_sent) {
+        return finish(session, 0);
+    }
+    close_upstream(session, 0);
+    free_session(session);
+    return PROXY_GATEWAY_TIMEOUT;
+}
+
+void proxy_abort(proxy_session_t *session) {
+    if (session) {
+        close_upstream(session, 0);
+        free_session(session);
+    }
+}
+
+void proxy_cleanup(void) {
+    while (sessions) {
+        proxy_abort(sessions);
+    }
+    free(upstreams);
+    upstreams = NULL;
+    upstream_slots = 0;
+
+    for (int i = 0; i < route_count; i++) {
+        for (int j = 0; j < routes[i].server_count; j++) {
+            proxy_server_t *server = &routes[i].servers[j];
+            while (server->idle_count > 0) {
+                close(server->idle[--server->idle_count]);
+            }
+        }
+        free(routes[i].ring);
+        routes[i].ring = NULL;
+    }
+    route_count = 0;
+
+    while (pipe_cache_count > 0) {
+        pipe_cache_count--;
+        close(pipe_cache[pipe_cache_count][0]);
+        close(pipe_cache[pipe_cache_count][1]);
+    }
+}
@@ -0,0 +1,222 @@
+#include "resolve.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#ifdef HAVE_OPENAT2
+#include <linux/openat2.h>
+#endif
+
+/* the fields the open-file cache compares and the ETag is built from */
+#define RESOLVE_STATX_MASK (STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME)
+
+typedef struct {
+    char *dir;
+    int root_fd;
+    uint32_t hash;
+    int fd;
+    time_t validated;
+} resolve_dir_t;
+
+static resolve_dir_t dir_cache[RESOLVE_DIR_CACHE_SIZE];
+static int valid_seconds = RESOLVE_DEFAULT_VALID;
+static int beneath_supported = 1;
+
+static uint32_t hash_dir(int root_fd, const char *dir, size_t len) {
+    uint32_t hash = 2166136261u ^ (uint32_t)root_fd;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)dir[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static int climbs_out(const char *path) {
+    for (const char *p = path; *p; ) {
+        const char *end = strchr(p, '/');
+        size_t len = end ? (size_t)(end - p) : strlen(p);
+        if (len == 2 && p[0] == '.' && p[1] == '.') {
+            return 1;
+        }
+        p += len;
+        while (*p == '/') {
+            p++;
+        }
+    }
+    return 0;
+}
+
+static int open_beneath(int dirfd, const char *path, int flags) {
+#ifdef HAVE_OPENAT2
+    if (beneath_supported) {
+        struct open_how how;
+        memset(&how, 0, sizeof(how));
+        how.flags = flags | O_CLOEXEC;
+        how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+        int fd = syscall(SYS_openat2, dirfd, path, &how, sizeof(how));
+        if (fd != -1 || errno != ENOSYS) {
+            return fd;
+        }
+        LOG_WARN("openat2 is unavailable, refusing \"..\" in request paths instead");
+        beneath_supported = 0;
+    }
+#endif
+    if (path[0] == '/' || climbs_out(path)) {
+        errno = EXDEV;
+        return -1;
+    }
+    return openat(dirfd, path, flags | O_CLOEXEC);
+}
+
+static void drop_dir(resolve_dir_t *slot) {
+    if (slot->dir) {
+        close(slot->fd);
+        free(slot->dir);
+        slot->dir = NULL;
+    }
+}
+
+/* returns the directory holding rel's last component, from the table when
+ * it was validated recently; *base is that component and *slot the table
+ * entry used, NULL for files directly under the root */
+static int parent_fd(int root_fd, const char *rel, const char **base, resolve_dir_t **slot) {
+    while (*rel == '/') {
+        rel++;
+    }
+    *slot = NULL;
+
+    const char *last = strrchr(rel, '/');
+    if (!last) {
+        *base = rel;
+        return root_fd;
+    }
+    *base = last + 1;
+
+    size_t len = last - rel;
+    if (len >= PATH_MAX) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    uint32_t hash = hash_dir(root_fd, rel, len);
+    resolve_dir_t *entry = &dir_cache[hash & (RESOLVE_DIR_CACHE_SIZE - 1)];
+    time_t now = time(NULL);
+    if (entry->dir && entry->root_fd == root_fd && entry->hash == hash && strncmp(entry->dir, rel, len) == 0 &&
+        entry->dir[len] == '\0' && now - entry->validated < valid_seconds) {
+        *slot = entry;
+        return entry->fd;
+    }
+
+    char dir[PATH_MAX];
+    memcpy(dir, rel, len);
+    dir[len] = '\0';
+    int fd = open_beneath(root_fd, dir, O_PATH | O_DIRECTORY);
+    if (fd == -1) {
+        return -1;
+    }
+
+    drop_dir(entry);
+    entry->dir = strdup(dir);
+    if (!entry->dir) {
+        close(fd);
+        errno = ENOMEM;
+        return -1;
+    }
+    entry->root_fd = root_fd;
+    entry->hash = hash;
+    entry->fd = fd;
+    entry->validated = now;
+    return fd;
+}
+
+static void fill_stat(const struct statx *stx, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+    st->st_ino = stx->stx_ino;
+    st->st_mode = stx->stx_mode;
+    st->st_size = stx->stx_size;
+    st->st_mtim.tv_sec = stx->stx_mtime.tv_sec;
+    st->st_mtim.tv_nsec = stx->stx_mtime.tv_nsec;
+}
+
+int resolve_open_root(const char *root) {
+    int fd = open(root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        LOG_WARN("Failed to open root %s: %s", root, strerror(errno));
+    }
+    return fd;
+}
+
+/* opens rel's last component beneath its cached parent. A symlink there
+ * that leaves the parent but not the root, such as a/link -> ../b, fails
+ * that check with EXDEV and is resolved again beneath the root itself */
+static int open_file(int root_fd, const char *rel, int flags) {
+    const char *base;
+    resolve_dir_t *slot;
+    int dirfd = parent_fd(root_fd, rel, &base, &slot);
+    if (dirfd == -1) {
+        return -1;
+    }
+    if (*base == '\0') {
+        errno = EISDIR;
+        return -1;
+    }
+
+    int fd = open_beneath(dirfd, base, flags);
+    if (fd == -1 && errno == ENOENT && slot) {
+        /* the cached directory may have been replaced since it was opened */
+        drop_dir(slot);
+        dirfd = parent_fd(root_fd, rel, &base, &slot);
+        if (dirfd == -1) {
+            return -1;
+        }
+        fd = open_beneath(dirfd, base, flags);
+    }
+    if (fd == -1 && errno == EXDEV && dirfd != root_fd) {
+        while (*rel == '/') {
+            rel++;
+        }
+        fd = open_beneath(root_fd, rel, flags);
+    }
+    return fd;
+}
+
+int resolve_open(int root_fd, const char *rel) {
+    return open_file(root_fd, rel, O_RDONLY | O_NONBLOCK);
+}
+
+/* through an O_PATH descriptor, so the final component is held to the
+ * same beneath check as an open and a symlink out of the root is not
+ * followed */
+int resolve_stat(int root_fd, const char *rel, struct stat *st) {
+    int fd = open_file(root_fd, rel, O_PATH);
+    if (fd == -1) {
+        return -1;
+    }
+    int result = resolve_fstat(fd, st);
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return result;
+}
+
+int resolve_fstat(int fd, struct stat *st) {
+    struct statx stx;
+    if (statx(fd, "", AT_EMPTY_PATH | AT_STATX_SYNC_AS_STAT, RESOLVE_STATX_MASK, &stx) == -1) {
+        return -1;
+    }
+    fill_stat(&stx, st);
+    return 0;
+}
+
+void resolve_set_valid(int seconds) {
+    valid_seconds = seconds >= 0 ? seconds : RESOLVE_DEFAULT_VALID;
+}
+
+void resolve_cleanup(void) {
+    for (int i = 0; i < RESOLVE_DIR_CACHE_SIZE; i++) {
+        drop_dir(&dir_cache[i]);
+    }
+}
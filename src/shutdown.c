@@ -1,3 +1,5 @@
 #include "shutdown.h"
 
-volatile sig_atomic_t shutdown_requested = 0; 
\ No newline at end of file
+volatile sig_atomic_t shutdown_requested = 0;
+volatile sig_atomic_t reload_requested = 0;
+volatile sig_atomic_t drain_requested = 0;
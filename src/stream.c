@@ -0,0 +1,160 @@
+#include "stream.h"
+#include "metrics.h"
+
+http_stream_t *stream_create(int file_fd, off_t file_size, compression_type_t type, int level) {
+    http_stream_t *stream = malloc(sizeof(http_stream_t));
+    if (!stream) {
+        LOG_ERROR("Failed to allocate compression stream");
+        return NULL;
+    }
+
+    stream->encoder = encoding_stream_create(type, level);
+    if (!stream->encoder) {
+        LOG_ERROR("Failed to create %s encoder for stream", encoding_name(type));
+        free(stream);
+        return NULL;
+    }
+
+    stream->level = level;
+    stream->bytes_out = 0;
+    stream->cpu_ns = 0;
+    stream->file_fd = file_fd;
+    stream->file_offset = 0;
+    stream->file_size = file_size;
+    stream->in_pos = 0;
+    stream->in_len = 0;
+    stream->out_pos = 0;
+    stream->out_len = 0;
+    stream->eof = 0;
+    stream->finished = 0;
+
+    return stream;
+}
+
+static int stream_read_window(http_stream_t *stream) {
+    off_t remaining = stream->file_size - stream->file_offset;
+    if (remaining <= 0) {
+        stream->eof = 1;
+        return 0;
+    }
+
+    size_t want = remaining > STREAM_WINDOW_SIZE ? STREAM_WINDOW_SIZE : (size_t)remaining;
+    ssize_t bytes_read = file_io_read(stream->file_fd, stream->in, want, stream->file_offset, 1);
+
+    if (bytes_read == -1) {
+        LOG_ERROR("Failed to read file window at offset %ld: %s", (long)stream->file_offset, strerror(errno));
+        return -1;
+    }
+
+    if (bytes_read == 0 && !file_io_resident(stream->file_fd, stream->file_offset, 1)) {
+        return HTTP_SEND_FILE_IO;
+    }
+
+    if (bytes_read == 0) {
+        stream->eof = 1;
+        return 0;
+    }
+
+    stream->in_pos = 0;
+    stream->in_len = bytes_read;
+    stream->file_offset += bytes_read;
+    return 0;
+}
+
+static int stream_fill(http_stream_t *stream) {
+    unsigned char *body = stream->out + STREAM_CHUNK_HEADER_SIZE;
+    size_t produced = 0;
+    uint64_t cpu_start = compress_ctl_cpu_now();
+
+    while (produced == 0 && !stream->finished) {
+        if (stream->in_pos == stream->in_len && !stream->eof) {
+            int result = stream_read_window(stream);
+            if (result != 0) {
+                return result;
+            }
+        }
+
+        size_t consumed;
+        int ret = encoding_stream_process(stream->encoder, stream->in + stream->in_pos,
+                                          stream->in_len - stream->in_pos, &consumed,
+                                          body, STREAM_WINDOW_SIZE, &produced, stream->eof);
+        if (ret < 0) {
+            return -1;
+        }
+        stream->in_pos += consumed;
+        if (ret == 1) {
+            stream->finished = 1;
+        }
+    }
+
+    stream->cpu_ns += compress_ctl_cpu_now() - cpu_start;
+    stream->bytes_out += produced;
+    if (stream->finished) {
+        compress_ctl_record(stream->level, stream->file_offset, stream->bytes_out, stream->cpu_ns);
+    }
+    
+    size_t end = STREAM_CHUNK_HEADER_SIZE;
+    stream->out_pos = STREAM_CHUNK_HEADER_SIZE;
+
+    if (produced > 0) {
+        char chunk_header[STREAM_CHUNK_HEADER_SIZE + 1];
+        int header_len = snprintf(chunk_header, sizeof(chunk_header), "%zx\r\n", produced);
+        memcpy(body - header_len, chunk_header, header_len);
+        stream->out_pos -= header_len;
+        memcpy(body + produced, "\r\n", 2);
+        end += produced + 2;
+    }
+
+    if (stream->finished) {
+        memcpy(stream->out + end, "0\r\n\r\n", 5);
+        end += 5;
+    }
+
+    stream->out_len = end;
+    return 0;
+}
+
+int stream_send(int client_fd, http_stream_t *stream) {
+    for (;;) {
+        if (stream->out_pos < stream->out_len) {
+            ssize_t sent = send(client_fd, stream->out + stream->out_pos,
+                                stream->out_len - stream->out_pos, MSG_NOSIGNAL);
+            if (sent == -1) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    return 0;
+                } else if (errno == EINTR) {
+                    continue;
+                } else if (errno == EPIPE || errno == ECONNRESET) {
+                    LOG_DEBUG("Client disconnected during stream send: %s", strerror(errno));
+                    return -1;
+                }
+                LOG_ERROR("Failed to send stream chunk: %s", strerror(errno));
+                return -1;
+            }
+            stream->out_pos += sent;
+            METRICS_ADD(bytes_out, sent);
+            continue;
+        }
+
+        if (stream->finished) {
+            return 1;
+        }
+
+        int result = stream_fill(stream);
+        if (result == HTTP_SEND_FILE_IO) {
+            return result;
+        } else if (result != 0) {
+            LOG_ERROR("Failed to compress stream window");
+            return -1;
+        }
+    }
+}
+
+void stream_destroy(http_stream_t *stream) {
+    if (!stream) {
+        return;
+    }
+
+    encoding_stream_destroy(stream->encoder);
+    free(stream);
+}
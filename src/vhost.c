@@ -0,0 +1,264 @@
+#include "vhost.h"
+#include "http.h"
+#include "resolve.h"
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/* open addressing over the normalized names; the table holds at most
+ * CONFIG_MAX_VHOSTS * VHOST_MAX_NAMES names, half its slots */
+typedef struct {
+    char name[VHOST_NAME_MAX];
+    uint32_t hash;
+    int vhost;
+} vhost_slot_t;
+
+typedef struct {
+    vhost_t hosts[VHOST_MAX];
+    int count;
+    vhost_slot_t slots[VHOST_TABLE_SIZE];
+} vhost_table_t;
+
+static vhost_table_t *table = NULL;
+
+static uint32_t hash_name(const char *name) {
+    uint32_t hash = 2166136261u;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* lowercases the host and drops the port and a trailing dot; returns 0
+ * when nothing is left or the name does not fit */
+static size_t normalize_host(const char *host, char *out, size_t size) {
+    const char *end;
+    if (host[0] == '[') {
+        end = strchr(host, ']');
+        if (!end) {
+            return 0;
+        }
+        end++;
+    } else {
+        end = strchr(host, ':');
+        if (!end) {
+            end = host + strlen(host);
+        }
+        while (end > host && end[-1] == '.') {
+            end--;
+        }
+    }
+
+    size_t len = end - host;
+    if (len == 0 || len >= size) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        out[i] = tolower((unsigned char)host[i]);
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static int insert_name(vhost_table_t *t, const char *name, int id) {
+    char key[VHOST_NAME_MAX];
+    if (normalize_host(name, key, sizeof(key)) == 0) {
+        LOG_ERROR("Invalid vhost name '%s'", name);
+        return -1;
+    }
+
+    uint32_t hash = hash_name(key);
+    for (uint32_t i = hash & (VHOST_TABLE_SIZE - 1);; i = (i + 1) & (VHOST_TABLE_SIZE - 1)) {
+        vhost_slot_t *slot = &t->slots[i];
+        if (slot->name[0] == '\0') {
+            strcpy(slot->name, key);
+            slot->hash = hash;
+            slot->vhost = id;
+            return 0;
+        }
+        if (slot->hash == hash && strcmp(slot->name, key) == 0) {
+            LOG_ERROR("vhost name %s is used by %s and %s", key, t->hosts[slot->vhost].name, t->hosts[id].name);
+            return -1;
+        }
+    }
+}
+
+static int parse_option(vhost_t *host, const char *option) {
+    if (strncmp(option, "cache=", 6) == 0) {
+        host->cache_quota = config_parse_size(option + 6);
+        return 0;
+    }
+    if (strncmp(option, "compress=", 9) == 0) {
+        const char *value = option + 9;
+        if (strcasecmp(value, "on") == 0) {
+            host->compress_level_max = COMPRESSION_LEVEL_MAX;
+        } else if (strcasecmp(value, "off") == 0) {
+            host->compress_level_max = COMPRESSION_LEVEL_NONE;
+        } else {
+            int level = atoi(value);
+            if (level < COMPRESSION_LEVEL_MIN || level > COMPRESSION_LEVEL_MAX) {
+                return -1;
+            }
+            host->compress_level_max = level;
+        }
+        return 0;
+    }
+    return -1;
+}
+
+/* "names root [cache=SIZE] [compress=on|off|LEVEL]", names comma separated */
+static int parse_vhost(vhost_table_t *t, const char *spec) {
+    char copy[256];
+    strncpy(copy, spec, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+
+    char *save;
+    char *names = strtok_r(copy, " \t", &save);
+    char *root = strtok_r(NULL, " \t", &save);
+    if (!names || !root) {
+        return -1;
+    }
+
+    vhost_t *host = &t->hosts[t->count];
+    memset(host, 0, sizeof(*host));
+    host->id = t->count;
+    host->root_fd = -1;
+    host->compress_level_max = COMPRESSION_LEVEL_MAX;
+
+    size_t root_len = strlen(root);
+    while (root_len > 1 && root[root_len - 1] == '/') {
+        root[--root_len] = '\0';
+    }
+    struct stat st;
+    if (root_len >= sizeof(host->root_dir) || stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        LOG_ERROR("vhost root %s is not a directory", root);
+        return -1;
+    }
+    strcpy(host->root_dir, root);
+    host->root_len = root_len;
+
+    for (char *option = strtok_r(NULL, " \t", &save); option; option = strtok_r(NULL, " \t", &save)) {
+        if (parse_option(host, option) != 0) {
+            LOG_ERROR("Unknown vhost option '%s'", option);
+            return -1;
+        }
+    }
+
+    int name_count = 0;
+    char *name_save;
+    for (char *name = strtok_r(names, ",", &name_save); name; name = strtok_r(NULL, ",", &name_save)) {
+        if (name_count == VHOST_MAX_NAMES) {
+            LOG_ERROR("vhost %s has more than %d names", host->name, VHOST_MAX_NAMES);
+            return -1;
+        }
+        if (name_count == 0) {
+            snprintf(host->name, sizeof(host->name), "%s", name);
+        }
+        if (insert_name(t, name, host->id) != 0) {
+            return -1;
+        }
+        name_count++;
+    }
+
+    t->count++;
+    return 0;
+}
+
+static int build_table(vhost_table_t *t, const config_t *config) {
+    memset(t, 0, sizeof(*t));
+
+    vhost_t *fallback = &t->hosts[0];
+    strcpy(fallback->name, "default");
+    snprintf(fallback->root_dir, sizeof(fallback->root_dir), "%s", config->root_dir);
+    fallback->root_len = strlen(fallback->root_dir);
+    fallback->root_fd = -1;
+    fallback->compress_level_max = COMPRESSION_LEVEL_MAX;
+    t->count = 1;
+
+    for (int i = 0; i < config->vhost_count; i++) {
+        if (parse_vhost(t, config->vhosts[i]) != 0) {
+            LOG_ERROR("Invalid vhost '%s'", config->vhosts[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int vhost_validate(const config_t *config) {
+    vhost_table_t *scratch = malloc(sizeof(vhost_table_t));
+    if (!scratch) {
+        LOG_ERROR("Failed to allocate vhost table");
+        return -1;
+    }
+    int result = build_table(scratch, config);
+    free(scratch);
+    return result;
+}
+
+int vhost_init(const config_t *config) {
+    vhost_table_t *next = malloc(sizeof(vhost_table_t));
+    if (!next) {
+        LOG_ERROR("Failed to allocate vhost table");
+        return -1;
+    }
+    if (build_table(next, config) != 0) {
+        free(next);
+        return -1;
+    }
+
+    vhost_cleanup();
+    table = next;
+    for (int i = 0; i < table->count; i++) {
+        table->hosts[i].root_fd = resolve_open_root(table->hosts[i].root_dir);
+    }
+    for (int i = 1; i < table->count; i++) {
+        const vhost_t *host = &table->hosts[i];
+        LOG_INFO("Virtual host %s -> %s (cache quota %zu bytes, compression level <= %d)",
+                 host->name, host->root_dir, host->cache_quota, host->compress_level_max);
+    }
+    return table->count;
+}
+
+const vhost_t *vhost_lookup(const char *host) {
+    if (!table && vhost_init(config_get_instance()) < 0) {
+        return NULL;
+    }
+
+    char key[VHOST_NAME_MAX];
+    if (!host || table->count == 1 || normalize_host(host, key, sizeof(key)) == 0) {
+        return &table->hosts[0];
+    }
+
+    uint32_t hash = hash_name(key);
+    for (uint32_t i = hash & (VHOST_TABLE_SIZE - 1);; i = (i + 1) & (VHOST_TABLE_SIZE - 1)) {
+        const vhost_slot_t *slot = &table->slots[i];
+        if (slot->name[0] == '\0') {
+            return &table->hosts[0];
+        }
+        if (slot->hash == hash && strcmp(slot->name, key) == 0) {
+            return &table->hosts[slot->vhost];
+        }
+    }
+}
+
+const vhost_t *vhost_get(int id) {
+    if (!table || id < 0 || id >= table->count) {
+        return NULL;
+    }
+    return &table->hosts[id];
+}
+
+int vhost_count(void) {
+    return table ? table->count : 0;
+}
+
+void vhost_cleanup(void) {
+    for (int i = 0; table && i < table->count; i++) {
+        if (table->hosts[i].root_fd != -1) {
+            close(table->hosts[i].root_fd);
+        }
+    }
+    free(table);
+    table = NULL;
+}
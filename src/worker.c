@@ -66,7 +66,21 @@ static int remove_from_epoll(worker_t *worker, int fd) {
     return 0;
 }
 
-int worker_init(worker_t *worker, int server_fd, int cpu_id) {
+/* settings a reload can change under a running worker; the rest only
+ * reaches the workers the master forks to replace this one */
+static void worker_apply_config(worker_t *worker, const config_t *config) {
+    log_set_level((log_level_t)config->log_level);
+    worker->keep_alive_timeout = config->keep_alive_timeout > 0 ? config->keep_alive_timeout : KEEP_ALIVE_TIMEOUT;
+    compress_ctl_init(config);
+    latency_init(config->latency_histograms, config->server_timing_sample);
+    file_cache_init(config->open_file_cache_max, config->open_file_cache_valid);
+    cache_set_zerocopy_threshold(config->cache_zerocopy_min_size > 0 ? (size_t)config->cache_zerocopy_min_size : 0);
+    if (worker->compress_pool) {
+        http_set_offload_threshold(config->compress_offload_min_size);
+    }
+}
+
+int worker_init(worker_t *worker, int server_fd, int worker_id, int cpu_id) {
     memset(worker, 0, sizeof(worker_t));
     
     cpu_set_t cpuset;
@@ -78,7 +92,12 @@ int worker_init(worker_t *worker, int server_fd, int cpu_id) {
     }
     worker->cpu_id = cpu_id;
     
-    if (mempool_init(&worker->buffer_pool, BUFFER_SIZE, BUFFER_POOL_SIZE) != 0) {
+    config_t *config = config_get_instance();
+    if (capacity_plan(config, &worker->capacity) != 0) {
+        return -1;
+    }
+    
+    if (mempool_init(&worker->buffer_pool, worker->capacity.buffer_size, worker->capacity.growth_step) != 0) {
         LOG_ERROR("Failed to initialize buffer pool");
         return -1;
     }
@@ -104,9 +123,8 @@ int worker_init(worker_t *worker, int server_fd, int cpu_id) {
     
     worker->server_fd = server_fd;
     worker->is_running = 1;
-    worker->keep_alive_timeout = KEEP_ALIVE_TIMEOUT;
     
-    worker->events = malloc(sizeof(struct epoll_event) * MAX_EVENTS);
+    worker->events = malloc(sizeof(struct epoll_event) * worker->capacity.max_events);
     if (!worker->events) {
         LOG_ERROR("Failed to allocate events array");
         mempool_cleanup(&worker->buffer_pool);
@@ -114,7 +132,7 @@ int worker_init(worker_t *worker, int server_fd, int cpu_id) {
         return -1;
     }
     
-    worker->clients = calloc(MAX_CONNECTIONS, sizeof(client_conn_t));
+    worker->clients = calloc(worker->capacity.growth_step, sizeof(client_conn_t));
     if (!worker->clients) {
         LOG_ERROR("Failed to allocate clients array");
         mempool_cleanup(&worker->buffer_pool);
@@ -122,24 +140,71 @@ int worker_init(worker_t *worker, int server_fd, int cpu_id) {
         close(worker->epoll_fd);
         return -1;
     }
+    worker->client_capacity = worker->capacity.growth_step;
     
-    worker->connection_pool = malloc(sizeof(int) * CONNECTION_POOL_SIZE);
-    if (!worker->connection_pool) {
-        LOG_ERROR("Failed to allocate connection pool");
-        mempool_cleanup(&worker->buffer_pool);
-        free(worker->events);
-        free(worker->clients);
-        close(worker->epoll_fd);
-        return -1;
+    if (cache_init(worker->capacity.cache_entries, worker->capacity.cache_body_bytes) != 0) {
+        LOG_WARN("Response cache unavailable");
+    }
+    for (int i = 0; i < vhost_count(); i++) {
+        cache_set_quota(i, vhost_get(i)->cache_quota);
+    }
+    
+    if (config->compress_threads > 0) {
+        worker->compress_pool = compress_pool_create(config->compress_threads, config->compress_queue_size);
+        if (!worker->compress_pool ||
+            add_to_epoll(worker, compress_pool_event_fd(worker->compress_pool), EPOLLIN | EPOLLET) != 0) {
+            LOG_WARN("Compression offload unavailable, compressing inline");
+            compress_pool_destroy(worker->compress_pool);
+            worker->compress_pool = NULL;
+        }
+    }
+    if (config->io_threads > 0) {
+        worker->io_pool = file_io_pool_create(config->io_threads, config->io_queue_size);
+        if (worker->io_pool &&
+            add_to_epoll(worker, file_io_pool_event_fd(worker->io_pool), EPOLLIN | EPOLLET) == 0) {
+            file_io_enable_nowait(1);
+        } else {
+            LOG_WARN("Asynchronous file I/O unavailable, reading files inline");
+            file_io_pool_destroy(worker->io_pool);
+            worker->io_pool = NULL;
+        }
+    }
+    worker_apply_config(worker, config);
+    proxy_init(config, worker->epoll_fd);
+    if (access_log_init(config, worker_id) != 0) {
+        LOG_WARN("Access log unavailable, requests will not be logged");
+    }
+    /* the captured request half of a log record is only needed, and only
+     * allocated, while access logging is on */
+    if (access_log_enabled &&
+        mempool_init(&worker->access_pool, sizeof(access_log_entry_t), worker->capacity.growth_step) != 0) {
+        LOG_WARN("Failed to create access log entry pool, requests will not be logged");
+        access_log_enabled = 0;
     }
-    worker->pool_size = CONNECTION_POOL_SIZE;
-    worker->pool_count = 0;
     
     LOG_INFO("Worker running on CPU %d", worker->cpu_id);
     
     return 0;
 }
 
+static access_log_entry_t *worker_take_access(worker_t *worker) {
+    if (!access_log_enabled) {
+        return NULL;
+    }
+    access_log_entry_t *entry = mempool_alloc(&worker->access_pool);
+    if (entry) {
+        entry->len = 0;
+    }
+    return entry;
+}
+
+static void worker_drop_access(worker_t *worker, client_conn_t *client) {
+    if (client->access) {
+        mempool_free(&worker->access_pool, client->access);
+        client->access = NULL;
+    }
+}
+
 static int optimize_tcp_socket(int fd) {
     int yes = 1;
     
@@ -176,8 +241,59 @@ static int optimize_tcp_socket(int fd) {
     return 0;
 }
 
+/* the client table starts at one growth step and doubles up to
+ * max_connections. Only the accept path appends, and it holds no client
+ * pointers, so moving the table is safe */
+static int worker_reserve_client(worker_t *worker) {
+    if (worker->client_count < worker->client_capacity) {
+        return 0;
+    }
+    if (worker->client_capacity >= worker->capacity.max_connections) {
+        return -1;
+    }
+    
+    int capacity = worker->client_capacity * 2;
+    if (capacity > worker->capacity.max_connections) {
+        capacity = worker->capacity.max_connections;
+    }
+    
+    client_conn_t *clients = realloc(worker->clients, sizeof(client_conn_t) * capacity);
+    if (!clients) {
+        LOG_ERROR("Failed to grow clients array to %d", capacity);
+        return -1;
+    }
+    
+    worker->clients = clients;
+    worker->client_capacity = capacity;
+    LOG_DEBUG("Clients array grown to %d", capacity);
+    return 0;
+}
+
+/* a response that outlives the handler that built it moves to the heap;
+ * most connections never block, so client_conn_t does not embed one */
+static http_response_t *worker_hold_response(client_conn_t *client, const http_response_t *response) {
+    if (!client->pending_response) {
+        client->pending_response = malloc(sizeof(http_response_t));
+        if (!client->pending_response) {
+            LOG_ERROR("Failed to allocate pending response for fd=%d", client->fd);
+            return NULL;
+        }
+    }
+    if (response && response != client->pending_response) {
+        memcpy(client->pending_response, response, sizeof(http_response_t));
+    }
+    client->has_pending_response = 1;
+    return client->pending_response;
+}
+
+static void worker_release_response(client_conn_t *client) {
+    free(client->pending_response);
+    client->pending_response = NULL;
+    client->has_pending_response = 0;
+}
+
 int worker_add_client(worker_t *worker, int client_fd) {
-    if (worker->client_count >= MAX_CONNECTIONS) {
+    if (worker_reserve_client(worker) != 0) {
         LOG_ERROR("Too many clients");
         return -1;
     }
@@ -214,7 +330,14 @@ int worker_add_client(worker_t *worker, int client_fd) {
     worker->clients[worker->client_count].buffer = buffer;
     worker->clients[worker->client_count].keep_alive = 1; 
     worker->clients[worker->client_count].has_pending_response = 0;
+    worker->clients[worker->client_count].pending_response = NULL;
+    worker->clients[worker->client_count].waiting_for_body = 0;
+    worker->clients[worker->client_count].proxy = NULL;
+    worker->clients[worker->client_count].access = worker_take_access(worker);
     worker->client_count++;
+    METRICS_INC(accepts);
+    METRICS_INC(connections);
+    NX_PROBE2(accept, client_fd, worker->client_count);
     
     LOG_DEBUG("Buffer allocated for fd=%d", client_fd);
     
@@ -227,25 +350,33 @@ void worker_remove_client(worker_t *worker, int client_fd) {
             remove_from_epoll(worker, client_fd);
             remove_from_epoll(worker, worker->clients[i].timer_fd);
             
+            proxy_abort(worker->clients[i].proxy);
+            worker->clients[i].proxy = NULL;
+            
             if (worker->clients[i].buffer) {
                 mempool_free(&worker->buffer_pool, worker->clients[i].buffer);
                 LOG_DEBUG("Buffer freed for fd=%d", client_fd);
             }
             
             if (worker->clients[i].has_pending_response) {
-                http_free_response(&worker->clients[i].pending_response);
-                worker->clients[i].has_pending_response = 0;
+                access_log_finish(worker->clients[i].access, worker->clients[i].pending_response->status_code,
+                                  worker->clients[i].pending_response->bytes_sent);
+                http_free_response(worker->clients[i].pending_response);
             }
+            worker_release_response(&worker->clients[i]);
+            worker_drop_access(worker, &worker->clients[i]);
             
             close(client_fd);
             close(worker->clients[i].timer_fd);
+            METRICS_ADD(connections, -1);
             
             if (i < worker->client_count - 1) {
                 worker->clients[i] = worker->clients[worker->client_count - 1];
             }
             worker->client_count--;
+            NX_PROBE2(conn__close, client_fd, worker->client_count);
             
-            LOG_INFO("Closed connection: fd=%d, clients=%d", client_fd, worker->client_count);
+            LOG_DEBUG("Closed connection: fd=%d, clients=%d", client_fd, worker->client_count);
             
             break;
         }
@@ -255,9 +386,16 @@ void worker_remove_client(worker_t *worker, int client_fd) {
 void worker_handle_timeout(worker_t *worker, int timer_fd) {
     for (int i = 0; i < worker->client_count; i++) {
         if (worker->clients[i].timer_fd == timer_fd) {
+            uint64_t expirations;
+            if (read(timer_fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+                LOG_DEBUG("Failed to read timer fd=%d: %s", timer_fd, strerror(errno));
+            }
+            
+            /* proxied requests are bounded by proxy_timeout instead */
             time_t now = time(NULL);
-            if (now - worker->clients[i].last_activity >= worker->keep_alive_timeout) {
-                LOG_INFO("Client timeout: fd=%d, idle=%lds", worker->clients[i].fd, now - worker->clients[i].last_activity);
+            if (!worker->clients[i].proxy && now - worker->clients[i].last_activity >= worker->keep_alive_timeout) {
+                LOG_DEBUG("Client timeout: fd=%d, idle=%lds", worker->clients[i].fd, now - worker->clients[i].last_activity);
+                METRICS_INC(timeouts);
                 worker_remove_client(worker, worker->clients[i].fd);
             }
             break;
@@ -265,7 +403,292 @@ void worker_handle_timeout(worker_t *worker, int timer_fd) {
     }
 }
 
-void worker_handle_connection(worker_t *worker, int client_fd) {
+/* stops watching the socket for I/O until a pool job for the response
+ * completes; only hangups are still reported */
+static int worker_park_client(worker_t *worker, client_conn_t *client, http_response_t *response) {
+    struct epoll_event ev;
+    ev.events = EPOLLRDHUP | EPOLLET;
+    ev.data.fd = client->fd;
+    
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) == -1) {
+        LOG_ERROR("Failed to park client fd=%d: %s", client->fd, strerror(errno));
+        if (response != client->pending_response) {
+            http_free_response(response);
+        }
+        worker_remove_client(worker, client->fd);
+        return -1;
+    }
+    
+    if (!worker_hold_response(client, response)) {
+        http_free_response(response);
+        worker_remove_client(worker, client->fd);
+        return -1;
+    }
+    client->waiting_for_body = 1;
+    return 0;
+}
+
+static void worker_resume_client(worker_t *worker, client_conn_t *client) {
+    client->waiting_for_body = 0;
+    
+    struct epoll_event ev;
+    ev.events = EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    ev.data.fd = client->fd;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) == -1) {
+        LOG_ERROR("Failed to resume client fd=%d: %s", client->fd, strerror(errno));
+        worker_remove_client(worker, client->fd);
+    }
+}
+
+static int worker_offload_io(worker_t *worker, client_conn_t *client, http_response_t *response,
+                             file_io_kind_t kind) {
+    file_io_job_t *job = calloc(1, sizeof(file_io_job_t));
+    if (!job) {
+        return -1;
+    }
+    
+    /* the job owns a duplicate so closing the connection mid-read cannot
+     * recycle the descriptor under the I/O thread */
+    job->fd = fcntl(response->io_fd, F_DUPFD_CLOEXEC, 0);
+    if (job->fd == -1) {
+        free(job);
+        return -1;
+    }
+    
+    job->client_fd = client->fd;
+    job->id = ++worker->next_job_id;
+    job->kind = kind;
+    job->offset = response->io_offset;
+    job->length = response->io_length;
+    job->buf = kind == FILE_IO_READ ? response->body : NULL;
+    
+    if (file_io_pool_submit(worker->io_pool, job) != 0) {
+        LOG_DEBUG("File I/O queue saturated, reading inline for fd=%d", client->fd);
+        job->buf = NULL;
+        file_io_job_free(job);
+        return -1;
+    }
+    
+    if (kind == FILE_IO_READ) {
+        response->body = NULL;
+    }
+    client->job_id = job->id;
+    return 0;
+}
+
+/* the pending response hit a cold range: warm it on the I/O pool and come
+ * back through EPOLLOUT once it is resident */
+static void worker_wait_for_file(worker_t *worker, client_conn_t *client) {
+    http_response_t *response = client->pending_response;
+    
+    if (worker->io_pool && worker_offload_io(worker, client, response, FILE_IO_WARM) == 0) {
+        LOG_DEBUG("Waiting for %zu cold bytes at offset %ld for fd=%d",
+                  response->io_length, (long)response->io_offset, client->fd);
+        worker_park_client(worker, client, response);
+        return;
+    }
+    
+    file_io_warm(response->io_fd, response->io_offset, response->io_length);
+    worker_resume_client(worker, client);
+}
+
+static int worker_offload_compression(worker_t *worker, client_conn_t *client, http_response_t *response) {
+    compress_job_t *job = calloc(1, sizeof(compress_job_t));
+    if (!job) {
+        return -1;
+    }
+    
+    job->client_fd = client->fd;
+    job->id = ++worker->next_job_id;
+    job->type = response->compression_type;
+    job->level = response->compression_level;
+    job->in = response->body;
+    job->in_len = response->body_length;
+    response->timing.parked = latency_now();
+    
+    if (compress_pool_submit(worker->compress_pool, job) != 0) {
+        LOG_DEBUG("Compression queue saturated, sending identity for fd=%d", client->fd);
+        free(job);
+        return -1;
+    }
+    
+    response->body = NULL;
+    client->job_id = job->id;
+    return 0;
+}
+
+void worker_handle_compress_done(worker_t *worker) {
+    compress_pool_ack(worker->compress_pool);
+    
+    compress_job_t *job;
+    while ((job = compress_pool_complete(worker->compress_pool)) != NULL) {
+        client_conn_t *client = NULL;
+        for (int i = 0; i < worker->client_count; i++) {
+            if (worker->clients[i].fd == job->client_fd) {
+                client = &worker->clients[i];
+                break;
+            }
+        }
+        
+        if (!client || !client->waiting_for_body || client->job_id != job->id) {
+            LOG_DEBUG("Dropping compression result for closed fd=%d", job->client_fd);
+            compress_job_free(job);
+            continue;
+        }
+        
+        http_response_t *response = client->pending_response;
+        response->timing.compress += latency_since(response->timing.parked);
+        response->body = job->in;
+        if (job->status == 0) {
+            response->compressed_body = job->out;
+            response->compressed_length = job->out_len;
+            job->out = NULL;
+        }
+        job->in = NULL;
+        compress_job_free(job);
+        
+        http_complete_deferred(response);
+        worker_resume_client(worker, client);
+    }
+}
+
+void worker_handle_io_done(worker_t *worker) {
+    file_io_pool_ack(worker->io_pool);
+    
+    file_io_job_t *job;
+    while ((job = file_io_pool_complete(worker->io_pool)) != NULL) {
+        client_conn_t *client = NULL;
+        for (int i = 0; i < worker->client_count; i++) {
+            if (worker->clients[i].fd == job->client_fd) {
+                client = &worker->clients[i];
+                break;
+            }
+        }
+        
+        if (!client || !client->waiting_for_body || client->job_id != job->id) {
+            LOG_DEBUG("Dropping file I/O result for closed fd=%d", job->client_fd);
+            file_io_job_free(job);
+            continue;
+        }
+        
+        http_response_t *response = client->pending_response;
+        file_io_kind_t kind = job->kind;
+        int status = job->status;
+        if (kind == FILE_IO_READ) {
+            response->body = job->buf;
+            job->buf = NULL;
+        }
+        file_io_job_free(job);
+        
+        if (kind == FILE_IO_READ) {
+            if (status != 0) {
+                LOG_ERROR("Failed to read response body for fd=%d", client->fd);
+                worker_remove_client(worker, client->fd);
+                continue;
+            }
+            
+            http_complete_read(response);
+            if (response->deferred == HTTP_DEFER_COMPRESS) {
+                if (worker->compress_pool && worker_offload_compression(worker, client, response) == 0) {
+                    continue;
+                }
+                http_complete_deferred(response);
+            }
+        }
+        
+        worker_resume_client(worker, client);
+    }
+}
+
+/* hands the connection back from a finished proxy session: re-arm it for
+ * the next request, close it, or queue the gateway error in its place */
+static void worker_after_proxy(worker_t *worker, client_conn_t *client, int result) {
+    if (result == PROXY_PENDING) {
+        return;
+    }
+    
+    client->proxy = NULL;
+    client->last_activity = time(NULL);
+    
+    /* a relayed response was logged by the session; gateway errors are
+     * logged once the queued response below has been sent */
+    if ((result == PROXY_CLOSE || result == PROXY_DONE) && client->access) {
+        client->access->len = 0;
+    }
+    
+    if (result == PROXY_CLOSE) {
+        worker_remove_client(worker, client->fd);
+        return;
+    }
+    
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
+    ev.data.fd = client->fd;
+    
+    if (result != PROXY_DONE) {
+        metrics_count_response(result);
+        http_response_t *response = worker_hold_response(client, NULL);
+        if (!response) {
+            worker_remove_client(worker, client->fd);
+            return;
+        }
+        http_create_response(response, result);
+        http_add_header(response, "Content-Length", "0");
+        client->keep_alive = 0;
+        ev.events = EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    }
+    
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) == -1) {
+        LOG_ERROR("Failed to re-arm client fd=%d after proxying: %s", client->fd, strerror(errno));
+        worker_remove_client(worker, client->fd);
+    }
+}
+
+static void worker_start_proxy(worker_t *worker, client_conn_t *client, proxy_route_t *route,
+                               const http_request_t *request, const char *body, size_t body_len) {
+    int status;
+    proxy_session_t *session = proxy_start(route, client->fd, request, body, body_len, &status);
+    if (!session) {
+        worker_after_proxy(worker, client, status);
+        return;
+    }
+    
+    client->proxy = session;
+    if (client->access) {
+        session->access = *client->access;
+    }
+    worker_after_proxy(worker, client, proxy_run(session));
+}
+
+void worker_handle_upstream(worker_t *worker, proxy_session_t *session, uint32_t events) {
+    for (int i = 0; i < worker->client_count; i++) {
+        if (worker->clients[i].proxy == session) {
+            worker_after_proxy(worker, &worker->clients[i], proxy_handle_upstream(session, events));
+            return;
+        }
+    }
+    
+    proxy_abort(session);
+}
+
+/* walks backwards so a connection closed by its timeout does not shift an
+ * unvisited one into the slot just checked */
+static void worker_check_proxies(worker_t *worker) {
+    static time_t last_check = 0;
+    time_t now = time(NULL);
+    if (!proxy_enabled() || now == last_check) {
+        return;
+    }
+    last_check = now;
+    
+    for (int i = worker->client_count - 1; i >= 0; i--) {
+        if (worker->clients[i].proxy) {
+            worker_after_proxy(worker, &worker->clients[i], proxy_check_timeout(worker->clients[i].proxy, now));
+        }
+    }
+}
+
+void worker_handle_connection(worker_t *worker, int client_fd, const struct sockaddr_in *client_addr) {
     int opt = 1;
     
     if (setsockopt(client_fd, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt)) < 0) {
@@ -355,7 +778,7 @@ void worker_handle_connection(worker_t *worker, int client_fd) {
         return;
     }
     
-    if (worker->client_count >= MAX_CONNECTIONS) {
+    if (worker_reserve_client(worker) != 0) {
         LOG_WARN("Connection limit reached, rejecting new connection");
         mempool_free(&worker->buffer_pool, buffer);
         close(timer_fd);
@@ -369,13 +792,22 @@ void worker_handle_connection(worker_t *worker, int client_fd) {
     worker->clients[worker->client_count].buffer = buffer;
     worker->clients[worker->client_count].keep_alive = 1;  // Default to keep-alive
     worker->clients[worker->client_count].has_pending_response = 0;
+    worker->clients[worker->client_count].pending_response = NULL;
+    worker->clients[worker->client_count].waiting_for_body = 0;
+    worker->clients[worker->client_count].proxy = NULL;
+    worker->clients[worker->client_count].access = worker_take_access(worker);
     worker->client_count++;
-    
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
-    if (getpeername(client_fd, (struct sockaddr*)&client_addr, &addr_len) == 0) {
-        LOG_INFO("Accepted connection: fd=%d, ip=%s, port=%d, clients=%d", client_fd, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port), worker->client_count);
+    METRICS_INC(accepts);
+    METRICS_INC(connections);
+    NX_PROBE2(accept, client_fd, worker->client_count);
+    
+    client_conn_t *client = &worker->clients[worker->client_count - 1];
+    client->ip = client_addr->sin_addr.s_addr;
+    if (!inet_ntop(AF_INET, &client_addr->sin_addr, client->addr, sizeof(client->addr))) {
+        client->addr[0] = '\0';
     }
+    LOG_DEBUG("Accepted connection: fd=%d, ip=%s, port=%d, clients=%d", client_fd, client->addr,
+              ntohs(client_addr->sin_port), worker->client_count);
     
     LOG_DEBUG("Buffer allocated for fd=%d", client_fd);
 }
@@ -388,7 +820,18 @@ void worker_handle_client_data(worker_t *worker, int client_fd) {
             break;
         }
     }
-    if (!client || !client->buffer) {
+    if (!client) {
+        /* keep-alive timers arrive on the same EPOLLIN path */
+        worker_handle_timeout(worker, client_fd);
+        return;
+    }
+    if (!client->buffer) {
+        return;
+    }
+    
+    if (client->proxy) {
+        client->last_activity = time(NULL);
+        worker_after_proxy(worker, client, proxy_handle_client(client->proxy));
         return;
     }
 
@@ -396,9 +839,10 @@ void worker_handle_client_data(worker_t *worker, int client_fd) {
     int total_read = 0;
     int processed = 0;
 
-    while ((bytes_read = recv(client_fd, client->buffer + total_read, BUFFER_SIZE - total_read - 1, 0)) > 0) {
+    size_t buffer_size = worker->capacity.buffer_size;
+    while ((bytes_read = recv(client_fd, client->buffer + total_read, buffer_size - total_read - 1, 0)) > 0) {
         total_read += bytes_read;
-        if ((size_t)total_read >= BUFFER_SIZE - 1) {
+        if ((size_t)total_read >= buffer_size - 1) {
             break;
         }
     }
@@ -419,26 +863,83 @@ void worker_handle_client_data(worker_t *worker, int client_fd) {
 
             int req_len = end - (client->buffer + offset) + 4;
             
+            uint64_t request_start = latency_now();
             http_request_t request;
             if (http_parse_request(client->buffer + offset, req_len, &request) != 0) {
                 LOG_ERROR("Failed to parse HTTP request from fd=%d", client_fd);
                 http_response_t response;
                 http_create_response(&response, 400);
                 response.keep_alive = 0;  // Force close on error
+                metrics_count_response(400);
                 http_send_response(client_fd, &response);
                 worker_remove_client(worker, client_fd);
                 return;
             }
+            NX_PROBE4(request__parsed, client_fd, (const char *)request.uri, (const char *)request.method,
+                      request_start);
+            access_log_begin(client->access, client->addr, client->ip, &request, request_start);
 
+            proxy_route_t *route = proxy_enabled() ? proxy_match(request.uri) : NULL;
+            if (route) {
+                client->keep_alive = request.keep_alive && !worker->draining;
+                worker_start_proxy(worker, client, route, &request, client->buffer + offset + req_len,
+                                   total_read - offset - req_len);
+                return;
+            }
+
+            uint64_t parse_ns = latency_since(request_start);
             http_response_t response;
             http_handle_request(&request, &response);
+            metrics_count_response(response.status_code);
+            response.timing.start = request_start;
+            response.timing.parse = parse_ns;
+            response.timing.sampled = request_start && !response.is_cached && !response.head && latency_sample();
             
+            if (worker->draining) {
+                response.keep_alive = 0;
+            }
             client->keep_alive = response.keep_alive;
             
+            if (response.deferred == HTTP_DEFER_READ) {
+                if (worker->io_pool && worker_offload_io(worker, client, &response, FILE_IO_READ) == 0) {
+                    worker_park_client(worker, client, &response);
+                    LOG_DEBUG("Waiting for cold file read for fd=%d", client_fd);
+                    return;
+                }
+                
+                if (file_io_read(response.io_fd, (char *)response.body + response.io_offset, response.io_length,
+                                 response.io_offset, 0) != (ssize_t)response.io_length) {
+                    LOG_ERROR("Failed to read response body for fd=%d", client_fd);
+                    http_free_response(&response);
+                    worker_remove_client(worker, client_fd);
+                    return;
+                }
+                http_complete_read(&response);
+            }
+            
+            if (response.deferred == HTTP_DEFER_COMPRESS) {
+                if (worker->compress_pool && worker_offload_compression(worker, client, &response) == 0) {
+                    worker_park_client(worker, client, &response);
+                    LOG_DEBUG("Waiting for compressed body for fd=%d", client_fd);
+                    return;
+                }
+                
+                http_complete_deferred(&response);
+            }
+            
             int send_result = http_send_response(client_fd, &response);
+            latency_first_byte(&response);
             if (send_result == -1) {
                 worker_remove_client(worker, client_fd);
                 return;
+            } else if (send_result == HTTP_SEND_FILE_IO) {
+                if (!worker_hold_response(client, &response)) {
+                    http_free_response(&response);
+                    worker_remove_client(worker, client_fd);
+                    return;
+                }
+                worker_wait_for_file(worker, client);
+                return;
             } else if (send_result == 0) {
                 struct epoll_event ev;
                 ev.events = EPOLLOUT | EPOLLET | EPOLLRDHUP;
@@ -450,20 +951,27 @@ void worker_handle_client_data(worker_t *worker, int client_fd) {
                     return;
                 }
                 
-                client->pending_response = response;
-                client->has_pending_response = 1;
+                if (!worker_hold_response(client, &response)) {
+                    http_free_response(&response);
+                    worker_remove_client(worker, client_fd);
+                    return;
+                }
+                NX_PROBE2(send__blocked, client_fd, response.body_length - response.body_offset);
                 
                 LOG_DEBUG("Response send would block, switching to write monitoring for fd=%d", client_fd);
                 return;
             }
             
+            NX_PROBE3(response__done, client_fd, response.status_code, response.timing.start);
+            access_log_finish(client->access, response.status_code, response.bytes_sent);
+            latency_finish(&response);
             http_free_response(&response);
             
             processed++;
             offset += req_len;
 
             if (!client->keep_alive) {
-                LOG_INFO("Closing connection: fd=%d (keep-alive disabled)", client_fd);
+                LOG_DEBUG("Closing connection: fd=%d (keep-alive disabled)", client_fd);
                 worker_remove_client(worker, client_fd);
                 return;
             }
@@ -485,7 +993,7 @@ void worker_handle_client_data(worker_t *worker, int client_fd) {
             memmove(client->buffer, client->buffer + offset, total_read - offset);
         }
     } else if (bytes_read == 0 || (bytes_read == -1 && errno != EAGAIN && errno != EWOULDBLOCK)) {
-        LOG_INFO("Connection closed by client: fd=%d", client_fd);
+        LOG_DEBUG("Connection closed by client: fd=%d", client_fd);
         worker_remove_client(worker, client_fd);
     }
 }
@@ -506,25 +1014,40 @@ void worker_handle_client_write(worker_t *worker, int client_fd) {
     
     client->last_activity = time(NULL);
     
+    if (client->proxy) {
+        worker_after_proxy(worker, client, proxy_handle_client(client->proxy));
+        return;
+    }
+    
     if (client->has_pending_response) {
-        int send_result = http_send_response(client_fd, &client->pending_response);
+        NX_PROBE1(send__resumed, client_fd);
+        http_response_t *response = client->pending_response;
+        int send_result = http_send_response(client_fd, response);
+        latency_first_byte(response);
         
         if (send_result == -1) {
             LOG_DEBUG("Failed to send pending response, closing connection fd=%d", client_fd);
             worker_remove_client(worker, client_fd);
             return;
+        } else if (send_result == HTTP_SEND_FILE_IO) {
+            worker_wait_for_file(worker, client);
+            return;
         } else if (send_result == 0) {
+            NX_PROBE2(send__blocked, client_fd, response->body_length - response->body_offset);
             LOG_DEBUG("Pending response still would block for fd=%d", client_fd);
             return;
         }
         
         LOG_DEBUG("Successfully sent pending response for fd=%d", client_fd);
         
-        http_free_response(&client->pending_response);
-        client->has_pending_response = 0;
+        NX_PROBE3(response__done, client_fd, response->status_code, response->timing.start);
+        access_log_finish(client->access, response->status_code, response->bytes_sent);
+        latency_finish(response);
+        http_free_response(response);
+        worker_release_response(client);
         
         if (!client->keep_alive) {
-            LOG_INFO("Closing connection after sending pending response: fd=%d", client_fd);
+            LOG_DEBUG("Closing connection after sending pending response: fd=%d", client_fd);
             worker_remove_client(worker, client_fd);
             return;
         }
@@ -543,6 +1066,36 @@ void worker_handle_client_write(worker_t *worker, int client_fd) {
     LOG_DEBUG("Client fd %d ready for read operations", client_fd);
 }
 
+/* stops accepting so the successor on the shared socket takes new
+ * connections; the ones already open are finished off by worker_drain */
+static void worker_start_drain(worker_t *worker) {
+    worker->draining = 1;
+    worker->drain_deadline = time(NULL) + config_get_instance()->drain_timeout;
+    remove_from_epoll(worker, worker->server_fd);
+    LOG_INFO("Worker %d draining %d connections", worker->cpu_id, worker->client_count);
+}
+
+/* busy connections get their next response with Connection: close;
+ * ones that have gone quiet are closed, unless a request is already
+ * waiting in the socket, which is answered first */
+static void worker_drain(worker_t *worker) {
+    time_t now = time(NULL);
+    for (int i = worker->client_count - 1; i >= 0; i--) {
+        client_conn_t *client = &worker->clients[i];
+        if (client->has_pending_response || client->proxy || now - client->last_activity < WORKER_DRAIN_IDLE) {
+            continue;
+        }
+        
+        char byte;
+        ssize_t n = recv(client->fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT);
+        if (n > 0) {
+            worker_handle_client_data(worker, client->fd);
+        } else {
+            worker_remove_client(worker, client->fd);
+        }
+    }
+}
+
 void worker_run(worker_t *worker) {
     LOG_INFO("Worker %d starting event loop on CPU %d", worker->cpu_id, worker->cpu_id);
     
@@ -554,18 +1107,14 @@ void worker_run(worker_t *worker) {
     socklen_t addr_len = sizeof(client_addr);
     
     time_t last_stats_time = time(NULL);
-    unsigned long request_count = 0;
+    uint64_t last_request_total = metrics_worker->requests;
     unsigned long connection_count = 0;
     
-    struct epoll_event *events = malloc(sizeof(struct epoll_event) * MAX_EVENTS * 2);
-    if (!events) {
-        LOG_ERROR("Failed to allocate extended events array");
-        return;
-    }
+    struct epoll_event *events = worker->events;
     
     while (worker->is_running && !shutdown_requested) {
         int timeout = 5; 
-        int nfds = epoll_wait(worker->epoll_fd, events, MAX_EVENTS * 2, timeout);
+        int nfds = epoll_wait(worker->epoll_fd, events, worker->capacity.max_events, timeout);
         
         if (nfds == -1) {
             if (errno == EINTR) {
@@ -580,6 +1129,38 @@ void worker_run(worker_t *worker) {
             break;
         }
         
+        compress_ctl_tick();
+        worker_check_proxies(worker);
+        
+        if (log_reopen_requested) {
+            log_reopen_requested = 0;
+            log_reopen();
+            access_log_reopen();
+        }
+        
+        if (reload_requested) {
+            reload_requested = 0;
+            config_t *config = config_get_instance();
+            config_refresh(config);
+            worker_apply_config(worker, config);
+            LOG_INFO("Worker %d applied reloaded settings", worker->cpu_id);
+        }
+        
+        if (drain_requested && !worker->draining) {
+            worker_start_drain(worker);
+        }
+        if (worker->draining) {
+            worker_drain(worker);
+            if (worker->client_count == 0) {
+                LOG_INFO("Worker %d drained", worker->cpu_id);
+                break;
+            }
+            if (time(NULL) >= worker->drain_deadline) {
+                LOG_WARN("Worker %d drain timed out with %d connections open", worker->cpu_id, worker->client_count);
+                break;
+            }
+        }
+        
         if (nfds == 0) {
             idle_cycles++;
             if (idle_cycles >= max_idle_cycles) {
@@ -596,10 +1177,19 @@ void worker_run(worker_t *worker) {
         
         idle_cycles = 0;
         
+        struct timespec batch_start, batch_end;
+        clock_gettime(CLOCK_MONOTONIC, &batch_start);
+        
         for (int i = 0; i < nfds; i++) {
             int fd = events[i].data.fd;
             uint32_t event_flags = events[i].events;
             
+            proxy_session_t *upstream = proxy_find_upstream(fd);
+            if (upstream) {
+                worker_handle_upstream(worker, upstream, event_flags);
+                continue;
+            }
+            
             if (event_flags & (EPOLLERR | EPOLLHUP)) {
                 if (fd == worker->server_fd) {
                     LOG_ERROR("Server socket error");
@@ -612,6 +1202,16 @@ void worker_run(worker_t *worker) {
                 }
             }
             
+            if (worker->compress_pool && fd == compress_pool_event_fd(worker->compress_pool)) {
+                worker_handle_compress_done(worker);
+                continue;
+            }
+            
+            if (worker->io_pool && fd == file_io_pool_event_fd(worker->io_pool)) {
+                worker_handle_io_done(worker);
+                continue;
+            }
+            
             if (fd == worker->server_fd && (event_flags & EPOLLIN)) {
                 int accepted = 0;
                 
@@ -652,7 +1252,7 @@ void worker_run(worker_t *worker) {
                     
                     optimize_tcp_socket(client_fd);
                     
-                    worker_handle_connection(worker, client_fd);
+                    worker_handle_connection(worker, client_fd, &client_addr);
                     accepted++;
                     connection_count++;
                 }
@@ -663,7 +1263,6 @@ void worker_run(worker_t *worker) {
             }
             else if (event_flags & EPOLLIN) {
                 worker_handle_client_data(worker, fd);
-                request_count++;
             }
             else if (event_flags & EPOLLOUT) {
                 worker_handle_client_write(worker, fd);
@@ -673,17 +1272,36 @@ void worker_run(worker_t *worker) {
             }
         }
         
+        clock_gettime(CLOCK_MONOTONIC, &batch_end);
+        compress_ctl_observe_loop((batch_end.tv_sec - batch_start.tv_sec) * 1000000 +
+                                  (batch_end.tv_nsec - batch_start.tv_nsec) / 1000);
+        
         time_t now = time(NULL);
         if (now - last_stats_time >= 10) {
-            unsigned long requests_per_sec = request_count / (now - last_stats_time);
+            unsigned long requests_per_sec = (metrics_worker->requests - last_request_total) / (now - last_stats_time);
             LOG_INFO("Worker %d stats: %lu req/s, %lu total connections, %d current clients",
                      worker->cpu_id, requests_per_sec, connection_count, worker->client_count);
-            request_count = 0;
+            
+            compress_stats_t cstats;
+            compress_ctl_stats(&cstats);
+            char levels[128];
+            int levels_len = 0;
+            for (int l = COMPRESSION_LEVEL_MIN; l <= COMPRESSION_LEVEL_MAX; l++) {
+                levels_len += snprintf(levels + levels_len, sizeof(levels) - levels_len, "%s%lu",
+                                       l == COMPRESSION_LEVEL_MIN ? "" : "/", (unsigned long)cstats.responses[l]);
+            }
+            LOG_INFO("Worker %d compression: offset %+d (cpu %d%%, lag %dms), levels 1-9 = %s, "
+                     "skipped %lu, saved %lu of %lu bytes, %lu ms CPU",
+                     worker->cpu_id, cstats.offset, cstats.cpu_percent, cstats.lag_ms, levels,
+                     (unsigned long)cstats.skipped,
+                     (unsigned long)(cstats.bytes_in - cstats.bytes_out),
+                     (unsigned long)cstats.bytes_in,
+                     (unsigned long)(cstats.cpu_ns / 1000000));
+            last_request_total = metrics_worker->requests;
             last_stats_time = now;
         }
     }
     
-    free(events);
     LOG_INFO("Worker %d exiting event loop", worker->cpu_id);
 }
 
@@ -696,6 +1314,11 @@ void worker_cleanup(worker_t *worker) {
         if (worker->clients[i].buffer) {
             mempool_free(&worker->buffer_pool, worker->clients[i].buffer);
         }
+        if (worker->clients[i].has_pending_response) {
+            http_free_response(worker->clients[i].pending_response);
+        }
+        worker_release_response(&worker->clients[i]);
+        worker_drop_access(worker, &worker->clients[i]);
         close(worker->clients[i].fd);
         close(worker->clients[i].timer_fd);
     }
@@ -704,4 +1327,14 @@ void worker_cleanup(worker_t *worker) {
     free(worker->events);
     close(worker->epoll_fd);
     mempool_cleanup(&worker->buffer_pool);
+    if (worker->access_pool.block_size > 0) {
+        mempool_cleanup(&worker->access_pool);
+    }
+    compress_pool_destroy(worker->compress_pool);
+    file_io_pool_destroy(worker->io_pool);
+    proxy_cleanup();
+    access_log_cleanup();
+    compress_engine_release();
+    file_cache_cleanup();
+    cache_cleanup();
 } 
\ No newline at end of file
@@ -0,0 +1,424 @@
+#include "access_log_format.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+
+/* Decodes access logs written with access_log_format=binary.
+ * usage: access_log_decode [-f clf|json|summary] [-n top] [file ...]
+ * Reads stdin when no file is given; summaries cover all files together. */
+
+#define DECODE_MAX_PAYLOAD (16 * 1024 * 1024)
+#define DECODE_STATUS_MAX 600
+
+typedef enum {
+    OUTPUT_CLF = 0,
+    OUTPUT_JSON,
+    OUTPUT_SUMMARY
+} output_t;
+
+typedef struct {
+    const char *ptr;
+    size_t len;
+} field_t;
+
+typedef struct {
+    uint64_t time_us;
+    uint32_t addr;
+    int status;
+    uint64_t bytes;
+    uint64_t duration_us;
+    field_t fields[ACCESS_BIN_COLUMNS];
+} record_t;
+
+typedef struct {
+    char *uri;
+    uint64_t requests;
+    uint64_t bytes;
+} uri_stat_t;
+
+static output_t output = OUTPUT_CLF;
+static int top_count = 10;
+
+static uint64_t total_requests = 0;
+static uint64_t total_bytes = 0;
+static uint64_t first_us = 0;
+static uint64_t last_us = 0;
+static uint64_t status_counts[DECODE_STATUS_MAX];
+static uint64_t duration_sum_us = 0;
+static uint64_t duration_count = 0;
+static uri_stat_t *uris = NULL;
+static size_t uri_capacity = 0;
+static size_t uri_count = 0;
+
+static void print_escaped(const field_t *field, const char *empty) {
+    if (field->len == 0) {
+        fputs(empty, stdout);
+        return;
+    }
+    for (size_t i = 0; i < field->len; i++) {
+        unsigned char c = (unsigned char)field->ptr[i];
+        if (c == '"' || c == '\\' || c < 0x20 || c >= 0x7f) {
+            printf("\\x%02X", c);
+        } else {
+            putchar(c);
+        }
+    }
+}
+
+static void print_json_string(const field_t *field) {
+    putchar('"');
+    for (size_t i = 0; i < field->len; i++) {
+        unsigned char c = (unsigned char)field->ptr[i];
+        if (c == '"' || c == '\\') {
+            putchar('\\');
+            putchar(c);
+        } else if (c < 0x20 || c >= 0x7f) {
+            printf("\\u%04x", c);
+        } else {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+static void print_clf(const record_t *record) {
+    char addr[INET_ADDRSTRLEN];
+    struct in_addr in = {record->addr};
+    inet_ntop(AF_INET, &in, addr, sizeof(addr));
+
+    time_t seconds = (time_t)(record->time_us / 1000000);
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    char stamp[40];
+    strftime(stamp, sizeof(stamp), "%d/%b/%Y:%H:%M:%S %z", &tm);
+
+    printf("%s - - [%s] \"", addr, stamp);
+    print_escaped(&record->fields[ACCESS_BIN_METHOD], "-");
+    putchar(' ');
+    print_escaped(&record->fields[ACCESS_BIN_URI], "-");
+    putchar(' ');
+    print_escaped(&record->fields[ACCESS_BIN_PROTOCOL], "-");
+    printf("\" %d %lu \"", record->status, (unsigned long)record->bytes);
+    print_escaped(&record->fields[ACCESS_BIN_REFERER], "-");
+    fputs("\" \"", stdout);
+    print_escaped(&record->fields[ACCESS_BIN_AGENT], "-");
+    if (record->duration_us) {
+        printf("\" %.6f\n", (record->duration_us - 1) / 1e6);
+    } else {
+        fputs("\" -\n", stdout);
+    }
+}
+
+static void print_json(const record_t *record) {
+    char addr[INET_ADDRSTRLEN];
+    struct in_addr in = {record->addr};
+    inet_ntop(AF_INET, &in, addr, sizeof(addr));
+
+    time_t seconds = (time_t)(record->time_us / 1000000);
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    static const char *names[ACCESS_BIN_COLUMNS] = {
+        [ACCESS_BIN_METHOD] = "method",
+        [ACCESS_BIN_URI] = "uri",
+        [ACCESS_BIN_PROTOCOL] = "protocol",
+        [ACCESS_BIN_REFERER] = "referer",
+        [ACCESS_BIN_AGENT] = "user_agent",
+    };
+
+    printf("{\"time\":\"%s.%06luZ\",\"addr\":\"%s\"", stamp, (unsigned long)(record->time_us % 1000000), addr);
+    for (int c = 0; c < ACCESS_BIN_COLUMNS; c++) {
+        printf(",\"%s\":", names[c]);
+        print_json_string(&record->fields[c]);
+    }
+    printf(",\"status\":%d,\"bytes\":%lu", record->status, (unsigned long)record->bytes);
+    if (record->duration_us) {
+        printf(",\"request_time\":%.6f", (record->duration_us - 1) / 1e6);
+    }
+    fputs("}\n", stdout);
+}
+
+static uint64_t hash_field(const field_t *field) {
+    uint64_t hash = 1469598103934665603ULL;
+    for (size_t i = 0; i < field->len; i++) {
+        hash = (hash ^ (unsigned char)field->ptr[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static uri_stat_t *find_uri(const field_t *field) {
+    if (uri_count * 10 >= uri_capacity * 7) {
+        size_t capacity = uri_capacity ? uri_capacity * 2 : 1024;
+        uri_stat_t *table = calloc(capacity, sizeof(uri_stat_t));
+        if (!table) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < uri_capacity; i++) {
+            if (uris[i].uri) {
+                field_t key = {uris[i].uri, strlen(uris[i].uri)};
+                size_t slot = hash_field(&key) & (capacity - 1);
+                while (table[slot].uri) {
+                    slot = (slot + 1) & (capacity - 1);
+                }
+                table[slot] = uris[i];
+            }
+        }
+        free(uris);
+        uris = table;
+        uri_capacity = capacity;
+    }
+
+    size_t slot = hash_field(field) & (uri_capacity - 1);
+    while (uris[slot].uri) {
+        if (strlen(uris[slot].uri) == field->len && memcmp(uris[slot].uri, field->ptr, field->len) == 0) {
+            return &uris[slot];
+        }
+        slot = (slot + 1) & (uri_capacity - 1);
+    }
+
+    uris[slot].uri = strndup(field->ptr, field->len);
+    if (!uris[slot].uri) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    uri_count++;
+    return &uris[slot];
+}
+
+static void summarize(const record_t *record) {
+    if (total_requests == 0 || record->time_us < first_us) {
+        first_us = record->time_us;
+    }
+    if (record->time_us > last_us) {
+        last_us = record->time_us;
+    }
+    total_requests++;
+    total_bytes += record->bytes;
+    if (record->status >= 0 && record->status < DECODE_STATUS_MAX) {
+        status_counts[record->status]++;
+    }
+    if (record->duration_us) {
+        duration_sum_us += record->duration_us - 1;
+        duration_count++;
+    }
+
+    uri_stat_t *stat = find_uri(&record->fields[ACCESS_BIN_URI]);
+    stat->requests++;
+    stat->bytes += record->bytes;
+}
+
+static int compare_requests(const void *a, const void *b) {
+    const uri_stat_t *x = a;
+    const uri_stat_t *y = b;
+    if (x->requests != y->requests) {
+        return x->requests < y->requests ? 1 : -1;
+    }
+    return strcmp(x->uri ? x->uri : "", y->uri ? y->uri : "");
+}
+
+static void print_summary(void) {
+    double span = last_us > first_us ? (last_us - first_us) / 1e6 : 0;
+    printf("requests: %lu\n", (unsigned long)total_requests);
+    printf("bytes:    %lu\n", (unsigned long)total_bytes);
+    printf("span:     %.3fs", span);
+    if (span > 0) {
+        printf(" (%.1f req/s)", total_requests / span);
+    }
+    putchar('\n');
+    if (duration_count) {
+        printf("mean request time: %.6fs over %lu requests\n", duration_sum_us / 1e6 / duration_count,
+               (unsigned long)duration_count);
+    }
+
+    printf("\nstatus:\n");
+    for (int i = 0; i < DECODE_STATUS_MAX; i++) {
+        if (status_counts[i]) {
+            printf("  %3d %10lu  %5.1f%%\n", i, (unsigned long)status_counts[i],
+                   100.0 * status_counts[i] / total_requests);
+        }
+    }
+
+    if (uri_count == 0) {
+        return;
+    }
+    qsort(uris, uri_capacity, sizeof(uri_stat_t), compare_requests);
+    printf("\ntop URIs by requests:\n");
+    for (size_t i = 0; i < uri_count && i < (size_t)top_count; i++) {
+        printf("  %10lu %14lu  %s\n", (unsigned long)uris[i].requests, (unsigned long)uris[i].bytes,
+               uris[i].uri[0] ? uris[i].uri : "-");
+    }
+}
+
+static int decode_block(const unsigned char *payload, size_t len, uint32_t records, uint64_t base_us) {
+    static field_t dicts[ACCESS_BIN_COLUMNS][ACCESS_BIN_DICT_MAX];
+    int dict_count[ACCESS_BIN_COLUMNS] = {0};
+    const unsigned char *p = payload;
+    const unsigned char *end = payload + len;
+
+    for (uint32_t r = 0; r < records; r++) {
+        record_t record;
+        if (end - p < 10) {
+            return -1;
+        }
+        record.time_us = base_us + access_bin_get_le(p, 4);
+        memcpy(&record.addr, p + 4, 4);
+        record.status = (int)access_bin_get_le(p + 8, 2);
+        p += 10;
+        if (access_bin_get_varint(&p, end, &record.bytes) != 0 ||
+            access_bin_get_varint(&p, end, &record.duration_us) != 0) {
+            return -1;
+        }
+
+        for (int c = 0; c < ACCESS_BIN_COLUMNS; c++) {
+            uint64_t ref;
+            if (access_bin_get_varint(&p, end, &ref) != 0) {
+                return -1;
+            }
+            if (ref % 2 == 0) {
+                if (ref / 2 >= (uint64_t)dict_count[c]) {
+                    return -1;
+                }
+                record.fields[c] = dicts[c][ref / 2];
+            } else {
+                uint64_t field_len = ref / 2;
+                if (field_len > (uint64_t)(end - p) || dict_count[c] >= ACCESS_BIN_DICT_MAX) {
+                    return -1;
+                }
+                record.fields[c] = (field_t){(const char *)p, field_len};
+                dicts[c][dict_count[c]++] = record.fields[c];
+                p += field_len;
+            }
+        }
+
+        if (output == OUTPUT_CLF) {
+            print_clf(&record);
+        } else if (output == OUTPUT_JSON) {
+            print_json(&record);
+        } else {
+            summarize(&record);
+        }
+    }
+
+    return p == end ? 0 : -1;
+}
+
+static int decode_file(FILE *file, const char *name) {
+    unsigned char *payload = NULL;
+    size_t capacity = 0;
+    uint64_t offset = 0;
+    int result = 0;
+
+    for (;;) {
+        unsigned char header[ACCESS_BIN_HEADER_SIZE];
+        size_t got = fread(header, 1, sizeof(header), file);
+        if (got == 0) {
+            break;
+        }
+        if (got < sizeof(header) || memcmp(header, ACCESS_BIN_MAGIC, 4) != 0) {
+            fprintf(stderr, "%s: no block header at offset %lu\n", name, (unsigned long)offset);
+            result = -1;
+            break;
+        }
+
+        unsigned int version = (unsigned int)access_bin_get_le(header + 4, 2);
+        size_t header_size = access_bin_get_le(header + 6, 2);
+        uint32_t records = (uint32_t)access_bin_get_le(header + 8, 4);
+        size_t len = access_bin_get_le(header + 12, 4);
+        uint64_t base_us = access_bin_get_le(header + 16, 8);
+        if (version != ACCESS_BIN_VERSION || header_size < ACCESS_BIN_HEADER_SIZE || len > DECODE_MAX_PAYLOAD) {
+            fprintf(stderr, "%s: unsupported block (version %u) at offset %lu\n", name, version,
+                    (unsigned long)offset);
+            result = -1;
+            break;
+        }
+        if (fseek(file, header_size - ACCESS_BIN_HEADER_SIZE, SEEK_CUR) != 0 && header_size > ACCESS_BIN_HEADER_SIZE) {
+            result = -1;
+            break;
+        }
+
+        if (len > capacity) {
+            unsigned char *grown = realloc(payload, len);
+            if (!grown) {
+                fprintf(stderr, "out of memory\n");
+                result = -1;
+                break;
+            }
+            payload = grown;
+            capacity = len;
+        }
+        if (fread(payload, 1, len, file) != len) {
+            fprintf(stderr, "%s: truncated block at offset %lu\n", name, (unsigned long)offset);
+            result = -1;
+            break;
+        }
+        if (decode_block(payload, len, records, base_us) != 0) {
+            fprintf(stderr, "%s: corrupt block at offset %lu\n", name, (unsigned long)offset);
+            result = -1;
+        }
+        offset += header_size + len;
+    }
+
+    free(payload);
+    return result;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "usage: %s [-f clf|json|summary] [-n top] [file ...]\n", program);
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "f:n:h")) != -1) {
+        switch (opt) {
+            case 'f':
+                if (strcmp(optarg, "clf") == 0) {
+                    output = OUTPUT_CLF;
+                } else if (strcmp(optarg, "json") == 0) {
+                    output = OUTPUT_JSON;
+                } else if (strcmp(optarg, "summary") == 0) {
+                    output = OUTPUT_SUMMARY;
+                } else {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'n':
+                top_count = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    int status = 0;
+    if (optind == argc) {
+        status = decode_file(stdin, "stdin") != 0;
+    }
+    for (int i = optind; i < argc; i++) {
+        FILE *file = strcmp(argv[i], "-") == 0 ? stdin : fopen(argv[i], "rb");
+        if (!file) {
+            fprintf(stderr, "%s: %s\n", argv[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        if (decode_file(file, argv[i]) != 0) {
+            status = 1;
+        }
+        if (file != stdin) {
+            fclose(file);
+        }
+    }
+
+    if (output == OUTPUT_SUMMARY) {
+        print_summary();
+    }
+    return status;
+}